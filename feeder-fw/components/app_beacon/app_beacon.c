@@ -27,33 +27,68 @@
 #define LOG_LOCAL_LEVEL ESP_LOG_NONE ///< Defines the log level. See https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/system/log.html for more information
 #include "esp_log.h"
 #include "esp_err.h"
-#include "esp_bt.h"
-#include "esp_bt_defs.h"
-#include "esp_bt_main.h"
-#include "esp_gap_ble_api.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 #include "app_beacon.h"
+#include "app_beacon_registry.h"
+#include "app_beacon_adv.h"
+#include "app_beacon_ble.h"
 #include "app_status.h"
-#include "app_pwm.h"
+#include "app_feed_log.h"
+#include "app_lid.h"
+#include "app_pm.h"
+#include "app_event.h"
+#include "app_nvs.h"
 
 #define SCAN_FILTER_MAC (1)                              ///< Filter scan by MAC address (0: False, other: True)
+#define SCAN_FILTER_WHITELIST (1)                        ///< Filter scan by MAC address in the BT controller, using its whitelist, when all the authorized MACs fit in it (0: False, other: True). Requires SCAN_FILTER_MAC
+#define SCAN_ADAPTIVE (1)                                ///< Lower the scan duty cycle while no authorized beacon is around (0: False, other: True)
+#define OPEN_LATENCY_BOUND_MS (50)                       ///< Maximum expected time from the advertisement that makes the first beacon found to the lid open command, exceeded if e.g. a light sleep wake-up or a CPU frequency switch delays the detection task (ms)
 #define SCAN_FILTER_RSSI (0)                             ///< Filter scan by RSSI (0: False, other: True)
-#define SCAN_FILTER_EDD_TLM (1)                          ///< Filter scan by data type (Eddystone TLM) (0: False, other: True)
+#define SCAN_FILTER_FRAME (1)                            ///< Filter scan by frame (Eddystone-TLM, Eddystone-UID or iBeacon) (0: False, other: True)
 #define PRINT_ADV_DATA (0)                               ///< Print advertisements data (0: False, other: True)
-#define RSSI_MOVING_AVG_NUM_OF_SAMPLES (8)               ///< Number of samples for RSSI moving average
-#define MIN_RSSI_FOR_DETECTION_DBM (-48)                 ///< Minimum RSSI for detection (dBm)
-#define MIN_TIMES_SEEN_FOR_DETECTION (3)                 ///< Minimum times the beacon has to be seen with a sufficient RSSI and within a short period of time for detection
+#define ADV_LATENCY_PRINT_COUNT (256)                    ///< Number of advertisements after which the HCI to handler latency is printed, if APP_BEACON_BLE_LATENCY_PROFILE is enabled (see app_beacon_ble.h)
+/* The detection thresholds and the scan intervals and windows are part of the configuration (see app_nvs.h). The
+ * lost check times can be overridden at build time (e.g. by the host replay benchmark, see host/beacon_replay.c) to
+ * tune them against recorded advertisement traces.
+ */
+#define SCAN_ACTIVE_RSSI_MARGIN_DB (10)                  ///< Margin below the minimum RSSI for detection of an authorized beacon advertisement for the scan to become active, so that a beacon far from the feeder does not keep it active (dB)
+#define SCAN_ACTIVE_TIMEOUT_MS (10000)                   ///< Time the scan stays active after the last sighting of an authorized beacon, while no beacon is found (ms)
+#define SCAN_OP_TIMEOUT_MS (2000)                        ///< Maximum time for the BLE host stack to complete a scan parameters, start or stop request, after which the scan is configured and started again (ms)
+#ifndef TIME_BEFORE_BEACON_LOST_CHECK_INIT_VAL_MS
 #define TIME_BEFORE_BEACON_LOST_CHECK_INIT_VAL_MS (1000) ///< Initial value for time before checking if beacon has been lost (ms)
+#endif
+#ifndef TIME_BEFORE_BEACON_LOST_CHECK_DECREMENT_MS
 #define TIME_BEFORE_BEACON_LOST_CHECK_DECREMENT_MS (500) ///< Decrement for time before checking if beacon has been lost (ms)
+#endif
+#define TIME_BEFORE_BEACON_LOST_CHECK_TICK_MS (250)      ///< Period of the beacon lost check timer, all the beacon lost check times must be multiples of it (ms)
 #define MAX_TIMES_SEEN (4)                               ///< Limit of number of times that the beacon has been seen in a short period of time
+#define ADV_RING_SIZE (32)                               ///< Number of advertisement records that fit in the ring between the GAP callback and the detection task (power of 2)
+#define ADV_RING_BATCH_SIZE (8)                          ///< Maximum number of advertisement records processed by the detection task while holding the registry lock
+#define BEACON_BATTERY_LOW_MV (3000)                     ///< TLM battery voltage below which a beacon battery is low (mV)
+
+#if (ADV_RING_SIZE & (ADV_RING_SIZE - 1)) != 0
+#error "ADV_RING_SIZE must be a power of 2"
+#endif
+
+/// @brief Typedef for the compact advertisement record passed from the GAP callback to the detection task.
+typedef struct
+{
+    uint8_t mac[6];                          ///< Advertiser's MAC address.
+    int8_t rssi;                             ///< Advertisement RSSI (dBm).
+    int64_t timestamp_us;                    ///< Time when the advertisement was received (us since boot).
+    app_beacon_frame_t frame;                ///< Beacon frame decoded from the advertisement.
+} adv_record_t;
 
-/// @brief Typedef to store information about the beacon.
+/// @brief Typedef for a visit that ended, logged to the feed log once the registry lock is released.
 typedef struct
 {
-    esp_bd_addr_t auth_mac; ///< Authorized MAC address (beacon's MAC address).
-    uint8_t found;          ///< Flag that indicates if the beacon has been detected. Set to true (1) when the beacon's advertisement is scanned multiple times in a short period of time.
-    uint16_t times_seen;    ///< Number of times that the beacon has been seen in a short period of time.
-} beacon_t;
+    uint8_t mac[6];       ///< Beacon MAC address.
+    uint32_t duration_ms; ///< Time the beacon was found (ms).
+} visit_end_t;
 
 /// @brief Typedef for storing the status of the BLE scan.
 typedef enum
@@ -68,16 +103,16 @@ typedef enum
     ble_scan_stop_pending,  /**< BLE scan requested to be stopped while it could not be instantly stopped */
 } ble_scan_status_t;
 
+/// @brief Typedef for the BLE scan duty cycle modes.
+typedef enum
+{
+    ble_scan_mode_idle = 0, /**< Low duty cycle scan, while no authorized beacon is around */
+    ble_scan_mode_active,   /**< Continuous scan, from the first sighting of an authorized beacon until the lid closes */
+} ble_scan_mode_t;
+
 static const char *TAG = "app_beacon";                  ///< Tag to be used when logging
 static ble_scan_status_t scan_status = ble_scan_uninit; ///< Variable that holds BLE scan status
-static esp_ble_scan_params_t ble_scan_params = {
-    .scan_type = BLE_SCAN_TYPE_PASSIVE,
-    .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
-    .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
-    .scan_interval = 400, // scan interval (ms) = 400 * 0.625 = 250 ms
-    .scan_window = 400,   // scan window (ms) = 400 * 0.625 = 250 ms
-    .scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE,
-}; ///< BLE scan parameters
+static app_beacon_ble_scan_params_t scan_params = {0};  ///< BLE scan parameters
 static const char *scan_statuses_str[] = {
     "ble_scan_uninit",
     "ble_scan_initialing",
@@ -88,24 +123,87 @@ static const char *scan_statuses_str[] = {
     "ble_scan_start_pending",
     "ble_scan_stop_pending",
 }; ///< BLE scan statuses as strings for debugging
-static beacon_t beacon = {
-    .auth_mac = {0},
-    .found = 0,
-    .times_seen = 0,
-}; ///< Variable that holds beacon informatio
-static int rssi_moving_avg_samples[RSSI_MOVING_AVG_NUM_OF_SAMPLES] = {0}; ///< Array with RSSI moving average samples
-static uint8_t rssi_moving_avg_samples_index = 0;                         /** Index of RSSI moving average to keep track of
-                                                                           * which position the samples are supposed to be stored in */
-static uint8_t rssi_moving_avg_ready = 0;                                 /** Flag that indicates if RSSI moving average is ready, so that its
-                                                                           * result is only used after collecting the sufficient ammount of samples */
-float rssi_moving_avg_result_prev = 0;
-static TaskHandle_t app_beacon__beacon_check_task_handle = NULL; ///< Beacon lost check task handle
+static portMUX_TYPE registry_lock = portMUX_INITIALIZER_UNLOCKED;  ///< Lock protecting the authorized beacons registry, and the scan intervals and windows
+static uint8_t beacons_found_count = 0;                            ///< Number of authorized beacons currently detected, the lid is open while it is not zero
+static uint8_t beacons_battery_low_count = 0;                      ///< Number of authorized beacons currently reporting a low battery level
+static ble_scan_mode_t scan_mode = ble_scan_mode_idle;             ///< Scan duty cycle mode
+static int64_t scan_last_sighting_us = 0;                          ///< Time of the last advertisement of an authorized beacon (us since boot)
+static esp_timer_handle_t scan_active_timer = NULL;                ///< Timer that returns the scan to idle if no beacon is found after a sighting
+static esp_timer_handle_t scan_op_timer = NULL;                    ///< Timer that recovers the scan if a request to the BLE host stack is not completed in SCAN_OP_TIMEOUT_MS
+static uint8_t scan_requested = 0;                                 ///< Scan state last requested, 1 by app_beacon__ble_scan_start and 0 by app_beacon__ble_scan_stop
+static esp_err_t scan_params_set_status = ESP_OK;                  ///< Status of the last completion of the scan parameters request
+static esp_err_t scan_started_status = ESP_OK;                     ///< Status of the last completion of the scan start request
+static esp_err_t scan_stopped_status = ESP_OK;                     ///< Status of the last completion of the scan stop request
+static uint8_t scan_signals_created = 0;                           ///< Flag that indicates that the signals below were created
+static app_event_signal_t scan_params_set_signal;                  ///< Signal of the completion of the scan parameters request
+static app_event_signal_t scan_started_signal;                     ///< Signal of the completion of the scan start request
+static app_event_signal_t scan_stopped_signal;                     ///< Signal of the completion of the scan stop request
+static app_event_signal_t whitelist_failed_signal;                 ///< Signal of a whitelist update failure
+static app_event_signal_t scan_request_signal;                     ///< Signal of app_beacon__ble_scan_start and app_beacon__ble_scan_stop
+static app_event_signal_t scan_config_signal;                      ///< Signal of the requests to configure the scan again
+static app_event_signal_t scan_sighting_signal;                    ///< Signal of the sightings of authorized beacons by the detection task
+static int64_t open_latency_max_us = 0;                            ///< Maximum time from the advertisement that makes the first beacon found to the lid open command (us)
+static uint16_t whitelist_size = 0;                                ///< Number of addresses that fit in the BT controller whitelist, 0 if the whitelist cannot be used
+static uint8_t scan_config_pending = 1;                            ///< Flag that indicates that the authorized MACs or the scan mode changed, so the scan must be configured again
+static esp_timer_handle_t beacon_check_timer = NULL;               ///< Timer to check if the beacons found have been lost, running while the lid is open
+static TaskHandle_t app_beacon__detection_task_handle = NULL;      ///< Detection task handle
+static adv_record_t adv_ring[ADV_RING_SIZE];                       ///< Single-producer (GAP callback), single-consumer (detection task) ring of advertisement records
+static uint32_t adv_ring_head = 0;                                 ///< Index of the next record to be written, only modified by the producer
+static uint32_t adv_ring_tail = 0;                                 ///< Index of the next record to be read, only modified by the consumer
+static uint32_t adv_ring_dropped = 0;                              ///< Number of advertisement records dropped because the ring was full
+static int8_t min_rssi_for_detection_dbm = 0;                      ///< Minimum RSSI for detection (dBm), from the configuration
+static uint8_t min_times_seen_for_detection = 0;                   ///< Minimum times the beacon has to be seen for detection, from the configuration
+static uint16_t scan_idle_interval = 0;                            ///< Scan interval while idle (0.625 ms units), from the configuration
+static uint16_t scan_idle_window = 0;                              ///< Scan window while idle (0.625 ms units), from the configuration
+static uint16_t scan_active_interval = 0;                          ///< Scan interval while active (0.625 ms units), from the configuration
+static uint16_t scan_active_window = 0;                            ///< Scan window while active (0.625 ms units), from the configuration
+static int64_t first_scan_start_us = 0;                            ///< Time when the BLE scan was first started (us since boot), 0 if it was not
+static int64_t first_scan_result_us = 0;                           ///< Time of the first advertisement reported by the BLE scan (us since boot), 0 if there was none
+static uint32_t ble_stack_heap_bytes = 0;                          ///< Heap taken by the bring-up of the BT controller and the BLE host stack (bytes)
+#if APP_BEACON_BLE_LATENCY_PROFILE
+static uint32_t adv_latency_count = 0;                             ///< Number of advertisements whose HCI to handler latency was measured since it was last printed
+static int64_t adv_latency_sum_us = 0;                             ///< Sum of the HCI to handler latencies since they were last printed (us)
+static int64_t adv_latency_max_us = 0;                             ///< Maximum HCI to handler latency since it was last printed (us)
+#endif // APP_BEACON_BLE_LATENCY_PROFILE
 
-static void app_beacon__ble_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
-static void app_beacon__beacon_check_task(void *arg);
+static void app_beacon__ble_scan_params_set(esp_err_t status);
+static void app_beacon__ble_scan_started(esp_err_t status);
+static void app_beacon__ble_scan_stopped(esp_err_t status);
+static void app_beacon__ble_whitelist_failed(void);
+static void app_beacon__scan_params_set_handler(void *arg);
+static void app_beacon__scan_started_handler(void *arg);
+static void app_beacon__scan_stopped_handler(void *arg);
+static void app_beacon__whitelist_failed_handler(void *arg);
+static void app_beacon__adv_report_handler(const uint8_t mac[6], int8_t rssi, const uint8_t *data, uint8_t data_len);
+static void app_beacon__beacon_check_handler(void *arg);
+static void app_beacon__detection_task(void *arg);
+static uint8_t app_beacon__update_beacon(app_beacon_registry_entry_t *beacon, const adv_record_t *record,
+                                         uint8_t *open_lid, uint8_t *battery_low_changed);
+static esp_err_t app_beacon__create_signals(void);
+static esp_err_t app_beacon__scan_start(void);
+static esp_err_t app_beacon__scan_stop(void);
+static void app_beacon__scan_request_handler(void *arg);
+static void app_beacon__scan_op_begin(void);
+static void app_beacon__scan_op_timer_handler(void *arg);
+static void app_beacon__scan_request_config(void);
+static void app_beacon__scan_request_config_handler(void *arg);
+static esp_err_t app_beacon__scan_config(void);
+static void app_beacon__scan_set_mode(ble_scan_mode_t mode);
+static void app_beacon__scan_sighting_handler(void *arg);
+static void app_beacon__scan_active_timer_handler(void *arg);
+static void app_beacon__apply_config(const app_nvs_config_t *config);
+
+static const app_beacon_ble_handlers_t ble_handlers = {
+    .scan_params_set = app_beacon__ble_scan_params_set,
+    .scan_started = app_beacon__ble_scan_started,
+    .scan_stopped = app_beacon__ble_scan_stopped,
+    .whitelist_failed = app_beacon__ble_whitelist_failed,
+    .adv_report = app_beacon__adv_report_handler,
+}; ///< BLE scan event handlers
 
 /**
- * @brief Initialize necessary stuff to perform BLE scan.
+ * @brief Initialize necessary stuff to perform BLE scan: the BT controller, the BLE host stack and the detection task. The
+ * scan itself is started by app_beacon__ble_scan_start.
  *
  * @return esp_err_t
  * @retval ESP_OK on success.
@@ -122,462 +220,1342 @@ esp_err_t app_beacon__init(void)
         return err;
     }
 
-    scan_status = ble_scan_initialing;
-
-    err = esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
-
+    err = app_beacon__create_signals();
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Error releasing memory: %s", esp_err_to_name(err));
         return err;
     }
 
-    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
-    err = esp_bt_controller_init(&bt_cfg);
-
+    app_nvs_config_t config;
+    app_nvs__get_config(&config);
+    app_beacon__apply_config(&config);
+    err = app_nvs__subscribe(app_beacon__apply_config);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Error initializing BT controller: %s",
-                 esp_err_to_name(err));
         return err;
     }
 
-    err = esp_bt_controller_enable(ESP_BT_MODE_BLE);
-    if (err != ESP_OK)
+    scan_status = ble_scan_initialing;
+
+#if SCAN_ADAPTIVE
+    if (scan_active_timer == NULL)
     {
-        ESP_LOGE(TAG, "Error enabling BT controller: %s",
-                 esp_err_to_name(err));
-        return err;
+        err = app_event__timer_create("scan_active", app_beacon__scan_active_timer_handler, NULL, &scan_active_timer);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error creating scan_active timer: %s", esp_err_to_name(err));
+            return err;
+        }
     }
+#endif // SCAN_ADAPTIVE
 
-    err = esp_bluedroid_init();
-    if (err != ESP_OK)
+    if (scan_op_timer == NULL)
     {
-        ESP_LOGE(TAG, "Error initializing bluedroid: %s",
-                 esp_err_to_name(err));
-        return err;
+        err = app_event__timer_create("scan_op", app_beacon__scan_op_timer_handler, NULL, &scan_op_timer);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error creating scan_op timer: %s", esp_err_to_name(err));
+            return err;
+        }
     }
 
-    err = esp_bluedroid_enable();
-
-    if (err != ESP_OK)
+    if (beacon_check_timer == NULL)
     {
-        ESP_LOGE(TAG, "Error enabling bluedroid %s",
-                 esp_err_to_name(err));
-        return err;
+        err = app_event__timer_create("beacon_check", app_beacon__beacon_check_handler, NULL, &beacon_check_timer);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error creating beacon_check timer: %s", esp_err_to_name(err));
+            return err;
+        }
     }
 
-    err = esp_ble_gap_register_callback(app_beacon__ble_gap_cb);
-
-    if (err != ESP_OK)
+    if (app_beacon__detection_task_handle == NULL &&
+        xTaskCreate(app_beacon__detection_task,
+                    "app_beacon__detection_task", 2048, NULL, 10,
+                    &app_beacon__detection_task_handle) != pdPASS)
     {
-        ESP_LOGE(TAG, "Error registering BLE GAP callback: %s",
-                 esp_err_to_name(err));
-        return err;
+        ESP_LOGE(TAG, "Error creating app_beacon__detection_task");
+        return ESP_FAIL;
     }
 
-    err = esp_ble_gap_set_scan_params(&ble_scan_params);
-
+    uint32_t free_heap = esp_get_free_heap_size();
+    err = app_beacon_ble__init(&ble_handlers);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG,
-                 "Error setting scan parameters: %s", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Error initializing BLE host stack: %s", esp_err_to_name(err));
         return err;
     }
+    ble_stack_heap_bytes = free_heap - esp_get_free_heap_size();
+    ESP_LOGI(TAG, "BLE host stack initialized, %d bytes of heap", (int)ble_stack_heap_bytes);
 
-    if (xTaskCreate(app_beacon__beacon_check_task,
-                    "app_beacon__beacon_check_task", 2048, NULL, 10,
-                    &app_beacon__beacon_check_task_handle) != pdPASS)
+#if SCAN_FILTER_MAC && SCAN_FILTER_WHITELIST
+    whitelist_size = app_beacon_ble__get_whitelist_size();
+    if (whitelist_size == 0)
     {
-        ESP_LOGE(TAG, "Error creating app_beacon__beacon_check_task");
-        return ESP_FAIL;
+        ESP_LOGW(TAG, "Whitelist not available, filtering scan in software");
     }
+#endif // SCAN_FILTER_MAC && SCAN_FILTER_WHITELIST
 
+    // the scan parameters are set by app_beacon__ble_scan_start, once the registry holds the authorized MACs
+    scan_status = ble_scan_off;
     return err;
 }
 
 /**
- * @brief BLE GAP event handler.
+ * @brief Create the signals of the scan state machine. The signals raised before app_beacon__init (e.g. a MAC
+ * authorized by the configuration) are not needed, the scan is configured when it is first started.
  *
- * @param event Tell which event happened.
- * @param param Pointer to union with other event data.
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code of app_event__signal_create on failure.
  */
-static void app_beacon__ble_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+static esp_err_t app_beacon__create_signals(void)
 {
-    esp_err_t err;
+    const struct
+    {
+        app_event_handler_t handler;
+        app_event_signal_t *signal;
+    } signals[] = {
+        {app_beacon__scan_params_set_handler, &scan_params_set_signal},
+        {app_beacon__scan_started_handler, &scan_started_signal},
+        {app_beacon__scan_stopped_handler, &scan_stopped_signal},
+        {app_beacon__whitelist_failed_handler, &whitelist_failed_signal},
+        {app_beacon__scan_request_handler, &scan_request_signal},
+        {app_beacon__scan_request_config_handler, &scan_config_signal},
+        {app_beacon__scan_sighting_handler, &scan_sighting_signal},
+    };
 
-    switch (event)
+    if (scan_signals_created)
     {
-    case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+        return ESP_OK;
+    }
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
     {
-        // BLE parameters setting completed
-
-        err = param->scan_param_cmpl.status;
-        if (err != ESP_BT_STATUS_SUCCESS)
+        esp_err_t err = app_event__signal_create(signals[i].handler, NULL, signals[i].signal);
+        if (err != ESP_OK)
         {
-            scan_status = ble_scan_uninit;
-            ESP_LOGE(TAG, "BLE scan parameters setting failed: %s",
-                     esp_err_to_name(err));
+            ESP_LOGE(TAG, "Error creating scan signals: %s", esp_err_to_name(err));
+            return err;
         }
-        else
-        {
-            // start BLE scan if parameters were set successfully
+    }
+    __atomic_store_n(&scan_signals_created, 1, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
 
-            if (scan_status != ble_scan_stop_pending)
-            {
-                // if BLE scan stop was requested, do not start BLE scan
-                scan_status = ble_scan_off;
-            }
+/**
+ * @brief Completion of the scan parameters request, run by the BLE host task: handled by the event loop.
+ *
+ * @param status ESP_OK if the scan parameters were set.
+ */
+static void app_beacon__ble_scan_params_set(esp_err_t status)
+{
+    __atomic_store_n(&scan_params_set_status, status, __ATOMIC_RELEASE);
+    app_event__signal(scan_params_set_signal);
+}
 
-            err = app_beacon__ble_scan_start();
-            if (err != ESP_OK)
-            {
-                ESP_LOGE(TAG, "Error starting BLE scan: %s",
-                         esp_err_to_name(err));
-            }
-        }
-        break;
+/**
+ * @brief Completion of the scan start request, run by the BLE host task: handled by the event loop.
+ *
+ * @param status ESP_OK if the scan started.
+ */
+static void app_beacon__ble_scan_started(esp_err_t status)
+{
+    __atomic_store_n(&scan_started_status, status, __ATOMIC_RELEASE);
+    app_event__signal(scan_started_signal);
+}
+
+/**
+ * @brief Completion of the scan stop request, run by the BLE host task: handled by the event loop.
+ *
+ * @param status ESP_OK if the scan stopped.
+ */
+static void app_beacon__ble_scan_stopped(esp_err_t status)
+{
+    __atomic_store_n(&scan_stopped_status, status, __ATOMIC_RELEASE);
+    app_event__signal(scan_stopped_signal);
+}
+
+/**
+ * @brief Whitelist update failure reported by the BT controller, run by the BLE host task: handled by the event loop.
+ *
+ */
+static void app_beacon__ble_whitelist_failed(void)
+{
+    app_event__signal(whitelist_failed_signal);
+}
+
+/**
+ * @brief Handler of the completion of the scan parameters request, run by the event loop.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_beacon__scan_params_set_handler(void *arg)
+{
+    esp_err_t status = __atomic_load_n(&scan_params_set_status, __ATOMIC_ACQUIRE);
+    esp_err_t err;
+
+    esp_timer_stop(scan_op_timer);
+    if (status != ESP_OK)
+    {
+        scan_status = ble_scan_uninit;
+        ESP_LOGE(TAG, "BLE scan parameters setting failed: %s",
+                 esp_err_to_name(status));
     }
-    case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+    else
     {
-        err = param->scan_start_cmpl.status;
+        // start BLE scan if parameters were set successfully
 
-        if (err != ESP_BT_STATUS_SUCCESS)
+        if (scan_status != ble_scan_stop_pending)
         {
-            ESP_LOGE(TAG, "BLE scan start failed: %s", esp_err_to_name(err));
+            // if BLE scan stop was requested, do not start BLE scan
             scan_status = ble_scan_off;
         }
-        else
-        {
-            ble_scan_status_t scan_status_temp = scan_status;
-            scan_status = ble_scan_on;
-            ESP_LOGI(TAG, "BLE scan started, scan_status=%s",
-                     scan_statuses_str[scan_status]);
 
-            if (scan_status_temp == ble_scan_stop_pending)
-            {
-                // if BLE scan stop was requested, stop BLE scan right after it was started
-                app_beacon__ble_scan_stop();
-            }
+        err = app_beacon__scan_start();
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error starting BLE scan: %s",
+                     esp_err_to_name(err));
         }
-        break;
     }
-    case ESP_GAP_BLE_SCAN_RESULT_EVT:
-    {
-        // BLE scan results ready
-
-        esp_ble_gap_cb_param_t *scan_result = (esp_ble_gap_cb_param_t *)param;
-        float rssi_moving_avg_result = 0;
+}
 
-        if (scan_result->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT)
-        {
-            if (1
-#if SCAN_FILTER_MAC
-                // check if advertisement MAC matches authorized MAC address
-                && (beacon.auth_mac[0] == scan_result->scan_rst.bda[0] &&
-                    beacon.auth_mac[1] == scan_result->scan_rst.bda[1] &&
-                    beacon.auth_mac[2] == scan_result->scan_rst.bda[2] &&
-                    beacon.auth_mac[3] == scan_result->scan_rst.bda[3] &&
-                    beacon.auth_mac[4] == scan_result->scan_rst.bda[4] &&
-                    beacon.auth_mac[5] == scan_result->scan_rst.bda[5])
-#endif // SCAN_FILTER_MAC
-#if SCAN_FILTER_RSSI
-                // check if advertisement RSSI is higher than minimum (this is also checked later when detecting beacon)
-                && (scan_result->scan_rst.rssi > MIN_RSSI_FOR_DETECTION_DBM)
-#endif // SCAN_FILTER_RSSI
-#if SCAN_FILTER_EDD_TLM
-                // check if advertisement is in Eddystone TLM format
-                // see https://github.com/google/eddystone/blob/master/protocol-specification.md
-                && (scan_result->scan_rst.ble_adv[0] == 0x02 &&
-                    scan_result->scan_rst.ble_adv[1] == 0x01 &&
-                    scan_result->scan_rst.ble_adv[2] == 0x06 &&
-                    scan_result->scan_rst.ble_adv[3] == 0x03 &&
-                    scan_result->scan_rst.ble_adv[4] == 0x03 &&
-                    scan_result->scan_rst.ble_adv[5] == 0xaa &&
-                    scan_result->scan_rst.ble_adv[6] == 0xfe &&
-                    scan_result->scan_rst.ble_adv[7] == 0x11 &&
-                    scan_result->scan_rst.ble_adv[8] == 0x16 &&
-                    scan_result->scan_rst.ble_adv[9] == 0xaa &&
-                    scan_result->scan_rst.ble_adv[10] == 0xfe &&
-                    scan_result->scan_rst.ble_adv[11] == 0x20)
-#endif // SCAN_FILTER_EDD_TLM
-            )
-            {
-                ESP_LOGI(TAG,
-                         "Device found, MAC: %2.2x:%2.2x:%2.2x:%2.2x:%2.2x:%2.2x",
-                         scan_result->scan_rst.bda[0],
-                         scan_result->scan_rst.bda[1],
-                         scan_result->scan_rst.bda[2],
-                         scan_result->scan_rst.bda[3],
-                         scan_result->scan_rst.bda[4],
-                         scan_result->scan_rst.bda[5]);
-                ESP_LOGI(TAG, "RSSI: %d dBm",
-                         scan_result->scan_rst.rssi);
-#if PRINT_ADV_DATA
-                ESP_LOGI(TAG, "Adv data:");
-                for (uint8_t i = 0; i < scan_result->scan_rst.adv_data_len; i++)
-                {
-                    printf("%2.2x ", scan_result->scan_rst.ble_adv[i]);
-                }
-                printf("\n");
-#endif // PRINT_ADV_DATA
-                rssi_moving_avg_samples[rssi_moving_avg_samples_index] = scan_result->scan_rst.rssi;
-                rssi_moving_avg_samples_index++;
-                if (!rssi_moving_avg_ready)
-                {
-                    if (rssi_moving_avg_samples_index < (RSSI_MOVING_AVG_NUM_OF_SAMPLES - 1))
-                    {
-                        ESP_LOGI(TAG, "RSSI moving average is not ready yet");
-                        return;
-                    }
-                    else
-                    {
-                        rssi_moving_avg_ready = 1;
-                    }
-                }
-                rssi_moving_avg_result = 0;
-                for (uint8_t i = 0; i < RSSI_MOVING_AVG_NUM_OF_SAMPLES; i++)
-                {
-                    rssi_moving_avg_result += rssi_moving_avg_samples[i];
-                }
-                rssi_moving_avg_result /= RSSI_MOVING_AVG_NUM_OF_SAMPLES;
-                if (rssi_moving_avg_result_prev != 0)
-                {
-                    if (rssi_moving_avg_result > rssi_moving_avg_result_prev + 2)
-                    {
-                        rssi_moving_avg_result = rssi_moving_avg_result_prev + 2;
-                    }
-                    else if (rssi_moving_avg_result < rssi_moving_avg_result_prev - 2)
-                    {
-                        rssi_moving_avg_result = rssi_moving_avg_result_prev - 2;
-                    }
-                }
-                if (rssi_moving_avg_samples_index == RSSI_MOVING_AVG_NUM_OF_SAMPLES)
-                {
-                    rssi_moving_avg_samples_index = 0;
-                }
-                ESP_LOGI(TAG, "RSSI moving average: %2.2f dBm, previous: %2.2f dBm", rssi_moving_avg_result, rssi_moving_avg_result_prev);
-                rssi_moving_avg_result_prev = rssi_moving_avg_result;
-
-                uint16_t beacon_bat_mv =
-                    (scan_result->scan_rst.ble_adv[10 + 3] << 8) | scan_result->scan_rst.ble_adv[11 + 3]; // get beacon battery level in mV
-                int8_t beacon_temp_c_int =
-                    scan_result->scan_rst.ble_adv[12 + 3]; // get integer part of beacon temperature in degrees Celsius
-                uint8_t beacon_temp_c_dec =
-                    (scan_result->scan_rst.ble_adv[13 + 3] * 100) / 255; // get decimal part of beacon temperature in degrees Celsius
-
-                // ESP_LOGI(TAG, "Beacon battery: %" PRIu16 " mV",
-                //  beacon_bat_mv);
-                // ESP_LOGI(TAG,
-                //  "Beacon temperature: %" PRId8 ".%" PRIu8
-                //  " degrees Celsius",
-                //  beacon_temp_c_int, beacon_temp_c_dec);
-
-                if (beacon_bat_mv < 3000)
-                {
-                    // set beacon battery to low if battery level is less than 3000 mV
-                    app_status__set_beacon_battery_low_status(1);
-                }
-                else
-                {
-                    // set beacon battery to ok if battery level is greater or equal than 3000 mV
-                    app_status__set_beacon_battery_low_status(0);
-                }
+/**
+ * @brief Handler of the completion of the scan start request, run by the event loop.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_beacon__scan_started_handler(void *arg)
+{
+    esp_err_t status = __atomic_load_n(&scan_started_status, __ATOMIC_ACQUIRE);
 
-                /* The beacon.found flag is set to 1 if the beacon is seen 2 times in a short period of time
-                 * and the RSSI is greater than MIN_RSSI_FOR_DETECTION_DBM. When the beacon is seen 2 times, the lid will be
-                 * opened. This is a debouncing scheme so that the lid does not open when the pet just passes
-                 * nearby. Everytime this beacon is seen, the task app_beacon__beacon_check_task is resumed.
-                 * This task checks if the number of times that the beacon has been seen when the task was
-                 * resumed is different from the number of times it was seen some seconds later. If the
-                 * numbers are not different, it means that the beacon has not been seen for some time and
-                 * in this case the lid will be closed and beacon.found will be set to zero.
-                 */
-                if (rssi_moving_avg_result >= MIN_RSSI_FOR_DETECTION_DBM)
-                {
-                    if (beacon.times_seen < MAX_TIMES_SEEN)
-                        beacon.times_seen++;
-                    if (!beacon.found)
-                    {
-                        if (beacon.times_seen >= MIN_TIMES_SEEN_FOR_DETECTION)
-                        {
-                            ESP_LOGI(TAG, "Beacon detected, opening lid");
-                            beacon.found = 1;
-                            app_pwm__set_duty_max();
-                            vTaskResume(app_beacon__beacon_check_task_handle);
-                        }
-                    }
-                }
-            }
-        }
-        break;
+    esp_timer_stop(scan_op_timer);
+    if (status != ESP_OK)
+    {
+        ESP_LOGE(TAG, "BLE scan start failed: %s", esp_err_to_name(status));
+        scan_status = ble_scan_off;
     }
-    case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+    else
     {
-        err = param->scan_stop_cmpl.status;
+        ble_scan_status_t scan_status_temp = scan_status;
+        scan_status = ble_scan_on;
+        ESP_LOGI(TAG, "BLE scan started, scan_status=%s",
+                 scan_statuses_str[scan_status]);
+        if (first_scan_start_us == 0)
+        {
+            first_scan_start_us = esp_timer_get_time();
+        }
 
-        if (err != ESP_BT_STATUS_SUCCESS)
+        if (scan_status_temp == ble_scan_stop_pending)
         {
-            ESP_LOGE(TAG, "BLE scan stop failed: %s", esp_err_to_name(err));
-            scan_status = ble_scan_on;
+            // if BLE scan stop was requested, stop BLE scan right after it was started
+            app_beacon__scan_stop();
         }
-        else
+        else if (scan_config_pending)
         {
-            ESP_LOGI(TAG, "BLE scan stopped");
-            ble_scan_status_t scan_status_temp = scan_status;
-            scan_status = ble_scan_off;
-
-            if (scan_status_temp == ble_scan_start_pending)
-            {
-                // if BLE scan start was requested, start BLE scan right after it was stopped
-                app_beacon__ble_scan_start();
-            }
+            // authorized MACs or scan mode changed while BLE scan was starting
+            app_beacon__scan_request_config();
         }
-        break;
-    }
-    default:
-        break;
     }
 }
 
+#if APP_BEACON_BLE_LATENCY_PROFILE
 /**
- * @brief Start BLE scan. If scan is stopping, scan start is put into pending
- * state, so it is started after it finishes stopping.
+ * @brief Account the time from the HCI advertising report of an advertisement to its handler, printing the mean and
+ * maximum every ADV_LATENCY_PRINT_COUNT advertisements. Run by the BLE host task.
  *
- * @return esp_err_t
- * @retval ESP_OK on success.
- * @retval Error code on failure.
+ * @param mac Advertiser's MAC address.
  */
-esp_err_t app_beacon__ble_scan_start(void)
+static void app_beacon__adv_latency_add(const uint8_t mac[6])
 {
-    esp_err_t err = ESP_OK;
-
-    if (scan_status == ble_scan_uninit)
+    int64_t received_us = app_beacon_hci__take_adv_report_us(mac);
+    if (received_us == 0)
     {
-        err = app_beacon__init();
-
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "BLE scan initialization failed: %s",
-                     esp_err_to_name(err));
-        }
+        return;
     }
-    else if (scan_status == ble_scan_off)
+    int64_t latency_us = esp_timer_get_time() - received_us;
+    adv_latency_sum_us += latency_us;
+    if (latency_us > adv_latency_max_us)
     {
-        scan_status = ble_scan_starting;
-        err = esp_ble_gap_start_scanning(0);
+        adv_latency_max_us = latency_us;
+    }
+    if (++adv_latency_count == ADV_LATENCY_PRINT_COUNT)
+    {
+        printf("HCI advertising report to handler latency over %d advertisements: mean %d us, max %d us\n",
+               ADV_LATENCY_PRINT_COUNT, (int)(adv_latency_sum_us / ADV_LATENCY_PRINT_COUNT), (int)adv_latency_max_us);
+        adv_latency_count = 0;
+        adv_latency_sum_us = 0;
+        adv_latency_max_us = 0;
+    }
+}
+#endif // APP_BEACON_BLE_LATENCY_PROFILE
 
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "BLE GAP scan start failed: %s",
-                     esp_err_to_name(err));
-        }
+/**
+ * @brief Handler of the advertisements received by the BLE scan, run by the BLE host task.
+ *
+ * Only the filtering is done here: an advertisement that passes the filters is copied into a compact record and
+ * handed over to app_beacon__detection_task, which does the actual processing (RSSI filtering, detection, lid and
+ * status updates).
+ *
+ * @param mac Advertiser's MAC address.
+ * @param rssi Advertisement RSSI (dBm).
+ * @param data Advertising data.
+ * @param data_len Advertising data length.
+ */
+static void app_beacon__adv_report_handler(const uint8_t mac[6], int8_t rssi, const uint8_t *data, uint8_t data_len)
+{
+#if APP_BEACON_BLE_LATENCY_PROFILE
+    app_beacon__adv_latency_add(mac);
+#endif // APP_BEACON_BLE_LATENCY_PROFILE
+    if (first_scan_result_us == 0)
+    {
+        first_scan_result_us = esp_timer_get_time();
     }
-    else if (scan_status == ble_scan_stopping)
+#if SCAN_FILTER_MAC
+    // check if advertisement MAC is in the authorized beacons registry
+    taskENTER_CRITICAL(&registry_lock);
+    int beacon_index = app_beacon_registry__find(mac);
+    taskEXIT_CRITICAL(&registry_lock);
+    if (beacon_index == APP_BEACON_REGISTRY_NOT_FOUND)
     {
-        scan_status = ble_scan_start_pending;
+        return;
     }
-    else if (scan_status == ble_scan_stop_pending)
+#endif // SCAN_FILTER_MAC
+#if SCAN_FILTER_RSSI
+    // check if advertisement RSSI is higher than minimum (this is also checked later when detecting beacon)
+    if (rssi <= min_rssi_for_detection_dbm)
     {
-        ESP_LOGI(TAG, "BLE scan stop already pending, not starting scan");
-        scan_status = ble_scan_off;
+        return;
     }
-    else
+#endif // SCAN_FILTER_RSSI
+#if PRINT_ADV_DATA
+    ESP_LOGI(TAG, "Adv data:");
+    for (uint8_t i = 0; i < data_len; i++)
     {
-        ESP_LOGI(TAG, "Cannot start BLE scan right now, scan_status=%d (%s)",
-                 scan_status, scan_statuses_str[scan_status]);
+        printf("%2.2x ", data[i]);
     }
-
-    return err;
+    printf("\n");
+#endif // PRINT_ADV_DATA
+    uint32_t head = adv_ring_head;
+    if (head - __atomic_load_n(&adv_ring_tail, __ATOMIC_ACQUIRE) == ADV_RING_SIZE)
+    {
+        adv_ring_dropped++;
+        return;
+    }
+    adv_record_t *record = &adv_ring[head & (ADV_RING_SIZE - 1)];
+    // decode the beacon frame right into the record by walking the AD structures, the record is only
+    // published (head incremented) if the advertisement passes the frame filter
+    if (!app_beacon_adv__parse(data, data_len, &record->frame) && SCAN_FILTER_FRAME)
+    {
+        return;
+    }
+    memcpy(record->mac, mac, sizeof(record->mac));
+    record->rssi = rssi;
+    record->timestamp_us = esp_timer_get_time();
+    __atomic_store_n(&adv_ring_head, head + 1, __ATOMIC_RELEASE);
+    xTaskNotifyGive(app_beacon__detection_task_handle);
 }
 
 /**
- * @brief Stop BLE scan. If scan is starting, scan stop is put into pending
- * state, so it is stopped after it finishes starting.
+ * @brief Handler of the completion of the scan stop request, run by the event loop.
  *
- * @return esp_err_t
- * @retval ESP_OK on success.
- * @retval Error code on failure.
+ * @param arg Optional argument (not being used).
  */
-esp_err_t app_beacon__ble_scan_stop(void)
+static void app_beacon__scan_stopped_handler(void *arg)
 {
-    esp_err_t err = ESP_OK;
+    esp_err_t status = __atomic_load_n(&scan_stopped_status, __ATOMIC_ACQUIRE);
 
-    if (scan_status == ble_scan_uninit)
+    esp_timer_stop(scan_op_timer);
+    if (status != ESP_OK)
     {
-        ESP_LOGW(TAG, "BLE scan is not initialized yet");
+        ESP_LOGE(TAG, "BLE scan stop failed: %s", esp_err_to_name(status));
+        scan_status = ble_scan_on;
     }
-    else if (scan_status == ble_scan_on)
+    else
     {
-        scan_status = ble_scan_stopping;
-        err = esp_ble_gap_stop_scanning();
+        ESP_LOGI(TAG, "BLE scan stopped");
+        ble_scan_status_t scan_status_temp = scan_status;
+        scan_status = ble_scan_off;
 
-        if (err != ESP_OK)
+        if (scan_status_temp == ble_scan_start_pending)
         {
-            ESP_LOGE(TAG, "BLE GAP scan stop failed: %s",
-                     esp_err_to_name(err));
+            // if BLE scan start was requested, start BLE scan right after it was stopped
+            app_beacon__scan_start();
         }
     }
-    else if ((scan_status == ble_scan_starting) ||
-             (scan_status == ble_scan_initialing))
-    {
-        scan_status = ble_scan_stop_pending;
-    }
-    else
-    {
-        ESP_LOGI(TAG, "Cannot stop BLE scan right now, scan_status=%d (%s)",
-                 scan_status, scan_statuses_str[scan_status]);
-    }
-    return err;
 }
 
 /**
- * @brief Sets authorized MAC address in beacon structure.
+ * @brief Handler of a whitelist update failure reported by the BT controller, run by the event loop.
  *
- * @param mac_addr 6 bytes array with authorized MAC address.
+ * @param arg Optional argument (not being used).
  */
-void app_beacon__set_auth_mac(uint8_t mac_addr[6])
+static void app_beacon__whitelist_failed_handler(void *arg)
 {
-    memcpy(beacon.auth_mac, mac_addr, ESP_BD_ADDR_LEN);
+    /* The scan parameters were queued right after the whitelist update, so the scan may be about
+     * to start with an incomplete whitelist. Stop using it and configure the scan again.
+     */
+    ESP_LOGE(TAG, "Whitelist update failed, filtering scan in software");
+    whitelist_size = 0;
+    app_beacon__scan_request_config();
 }
 
 /**
- * @brief This task checks if the number of times that the beacon has been seen when the task was
- * resumed is different from the number of times it was seen some seconds later. If the
- * numbers are not different, it means that the beacon has not been seen for some time and
- * in this case the lid will be closed and beacon.found will be set to zero.
+ * @brief Update the state of an authorized beacon with a new advertisement. Must be called with the registry lock
+ * held, so the actions resulting from the update (opening the lid, updating statuses) are returned to the caller
+ * instead of being performed here.
  *
- * @param arg
+ * @param beacon Beacon that sent the advertisement.
+ * @param record Advertisement record.
+ * @param open_lid Set to 1 if this was the first authorized beacon found, so the lid must be opened. Left unchanged
+ * otherwise, so that it accumulates over a batch of advertisements.
+ * @param battery_low_changed Set to 1 if the number of beacons with a low battery level changed.
+ * @return uint8_t 1 if the beacon was found with this advertisement, 0 otherwise.
  */
-static void app_beacon__beacon_check_task(void *arg)
+static uint8_t app_beacon__update_beacon(app_beacon_registry_entry_t *beacon, const adv_record_t *record,
+                                         uint8_t *open_lid, uint8_t *battery_low_changed)
 {
-    uint16_t time_to_wait_before_check = TIME_BEFORE_BEACON_LOST_CHECK_INIT_VAL_MS;
-    vTaskSuspend(NULL);
-    for (;;)
+    int32_t rssi_q8 = 0;
+    app_beacon_sighting_t *sighting = &beacon->history[beacon->history_index];
+
+    sighting->time_ms = (uint32_t)(record->timestamp_us / 1000);
+    sighting->rssi = record->rssi;
+    sighting->type = record->frame.type;
+    beacon->history_index = (beacon->history_index + 1) % APP_BEACON_HISTORY_LEN;
+    if (beacon->history_count < APP_BEACON_HISTORY_LEN)
     {
-        uint16_t beacon_times_seen_prev = beacon.times_seen;
-        ESP_LOGI(TAG, "waiting for %d ms to check if beacon has been lost, beacon.times_seen=%d", time_to_wait_before_check, (int)beacon.times_seen);
-        vTaskDelay(pdMS_TO_TICKS(time_to_wait_before_check));
-        if (beacon.found && (beacon.times_seen - beacon_times_seen_prev == 0) && beacon.times_seen)
+        beacon->history_count++;
+    }
+
+    switch (record->frame.type)
+    {
+    case app_beacon_frame_eddystone_tlm:
+    {
+        beacon->tlm = record->frame.tlm;
+        sighting->tlm = record->frame.tlm;
+
+        // beacon battery is low if battery level is less than BEACON_BATTERY_LOW_MV, and it is reported as low while any beacon battery is low
+        uint8_t beacon_battery_low = (record->frame.tlm.battery_mv != 0 && record->frame.tlm.battery_mv < BEACON_BATTERY_LOW_MV);
+        if (beacon_battery_low != beacon->battery_low)
         {
-            beacon.times_seen--;
-            if (beacon.times_seen == 0)
+            beacon->battery_low = beacon_battery_low;
+            if (beacon_battery_low)
             {
-                beacon.found = 0;
-                ESP_LOGI(TAG, "Beacon lost, closing lid");
-                app_pwm__set_duty_min();
-                vTaskSuspend(NULL);
-                time_to_wait_before_check = TIME_BEFORE_BEACON_LOST_CHECK_INIT_VAL_MS;
+                beacons_battery_low_count++;
             }
-            else if (time_to_wait_before_check >= 750)
+            else
             {
-                time_to_wait_before_check -= TIME_BEFORE_BEACON_LOST_CHECK_DECREMENT_MS;
+                beacons_battery_low_count--;
             }
+            *battery_low_changed = 1;
         }
-        else
+        break;
+    }
+    case app_beacon_frame_eddystone_uid:
+        beacon->uid = record->frame.uid;
+        break;
+    case app_beacon_frame_ibeacon:
+        beacon->ibeacon = record->frame.ibeacon;
+        break;
+    default:
+        break;
+    }
+
+    if (!app_beacon_rssi_filter__update(&beacon->rssi_filter, record->rssi, &rssi_q8))
+    {
+        // RSSI filter does not have an output yet
+        return 0;
+    }
+
+    /* The beacon->found flag is set to 1 if the beacon is seen min_times_seen_for_detection times in a short
+     * period of time and the RSSI is greater than min_rssi_for_detection_dbm. When the first authorized beacon
+     * is found, the lid will be opened. This is a debouncing scheme so that the lid does not open when the pet
+     * just passes nearby. When the first beacon is found, beacon_check_timer is started. Its handler,
+     * app_beacon__beacon_check_handler, checks, for each beacon found, if the number of times that it has been seen at the beginning
+     * of a check period is different from the number of times it was seen some time later. If the numbers are
+     * not different, it means that the beacon has not been seen for some time and in this case its found flag
+     * will be set to zero. The lid will be closed once all the beacons are lost.
+     */
+    if (rssi_q8 >= APP_BEACON_RSSI_FILTER_Q8(min_rssi_for_detection_dbm))
+    {
+        if (beacon->times_seen < MAX_TIMES_SEEN)
+            beacon->times_seen++;
+        if (!beacon->found)
         {
-            time_to_wait_before_check = TIME_BEFORE_BEACON_LOST_CHECK_INIT_VAL_MS;
+            if (beacon->times_seen >= min_times_seen_for_detection)
+            {
+                beacon->found = 1;
+                beacon->times_seen_prev = beacon->times_seen;
+                beacon->lost_check_wait_ms = TIME_BEFORE_BEACON_LOST_CHECK_INIT_VAL_MS;
+                beacon->lost_check_elapsed_ms = 0;
+                beacon->found_at_us = record->timestamp_us;
+                beacons_found_count++;
+                // accumulated, another beacon may be found later in the same batch
+                *open_lid |= (beacons_found_count == 1);
+                return 1;
+            }
         }
     }
-    vTaskDelete(NULL);
-}
\ No newline at end of file
+    return 0;
+}
+
+/* The scan state machine (scan_status, scan_mode, scan_config_pending, scan_params and the BT controller
+ * whitelist) is only run by the event loop, so it needs no lock: the completions reported by the BLE host task, the
+ * sightings of the detection task, the configuration changes made from any task (e.g. the web server) and the public
+ * app_beacon__ble_scan_start and app_beacon__ble_scan_stop are all signals of the event loop, which are never
+ * dropped (see app_event__signal). A completion that never comes (e.g. lost by the BLE host stack) would still leave
+ * the scan starting or stopping for good, so each request to the BLE host stack starts scan_op_timer, which
+ * configures and starts the scan again if the request is not completed in SCAN_OP_TIMEOUT_MS.
+ */
+
+/**
+ * @brief Start BLE scan, initializing it first if needed (in the calling task, e.g. during boot). The scan start
+ * itself is posted to the event loop, see app_beacon__scan_start.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code on failure.
+ */
+esp_err_t app_beacon__ble_scan_start(void)
+{
+    esp_err_t err = ESP_OK;
+
+    if (scan_status == ble_scan_uninit)
+    {
+        err = app_beacon__init();
+
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "BLE scan initialization failed: %s",
+                     esp_err_to_name(err));
+            return err;
+        }
+    }
+    __atomic_store_n(&scan_requested, 1, __ATOMIC_RELEASE);
+    app_event__signal(scan_request_signal);
+    return ESP_OK;
+}
+
+/**
+ * @brief Stop BLE scan. The scan stop is done by the event loop, see app_beacon__scan_stop.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval ESP_ERR_INVALID_STATE if BLE scan is not initialized.
+ */
+esp_err_t app_beacon__ble_scan_stop(void)
+{
+    if (!__atomic_load_n(&scan_signals_created, __ATOMIC_ACQUIRE))
+    {
+        ESP_LOGW(TAG, "BLE scan is not initialized yet");
+        return ESP_ERR_INVALID_STATE;
+    }
+    __atomic_store_n(&scan_requested, 0, __ATOMIC_RELEASE);
+    app_event__signal(scan_request_signal);
+    return ESP_OK;
+}
+
+/**
+ * @brief Handler of app_beacon__ble_scan_start and app_beacon__ble_scan_stop, run by the event loop: moves the scan
+ * towards the state last requested.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_beacon__scan_request_handler(void *arg)
+{
+    if (__atomic_load_n(&scan_requested, __ATOMIC_ACQUIRE))
+    {
+        app_beacon__scan_start();
+    }
+    else
+    {
+        app_beacon__scan_stop();
+    }
+}
+
+/**
+ * @brief Start scan_op_timer, right before a request to the BLE host stack. Stopped by the handler of its completion.
+ *
+ */
+static void app_beacon__scan_op_begin(void)
+{
+    esp_timer_stop(scan_op_timer);
+    esp_timer_start_once(scan_op_timer, (uint64_t)SCAN_OP_TIMEOUT_MS * 1000);
+}
+
+/**
+ * @brief Handler of scan_op_timer, run by the event loop when a request to the BLE host stack was not completed in
+ * SCAN_OP_TIMEOUT_MS. The scan is considered off, and is configured and started again if it was last requested to be
+ * on. A late completion is then taken for the new request.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_beacon__scan_op_timer_handler(void *arg)
+{
+    ESP_LOGE(TAG, "BLE scan request not completed in %d ms, scan_status=%s", SCAN_OP_TIMEOUT_MS,
+             scan_statuses_str[scan_status]);
+    scan_status = ble_scan_off;
+    scan_config_pending = 1;
+    if (__atomic_load_n(&scan_requested, __ATOMIC_ACQUIRE))
+    {
+        app_beacon__scan_start();
+    }
+}
+
+/**
+ * @brief Start BLE scan, initializing it first if needed, run by the event loop. If scan is stopping, scan start is
+ * put into pending state, so it is started after it finishes stopping.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code on failure.
+ */
+static esp_err_t app_beacon__scan_start(void)
+{
+    esp_err_t err = ESP_OK;
+
+    if (scan_status == ble_scan_uninit)
+    {
+        err = app_beacon__init();
+
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "BLE scan initialization failed: %s",
+                     esp_err_to_name(err));
+            return err;
+        }
+    }
+
+    if (scan_status == ble_scan_off)
+    {
+        if (scan_config_pending)
+        {
+            // BLE scan is started once the scan parameters are set
+            return app_beacon__scan_config();
+        }
+        scan_status = ble_scan_starting;
+        app_beacon__scan_op_begin();
+        err = app_beacon_ble__start_scan();
+
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "BLE GAP scan start failed: %s",
+                     esp_err_to_name(err));
+        }
+    }
+    else if (scan_status == ble_scan_stopping)
+    {
+        scan_status = ble_scan_start_pending;
+    }
+    else if (scan_status == ble_scan_stop_pending)
+    {
+        ESP_LOGI(TAG, "BLE scan stop already pending, not starting scan");
+        scan_status = ble_scan_off;
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Cannot start BLE scan right now, scan_status=%d (%s)",
+                 scan_status, scan_statuses_str[scan_status]);
+    }
+
+    return err;
+}
+
+/**
+ * @brief Stop BLE scan, run by the event loop. If scan is starting, scan stop is put into pending
+ * state, so it is stopped after it finishes starting.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code on failure.
+ */
+static esp_err_t app_beacon__scan_stop(void)
+{
+    esp_err_t err = ESP_OK;
+
+    if (scan_status == ble_scan_uninit)
+    {
+        ESP_LOGW(TAG, "BLE scan is not initialized yet");
+    }
+    else if (scan_status == ble_scan_on)
+    {
+        scan_status = ble_scan_stopping;
+        app_beacon__scan_op_begin();
+        err = app_beacon_ble__stop_scan();
+
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "BLE GAP scan stop failed: %s",
+                     esp_err_to_name(err));
+        }
+    }
+    else if ((scan_status == ble_scan_starting) ||
+             (scan_status == ble_scan_initialing))
+    {
+        scan_status = ble_scan_stop_pending;
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Cannot stop BLE scan right now, scan_status=%d (%s)",
+                 scan_status, scan_statuses_str[scan_status]);
+    }
+    return err;
+}
+
+/**
+ * @brief Fill the end of the visit of a found beacon. Must be called with registry_lock taken.
+ *
+ * @param beacon Beacon found.
+ * @param visit_end Visit end.
+ */
+static void app_beacon__visit_end(const app_beacon_registry_entry_t *beacon, visit_end_t *visit_end)
+{
+    memcpy(visit_end->mac, beacon->auth_mac, sizeof(visit_end->mac));
+    visit_end->duration_ms = (uint32_t)((esp_timer_get_time() - beacon->found_at_us) / 1000);
+}
+
+/**
+ * @brief Append the ends of visits to the feed log. Must not be called with registry_lock taken.
+ *
+ * @param visits_end Visits ended.
+ * @param count Number of visits ended.
+ */
+static void app_beacon__log_visits_end(const visit_end_t *visits_end, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        app_feed_log__append(app_feed_log_event_visit_end, visits_end[i].mac, 0, visits_end[i].duration_ms);
+    }
+}
+
+/**
+ * @brief Apply the configuration: detection thresholds, scan intervals and windows, and authorized MACs. The MACs
+ * authorized in the configuration are added to the registry and the ones no longer in it are removed, so the beacons
+ * that stay authorized keep their state (e.g. a beacon found while a MAC is added). Subscribed to the configuration
+ * changes, see app_nvs__subscribe.
+ *
+ * @param config Configuration.
+ */
+static void app_beacon__apply_config(const app_nvs_config_t *config)
+{
+    uint8_t registry_macs[APP_BEACON_REGISTRY_MAX_ENTRIES][6];
+    uint8_t removed_macs[APP_BEACON_REGISTRY_MAX_ENTRIES][6];
+    size_t removed_count = 0;
+
+    min_rssi_for_detection_dbm = config->min_rssi_for_detection_dbm;
+    min_times_seen_for_detection = config->min_times_seen_for_detection;
+    // also applied at initialization, from the calling task, so written as app_beacon__scan_config reads them
+    taskENTER_CRITICAL(&registry_lock);
+    uint8_t scan_changed = (scan_idle_interval != config->scan_idle_interval) ||
+                           (scan_idle_window != config->scan_idle_window) ||
+                           (scan_active_interval != config->scan_active_interval) ||
+                           (scan_active_window != config->scan_active_window);
+    scan_idle_interval = config->scan_idle_interval;
+    scan_idle_window = config->scan_idle_window;
+    scan_active_interval = config->scan_active_interval;
+    scan_active_window = config->scan_active_window;
+    taskEXIT_CRITICAL(&registry_lock);
+    if (scan_changed)
+    {
+        app_beacon__scan_request_config();
+    }
+
+    // the registry MACs are compared outside the critical section, the ones removed meanwhile are not found
+    taskENTER_CRITICAL(&registry_lock);
+    size_t registry_count = app_beacon_registry__count();
+    for (size_t i = 0; i < registry_count; i++)
+    {
+        memcpy(registry_macs[i], app_beacon_registry__get(i)->auth_mac, 6);
+    }
+    taskEXIT_CRITICAL(&registry_lock);
+
+    for (size_t i = 0; i < registry_count; i++)
+    {
+        uint8_t authorized = 0;
+        for (size_t j = 0; (j < config->authorized_macs_count) && !authorized; j++)
+        {
+            authorized = (memcmp(config->authorized_macs[j], registry_macs[i], 6) == 0);
+        }
+        if (!authorized)
+        {
+            memcpy(removed_macs[removed_count++], registry_macs[i], 6);
+        }
+    }
+
+    for (size_t i = 0; i < removed_count; i++)
+    {
+        app_beacon__remove_auth_mac(removed_macs[i]);
+    }
+    for (size_t i = 0; i < config->authorized_macs_count; i++)
+    {
+        taskENTER_CRITICAL(&registry_lock);
+        int beacon_index = app_beacon_registry__find(config->authorized_macs[i]);
+        taskEXIT_CRITICAL(&registry_lock);
+        if (beacon_index == APP_BEACON_REGISTRY_NOT_FOUND)
+        {
+            app_beacon__add_auth_mac((uint8_t *)config->authorized_macs[i]);
+        }
+    }
+}
+
+/**
+ * @brief Sets authorized MAC address, replacing all the previously authorized ones.
+ *
+ * @param mac_addr 6 bytes array with authorized MAC address.
+ */
+void app_beacon__set_auth_mac(uint8_t mac_addr[6])
+{
+    app_beacon__clear_auth_macs();
+    app_beacon__add_auth_mac(mac_addr);
+}
+
+/**
+ * @brief Adds MAC address to the authorized beacons registry.
+ *
+ * @param mac_addr 6 bytes array with authorized MAC address.
+ * @return esp_err_t
+ * @retval ESP_OK if MAC address is added or is already authorized.
+ * @retval ESP_ERR_INVALID_ARG if MAC address is 00:00:00:00:00:00.
+ * @retval ESP_ERR_NO_MEM if the maximum number of authorized beacons has been reached.
+ */
+esp_err_t app_beacon__add_auth_mac(uint8_t mac_addr[6])
+{
+    taskENTER_CRITICAL(&registry_lock);
+    esp_err_t err = app_beacon_registry__add(mac_addr);
+    taskEXIT_CRITICAL(&registry_lock);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error adding authorized MAC: %s", esp_err_to_name(err));
+    }
+#if SCAN_FILTER_MAC && SCAN_FILTER_WHITELIST
+    else
+    {
+        app_beacon__scan_request_config();
+    }
+#endif // SCAN_FILTER_MAC && SCAN_FILTER_WHITELIST
+    return err;
+}
+
+/**
+ * @brief Removes MAC address from the authorized beacons registry.
+ *
+ * @param mac_addr 6 bytes array with MAC address.
+ * @return esp_err_t
+ * @retval ESP_OK if MAC address is removed.
+ * @retval ESP_ERR_NOT_FOUND if MAC address is not authorized.
+ */
+esp_err_t app_beacon__remove_auth_mac(uint8_t mac_addr[6])
+{
+    visit_end_t visit_end;
+    uint8_t found = 0;
+
+    taskENTER_CRITICAL(&registry_lock);
+    int beacon_index = app_beacon_registry__find(mac_addr);
+    app_beacon_registry_entry_t *beacon = app_beacon_registry__get(beacon_index);
+    if (beacon != NULL)
+    {
+        // the beacon lost check timer handler closes the lid if this was the last beacon found
+        found = beacon->found;
+        if (found)
+        {
+            app_beacon__visit_end(beacon, &visit_end);
+        }
+        beacons_found_count -= beacon->found;
+        beacons_battery_low_count -= beacon->battery_low;
+    }
+    esp_err_t err = app_beacon_registry__remove(mac_addr);
+    taskEXIT_CRITICAL(&registry_lock);
+
+    app_beacon__log_visits_end(&visit_end, found);
+    app_status__set_beacon_battery_low_status(beacons_battery_low_count);
+#if SCAN_FILTER_MAC && SCAN_FILTER_WHITELIST
+    if (err == ESP_OK)
+    {
+        app_beacon__scan_request_config();
+    }
+#endif // SCAN_FILTER_MAC && SCAN_FILTER_WHITELIST
+    return err;
+}
+
+/**
+ * @brief Removes all MAC addresses from the authorized beacons registry.
+ *
+ */
+void app_beacon__clear_auth_macs(void)
+{
+    visit_end_t visits_end[APP_BEACON_REGISTRY_MAX_ENTRIES];
+    uint8_t visits_end_count = 0;
+
+    taskENTER_CRITICAL(&registry_lock);
+    for (size_t i = 0; i < app_beacon_registry__count(); i++)
+    {
+        const app_beacon_registry_entry_t *beacon = app_beacon_registry__get(i);
+        if (beacon->found)
+        {
+            app_beacon__visit_end(beacon, &visits_end[visits_end_count++]);
+        }
+    }
+    app_beacon_registry__clear();
+    beacons_found_count = 0;
+    beacons_battery_low_count = 0;
+    taskEXIT_CRITICAL(&registry_lock);
+
+    app_beacon__log_visits_end(visits_end, visits_end_count);
+    app_status__set_beacon_battery_low_status(0);
+#if SCAN_FILTER_MAC && SCAN_FILTER_WHITELIST
+    app_beacon__scan_request_config();
+#endif // SCAN_FILTER_MAC && SCAN_FILTER_WHITELIST
+}
+
+/**
+ * @brief Get the maximum lid open latency since boot: the time from the advertisement that made the first beacon
+ * found (as timestamped by the GAP callback) to the lid open command. Power management must keep it under
+ * OPEN_LATENCY_BOUND_MS.
+ *
+ * @return int64_t Maximum lid open latency (us).
+ */
+int64_t app_beacon__get_open_latency_max_us(void)
+{
+    return open_latency_max_us;
+}
+
+/**
+ * @brief Get the time when the BLE scan was first started, i.e. when the BT controller confirmed the scan start.
+ *
+ * @return int64_t Time of the first scan start (us since boot), 0 if the scan was not started yet.
+ */
+int64_t app_beacon__get_first_scan_start_us(void)
+{
+    return first_scan_start_us;
+}
+
+/**
+ * @brief Get the time of the first advertisement reported by the BLE scan, before any filtering in software. With
+ * the scan filtered by the BT controller whitelist, it is the first advertisement of an authorized beacon.
+ *
+ * @return int64_t Time of the first scan result (us since boot), 0 if there was none yet.
+ */
+int64_t app_beacon__get_first_scan_result_us(void)
+{
+    return first_scan_result_us;
+}
+
+/**
+ * @brief Get the heap taken by the bring-up of the BT controller and the BLE host stack (Bluedroid or NimBLE, see
+ * app_beacon_ble.h), measured as the drop of the free heap during it.
+ *
+ * @return uint32_t Heap taken by the BLE stack (bytes), 0 before app_beacon__init.
+ */
+uint32_t app_beacon__get_ble_stack_heap_bytes(void)
+{
+    return ble_stack_heap_bytes;
+}
+
+/**
+ * @brief Get the last sightings of an authorized beacon, with the TLM fields of the ones that carried a TLM frame.
+ * Can be called from any task.
+ *
+ * @param mac_addr 6 bytes array with MAC address of the authorized beacon.
+ * @param sightings Sightings, oldest first.
+ * @param max Maximum number of sightings to get (at most APP_BEACON_HISTORY_LEN are kept).
+ * @return size_t Number of sightings written, 0 if the beacon is not authorized.
+ */
+size_t app_beacon__get_history(const uint8_t mac_addr[6], app_beacon_sighting_t *sightings, size_t max)
+{
+    size_t count = 0;
+
+    taskENTER_CRITICAL(&registry_lock);
+    app_beacon_registry_entry_t *beacon = app_beacon_registry__get(app_beacon_registry__find(mac_addr));
+    if (beacon != NULL)
+    {
+        count = (beacon->history_count < max) ? beacon->history_count : max;
+        for (size_t i = 0; i < count; i++)
+        {
+            sightings[i] = beacon->history[(beacon->history_index + APP_BEACON_HISTORY_LEN - count + i) % APP_BEACON_HISTORY_LEN];
+        }
+    }
+    taskEXIT_CRITICAL(&registry_lock);
+    return count;
+}
+
+/**
+ * @brief Request the BLE scan to be configured again, because the authorized MACs (BT controller whitelist), the
+ * scan intervals and windows or the scan mode changed. Can be called from any task, the request is handled by the
+ * event loop.
+ *
+ */
+static void app_beacon__scan_request_config(void)
+{
+    if (__atomic_load_n(&scan_signals_created, __ATOMIC_ACQUIRE))
+    {
+        app_event__signal(scan_config_signal);
+    }
+}
+
+/**
+ * @brief Handler of the requests to configure the BLE scan again, run by the event loop. Neither the whitelist nor
+ * the scan parameters can be changed while scanning, so a running BLE scan is stopped and started again, and the
+ * configuration is done by app_beacon__scan_start while the scan is off. Several requests in a row (e.g. when all
+ * the authorized MACs are loaded from NVS) result in a single configuration.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_beacon__scan_request_config_handler(void *arg)
+{
+    scan_config_pending = 1;
+    if (scan_status == ble_scan_on)
+    {
+        app_beacon__scan_stop();
+        app_beacon__scan_start();
+    }
+}
+
+/**
+ * @brief Configure the BLE scan: load the authorized MACs into the BT controller whitelist and set the scan
+ * filter policy accordingly, set the scan interval and window of the current scan mode, then set the scan
+ * parameters (BLE scan is started when they are set). Must be called while BLE scan is off.
+ *
+ * Beacons may advertise with a public or a random static address, and the whitelist needs the address type, so
+ * each MAC takes two whitelist entries. If the authorized MACs do not fit in the whitelist, the controller
+ * reports all the advertisements and the MACs are only filtered in software, by the GAP callback.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code on failure.
+ */
+static esp_err_t app_beacon__scan_config(void)
+{
+    esp_err_t err = ESP_OK;
+
+    scan_config_pending = 0;
+
+#if SCAN_FILTER_MAC && SCAN_FILTER_WHITELIST
+    uint8_t auth_macs[APP_BEACON_REGISTRY_MAX_ENTRIES][6];
+    size_t auth_macs_count = 0;
+    uint8_t use_whitelist = 0;
+
+    taskENTER_CRITICAL(&registry_lock);
+    auth_macs_count = app_beacon_registry__count();
+    for (size_t i = 0; i < auth_macs_count; i++)
+    {
+        memcpy(auth_macs[i], app_beacon_registry__get(i)->auth_mac, sizeof(auth_macs[i]));
+    }
+    taskEXIT_CRITICAL(&registry_lock);
+
+    use_whitelist = (whitelist_size != 0) && (2 * auth_macs_count <= whitelist_size);
+    if (use_whitelist)
+    {
+        err = app_beacon_ble__set_whitelist((const uint8_t(*)[6])auth_macs, auth_macs_count);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error updating whitelist, filtering scan in software: %s",
+                     esp_err_to_name(err));
+            whitelist_size = 0;
+            use_whitelist = 0;
+        }
+    }
+
+    if (use_whitelist)
+    {
+        ESP_LOGI(TAG, "Filtering scan in the BT controller, %d authorized MACs in the whitelist", (int)auth_macs_count);
+        scan_params.use_whitelist = 1;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "%d authorized MACs do not fit in the whitelist (%d addresses), filtering scan in software",
+                 (int)auth_macs_count, (int)whitelist_size);
+        scan_params.use_whitelist = 0;
+    }
+#endif // SCAN_FILTER_MAC && SCAN_FILTER_WHITELIST
+
+#if SCAN_ADAPTIVE
+    uint8_t scan_idle = (scan_mode == ble_scan_mode_idle);
+    ESP_LOGI(TAG, "Scan mode: %s", scan_idle ? "idle" : "active");
+#else
+    uint8_t scan_idle = 0;
+#endif // SCAN_ADAPTIVE
+    // the interval and window of a mode are written together by app_beacon__apply_config
+    taskENTER_CRITICAL(&registry_lock);
+    scan_params.interval = scan_idle ? scan_idle_interval : scan_active_interval;
+    scan_params.window = scan_idle ? scan_idle_window : scan_active_window;
+    taskEXIT_CRITICAL(&registry_lock);
+
+    // the scan is configured again, so it goes through the same states as during its initialization
+    scan_status = ble_scan_initialing;
+    app_beacon__scan_op_begin();
+    err = app_beacon_ble__set_scan_params(&scan_params);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error setting scan parameters: %s", esp_err_to_name(err));
+        esp_timer_stop(scan_op_timer);
+        scan_status = ble_scan_off;
+    }
+    return err;
+}
+
+/**
+ * @brief Set the BLE scan duty cycle mode, run by the event loop. The scan is configured again only if the mode
+ * changes. When the scan becomes active, scan_active_timer is started, so that it returns to idle if the beacon that
+ * was sighted is not found (e.g. the pet just passed nearby).
+ *
+ * @param mode New scan mode.
+ */
+static void app_beacon__scan_set_mode(ble_scan_mode_t mode)
+{
+#if SCAN_ADAPTIVE
+    if (mode == scan_mode)
+    {
+        return;
+    }
+    scan_mode = mode;
+    if (mode == ble_scan_mode_active)
+    {
+        // run at full speed while a beacon is close, so that it is detected with the lowest latency
+        app_pm__lock_acquire(app_pm_lock_ble_active);
+        esp_timer_start_once(scan_active_timer, SCAN_ACTIVE_TIMEOUT_MS * 1000);
+    }
+    else
+    {
+        esp_timer_stop(scan_active_timer);
+        app_pm__lock_release(app_pm_lock_ble_active);
+    }
+    app_beacon__scan_request_config();
+#endif // SCAN_ADAPTIVE
+}
+
+/**
+ * @brief Handler of the sightings of authorized beacons signaled by the detection task, run by the event loop.
+ * Several sightings before it runs are handled once.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_beacon__scan_sighting_handler(void *arg)
+{
+    scan_last_sighting_us = esp_timer_get_time();
+    app_beacon__scan_set_mode(ble_scan_mode_active);
+}
+
+/**
+ * @brief Handler of scan_active_timer, run by the event loop. Returns the scan to idle if no beacon has been found and no authorized
+ * beacon has been sighted for SCAN_ACTIVE_TIMEOUT_MS, otherwise it is started again for the remaining time. While
+ * a beacon is found, the scan returns to idle when the lid closes.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_beacon__scan_active_timer_handler(void *arg)
+{
+    if (beacons_found_count != 0)
+    {
+        return;
+    }
+    int64_t elapsed_us = esp_timer_get_time() - scan_last_sighting_us;
+    if (elapsed_us >= SCAN_ACTIVE_TIMEOUT_MS * 1000)
+    {
+        app_beacon__scan_set_mode(ble_scan_mode_idle);
+    }
+    else
+    {
+        esp_timer_start_once(scan_active_timer, SCAN_ACTIVE_TIMEOUT_MS * 1000 - elapsed_us);
+    }
+}
+
+/**
+ * @brief Handler of beacon_check_timer, run by the event loop every TIME_BEFORE_BEACON_LOST_CHECK_TICK_MS while the
+ * lid is open. It checks, for each beacon found, if the number of times that it has been seen at the beginning
+ * of a check period is different from the number of times it was seen some time later. If the numbers are not
+ * different, it means that the beacon has not been seen for some time and in this case its found flag will be set
+ * to zero. When all the beacons are lost, the lid will be closed and the timer stopped.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_beacon__beacon_check_handler(void *arg)
+{
+    visit_end_t lost[APP_BEACON_REGISTRY_MAX_ENTRIES];
+    uint8_t lost_count = 0;
+
+    taskENTER_CRITICAL(&registry_lock);
+    for (int i = 0; i < (int)app_beacon_registry__count(); i++)
+    {
+        app_beacon_registry_entry_t *beacon = app_beacon_registry__get(i);
+        if (!beacon->found)
+        {
+            continue;
+        }
+        beacon->lost_check_elapsed_ms += TIME_BEFORE_BEACON_LOST_CHECK_TICK_MS;
+        if (beacon->lost_check_elapsed_ms < beacon->lost_check_wait_ms)
+        {
+            continue;
+        }
+        beacon->lost_check_elapsed_ms = 0;
+        if ((beacon->times_seen - beacon->times_seen_prev == 0) && beacon->times_seen)
+        {
+            beacon->times_seen--;
+            if (beacon->times_seen == 0)
+            {
+                beacon->found = 0;
+                beacons_found_count--;
+                app_beacon__visit_end(beacon, &lost[lost_count++]);
+            }
+            else if (beacon->lost_check_wait_ms >= 750)
+            {
+                beacon->lost_check_wait_ms -= TIME_BEFORE_BEACON_LOST_CHECK_DECREMENT_MS;
+            }
+        }
+        else
+        {
+            beacon->lost_check_wait_ms = TIME_BEFORE_BEACON_LOST_CHECK_INIT_VAL_MS;
+        }
+        beacon->times_seen_prev = beacon->times_seen;
+    }
+    uint8_t lid_must_close = (beacons_found_count == 0);
+    taskEXIT_CRITICAL(&registry_lock);
+
+    app_beacon__log_visits_end(lost, lost_count);
+
+    if (lid_must_close)
+    {
+        ESP_LOGI(TAG, "All beacons lost, closing lid");
+        esp_timer_stop(beacon_check_timer);
+        app_lid__close();
+
+        /* The detection task may have found a beacon, opened the lid and started the timer after the count was
+         * checked above. In that case the lid must be opened again, since it was closed after being opened, and
+         * the timer started again, since it was stopped after being started.
+         */
+        taskENTER_CRITICAL(&registry_lock);
+        uint8_t found_while_closing = (beacons_found_count != 0);
+        taskEXIT_CRITICAL(&registry_lock);
+        if (found_while_closing)
+        {
+            ESP_LOGI(TAG, "Beacon detected while closing lid, opening it again");
+            app_lid__open();
+            esp_timer_start_periodic(beacon_check_timer, TIME_BEFORE_BEACON_LOST_CHECK_TICK_MS * 1000);
+        }
+        else
+        {
+            app_beacon__scan_set_mode(ble_scan_mode_idle);
+        }
+    }
+}
+
+/**
+ * @brief Task to process the advertisement records queued by the GAP callback. The records are drained in
+ * batches of up to ADV_RING_BATCH_SIZE, taking the registry lock once per batch, and the resulting actions
+ * (opening the lid, updating statuses) are performed after the lock is released.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_beacon__detection_task(void *arg)
+{
+    uint32_t adv_ring_dropped_prev = 0;
+
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        uint32_t tail = adv_ring_tail;
+        uint32_t head = __atomic_load_n(&adv_ring_head, __ATOMIC_ACQUIRE);
+        while (tail != head)
+        {
+            uint32_t batch_end = (head - tail > ADV_RING_BATCH_SIZE) ? (tail + ADV_RING_BATCH_SIZE) : head;
+            uint8_t open_lid = 0;
+            uint8_t battery_low_changed = 0;
+            uint8_t sighted = 0;
+            int64_t open_lid_adv_us = 0;
+            const adv_record_t *last_record = NULL;
+            app_beacon_tlm_t last_tlm;
+            uint32_t authorized_count = 0;
+            const adv_record_t *found_records[ADV_RING_BATCH_SIZE];
+            uint8_t found_count = 0;
+
+            taskENTER_CRITICAL(&registry_lock);
+            for (uint32_t i = tail; i != batch_end; i++)
+            {
+                adv_record_t *record = &adv_ring[i & (ADV_RING_SIZE - 1)];
+#if SCAN_FILTER_MAC
+                app_beacon_registry_entry_t *beacon = app_beacon_registry__get(app_beacon_registry__find(record->mac));
+#else
+                app_beacon_registry_entry_t *beacon = app_beacon_registry__get(0);
+#endif // SCAN_FILTER_MAC
+                if (beacon != NULL)
+                {
+                    sighted |= (record->rssi >= min_rssi_for_detection_dbm - SCAN_ACTIVE_RSSI_MARGIN_DB);
+                    if (app_beacon__update_beacon(beacon, record, &open_lid, &battery_low_changed))
+                    {
+                        found_records[found_count++] = record;
+                    }
+                    if (open_lid && !open_lid_adv_us)
+                    {
+                        open_lid_adv_us = record->timestamp_us;
+                    }
+                    last_record = record;
+                    last_tlm = beacon->tlm;
+                    authorized_count++;
+                }
+            }
+            taskEXIT_CRITICAL(&registry_lock);
+
+            if (last_record != NULL)
+            {
+                // before the first TLM frame of the beacon, its TLM fields are all zero
+                app_status__set_beacon_sighting(last_record->rssi, last_tlm.battery_mv,
+                                                last_tlm.battery_mv ? last_tlm.temp_q8 : APP_BEACON_TLM_TEMP_UNSUPPORTED,
+                                                last_record->timestamp_us);
+            }
+            app_status__add_scan_stats(authorized_count, adv_ring_dropped);
+            for (uint8_t i = 0; i < found_count; i++)
+            {
+                app_feed_log__append(app_feed_log_event_visit_start, found_records[i]->mac, found_records[i]->rssi, 0);
+            }
+
+            for (uint32_t i = tail; i != batch_end; i++)
+            {
+                adv_record_t *record = &adv_ring[i & (ADV_RING_SIZE - 1)];
+                ESP_LOGI(TAG, "Device found, MAC: %2.2x:%2.2x:%2.2x:%2.2x:%2.2x:%2.2x, RSSI: %d dBm, queued for %d us",
+                         record->mac[0], record->mac[1], record->mac[2], record->mac[3], record->mac[4], record->mac[5],
+                         record->rssi, (int)(esp_timer_get_time() - record->timestamp_us));
+            }
+
+            tail = batch_end;
+            __atomic_store_n(&adv_ring_tail, tail, __ATOMIC_RELEASE);
+
+            if (sighted)
+            {
+                // an authorized beacon is getting close, scan continuously so that it is detected quickly
+                app_event__signal(scan_sighting_signal);
+            }
+            if (battery_low_changed)
+            {
+                app_status__set_beacon_battery_low_status(beacons_battery_low_count);
+            }
+            if (open_lid)
+            {
+                ESP_LOGI(TAG, "Beacon detected, opening lid");
+                app_lid__open();
+                app_status__increment(app_status_counter_detection);
+                esp_timer_start_periodic(beacon_check_timer, TIME_BEFORE_BEACON_LOST_CHECK_TICK_MS * 1000);
+
+                int64_t open_latency_us = esp_timer_get_time() - open_lid_adv_us;
+                if (open_latency_us > open_latency_max_us)
+                {
+                    open_latency_max_us = open_latency_us;
+                }
+                if (open_latency_us > OPEN_LATENCY_BOUND_MS * 1000)
+                {
+                    ESP_LOGW(TAG, "Lid open latency %d us exceeds bound of %d ms", (int)open_latency_us, OPEN_LATENCY_BOUND_MS);
+                }
+            }
+
+            head = __atomic_load_n(&adv_ring_head, __ATOMIC_ACQUIRE);
+        }
+
+        if (adv_ring_dropped != adv_ring_dropped_prev)
+        {
+            adv_ring_dropped_prev = adv_ring_dropped;
+            ESP_LOGW(TAG, "%d advertisement records dropped so far, ring full", (int)adv_ring_dropped_prev);
+        }
+    }
+    vTaskDelete(NULL);
+}
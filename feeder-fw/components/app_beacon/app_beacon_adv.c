@@ -0,0 +1,168 @@
+/**
+ * @file app_beacon_adv.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the advertising data parser, which walks the AD structures of an advertisement and decodes the
+ * beacon frames it carries: Eddystone-UID, Eddystone-TLM and iBeacon.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#include <string.h>
+
+#include "app_beacon_adv.h"
+
+#define AD_TYPE_SERVICE_DATA_16 (0x16)          ///< AD type of service data with a 16-bit UUID
+#define AD_TYPE_MANUFACTURER_DATA (0xff)        ///< AD type of manufacturer specific data
+#define EDDYSTONE_UUID_LO (0xaa)                ///< Eddystone 16-bit service UUID (0xfeaa), least significant byte
+#define EDDYSTONE_UUID_HI (0xfe)                ///< Eddystone 16-bit service UUID (0xfeaa), most significant byte
+#define EDDYSTONE_FRAME_UID (0x00)              ///< Eddystone-UID frame type
+#define EDDYSTONE_FRAME_TLM (0x20)              ///< Eddystone-TLM frame type
+#define EDDYSTONE_TLM_VERSION_PLAIN (0x00)      ///< Version of the unencrypted Eddystone-TLM frame
+#define EDDYSTONE_UID_LEN (18)                  ///< Length of an Eddystone-UID frame, without the optional reserved bytes
+#define EDDYSTONE_TLM_LEN (14)                  ///< Length of an unencrypted Eddystone-TLM frame
+#define APPLE_COMPANY_ID_LO (0x4c)              ///< Apple company identifier (0x004c), least significant byte
+#define APPLE_COMPANY_ID_HI (0x00)              ///< Apple company identifier (0x004c), most significant byte
+#define IBEACON_TYPE (0x02)                     ///< iBeacon type, after the company identifier
+#define IBEACON_LEN (0x15)                      ///< iBeacon length, after the iBeacon type
+#define IBEACON_DATA_LEN (25)                   ///< Length of the iBeacon manufacturer data, with the company identifier
+
+/* Eddystone (https://github.com/google/eddystone/blob/master/protocol-specification.md) and iBeacon fields are
+ * big-endian, except for the company identifier, which is little-endian like every Bluetooth field.
+ */
+
+/**
+ * @brief Read a big-endian 16-bit field.
+ *
+ * @param data Field bytes.
+ * @return uint16_t Field value.
+ */
+static inline uint16_t app_beacon_adv__be16(const uint8_t *data)
+{
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+/**
+ * @brief Read a big-endian 32-bit field.
+ *
+ * @param data Field bytes.
+ * @return uint32_t Field value.
+ */
+static inline uint32_t app_beacon_adv__be32(const uint8_t *data)
+{
+    return ((uint32_t)app_beacon_adv__be16(data) << 16) | app_beacon_adv__be16(&data[2]);
+}
+
+/**
+ * @brief Decode an Eddystone frame, from the service data after the Eddystone UUID.
+ *
+ * @param data Eddystone frame, starting at its frame type.
+ * @param len Length of the Eddystone frame.
+ * @param frame Decoded frame.
+ * @return uint8_t 1 if the frame is a supported Eddystone frame, 0 otherwise.
+ */
+static uint8_t app_beacon_adv__parse_eddystone(const uint8_t *data, uint8_t len, app_beacon_frame_t *frame)
+{
+    if (data[0] == EDDYSTONE_FRAME_TLM && len >= EDDYSTONE_TLM_LEN && data[1] == EDDYSTONE_TLM_VERSION_PLAIN)
+    {
+        frame->type = app_beacon_frame_eddystone_tlm;
+        frame->tlm.version = data[1];
+        frame->tlm.battery_mv = app_beacon_adv__be16(&data[2]);
+        frame->tlm.temp_q8 = (int16_t)app_beacon_adv__be16(&data[4]);
+        frame->tlm.adv_count = app_beacon_adv__be32(&data[6]);
+        frame->tlm.uptime_ds = app_beacon_adv__be32(&data[10]);
+        return 1;
+    }
+    if (data[0] == EDDYSTONE_FRAME_UID && len >= EDDYSTONE_UID_LEN)
+    {
+        frame->type = app_beacon_frame_eddystone_uid;
+        frame->uid.tx_power = (int8_t)data[1];
+        memcpy(frame->uid.namespace_id, &data[2], sizeof(frame->uid.namespace_id));
+        memcpy(frame->uid.instance_id, &data[12], sizeof(frame->uid.instance_id));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode an iBeacon frame, from the manufacturer specific data.
+ *
+ * @param data Manufacturer specific data, starting at the company identifier.
+ * @param len Length of the manufacturer specific data.
+ * @param frame Decoded frame.
+ * @return uint8_t 1 if the data is an iBeacon frame, 0 otherwise.
+ */
+static uint8_t app_beacon_adv__parse_ibeacon(const uint8_t *data, uint8_t len, app_beacon_frame_t *frame)
+{
+    if (len < IBEACON_DATA_LEN || data[0] != APPLE_COMPANY_ID_LO || data[1] != APPLE_COMPANY_ID_HI ||
+        data[2] != IBEACON_TYPE || data[3] != IBEACON_LEN)
+    {
+        return 0;
+    }
+    frame->type = app_beacon_frame_ibeacon;
+    memcpy(frame->ibeacon.uuid, &data[4], sizeof(frame->ibeacon.uuid));
+    frame->ibeacon.major = app_beacon_adv__be16(&data[20]);
+    frame->ibeacon.minor = app_beacon_adv__be16(&data[22]);
+    frame->ibeacon.tx_power = (int8_t)data[24];
+    return 1;
+}
+
+/**
+ * @brief Parse advertising data: walk its AD structures (length, type, data) and decode the first beacon frame
+ * found. Only the AD type byte of the other structures is read, and a malformed structure ends the walk.
+ *
+ * @param data Advertising data.
+ * @param len Length of the advertising data.
+ * @param frame Decoded frame, with type app_beacon_frame_none if no beacon frame is found.
+ * @return uint8_t 1 if a beacon frame is found, 0 otherwise.
+ */
+uint8_t app_beacon_adv__parse(const uint8_t *data, uint8_t len, app_beacon_frame_t *frame)
+{
+    uint8_t pos = 0;
+
+    frame->type = app_beacon_frame_none;
+    while (pos < len)
+    {
+        uint8_t ad_len = data[pos]; // length of the AD type and data
+        if (ad_len == 0 || ad_len > len - pos - 1)
+        {
+            // zero length marks the end of the significant part, a longer one is truncated
+            break;
+        }
+        const uint8_t *ad_data = &data[pos + 2];
+        uint8_t ad_data_len = ad_len - 1;
+
+        switch (data[pos + 1])
+        {
+        case AD_TYPE_SERVICE_DATA_16:
+            if (ad_data_len > 2 && ad_data[0] == EDDYSTONE_UUID_LO && ad_data[1] == EDDYSTONE_UUID_HI)
+            {
+                return app_beacon_adv__parse_eddystone(&ad_data[2], ad_data_len - 2, frame);
+            }
+            break;
+        case AD_TYPE_MANUFACTURER_DATA:
+            if (app_beacon_adv__parse_ibeacon(ad_data, ad_data_len, frame))
+            {
+                return 1;
+            }
+            break;
+        default:
+            break;
+        }
+        pos += ad_len + 1;
+    }
+    return 0;
+}
@@ -0,0 +1,18 @@
+/**
+ * @file app_beacon_adv.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Private header of the advertising data parser of the app_beacon component.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "app_beacon.h"
+
+uint8_t app_beacon_adv__parse(const uint8_t *data, uint8_t len, app_beacon_frame_t *frame);
@@ -0,0 +1,53 @@
+/**
+ * @file app_beacon_ble.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Private header of the BLE host stack backend of the app_beacon component.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define APP_BEACON_BLE_LATENCY_PROFILE (0) ///< Measure the time from each HCI advertising report to the adv_report handler, see app_beacon_hci.c (0: False, other: True)
+
+/* The BLE scan is run by one of two backends, selected by the host stack enabled in sdkconfig (see CMakeLists.txt):
+ * app_beacon_bluedroid.c (CONFIG_BT_BLUEDROID_ENABLED) or app_beacon_nimble.c (CONFIG_BT_NIMBLE_ENABLED). The scan
+ * parameters, scan start and scan stop requests complete asynchronously, with their event handler run by the BLE
+ * host task, as the Bluedroid GAP API does. MACs are in the order they are printed, most significant byte first.
+ */
+
+/// @brief Typedef for the BLE scan parameters.
+typedef struct
+{
+    uint16_t interval;     ///< Scan interval (0.625 ms units)
+    uint16_t window;       ///< Scan window (0.625 ms units)
+    uint8_t use_whitelist; ///< Report only the advertisements of the MACs in the whitelist (0: False, other: True)
+} app_beacon_ble_scan_params_t;
+
+/// @brief Typedef for the BLE scan event handlers, run by the BLE host task.
+typedef struct
+{
+    void (*scan_params_set)(esp_err_t status);                                                   ///< Scan parameters request completed
+    void (*scan_started)(esp_err_t status);                                                      ///< Scan start request completed
+    void (*scan_stopped)(esp_err_t status);                                                      ///< Scan stop request completed
+    void (*whitelist_failed)(void);                                                              ///< Whitelist update failed after app_beacon_ble__set_whitelist returned
+    void (*adv_report)(const uint8_t mac[6], int8_t rssi, const uint8_t *data, uint8_t data_len); ///< Advertisement received
+} app_beacon_ble_handlers_t;
+
+esp_err_t app_beacon_ble__init(const app_beacon_ble_handlers_t *handlers);
+uint16_t app_beacon_ble__get_whitelist_size(void);
+esp_err_t app_beacon_ble__set_whitelist(const uint8_t (*macs)[6], size_t count);
+esp_err_t app_beacon_ble__set_scan_params(const app_beacon_ble_scan_params_t *params);
+esp_err_t app_beacon_ble__start_scan(void);
+esp_err_t app_beacon_ble__stop_scan(void);
+#if APP_BEACON_BLE_LATENCY_PROFILE
+int64_t app_beacon_hci__take_adv_report_us(const uint8_t mac[6]);
+#endif // APP_BEACON_BLE_LATENCY_PROFILE
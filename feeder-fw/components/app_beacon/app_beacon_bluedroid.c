@@ -0,0 +1,233 @@
+/**
+ * @file app_beacon_bluedroid.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the Bluedroid backend of the BLE scan: brings up the BT controller and Bluedroid, and translates
+ * the Bluedroid GAP events into the app_beacon_ble event handlers.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#include <string.h>
+
+#define LOG_LOCAL_LEVEL ESP_LOG_NONE ///< Defines the log level. See https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/system/log.html for more information
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_bt.h"
+#include "esp_bt_defs.h"
+#include "esp_bt_main.h"
+#include "esp_gap_ble_api.h"
+
+#include "app_beacon_ble.h"
+
+static const char *TAG = "app_beacon_bluedroid";         ///< Tag to be used when logging
+static const app_beacon_ble_handlers_t *handlers = NULL; ///< Event handlers
+static esp_ble_scan_params_t ble_scan_params = {
+    .scan_type = BLE_SCAN_TYPE_PASSIVE,
+    .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+    .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
+    .scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE,
+}; ///< BLE scan parameters
+
+static void app_beacon_bluedroid__gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+
+/**
+ * @brief Bring up the BT controller (BLE only) and Bluedroid, and register the GAP callback.
+ *
+ * @param ble_handlers Event handlers, must stay valid.
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code on failure.
+ */
+esp_err_t app_beacon_ble__init(const app_beacon_ble_handlers_t *ble_handlers)
+{
+    handlers = ble_handlers;
+
+    esp_err_t err = esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error releasing memory: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
+    err = esp_bt_controller_init(&bt_cfg);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error initializing BT controller: %s",
+                 esp_err_to_name(err));
+        return err;
+    }
+
+    err = esp_bt_controller_enable(ESP_BT_MODE_BLE);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error enabling BT controller: %s",
+                 esp_err_to_name(err));
+        return err;
+    }
+
+    err = esp_bluedroid_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error initializing bluedroid: %s",
+                 esp_err_to_name(err));
+        return err;
+    }
+
+    err = esp_bluedroid_enable();
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error enabling bluedroid %s",
+                 esp_err_to_name(err));
+        return err;
+    }
+
+    err = esp_ble_gap_register_callback(app_beacon_bluedroid__gap_cb);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error registering BLE GAP callback: %s",
+                 esp_err_to_name(err));
+    }
+    return err;
+}
+
+/**
+ * @brief Get the number of addresses that fit in the BT controller whitelist.
+ *
+ * @return uint16_t Whitelist size, 0 if it cannot be read.
+ */
+uint16_t app_beacon_ble__get_whitelist_size(void)
+{
+    uint16_t size = 0;
+    esp_err_t err = esp_ble_gap_get_whitelist_size(&size);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Error getting whitelist size: %s", esp_err_to_name(err));
+        size = 0;
+    }
+    return size;
+}
+
+/**
+ * @brief Replace the whitelist. Each MAC takes two entries, as a public and as a random static address. The updates
+ * are queued, a failure reported by the BT controller afterwards calls the whitelist_failed handler.
+ *
+ * @param macs MACs.
+ * @param count Number of MACs.
+ * @return esp_err_t
+ * @retval ESP_OK if the updates are queued.
+ * @retval Error code otherwise.
+ */
+esp_err_t app_beacon_ble__set_whitelist(const uint8_t (*macs)[6], size_t count)
+{
+    esp_err_t err = esp_ble_gap_clear_whitelist();
+
+    for (size_t i = 0; (i < count) && (err == ESP_OK); i++)
+    {
+        uint8_t mac[6];
+        memcpy(mac, macs[i], sizeof(mac));
+        err = esp_ble_gap_update_whitelist(true, mac, BLE_WL_ADDR_TYPE_PUBLIC);
+        if (err == ESP_OK)
+        {
+            err = esp_ble_gap_update_whitelist(true, mac, BLE_WL_ADDR_TYPE_RANDOM);
+        }
+    }
+    return err;
+}
+
+/**
+ * @brief Set the scan parameters, the scan_params_set handler is called when they are set.
+ *
+ * @param params Scan parameters.
+ * @return esp_err_t
+ * @retval ESP_OK if the request is queued.
+ * @retval Error code otherwise.
+ */
+esp_err_t app_beacon_ble__set_scan_params(const app_beacon_ble_scan_params_t *params)
+{
+    ble_scan_params.scan_interval = params->interval;
+    ble_scan_params.scan_window = params->window;
+    ble_scan_params.scan_filter_policy = params->use_whitelist ? BLE_SCAN_FILTER_ALLOW_ONLY_WLST : BLE_SCAN_FILTER_ALLOW_ALL;
+    return esp_ble_gap_set_scan_params(&ble_scan_params);
+}
+
+/**
+ * @brief Start scanning with the last parameters set, the scan_started handler is called when it started.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK if the request is queued.
+ * @retval Error code otherwise.
+ */
+esp_err_t app_beacon_ble__start_scan(void)
+{
+    return esp_ble_gap_start_scanning(0);
+}
+
+/**
+ * @brief Stop scanning, the scan_stopped handler is called when it stopped.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK if the request is queued.
+ * @retval Error code otherwise.
+ */
+esp_err_t app_beacon_ble__stop_scan(void)
+{
+    return esp_ble_gap_stop_scanning();
+}
+
+/**
+ * @brief BLE GAP event handler, run by the Bluedroid (BTC) task.
+ *
+ * @param event Tell which event happened.
+ * @param param Pointer to union with other event data.
+ */
+static void app_beacon_bluedroid__gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+    switch (event)
+    {
+    case ESP_GAP_BLE_SCAN_RESULT_EVT:
+        if (param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT)
+        {
+            handlers->adv_report(param->scan_rst.bda, (int8_t)param->scan_rst.rssi, param->scan_rst.ble_adv,
+                                 param->scan_rst.adv_data_len);
+        }
+        break;
+    case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+        handlers->scan_params_set((param->scan_param_cmpl.status == ESP_BT_STATUS_SUCCESS) ? ESP_OK : ESP_FAIL);
+        break;
+    case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+        handlers->scan_started((param->scan_start_cmpl.status == ESP_BT_STATUS_SUCCESS) ? ESP_OK : ESP_FAIL);
+        break;
+    case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+        handlers->scan_stopped((param->scan_stop_cmpl.status == ESP_BT_STATUS_SUCCESS) ? ESP_OK : ESP_FAIL);
+        break;
+    case ESP_GAP_BLE_UPDATE_WHITELIST_COMPLETE_EVT:
+        if (param->update_whitelist_cmpl.status != ESP_BT_STATUS_SUCCESS)
+        {
+            ESP_LOGE(TAG, "Whitelist update failed, status %d", (int)param->update_whitelist_cmpl.status);
+            handlers->whitelist_failed();
+        }
+        break;
+    default:
+        break;
+    }
+}
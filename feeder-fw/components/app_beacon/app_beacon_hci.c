@@ -0,0 +1,166 @@
+/**
+ * @file app_beacon_hci.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the timestamping of the HCI advertising reports, for the measurement of the time the BLE host stack
+ * takes to deliver each advertisement to the adv_report handler (see APP_BEACON_BLE_LATENCY_PROFILE).
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#include <string.h>
+
+#include "esp_bt.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#include "app_beacon_ble.h"
+
+#define HCI_H4_TYPE_EVENT (0x04)          ///< H4 packet type of the HCI events
+#define HCI_EVENT_LE_META (0x3E)          ///< HCI LE Meta event code
+#define HCI_LE_SUBEVENT_ADV_REPORT (0x02) ///< HCI LE Advertising Report subevent code
+#define HCI_ADV_REPORTS_OFFSET (5)        ///< Offset of the first report in an H4 HCI LE Advertising Report packet
+#define HCI_ADV_REPORT_HEADER_LEN (9)     ///< Length of a report up to its data: event type, address type, address and data length
+#define ADV_REPORT_STAMPS_SIZE (8)        ///< Number of advertising reports whose arrival time is kept, covers the reports queued in the BLE host stack
+
+/* Bluedroid and NimBLE both receive the HCI packets from the ESP32 BT controller through the VHCI callback they
+ * register with esp_vhci_host_register_callback. The component is linked with --wrap for it (see CMakeLists.txt), so
+ * the callback registered is a shim that, when APP_BEACON_BLE_LATENCY_PROFILE is enabled, stamps the arrival time of
+ * each advertising report before passing the packet on to the host stack. The adv_report handler looks the stamp up
+ * by MAC, so the latency measured is the same for both backends: HCI event in, through the host stack, handler in.
+ */
+
+/// @brief Typedef to store the arrival time of an advertising report.
+typedef struct
+{
+    uint8_t mac[6];      ///< Advertiser's MAC address, most significant byte first
+    int64_t received_us; ///< Arrival time of the HCI event (us since boot), 0 if the stamp was taken
+} adv_report_stamp_t;
+
+esp_err_t __real_esp_vhci_host_register_callback(const esp_vhci_host_callback_t *callback);
+
+#if APP_BEACON_BLE_LATENCY_PROFILE
+static const esp_vhci_host_callback_t *host_callback = NULL;               ///< VHCI callbacks registered by the BLE host stack
+static adv_report_stamp_t adv_report_stamps[ADV_REPORT_STAMPS_SIZE];       ///< Arrival times of the last advertising reports
+static uint8_t adv_report_stamps_next = 0;                                 ///< Index of the next stamp to be written
+static portMUX_TYPE adv_report_stamps_lock = portMUX_INITIALIZER_UNLOCKED; ///< Lock protecting adv_report_stamps
+
+/**
+ * @brief Stamp the arrival time of the reports of an HCI LE Advertising Report event. Runs in the BT controller task.
+ *
+ * @param data H4 packet.
+ * @param len Packet length.
+ */
+static void app_beacon_hci__stamp_adv_reports(const uint8_t *data, uint16_t len)
+{
+    if (len <= HCI_ADV_REPORTS_OFFSET || data[0] != HCI_H4_TYPE_EVENT || data[1] != HCI_EVENT_LE_META ||
+        data[3] != HCI_LE_SUBEVENT_ADV_REPORT)
+    {
+        return;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    uint8_t reports = data[4];
+    uint16_t offset = HCI_ADV_REPORTS_OFFSET;
+    taskENTER_CRITICAL(&adv_report_stamps_lock);
+    for (uint8_t i = 0; (i < reports) && (offset + HCI_ADV_REPORT_HEADER_LEN <= len); i++)
+    {
+        adv_report_stamp_t *stamp = &adv_report_stamps[adv_report_stamps_next];
+        // the address is sent least significant byte first
+        for (uint8_t j = 0; j < 6; j++)
+        {
+            stamp->mac[j] = data[offset + 2 + 5 - j];
+        }
+        stamp->received_us = now_us;
+        adv_report_stamps_next = (adv_report_stamps_next + 1) % ADV_REPORT_STAMPS_SIZE;
+        // data and RSSI
+        offset += HCI_ADV_REPORT_HEADER_LEN + data[offset + 8] + 1;
+    }
+    taskEXIT_CRITICAL(&adv_report_stamps_lock);
+}
+
+/**
+ * @brief Take the arrival time of the last HCI advertising report of a MAC, so that each report is counted once.
+ *
+ * @param mac Advertiser's MAC address.
+ * @return int64_t Arrival time of the report (us since boot), 0 if none is kept.
+ */
+int64_t app_beacon_hci__take_adv_report_us(const uint8_t mac[6])
+{
+    int64_t received_us = 0;
+
+    taskENTER_CRITICAL(&adv_report_stamps_lock);
+    for (uint8_t i = 1; i <= ADV_REPORT_STAMPS_SIZE; i++)
+    {
+        // newest first
+        adv_report_stamp_t *stamp = &adv_report_stamps[(adv_report_stamps_next + ADV_REPORT_STAMPS_SIZE - i) % ADV_REPORT_STAMPS_SIZE];
+        if (stamp->received_us != 0 && memcmp(stamp->mac, mac, 6) == 0)
+        {
+            received_us = stamp->received_us;
+            stamp->received_us = 0;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&adv_report_stamps_lock);
+    return received_us;
+}
+
+/**
+ * @brief VHCI callback of the packets sent by the BT controller to the host, run in the BT controller task.
+ *
+ * @param data H4 packet.
+ * @param len Packet length.
+ * @return int Return of the BLE host stack callback.
+ */
+static int app_beacon_hci__host_recv(uint8_t *data, uint16_t len)
+{
+    app_beacon_hci__stamp_adv_reports(data, len);
+    return host_callback->notify_host_recv(data, len);
+}
+
+/**
+ * @brief VHCI callback of the controller being ready to receive a packet, run in the BT controller task.
+ *
+ */
+static void app_beacon_hci__host_send_available(void)
+{
+    host_callback->notify_host_send_available();
+}
+
+/// @brief VHCI callbacks registered in place of the ones of the BLE host stack.
+static const esp_vhci_host_callback_t shim_callback = {
+    .notify_host_send_available = app_beacon_hci__host_send_available,
+    .notify_host_recv = app_beacon_hci__host_recv,
+};
+#endif // APP_BEACON_BLE_LATENCY_PROFILE
+
+/**
+ * @brief Called by the BLE host stack in place of esp_vhci_host_register_callback (linked with --wrap). If
+ * APP_BEACON_BLE_LATENCY_PROFILE is enabled, registers the shim callbacks, which pass the packets on to the ones of
+ * the host stack, otherwise the ones of the host stack.
+ *
+ * @param callback VHCI callbacks of the BLE host stack, must stay valid.
+ * @return esp_err_t Return of esp_vhci_host_register_callback.
+ */
+esp_err_t __wrap_esp_vhci_host_register_callback(const esp_vhci_host_callback_t *callback)
+{
+#if APP_BEACON_BLE_LATENCY_PROFILE
+    host_callback = callback;
+    return __real_esp_vhci_host_register_callback(&shim_callback);
+#else
+    return __real_esp_vhci_host_register_callback(callback);
+#endif // APP_BEACON_BLE_LATENCY_PROFILE
+}
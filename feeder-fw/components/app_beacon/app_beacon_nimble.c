@@ -0,0 +1,359 @@
+/**
+ * @file app_beacon_nimble.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the NimBLE backend of the BLE scan: brings up the BT controller and the NimBLE host, and translates
+ * the NimBLE GAP discovery into the app_beacon_ble event handlers.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#define LOG_LOCAL_LEVEL ESP_LOG_NONE ///< Defines the log level. See https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/system/log.html for more information
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_bt.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "host/ble_hs.h"
+#include "nimble/hci_common.h"
+
+#include "app_beacon_ble.h"
+
+#define NIMBLE_SYNC_TIMEOUT_MS (2000)  ///< Maximum time waited for the NimBLE host to sync with the BT controller (ms)
+#define NIMBLE_WHITELIST_SIZE_MAX (32) ///< Maximum whitelist size used, bounds the addresses passed to ble_gap_wl_set
+
+/* Unlike Bluedroid, NimBLE sets the scan parameters when the discovery starts, and starts and cancels the discovery
+ * synchronously. To keep the behavior of the Bluedroid backend (completion handlers run by the BLE host task, after
+ * the request returned), the completions are posted to the NimBLE host task as events. NimBLE stores addresses least
+ * significant byte first, so they are reversed on the way in and out.
+ *
+ * NimBLE has no API to read the whitelist size, which Bluedroid reads from the controller at startup with the HCI LE
+ * Read Filter Accept List Size command. The same command is sent here with ble_hs_hci_cmd_tx, the function NimBLE
+ * itself uses to send HCI commands, which is not in its public headers.
+ */
+
+int ble_hs_hci_cmd_tx(uint16_t opcode, const void *cmd, uint8_t cmd_len, void *rsp, uint8_t rsp_len);
+
+static const char *TAG = "app_beacon_nimble";            ///< Tag to be used when logging
+static const app_beacon_ble_handlers_t *handlers = NULL; ///< Event handlers
+static SemaphoreHandle_t sync_sem = NULL;                ///< Given when the NimBLE host is synced with the BT controller
+static struct ble_gap_disc_params disc_params = {
+    .passive = 1,
+    .filter_duplicates = 0,
+}; ///< Discovery (scan) parameters
+static uint8_t scanning = 0;                             ///< Flag that indicates that the discovery is running, or was running when the host was reset
+static struct ble_npl_event scan_params_set_event;       ///< Event posting the completion of the scan parameters request
+static struct ble_npl_event scan_started_event;          ///< Event posting the completion of the scan start request
+static struct ble_npl_event scan_stopped_event;          ///< Event posting the completion of the scan stop request
+static esp_err_t scan_started_status = ESP_OK;           ///< Status of the last scan start request
+static esp_err_t scan_stopped_status = ESP_OK;           ///< Status of the last scan stop request
+static uint16_t whitelist_size = 0;                      ///< Number of addresses that fit in the BT controller whitelist, read at init, 0 if it cannot be read
+
+static int app_beacon_nimble__gap_event(struct ble_gap_event *event, void *arg);
+
+/**
+ * @brief Copy a MAC, reversing its byte order (printed order from/to NimBLE order).
+ *
+ * @param dst Destination.
+ * @param src Source.
+ */
+static void app_beacon_nimble__reverse_mac(uint8_t dst[6], const uint8_t src[6])
+{
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        dst[i] = src[5 - i];
+    }
+}
+
+/**
+ * @brief Start the discovery with disc_params.
+ *
+ * @return int 0 on success, NimBLE error code otherwise.
+ */
+static int app_beacon_nimble__disc_start(void)
+{
+    return ble_gap_disc(BLE_OWN_ADDR_PUBLIC, BLE_HS_FOREVER, &disc_params, app_beacon_nimble__gap_event, NULL);
+}
+
+/**
+ * @brief Event run by the NimBLE host task after a scan parameters request.
+ *
+ * @param ev Event.
+ */
+static void app_beacon_nimble__scan_params_set_event(struct ble_npl_event *ev)
+{
+    handlers->scan_params_set(ESP_OK);
+}
+
+/**
+ * @brief Event run by the NimBLE host task after a scan start request.
+ *
+ * @param ev Event.
+ */
+static void app_beacon_nimble__scan_started_event(struct ble_npl_event *ev)
+{
+    handlers->scan_started(scan_started_status);
+}
+
+/**
+ * @brief Event run by the NimBLE host task after a scan stop request.
+ *
+ * @param ev Event.
+ */
+static void app_beacon_nimble__scan_stopped_event(struct ble_npl_event *ev)
+{
+    handlers->scan_stopped(scan_stopped_status);
+}
+
+/**
+ * @brief Called by the NimBLE host once it is synced with the BT controller, at startup and after a reset. A
+ * discovery that was stopped by the reset is started again.
+ *
+ */
+static void app_beacon_nimble__sync_cb(void)
+{
+    if (scanning)
+    {
+        int rc = app_beacon_nimble__disc_start();
+        if (rc != 0)
+        {
+            ESP_LOGE(TAG, "Error %d restarting discovery after host reset", rc);
+            scanning = 0;
+        }
+    }
+    xSemaphoreGive(sync_sem);
+}
+
+/**
+ * @brief Called by the NimBLE host when it resets, e.g. after a BT controller error.
+ *
+ * @param reason Reset reason.
+ */
+static void app_beacon_nimble__reset_cb(int reason)
+{
+    ESP_LOGE(TAG, "NimBLE host reset, reason %d", reason);
+}
+
+/**
+ * @brief NimBLE host task, returns when nimble_port_stop is called.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_beacon_nimble__host_task(void *arg)
+{
+    nimble_port_run();
+    nimble_port_freertos_deinit();
+}
+
+/**
+ * @brief Bring up the BT controller (BLE only) and the NimBLE host, and wait for them to sync.
+ *
+ * @param ble_handlers Event handlers, must stay valid.
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval ESP_ERR_TIMEOUT if the host does not sync within NIMBLE_SYNC_TIMEOUT_MS.
+ * @retval Error code on failure.
+ */
+esp_err_t app_beacon_ble__init(const app_beacon_ble_handlers_t *ble_handlers)
+{
+    handlers = ble_handlers;
+    sync_sem = xSemaphoreCreateBinary();
+    if (sync_sem == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error releasing memory: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    // also initializes and enables the BT controller
+    err = nimble_port_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error initializing NimBLE: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    ble_npl_event_init(&scan_params_set_event, app_beacon_nimble__scan_params_set_event, NULL);
+    ble_npl_event_init(&scan_started_event, app_beacon_nimble__scan_started_event, NULL);
+    ble_npl_event_init(&scan_stopped_event, app_beacon_nimble__scan_stopped_event, NULL);
+    ble_hs_cfg.sync_cb = app_beacon_nimble__sync_cb;
+    ble_hs_cfg.reset_cb = app_beacon_nimble__reset_cb;
+    nimble_port_freertos_init(app_beacon_nimble__host_task);
+
+    if (xSemaphoreTake(sync_sem, NIMBLE_SYNC_TIMEOUT_MS / portTICK_PERIOD_MS) != pdTRUE)
+    {
+        ESP_LOGE(TAG, "NimBLE host did not sync with the BT controller");
+        return ESP_ERR_TIMEOUT;
+    }
+
+    struct ble_hci_le_rd_white_list_rp rsp;
+    int rc = ble_hs_hci_cmd_tx(BLE_HCI_OP(BLE_HCI_OGF_LE, BLE_HCI_OCF_LE_RD_WHITE_LIST_SIZE), NULL, 0, &rsp, sizeof(rsp));
+    if (rc != 0)
+    {
+        // the scan is filtered in software
+        ESP_LOGW(TAG, "Error %d reading whitelist size", rc);
+    }
+    else
+    {
+        whitelist_size = (rsp.size < NIMBLE_WHITELIST_SIZE_MAX) ? rsp.size : NIMBLE_WHITELIST_SIZE_MAX;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the number of addresses that fit in the BT controller whitelist.
+ *
+ * @return uint16_t Whitelist size, 0 if it cannot be read.
+ */
+uint16_t app_beacon_ble__get_whitelist_size(void)
+{
+    return whitelist_size;
+}
+
+/**
+ * @brief Replace the whitelist. Each MAC takes two entries, as a public and as a random static address. NimBLE
+ * cannot set an empty whitelist, so without MACs the previous one is kept: the MACs in it are no longer in the
+ * registry, and their advertisements are dropped by the MAC filter.
+ *
+ * @param macs MACs.
+ * @param count Number of MACs.
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval ESP_ERR_INVALID_SIZE if the MACs do not fit in the whitelist.
+ * @retval ESP_FAIL if the BT controller rejected the whitelist.
+ */
+esp_err_t app_beacon_ble__set_whitelist(const uint8_t (*macs)[6], size_t count)
+{
+    ble_addr_t addrs[NIMBLE_WHITELIST_SIZE_MAX];
+
+    if (count == 0)
+    {
+        return ESP_OK;
+    }
+    if (2 * count > whitelist_size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        addrs[2 * i].type = BLE_ADDR_PUBLIC;
+        app_beacon_nimble__reverse_mac(addrs[2 * i].val, macs[i]);
+        addrs[2 * i + 1].type = BLE_ADDR_RANDOM;
+        app_beacon_nimble__reverse_mac(addrs[2 * i + 1].val, macs[i]);
+    }
+
+    int rc = ble_gap_wl_set(addrs, (uint8_t)(2 * count));
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "Error %d setting whitelist", rc);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Set the scan parameters, used by the next scan start. The scan_params_set handler is called by the NimBLE
+ * host task.
+ *
+ * @param params Scan parameters.
+ * @return esp_err_t
+ * @retval ESP_OK always.
+ */
+esp_err_t app_beacon_ble__set_scan_params(const app_beacon_ble_scan_params_t *params)
+{
+    disc_params.itvl = params->interval;
+    disc_params.window = params->window;
+    disc_params.filter_policy = params->use_whitelist ? BLE_HCI_SCAN_FILT_USE_WL : BLE_HCI_SCAN_FILT_NO_WL;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &scan_params_set_event);
+    return ESP_OK;
+}
+
+/**
+ * @brief Start the discovery with the last parameters set. The scan_started handler is called by the NimBLE host
+ * task, with the result.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK always.
+ */
+esp_err_t app_beacon_ble__start_scan(void)
+{
+    int rc = app_beacon_nimble__disc_start();
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "Error %d starting discovery", rc);
+    }
+    scanning = (rc == 0);
+    scan_started_status = (rc == 0) ? ESP_OK : ESP_FAIL;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &scan_started_event);
+    return ESP_OK;
+}
+
+/**
+ * @brief Stop the discovery. The scan_stopped handler is called by the NimBLE host task, with the result.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK always.
+ */
+esp_err_t app_beacon_ble__stop_scan(void)
+{
+    int rc = ble_gap_disc_cancel();
+    if (rc != 0 && rc != BLE_HS_EALREADY)
+    {
+        ESP_LOGE(TAG, "Error %d stopping discovery", rc);
+    }
+    else
+    {
+        scanning = 0;
+    }
+    scan_stopped_status = scanning ? ESP_FAIL : ESP_OK;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &scan_stopped_event);
+    return ESP_OK;
+}
+
+/**
+ * @brief NimBLE GAP event handler of the discovery, run by the NimBLE host task.
+ *
+ * @param event GAP event.
+ * @param arg Optional argument (not being used).
+ * @return int Always 0.
+ */
+static int app_beacon_nimble__gap_event(struct ble_gap_event *event, void *arg)
+{
+    switch (event->type)
+    {
+    case BLE_GAP_EVENT_DISC:
+    {
+        uint8_t mac[6];
+        app_beacon_nimble__reverse_mac(mac, event->disc.addr.val);
+        handlers->adv_report(mac, event->disc.rssi, event->disc.data, event->disc.length_data);
+        break;
+    }
+    case BLE_GAP_EVENT_DISC_COMPLETE:
+        // the discovery runs forever, so it only completes if the host is reset, and is restarted once it syncs
+        ESP_LOGW(TAG, "Discovery complete, reason %d", event->disc_complete.reason);
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
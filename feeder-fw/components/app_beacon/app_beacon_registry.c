@@ -0,0 +1,233 @@
+/**
+ * @file app_beacon_registry.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the registry of authorized beacons, indexed by MAC address.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#include <string.h>
+
+#include "app_beacon_registry.h"
+
+#define REGISTRY_TABLE_MASK (APP_BEACON_REGISTRY_TABLE_SIZE - 1) ///< Mask used to wrap hash table indexes
+#define REGISTRY_HASH_MULTIPLIER (0x9e3779b97f4a7c15ULL)         ///< Multiplier for Fibonacci hashing of the MAC address key
+
+#if (APP_BEACON_REGISTRY_TABLE_SIZE & REGISTRY_TABLE_MASK) != 0
+#error "APP_BEACON_REGISTRY_TABLE_SIZE must be a power of 2"
+#endif
+
+/* The registry is an open addressing hash table (linear probing) of 48-bit MAC keys. The keys are stored in
+ * the table itself, so that rejecting an unknown MAC address costs one hash and, typically, a single compare
+ * against an empty slot. The beacons' state is kept in a dense array, so that it can be iterated cheaply.
+ * A key equal to zero marks an empty slot, which is why the 00:00:00:00:00:00 MAC address is not accepted.
+ */
+static uint64_t slot_keys[APP_BEACON_REGISTRY_TABLE_SIZE] = {0};                 ///< MAC address keys stored in each hash table slot
+static uint8_t slot_entries[APP_BEACON_REGISTRY_TABLE_SIZE] = {0};               ///< Index in entries array of the beacon stored in each hash table slot
+static app_beacon_registry_entry_t entries[APP_BEACON_REGISTRY_MAX_ENTRIES] = {0}; ///< Authorized beacons
+static size_t entries_count = 0;                                                 ///< Number of authorized beacons
+
+/**
+ * @brief Pack MAC address into an integer key.
+ *
+ * @param mac_addr 6 bytes array with MAC address.
+ * @return uint64_t Key with the MAC address in its 48 least significant bits.
+ */
+static inline uint64_t app_beacon_registry__mac_to_key(const uint8_t mac_addr[6])
+{
+    return ((uint64_t)mac_addr[0] << 40) | ((uint64_t)mac_addr[1] << 32) | ((uint64_t)mac_addr[2] << 24) |
+           ((uint64_t)mac_addr[3] << 16) | ((uint64_t)mac_addr[4] << 8) | (uint64_t)mac_addr[5];
+}
+
+/**
+ * @brief Get the hash table slot where the search for a key starts.
+ *
+ * @param key MAC address key.
+ * @return uint32_t Hash table slot index.
+ */
+static inline uint32_t app_beacon_registry__home_slot(uint64_t key)
+{
+    return (uint32_t)((key * REGISTRY_HASH_MULTIPLIER) >> 32) & REGISTRY_TABLE_MASK;
+}
+
+/**
+ * @brief Get the hash table slot holding a key.
+ *
+ * @param key MAC address key.
+ * @return int Hash table slot index, or APP_BEACON_REGISTRY_NOT_FOUND if key is not in the table.
+ */
+static int app_beacon_registry__find_slot(uint64_t key)
+{
+    uint32_t slot = app_beacon_registry__home_slot(key);
+    while (slot_keys[slot] != 0)
+    {
+        if (slot_keys[slot] == key)
+        {
+            return (int)slot;
+        }
+        slot = (slot + 1) & REGISTRY_TABLE_MASK;
+    }
+    return APP_BEACON_REGISTRY_NOT_FOUND;
+}
+
+/**
+ * @brief Remove all beacons from the registry.
+ *
+ */
+void app_beacon_registry__clear(void)
+{
+    memset(slot_keys, 0, sizeof(slot_keys));
+    memset(slot_entries, 0, sizeof(slot_entries));
+    memset(entries, 0, sizeof(entries));
+    entries_count = 0;
+}
+
+/**
+ * @brief Add beacon to the registry. Adding a beacon that is already registered does nothing.
+ *
+ * @param mac_addr 6 bytes array with beacon's MAC address.
+ * @return esp_err_t
+ * @retval ESP_OK if beacon is added or is already in the registry.
+ * @retval ESP_ERR_INVALID_ARG if MAC address is 00:00:00:00:00:00.
+ * @retval ESP_ERR_NO_MEM if registry is full.
+ */
+esp_err_t app_beacon_registry__add(const uint8_t mac_addr[6])
+{
+    uint64_t key = app_beacon_registry__mac_to_key(mac_addr);
+
+    if (key == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (app_beacon_registry__find_slot(key) != APP_BEACON_REGISTRY_NOT_FOUND)
+    {
+        return ESP_OK;
+    }
+    if (entries_count == APP_BEACON_REGISTRY_MAX_ENTRIES)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint32_t slot = app_beacon_registry__home_slot(key);
+    while (slot_keys[slot] != 0)
+    {
+        slot = (slot + 1) & REGISTRY_TABLE_MASK;
+    }
+
+    memset(&entries[entries_count], 0, sizeof(entries[entries_count]));
+    memcpy(entries[entries_count].auth_mac, mac_addr, sizeof(entries[entries_count].auth_mac));
+    slot_entries[slot] = (uint8_t)entries_count;
+    slot_keys[slot] = key;
+    entries_count++;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Remove beacon from the registry.
+ *
+ * Both the hash table and the entries array are kept compact: the hash table with backward shift deletion
+ * and the entries array by moving its last element to the position of the removed one.
+ *
+ * @param mac_addr 6 bytes array with beacon's MAC address.
+ * @return esp_err_t
+ * @retval ESP_OK if beacon is removed.
+ * @retval ESP_ERR_NOT_FOUND if beacon is not in the registry.
+ */
+esp_err_t app_beacon_registry__remove(const uint8_t mac_addr[6])
+{
+    int found_slot = app_beacon_registry__find_slot(app_beacon_registry__mac_to_key(mac_addr));
+
+    if (found_slot == APP_BEACON_REGISTRY_NOT_FOUND)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t slot = (uint32_t)found_slot;
+    uint8_t removed_entry = slot_entries[slot];
+
+    // backward shift deletion, so that no tombstones are needed and lookups stay short
+    uint32_t next = (slot + 1) & REGISTRY_TABLE_MASK;
+    while (slot_keys[next] != 0)
+    {
+        uint32_t home = app_beacon_registry__home_slot(slot_keys[next]);
+        if (((next - home) & REGISTRY_TABLE_MASK) >= ((next - slot) & REGISTRY_TABLE_MASK))
+        {
+            slot_keys[slot] = slot_keys[next];
+            slot_entries[slot] = slot_entries[next];
+            slot = next;
+        }
+        next = (next + 1) & REGISTRY_TABLE_MASK;
+    }
+    slot_keys[slot] = 0;
+    slot_entries[slot] = 0;
+
+    // move last entry to the position of the removed one
+    entries_count--;
+    if (removed_entry != entries_count)
+    {
+        entries[removed_entry] = entries[entries_count];
+        int moved_slot = app_beacon_registry__find_slot(app_beacon_registry__mac_to_key(entries[removed_entry].auth_mac));
+        slot_entries[moved_slot] = removed_entry;
+    }
+    memset(&entries[entries_count], 0, sizeof(entries[entries_count]));
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Look up beacon in the registry.
+ *
+ * @param mac_addr 6 bytes array with MAC address.
+ * @return int Index of the beacon (to be used with app_beacon_registry__get), or APP_BEACON_REGISTRY_NOT_FOUND
+ * if MAC address is not authorized.
+ */
+int app_beacon_registry__find(const uint8_t mac_addr[6])
+{
+    int slot = app_beacon_registry__find_slot(app_beacon_registry__mac_to_key(mac_addr));
+    if (slot == APP_BEACON_REGISTRY_NOT_FOUND)
+    {
+        return APP_BEACON_REGISTRY_NOT_FOUND;
+    }
+    return slot_entries[slot];
+}
+
+/**
+ * @brief Get number of beacons in the registry.
+ *
+ * @return size_t Number of beacons.
+ */
+size_t app_beacon_registry__count(void)
+{
+    return entries_count;
+}
+
+/**
+ * @brief Get beacon by its index. Indexes go from 0 to app_beacon_registry__count() - 1 and may change
+ * when a beacon is removed.
+ *
+ * @param index Beacon index.
+ * @return app_beacon_registry_entry_t* Pointer to beacon, or NULL if index is out of range.
+ */
+app_beacon_registry_entry_t *app_beacon_registry__get(int index)
+{
+    if (index < 0 || (size_t)index >= entries_count)
+    {
+        return NULL;
+    }
+    return &entries[index];
+}
@@ -0,0 +1,51 @@
+/**
+ * @file app_beacon_registry.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Private header of the authorized beacons registry of the app_beacon component.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#include "app_beacon.h"
+#include "app_beacon_rssi_filter.h"
+
+#define APP_BEACON_REGISTRY_MAX_ENTRIES (32)                                ///< Maximum number of authorized beacons
+#define APP_BEACON_REGISTRY_TABLE_SIZE (2 * APP_BEACON_REGISTRY_MAX_ENTRIES) ///< Hash table size (power of 2, load factor always <= 0.5)
+#define APP_BEACON_REGISTRY_NOT_FOUND (-1)                                  ///< Returned by lookups when the MAC is not in the registry
+
+/// @brief Typedef to store information about an authorized beacon.
+typedef struct
+{
+    uint8_t auth_mac[6];                                                    ///< Authorized MAC address (beacon's MAC address).
+    uint8_t found;                                                          ///< Flag that indicates if the beacon has been detected. Set to true (1) when the beacon's advertisement is scanned multiple times in a short period of time.
+    uint8_t battery_low;                                                    ///< Flag that indicates if the beacon reported a low battery level in its last advertisement.
+    uint16_t times_seen;                                                    ///< Number of times that the beacon has been seen in a short period of time.
+    uint16_t times_seen_prev;                                               ///< Value of times_seen at the beginning of the current beacon lost check period.
+    uint16_t lost_check_wait_ms;                                            ///< Length of the current beacon lost check period (ms).
+    uint16_t lost_check_elapsed_ms;                                         ///< Time elapsed in the current beacon lost check period (ms).
+    int64_t found_at_us;                                                    ///< Time when the beacon was detected (us since boot).
+    app_beacon_rssi_filter_t rssi_filter;                                   ///< RSSI filter
+    app_beacon_tlm_t tlm;                                                   ///< Last Eddystone-TLM frame, all zero until the first one
+    app_beacon_uid_t uid;                                                   ///< Last Eddystone-UID frame, all zero until the first one
+    app_beacon_ibeacon_t ibeacon;                                           ///< Last iBeacon frame, all zero until the first one
+    app_beacon_sighting_t history[APP_BEACON_HISTORY_LEN];                  ///< Last sightings, ring buffer
+    uint8_t history_index;                                                  ///< Index of the next sighting of the history
+    uint8_t history_count;                                                  ///< Number of sightings in the history
+} app_beacon_registry_entry_t;
+
+void app_beacon_registry__clear(void);
+esp_err_t app_beacon_registry__add(const uint8_t mac_addr[6]);
+esp_err_t app_beacon_registry__remove(const uint8_t mac_addr[6]);
+int app_beacon_registry__find(const uint8_t mac_addr[6]);
+size_t app_beacon_registry__count(void);
+app_beacon_registry_entry_t *app_beacon_registry__get(int index);
@@ -0,0 +1,187 @@
+/**
+ * @file app_beacon_rssi_filter.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the per-beacon RSSI filters. Only integer (fixed-point) arithmetic is used, and the cost of
+ * a sample does not depend on the window length, except for the median filter.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#include <string.h>
+
+#include "app_beacon_rssi_filter.h"
+
+#if (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_RUNNING_SUM) || (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_MEDIAN)
+#define RSSI_FILTER_SAMPLES_FOR_OUTPUT (APP_BEACON_RSSI_FILTER_WINDOW) ///< Number of samples before the filter has an output
+#else
+#define RSSI_FILTER_SAMPLES_FOR_OUTPUT (1) ///< Number of samples before the filter has an output
+#endif
+
+/**
+ * @brief Reset filter, discarding all its samples.
+ *
+ * @param filter Filter to be reset.
+ */
+void app_beacon_rssi_filter__reset(app_beacon_rssi_filter_t *filter)
+{
+    memset(filter, 0, sizeof(*filter));
+}
+
+#if (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_RUNNING_SUM)
+/**
+ * @brief Add sample to the running sum, replacing the oldest sample of the window.
+ *
+ * @param filter Filter.
+ * @param rssi New sample (dBm).
+ * @return int32_t Average of the window samples (dBm, Q8). Only meaningful once the window is full.
+ */
+static int32_t app_beacon_rssi_filter__add_sample(app_beacon_rssi_filter_t *filter, int8_t rssi)
+{
+    filter->sum += rssi - filter->samples[filter->index];
+    filter->samples[filter->index] = rssi;
+    return APP_BEACON_RSSI_FILTER_Q8(filter->sum) / APP_BEACON_RSSI_FILTER_WINDOW;
+}
+#elif (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_EWMA)
+/**
+ * @brief Add sample to the exponentially weighted moving average. The first sample initializes the average.
+ *
+ * @param filter Filter.
+ * @param rssi New sample (dBm).
+ * @return int32_t Average (dBm, Q8).
+ */
+static int32_t app_beacon_rssi_filter__add_sample(app_beacon_rssi_filter_t *filter, int8_t rssi)
+{
+    if (filter->count == 0)
+    {
+        filter->average_q8 = APP_BEACON_RSSI_FILTER_Q8(rssi);
+    }
+    else
+    {
+        filter->average_q8 += (APP_BEACON_RSSI_FILTER_Q8(rssi) - filter->average_q8) / (1 << APP_BEACON_RSSI_FILTER_EWMA_SHIFT);
+    }
+    return filter->average_q8;
+}
+#elif (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_MEDIAN)
+/**
+ * @brief Add sample to the median window, replacing the oldest sample. The sorted copy of the window is
+ * updated in place (one removal and one insertion), so no sort is needed per sample.
+ *
+ * @param filter Filter.
+ * @param rssi New sample (dBm).
+ * @return int32_t Median of the window samples (dBm, Q8). Only meaningful once the window is full.
+ */
+static int32_t app_beacon_rssi_filter__add_sample(app_beacon_rssi_filter_t *filter, int8_t rssi)
+{
+    uint8_t sorted_len = filter->count;
+    uint8_t pos;
+
+    if (sorted_len == APP_BEACON_RSSI_FILTER_WINDOW)
+    {
+        // remove oldest sample from the sorted window
+        int8_t oldest = filter->samples[filter->index];
+        for (pos = 0; filter->sorted[pos] != oldest; pos++)
+        {
+        }
+        memmove(&filter->sorted[pos], &filter->sorted[pos + 1], sorted_len - pos - 1);
+        sorted_len--;
+    }
+    filter->samples[filter->index] = rssi;
+
+    // insert new sample keeping the window sorted
+    for (pos = sorted_len; pos > 0 && filter->sorted[pos - 1] > rssi; pos--)
+    {
+        filter->sorted[pos] = filter->sorted[pos - 1];
+    }
+    filter->sorted[pos] = rssi;
+    sorted_len++;
+
+    if (sorted_len % 2)
+    {
+        return APP_BEACON_RSSI_FILTER_Q8(filter->sorted[sorted_len / 2]);
+    }
+    return APP_BEACON_RSSI_FILTER_Q8(filter->sorted[sorted_len / 2 - 1] + filter->sorted[sorted_len / 2]) / 2;
+}
+#elif (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_KALMAN)
+/**
+ * @brief Add sample to the Kalman filter. The RSSI is modelled as constant, with its changes (the pet moving)
+ * accounted as process noise. The first sample initializes the estimate.
+ *
+ * @param filter Filter.
+ * @param rssi New sample (dBm).
+ * @return int32_t RSSI estimate (dBm, Q8).
+ */
+static int32_t app_beacon_rssi_filter__add_sample(app_beacon_rssi_filter_t *filter, int8_t rssi)
+{
+    if (filter->count == 0)
+    {
+        filter->estimate_q8 = APP_BEACON_RSSI_FILTER_Q8(rssi);
+        filter->variance_q8 = APP_BEACON_RSSI_FILTER_KALMAN_MEASUREMENT_NOISE_Q8;
+        return filter->estimate_q8;
+    }
+
+    int64_t variance_pred_q8 = (int64_t)filter->variance_q8 + APP_BEACON_RSSI_FILTER_KALMAN_PROCESS_NOISE_Q8;
+    int64_t gain_q16 = (variance_pred_q8 << 16) / (variance_pred_q8 + APP_BEACON_RSSI_FILTER_KALMAN_MEASUREMENT_NOISE_Q8);
+    filter->estimate_q8 += (int32_t)(((APP_BEACON_RSSI_FILTER_Q8(rssi) - filter->estimate_q8) * gain_q16) / 65536);
+    filter->variance_q8 = (int32_t)((variance_pred_q8 * (65536 - gain_q16)) / 65536);
+    return filter->estimate_q8;
+}
+#endif
+
+/**
+ * @brief Add RSSI sample to the filter. The variation of the filter output between two samples is limited to
+ * APP_BEACON_RSSI_FILTER_MAX_STEP_DB, so that a burst of reflections does not make the beacon look closer or
+ * farther than it is.
+ *
+ * @param filter Filter.
+ * @param rssi New sample (dBm).
+ * @param rssi_q8 Filtered RSSI (dBm, Q8). Only written if the filter has an output.
+ * @return uint8_t 1 if the filter has an output, 0 if it still needs more samples.
+ */
+uint8_t app_beacon_rssi_filter__update(app_beacon_rssi_filter_t *filter, int8_t rssi, int32_t *rssi_q8)
+{
+    uint8_t had_output = (filter->count >= RSSI_FILTER_SAMPLES_FOR_OUTPUT);
+    int32_t output_q8 = app_beacon_rssi_filter__add_sample(filter, rssi);
+
+    filter->index = (filter->index + 1) % APP_BEACON_RSSI_FILTER_WINDOW;
+    if (filter->count < APP_BEACON_RSSI_FILTER_WINDOW)
+    {
+        filter->count++;
+    }
+    if (filter->count < RSSI_FILTER_SAMPLES_FOR_OUTPUT)
+    {
+        return 0;
+    }
+
+#if APP_BEACON_RSSI_FILTER_MAX_STEP_DB
+    if (had_output)
+    {
+        if (output_q8 > filter->output_q8 + APP_BEACON_RSSI_FILTER_Q8(APP_BEACON_RSSI_FILTER_MAX_STEP_DB))
+        {
+            output_q8 = filter->output_q8 + APP_BEACON_RSSI_FILTER_Q8(APP_BEACON_RSSI_FILTER_MAX_STEP_DB);
+        }
+        else if (output_q8 < filter->output_q8 - APP_BEACON_RSSI_FILTER_Q8(APP_BEACON_RSSI_FILTER_MAX_STEP_DB))
+        {
+            output_q8 = filter->output_q8 - APP_BEACON_RSSI_FILTER_Q8(APP_BEACON_RSSI_FILTER_MAX_STEP_DB);
+        }
+    }
+#else
+    (void)had_output;
+#endif
+    filter->output_q8 = output_q8;
+    *rssi_q8 = output_q8;
+    return 1;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file app_beacon_rssi_filter.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Private header of the per-beacon RSSI filter of the app_beacon component.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define APP_BEACON_RSSI_FILTER_RUNNING_SUM (0) ///< Moving average over a window of samples, kept as a running sum
+#define APP_BEACON_RSSI_FILTER_EWMA (1)        ///< Exponentially weighted moving average
+#define APP_BEACON_RSSI_FILTER_MEDIAN (2)      ///< Median of a window of samples
+#define APP_BEACON_RSSI_FILTER_KALMAN (3)      ///< One-dimensional Kalman filter (constant RSSI model)
+
+/* The filter and its parameters are selected at build time. All of them can be overridden with compile
+ * definitions (e.g. by the host replay benchmark, see host/beacon_replay.c).
+ */
+#ifndef APP_BEACON_RSSI_FILTER
+#define APP_BEACON_RSSI_FILTER (APP_BEACON_RSSI_FILTER_RUNNING_SUM) ///< Filter used for the beacons' RSSI
+#endif
+#ifndef APP_BEACON_RSSI_FILTER_WINDOW
+#define APP_BEACON_RSSI_FILTER_WINDOW (8) ///< Number of samples of the running sum and median filters (1 to 32)
+#endif
+#ifndef APP_BEACON_RSSI_FILTER_EWMA_SHIFT
+#define APP_BEACON_RSSI_FILTER_EWMA_SHIFT (2) ///< EWMA weight of a new sample is 1 / 2^APP_BEACON_RSSI_FILTER_EWMA_SHIFT
+#endif
+#ifndef APP_BEACON_RSSI_FILTER_KALMAN_PROCESS_NOISE_Q8
+#define APP_BEACON_RSSI_FILTER_KALMAN_PROCESS_NOISE_Q8 (APP_BEACON_RSSI_FILTER_Q8(1)) ///< Kalman process noise variance (dB^2, Q8)
+#endif
+#ifndef APP_BEACON_RSSI_FILTER_KALMAN_MEASUREMENT_NOISE_Q8
+#define APP_BEACON_RSSI_FILTER_KALMAN_MEASUREMENT_NOISE_Q8 (APP_BEACON_RSSI_FILTER_Q8(16)) ///< Kalman measurement noise variance (dB^2, Q8)
+#endif
+#ifndef APP_BEACON_RSSI_FILTER_MAX_STEP_DB
+#define APP_BEACON_RSSI_FILTER_MAX_STEP_DB (2) ///< Maximum variation of the filter output between two samples, 0 for no limit (dB)
+#endif
+
+#define APP_BEACON_RSSI_FILTER_Q8(dbm) ((int32_t)(dbm) * 256) ///< Convert dBm to the Q8 fixed-point format of the filter output
+
+#if (APP_BEACON_RSSI_FILTER_WINDOW < 1) || (APP_BEACON_RSSI_FILTER_WINDOW > 32)
+#error "APP_BEACON_RSSI_FILTER_WINDOW must be between 1 and 32"
+#endif
+
+/// @brief Typedef to store the state of the RSSI filter of a beacon.
+typedef struct
+{
+#if (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_RUNNING_SUM)
+    int8_t samples[APP_BEACON_RSSI_FILTER_WINDOW]; ///< Window samples, in arrival order (dBm)
+    int16_t sum;                                   ///< Sum of the window samples (dBm)
+#elif (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_EWMA)
+    int32_t average_q8; ///< Exponentially weighted moving average (dBm, Q8)
+#elif (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_MEDIAN)
+    int8_t samples[APP_BEACON_RSSI_FILTER_WINDOW]; ///< Window samples, in arrival order (dBm)
+    int8_t sorted[APP_BEACON_RSSI_FILTER_WINDOW];  ///< Window samples, sorted (dBm)
+#elif (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_KALMAN)
+    int32_t estimate_q8;  ///< RSSI estimate (dBm, Q8)
+    int32_t variance_q8;  ///< Variance of the estimate (dB^2, Q8)
+#else
+#error "Unknown APP_BEACON_RSSI_FILTER"
+#endif
+    uint8_t index;        ///< Position where the next sample is stored (window filters)
+    uint8_t count;        ///< Number of samples received, saturated at APP_BEACON_RSSI_FILTER_WINDOW
+    int32_t output_q8;    ///< Last filter output (dBm, Q8)
+} app_beacon_rssi_filter_t;
+
+void app_beacon_rssi_filter__reset(app_beacon_rssi_filter_t *filter);
+uint8_t app_beacon_rssi_filter__update(app_beacon_rssi_filter_t *filter, int8_t rssi, int32_t *rssi_q8);
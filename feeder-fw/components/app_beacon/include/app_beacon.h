@@ -11,9 +11,80 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
+#define APP_BEACON_HISTORY_LEN (8)              ///< Number of sightings kept per authorized beacon
+#define APP_BEACON_TLM_TEMP_UNSUPPORTED (-32768) ///< Eddystone TLM temperature of a beacon without a temperature sensor (Q8)
+
+/// @brief Typedef for the beacon frames decoded from the advertisements.
+typedef enum
+{
+    app_beacon_frame_none = 0,      /**< Unknown frame */
+    app_beacon_frame_eddystone_uid, /**< Eddystone-UID */
+    app_beacon_frame_eddystone_tlm, /**< Eddystone-TLM (unencrypted) */
+    app_beacon_frame_ibeacon,       /**< Apple iBeacon */
+} app_beacon_frame_type_t;
+
+/// @brief Typedef for an Eddystone-TLM frame.
+typedef struct
+{
+    uint8_t version;     ///< TLM version (0 for unencrypted TLM)
+    uint16_t battery_mv; ///< Battery voltage (mV), 0 if not supported
+    int16_t temp_q8;     ///< Temperature (°C, Q8), APP_BEACON_TLM_TEMP_UNSUPPORTED if not supported
+    uint32_t adv_count;  ///< Number of advertisements sent since the beacon booted
+    uint32_t uptime_ds;  ///< Time since the beacon booted (0.1 s)
+} app_beacon_tlm_t;
+
+/// @brief Typedef for an Eddystone-UID frame.
+typedef struct
+{
+    int8_t tx_power;          ///< Calibrated TX power at 0 m (dBm)
+    uint8_t namespace_id[10]; ///< Namespace ID
+    uint8_t instance_id[6];   ///< Instance ID
+} app_beacon_uid_t;
+
+/// @brief Typedef for an iBeacon frame.
+typedef struct
+{
+    uint8_t uuid[16]; ///< Proximity UUID
+    uint16_t major;   ///< Major
+    uint16_t minor;   ///< Minor
+    int8_t tx_power;  ///< Measured power at 1 m (dBm)
+} app_beacon_ibeacon_t;
+
+/// @brief Typedef for a beacon frame decoded from an advertisement.
+typedef struct
+{
+    app_beacon_frame_type_t type; ///< Frame type, selects the union member
+    union
+    {
+        app_beacon_tlm_t tlm;         ///< Eddystone-TLM frame
+        app_beacon_uid_t uid;         ///< Eddystone-UID frame
+        app_beacon_ibeacon_t ibeacon; ///< iBeacon frame
+    };
+} app_beacon_frame_t;
+
+/// @brief Typedef for a sighting of an authorized beacon, kept in its history.
+typedef struct
+{
+    uint32_t time_ms;             ///< Time when the advertisement was received (ms since boot)
+    int8_t rssi;                  ///< Advertisement RSSI (dBm)
+    app_beacon_frame_type_t type; ///< Type of the advertised frame
+    app_beacon_tlm_t tlm;         ///< TLM fields, only valid if type is app_beacon_frame_eddystone_tlm
+} app_beacon_sighting_t;
+
 esp_err_t app_beacon__init(void);
 esp_err_t app_beacon__ble_scan_start(void);
 esp_err_t app_beacon__ble_scan_stop(void);
 void app_beacon__set_auth_mac(uint8_t mac_addr[6]);
+esp_err_t app_beacon__add_auth_mac(uint8_t mac_addr[6]);
+esp_err_t app_beacon__remove_auth_mac(uint8_t mac_addr[6]);
+void app_beacon__clear_auth_macs(void);
+int64_t app_beacon__get_open_latency_max_us(void);
+int64_t app_beacon__get_first_scan_start_us(void);
+int64_t app_beacon__get_first_scan_result_us(void);
+uint32_t app_beacon__get_ble_stack_heap_bytes(void);
+size_t app_beacon__get_history(const uint8_t mac_addr[6], app_beacon_sighting_t *sightings, size_t max);
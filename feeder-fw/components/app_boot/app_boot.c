@@ -0,0 +1,306 @@
+/**
+ * @file app_boot.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the boot sequencer, which runs the init stages of the application as soon as their dependencies
+ * are done, several at a time, and the boot profiler, which times them.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#include <stddef.h>
+
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "app_boot.h"
+
+#define BOOT_WORKERS (2)              ///< Number of stages run at a time: the task calling app_boot__run and BOOT_WORKERS - 1 worker tasks
+#define BOOT_WORKER_STACK_SIZE (4096) ///< Stack size of the worker tasks, which run the init functions (bytes)
+#define BOOT_MILESTONES_MAX (4)       ///< Maximum number of milestones in the boot report
+#define BOOT_STATS_MAX (4)            ///< Maximum number of other measurements in the boot report
+
+/* Each worker (the calling task included) repeatedly takes the first stage of the table that is not started and whose
+ * dependencies are done, so the table order sets the priority between the stages that are ready. A worker with no
+ * stage ready waits until a running stage is done. Once a stage fails no other stage is started, and app_boot__run
+ * returns when the running ones are done. With two CPU cores, a slow stage that mostly waits for a peripheral or runs
+ * on its own (e.g. the BT controller and Bluedroid bring-up) overlaps with the chain of stages the feeding depends on.
+ *
+ * Times are taken with esp_timer_get_time, i.e. from the esp_timer start in the startup code, which does not include
+ * the ROM and second stage bootloaders.
+ */
+
+/// @brief Typedef to store the timing of a stage.
+typedef struct
+{
+    int64_t start_us; ///< Time when the stage started (us since boot)
+    int64_t end_us;   ///< Time when the stage was done (us since boot), 0 if it was not
+    uint8_t worker;   ///< Worker that ran the stage
+} stage_timing_t;
+
+/// @brief Typedef to store a milestone of the boot report.
+typedef struct
+{
+    const char *name; ///< Milestone name
+    int64_t time_us;  ///< Time of the milestone (us since boot), 0 if it was not reached
+} milestone_t;
+
+/// @brief Typedef to store another measurement of the boot report.
+typedef struct
+{
+    const char *name; ///< Measurement name
+    int64_t value;    ///< Measured value
+    const char *unit; ///< Unit of the value
+} stat_t;
+
+static const char *TAG = "app_boot";                          ///< Tag to be used when logging
+static portMUX_TYPE boot_lock = portMUX_INITIALIZER_UNLOCKED; ///< Lock protecting the sequencer state
+static const app_boot_stage_t *boot_stages = NULL;            ///< Stages being run
+static size_t boot_stages_count = 0;                          ///< Number of stages being run
+static uint32_t stages_started = 0;                           ///< Stages started (one bit per stage index)
+static uint32_t stages_done = 0;                              ///< Stages done (one bit per stage index)
+static esp_err_t boot_err = ESP_OK;                           ///< Error of the first stage that failed
+static uint8_t workers_waiting = 0;                           ///< Number of workers waiting for a stage to be done
+static SemaphoreHandle_t stage_done_sem = NULL;               ///< Given once per waiting worker when a stage is done or fails
+static SemaphoreHandle_t worker_exit_sem = NULL;              ///< Given by each worker task when it exits
+static stage_timing_t stage_timings[APP_BOOT_STAGES_MAX];     ///< Timing of each stage
+static int64_t boot_start_us = 0;                             ///< Time when app_boot__run was called (us since boot)
+static int64_t boot_end_us = 0;                               ///< Time when app_boot__run returned (us since boot)
+static milestone_t milestones[BOOT_MILESTONES_MAX];           ///< Milestones of the boot report
+static uint8_t milestones_count = 0;                          ///< Number of milestones
+static stat_t stats[BOOT_STATS_MAX];                          ///< Other measurements of the boot report
+static uint8_t stats_count = 0;                               ///< Number of other measurements
+
+/**
+ * @brief Run stages until none is left to start (or a stage failed). Run by the task calling app_boot__run and by the
+ * worker tasks.
+ *
+ * @param worker Worker index, 0 for the task calling app_boot__run.
+ */
+static void app_boot__work(uint8_t worker)
+{
+    for (;;)
+    {
+        int stage = -1;
+        uint8_t finished = 0;
+
+        taskENTER_CRITICAL(&boot_lock);
+        for (size_t i = 0; (i < boot_stages_count) && (stage < 0) && (boot_err == ESP_OK); i++)
+        {
+            if (!(stages_started & APP_BOOT_DEP(i)) && ((boot_stages[i].deps & stages_done) == boot_stages[i].deps))
+            {
+                stage = (int)i;
+                stages_started |= APP_BOOT_DEP(i);
+            }
+        }
+        if (stage < 0)
+        {
+            finished = (boot_err != ESP_OK) || (stages_started == APP_BOOT_DEP(boot_stages_count) - 1);
+            workers_waiting += !finished;
+        }
+        taskEXIT_CRITICAL(&boot_lock);
+
+        if (finished)
+        {
+            return;
+        }
+        if (stage < 0)
+        {
+            xSemaphoreTake(stage_done_sem, portMAX_DELAY);
+            continue;
+        }
+
+        stage_timings[stage].worker = worker;
+        stage_timings[stage].start_us = esp_timer_get_time();
+        esp_err_t err = boot_stages[stage].init();
+        stage_timings[stage].end_us = esp_timer_get_time();
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error %d in init stage %s: %s", err, boot_stages[stage].name, esp_err_to_name(err));
+            stage_timings[stage].end_us = 0;
+        }
+
+        taskENTER_CRITICAL(&boot_lock);
+        if (err == ESP_OK)
+        {
+            stages_done |= APP_BOOT_DEP(stage);
+        }
+        else if (boot_err == ESP_OK)
+        {
+            boot_err = err;
+        }
+        uint8_t wake = workers_waiting;
+        workers_waiting = 0;
+        taskEXIT_CRITICAL(&boot_lock);
+
+        for (uint8_t i = 0; i < wake; i++)
+        {
+            xSemaphoreGive(stage_done_sem);
+        }
+    }
+}
+
+/**
+ * @brief Worker task, runs stages along with the task calling app_boot__run.
+ *
+ * @param arg Worker index.
+ */
+static void app_boot__worker_task(void *arg)
+{
+    app_boot__work((uint8_t)(uintptr_t)arg);
+    xSemaphoreGive(worker_exit_sem);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Run init stages, each one as soon as all its dependencies are done, up to BOOT_WORKERS at a time. The
+ * stages that do not depend on each other may run concurrently, so their init functions must not share state that
+ * is not protected. Returns once all the stages are done, or once a stage failed and the running ones are done.
+ * Must be called once.
+ *
+ * @param stages Stages. A stage may only depend on stages with a lower index, so that there are no cycles.
+ * @param count Number of stages, at most APP_BOOT_STAGES_MAX.
+ * @return esp_err_t
+ * @retval ESP_OK if all the stages are done.
+ * @retval ESP_ERR_INVALID_ARG if there are too many stages or a stage depends on a later one.
+ * @retval ESP_ERR_NO_MEM if the worker tasks can not be created.
+ * @retval Error code of the first stage that failed otherwise.
+ */
+esp_err_t app_boot__run(const app_boot_stage_t *stages, size_t count)
+{
+    if (count > APP_BOOT_STAGES_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (stages[i].deps & ~(APP_BOOT_DEP(i) - 1))
+        {
+            ESP_LOGE(TAG, "Init stage %s depends on a later stage", stages[i].name);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    boot_start_us = esp_timer_get_time();
+    boot_stages = stages;
+    boot_stages_count = count;
+    stage_done_sem = xSemaphoreCreateCounting(BOOT_WORKERS, 0);
+    worker_exit_sem = xSemaphoreCreateCounting(BOOT_WORKERS, 0);
+    if (stage_done_sem == NULL || worker_exit_sem == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t workers = 1;
+    for (; workers < BOOT_WORKERS; workers++)
+    {
+        if (xTaskCreate(app_boot__worker_task, "app_boot__worker_task", BOOT_WORKER_STACK_SIZE,
+                        (void *)(uintptr_t)workers, uxTaskPriorityGet(NULL), NULL) != pdPASS)
+        {
+            ESP_LOGW(TAG, "Error creating worker task, running the init stages with %d workers", (int)workers);
+            break;
+        }
+    }
+    app_boot__work(0);
+    for (uint8_t i = 1; i < workers; i++)
+    {
+        xSemaphoreTake(worker_exit_sem, portMAX_DELAY);
+    }
+
+    vSemaphoreDelete(stage_done_sem);
+    vSemaphoreDelete(worker_exit_sem);
+    boot_end_us = esp_timer_get_time();
+    return boot_err;
+}
+
+/**
+ * @brief Add milestone to the boot report, e.g. an event that happens asynchronously after the init stages.
+ *
+ * @param name Milestone name.
+ * @param time_us Time of the milestone (us since boot), 0 if it was not reached.
+ */
+void app_boot__add_milestone(const char *name, int64_t time_us)
+{
+    if (milestones_count < BOOT_MILESTONES_MAX)
+    {
+        milestones[milestones_count].name = name;
+        milestones[milestones_count].time_us = time_us;
+        milestones_count++;
+    }
+}
+
+/**
+ * @brief Add other measurement to the boot report, e.g. the heap taken by a subsystem.
+ *
+ * @param name Measurement name.
+ * @param value Measured value.
+ * @param unit Unit of the value.
+ */
+void app_boot__add_stat(const char *name, int64_t value, const char *unit)
+{
+    if (stats_count < BOOT_STATS_MAX)
+    {
+        stats[stats_count].name = name;
+        stats[stats_count].value = value;
+        stats[stats_count].unit = unit;
+        stats_count++;
+    }
+}
+
+/**
+ * @brief Print the boot report: start time, duration and worker of each init stage, total time of the init stages,
+ * milestones and other measurements.
+ *
+ */
+void app_boot__print_report(void)
+{
+    int64_t busy_us = 0;
+
+    for (size_t i = 0; i < boot_stages_count; i++)
+    {
+        const stage_timing_t *timing = &stage_timings[i];
+        if (timing->end_us == 0)
+        {
+            ESP_LOGI(TAG, "Stage %-12s not done", boot_stages[i].name);
+            continue;
+        }
+        busy_us += timing->end_us - timing->start_us;
+        ESP_LOGI(TAG, "Stage %-12s worker %d, start %6lld us, took %6lld us", boot_stages[i].name, (int)timing->worker,
+                 (long long)timing->start_us, (long long)(timing->end_us - timing->start_us));
+    }
+    ESP_LOGI(TAG, "Init stages from %lld us to %lld us (%lld us, %lld us of stages)", (long long)boot_start_us,
+             (long long)boot_end_us, (long long)(boot_end_us - boot_start_us), (long long)busy_us);
+    for (uint8_t i = 0; i < milestones_count; i++)
+    {
+        if (milestones[i].time_us)
+        {
+            ESP_LOGI(TAG, "%s at %lld us", milestones[i].name, (long long)milestones[i].time_us);
+        }
+        else
+        {
+            ESP_LOGI(TAG, "%s not reached", milestones[i].name);
+        }
+    }
+    for (uint8_t i = 0; i < stats_count; i++)
+    {
+        ESP_LOGI(TAG, "%s: %lld %s", stats[i].name, (long long)stats[i].value, stats[i].unit);
+    }
+}
@@ -0,0 +1,33 @@
+/**
+ * @file app_boot.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Main header file of the app_boot component.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define APP_BOOT_STAGES_MAX (24)             ///< Maximum number of init stages
+#define APP_BOOT_DEP(stage) (1UL << (stage)) ///< Dependency on the stage with index stage, to be OR-ed in app_boot_stage_t.deps
+
+/// @brief Typedef for an init stage: a function that initializes a subsystem, run once all its dependencies are done.
+typedef struct
+{
+    const char *name;        ///< Stage name, used in the boot report
+    esp_err_t (*init)(void); ///< Init function
+    uint32_t deps;           ///< Stages that must be done before this one starts (APP_BOOT_DEP flags of their indexes)
+} app_boot_stage_t;
+
+esp_err_t app_boot__run(const app_boot_stage_t *stages, size_t count);
+void app_boot__add_milestone(const char *name, int64_t time_us);
+void app_boot__add_stat(const char *name, int64_t value, const char *unit);
+void app_boot__print_report(void);
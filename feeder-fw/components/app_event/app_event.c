@@ -0,0 +1,323 @@
+/**
+ * @file app_event.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the application event loop: a single task that runs, one at a time and in order, the handlers
+ * posted to its queue by the components, from tasks, ISRs or timers.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "app_event.h"
+
+#define EVENT_QUEUE_LENGTH (16)      ///< Maximum number of events waiting to be handled
+#define EVENT_SIGNALS_MAX (32)       ///< Maximum number of signals, timers included (bits of signals_pending)
+#define EVENT_TASK_STACK_SIZE (4096) ///< Stack size of the event loop task, shared by all the handlers (bytes)
+
+/* Handlers run in the event loop task, so they must not block for long: a slow handler delays every event queued
+ * after it. Work with a latency bound (e.g. opening the lid when a beacon is detected) is done in its own task.
+ *
+ * An event posted while the queue is full is dropped, which is fine for a request that is made again (e.g. the next
+ * battery reading) but not for a completion that a state machine waits for (e.g. the BLE scan started, the servo
+ * fade ended) nor for a timer expiry. Those are signals: raising a signal only sets its bit in signals_pending, so
+ * it can not be dropped, and the loop runs the handlers of the pending signals after every event. A single wake up
+ * event is queued until the loop handles the signals; if the queue is full, the loop is busy and handles them after
+ * the events ahead anyway. A signal raised several times before its handler runs is handled once, so a signal
+ * carries no argument of its own, the handler reads the state it has to act on.
+ */
+
+/// @brief Typedef to store an event: the handler to be run and its argument.
+typedef struct
+{
+    app_event_handler_t handler; ///< Function to be run by the event loop
+    void *arg;                   ///< Argument passed to the handler
+} app_event_t;
+
+static const char *TAG = "app_event";                                  ///< Tag to be used when logging
+static QueueHandle_t event_queue = NULL;                               ///< Queue of events waiting to be handled
+static TaskHandle_t app_event__loop_task_handle = NULL;                ///< Event loop task handle
+static app_event_t event_signals[EVENT_SIGNALS_MAX];                   ///< Handlers of the signals, including the ones of the timers
+static uint8_t event_signals_count = 0;                                ///< Number of signals created
+static portMUX_TYPE event_signals_lock = portMUX_INITIALIZER_UNLOCKED; ///< Lock protecting event_signals_count
+static uint32_t signals_pending = 0;                                   ///< Signals raised and not handled yet (one bit per signal)
+static uint32_t signals_posted = 0;                                    ///< Flag that indicates that the wake up event of the signals is queued
+static uint32_t events_dropped = 0;                                    ///< Number of events dropped because the queue was full
+static int64_t handler_max_us = 0;                                     ///< Maximum time taken by a handler (us)
+
+static void app_event__loop_task(void *arg);
+
+/**
+ * @brief Initialize the application event loop. Must be called before any other component that posts events is
+ * initialized.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK if the event loop is successfully initialized.
+ * @retval ESP_FAIL otherwise.
+ */
+esp_err_t app_event__init(void)
+{
+    if (event_queue != NULL)
+    {
+        return ESP_OK;
+    }
+
+    event_queue = xQueueCreate(EVENT_QUEUE_LENGTH, sizeof(app_event_t));
+    if (event_queue == NULL)
+    {
+        ESP_LOGE(TAG, "Error creating event queue");
+        return ESP_FAIL;
+    }
+
+    if (xTaskCreate(app_event__loop_task,
+                    "app_event__loop_task", EVENT_TASK_STACK_SIZE, NULL, 10,
+                    &app_event__loop_task_handle) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Error creating app_event__loop_task");
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Created app_event__loop_task");
+    return ESP_OK;
+}
+
+/**
+ * @brief Post event to be handled by the event loop. Must not be called from an ISR, see app_event__post_from_isr.
+ *
+ * @param handler Function to be run by the event loop.
+ * @param arg Argument passed to the handler.
+ * @return esp_err_t
+ * @retval ESP_OK if the event is successfully queued.
+ * @retval ESP_FAIL if the queue is full and the event was dropped.
+ */
+esp_err_t app_event__post(app_event_handler_t handler, void *arg)
+{
+    app_event_t event = {
+        .handler = handler,
+        .arg = arg,
+    };
+    if (xQueueSend(event_queue, &event, 0) != pdTRUE)
+    {
+        events_dropped++;
+        ESP_LOGE(TAG, "Event queue full, %d events dropped so far", (int)events_dropped);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Post event to be handled by the event loop, from an ISR.
+ *
+ * @param handler Function to be run by the event loop.
+ * @param arg Argument passed to the handler.
+ * @return esp_err_t
+ * @retval ESP_OK if the event is successfully queued.
+ * @retval ESP_FAIL if the queue is full and the event was dropped.
+ */
+esp_err_t IRAM_ATTR app_event__post_from_isr(app_event_handler_t handler, void *arg)
+{
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    app_event_t event = {
+        .handler = handler,
+        .arg = arg,
+    };
+    if (xQueueSendFromISR(event_queue, &event, &higher_priority_task_woken) != pdTRUE)
+    {
+        events_dropped++;
+        return ESP_FAIL;
+    }
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+    return ESP_OK;
+}
+
+/**
+ * @brief Create signal: an event that can not be dropped, see app_event__signal.
+ *
+ * @param handler Function to be run by the event loop when the signal is raised.
+ * @param arg Argument passed to the handler.
+ * @param out_signal Created signal.
+ * @return esp_err_t
+ * @retval ESP_OK if the signal is successfully created.
+ * @retval ESP_ERR_NO_MEM if EVENT_SIGNALS_MAX signals (timers included) were already created.
+ */
+esp_err_t app_event__signal_create(app_event_handler_t handler, void *arg, app_event_signal_t *out_signal)
+{
+    app_event_signal_t signal = EVENT_SIGNALS_MAX;
+
+    // Components may be initialized concurrently, so the slot is reserved under the lock
+    taskENTER_CRITICAL(&event_signals_lock);
+    if (event_signals_count < EVENT_SIGNALS_MAX)
+    {
+        signal = event_signals_count++;
+        event_signals[signal].handler = handler;
+        event_signals[signal].arg = arg;
+    }
+    taskEXIT_CRITICAL(&event_signals_lock);
+    if (signal == EVENT_SIGNALS_MAX)
+    {
+        ESP_LOGE(TAG, "Error creating signal, maximum of %d signals reached", EVENT_SIGNALS_MAX);
+        return ESP_ERR_NO_MEM;
+    }
+    *out_signal = signal;
+    return ESP_OK;
+}
+
+/**
+ * @brief Raise signal: its handler is run by the event loop, once however many times it is raised before it runs.
+ * Never fails, even if the event queue is full. Must not be called from an ISR, see app_event__signal_from_isr.
+ *
+ * @param signal Signal created with app_event__signal_create.
+ */
+void app_event__signal(app_event_signal_t signal)
+{
+    __atomic_fetch_or(&signals_pending, 1UL << signal, __ATOMIC_RELEASE);
+    if (!__atomic_exchange_n(&signals_posted, 1, __ATOMIC_ACQ_REL))
+    {
+        // if the queue is full the loop handles the signals after the events ahead, signals_posted is cleared then
+        app_event_t event = {
+            .handler = NULL,
+        };
+        xQueueSend(event_queue, &event, 0);
+    }
+}
+
+/**
+ * @brief Raise signal from an ISR, see app_event__signal.
+ *
+ * @param signal Signal created with app_event__signal_create.
+ */
+void IRAM_ATTR app_event__signal_from_isr(app_event_signal_t signal)
+{
+    BaseType_t higher_priority_task_woken = pdFALSE;
+
+    __atomic_fetch_or(&signals_pending, 1UL << signal, __ATOMIC_RELEASE);
+    if (!__atomic_exchange_n(&signals_posted, 1, __ATOMIC_ACQ_REL))
+    {
+        app_event_t event = {
+            .handler = NULL,
+        };
+        xQueueSendFromISR(event_queue, &event, &higher_priority_task_woken);
+    }
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+
+/**
+ * @brief Callback of the timers created with app_event__timer_create, raises their signal.
+ *
+ * @param arg Signal to be raised (app_event_signal_t).
+ */
+static void app_event__timer_cb(void *arg)
+{
+    app_event__signal((app_event_signal_t)(uintptr_t)arg);
+}
+
+/**
+ * @brief Create timer whose expiry is handled by the event loop: when it expires, the handler is run by the event
+ * loop instead of the esp_timer task, as a signal so that no expiry is dropped. The timer is started and stopped with
+ * the esp_timer API.
+ *
+ * @param name Timer name, used for debugging.
+ * @param handler Function to be run by the event loop when the timer expires.
+ * @param arg Argument passed to the handler.
+ * @param out_timer Created timer.
+ * @return esp_err_t
+ * @retval ESP_OK if the timer is successfully created.
+ * @retval ESP_ERR_NO_MEM if EVENT_SIGNALS_MAX signals (timers included) were already created.
+ * @retval Error code of esp_timer_create otherwise.
+ */
+esp_err_t app_event__timer_create(const char *name, app_event_handler_t handler, void *arg, esp_timer_handle_t *out_timer)
+{
+    app_event_signal_t signal;
+
+    // a signal whose timer could not be created is not reused
+    esp_err_t err = app_event__signal_create(handler, arg, &signal);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error creating %s timer", name);
+        return err;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = app_event__timer_cb,
+        .arg = (void *)(uintptr_t)signal,
+        .name = name,
+    };
+    err = esp_timer_create(&timer_args, out_timer);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d creating %s timer: %s", err, name, esp_err_to_name(err));
+        return err;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Run a handler, keeping track of the slowest one.
+ *
+ * @param event Handler and its argument.
+ */
+static void app_event__run(const app_event_t *event)
+{
+    int64_t start_us = esp_timer_get_time();
+    event->handler(event->arg);
+    int64_t handler_us = esp_timer_get_time() - start_us;
+    if (handler_us > handler_max_us)
+    {
+        handler_max_us = handler_us;
+        ESP_LOGD(TAG, "Slowest handler so far took %d us", (int)handler_max_us);
+    }
+}
+
+/**
+ * @brief Task that runs the handlers of the queued events, in the order they were posted, and after each one the
+ * handlers of the pending signals, in the order they were created.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_event__loop_task(void *arg)
+{
+    app_event_t event;
+
+    for (;;)
+    {
+        if (xQueueReceive(event_queue, &event, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+        if (event.handler != NULL)
+        {
+            app_event__run(&event);
+        }
+
+        // cleared first, so that a signal raised from now on queues the wake up event again
+        __atomic_store_n(&signals_posted, 0, __ATOMIC_RELEASE);
+        uint32_t pending = __atomic_exchange_n(&signals_pending, 0, __ATOMIC_ACQ_REL);
+        for (app_event_signal_t signal = 0; pending != 0; signal++, pending >>= 1)
+        {
+            if (pending & 1)
+            {
+                app_event__run(&event_signals[signal]);
+            }
+        }
+    }
+    vTaskDelete(NULL);
+}
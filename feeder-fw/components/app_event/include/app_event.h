@@ -0,0 +1,31 @@
+/**
+ * @file app_event.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Main header file of the app_event component.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+
+/// @brief Typedef for the functions run by the application event loop.
+typedef void (*app_event_handler_t)(void *arg);
+
+/// @brief Typedef for the signals, events that are never dropped (see app_event__signal).
+typedef uint8_t app_event_signal_t;
+
+esp_err_t app_event__init(void);
+esp_err_t app_event__post(app_event_handler_t handler, void *arg);
+esp_err_t app_event__post_from_isr(app_event_handler_t handler, void *arg);
+esp_err_t app_event__signal_create(app_event_handler_t handler, void *arg, app_event_signal_t *out_signal);
+void app_event__signal(app_event_signal_t signal);
+void app_event__signal_from_isr(app_event_signal_t signal);
+esp_err_t app_event__timer_create(const char *name, app_event_handler_t handler, void *arg, esp_timer_handle_t *out_timer);
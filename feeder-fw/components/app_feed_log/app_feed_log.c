@@ -0,0 +1,501 @@
+/**
+ * @file app_feed_log.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the feeding event log: an append-only log of fixed-size records in a dedicated flash partition,
+ * batched in RAM and written by the event loop.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "app_feed_log.h"
+#include "app_event.h"
+
+#define FEED_LOG_PARTITION_LABEL "feedlog"  ///< Label of the feeding log partition, see partitions.csv
+#define FEED_LOG_SECTOR_SIZE (4096)         ///< Flash sector size, the erase unit (bytes)
+#define FEED_LOG_SECTORS_MAX (64)           ///< Maximum number of sectors of the partition used
+#define FEED_LOG_RECORDS_PER_SECTOR (FEED_LOG_SECTOR_SIZE / sizeof(app_feed_log_record_t)) ///< Number of records in a sector
+#define FEED_LOG_BATCH_LEN (16)             ///< Number of records that can wait in RAM to be written
+#define FEED_LOG_FLUSH_THRESHOLD (8)        ///< Number of records waiting in RAM that triggers a write
+#define FEED_LOG_FLUSH_DELAY_MS (60 * 1000) ///< Maximum time a record waits in RAM to be written, i.e. lost on a power cut (ms)
+#define FEED_LOG_READ_CHUNK (8)             ///< Number of records read from flash at once
+#define FEED_LOG_SEQ_ERASED (0xffffffff)    ///< Sequence number of an erased (never written) record slot
+
+_Static_assert(sizeof(app_feed_log_record_t) == 32, "app_feed_log_record_t must be 32 bytes, a divisor of the sector size");
+
+/* The partition is a ring of sectors, written in order: when the sector being written (head) is full, the next one,
+ * which holds the oldest records, is erased and written next. Every sector is thus erased once per turn of the ring,
+ * which levels the wear, and the records are only ever programmed once, over erased flash. Each record has its own
+ * CRC, so a record torn by a power cut is skipped instead of corrupting the log.
+ *
+ * Records are appended to a RAM batch from any task without touching the flash, and the batch is written by the
+ * event loop when FEED_LOG_FLUSH_THRESHOLD records are waiting, or FEED_LOG_FLUSH_DELAY_MS after the first one.
+ * The batch is also written when the firmware restarts (esp_restart), so that no record is lost by a restart.
+ * On boot, the head is found from the first record of each sector and a binary search of the head sector, so the
+ * recovery reads a few dozen records instead of the whole partition.
+ */
+
+static const char *TAG = "app_feed_log";                                  ///< Tag to be used when logging
+static const esp_partition_t *partition = NULL;                           ///< Feeding log partition
+static SemaphoreHandle_t flash_lock = NULL;                               ///< Mutex protecting the partition and the sectors state
+static uint8_t sectors_count = 0;                                         ///< Number of sectors of the partition used
+static uint8_t head_sector = 0;                                           ///< Sector being written
+static uint16_t head_slot = 0;                                            ///< Next record slot of the head sector to be written
+static uint32_t sector_first_seq[FEED_LOG_SECTORS_MAX];                   ///< Sequence number of the first record of each sector, FEED_LOG_SEQ_ERASED if none
+static portMUX_TYPE batch_lock = portMUX_INITIALIZER_UNLOCKED;            ///< Lock protecting the batch and the sequence numbers
+static app_feed_log_record_t batch[FEED_LOG_BATCH_LEN];                   ///< Records waiting to be written
+static uint8_t batch_count = 0;                                           ///< Number of records waiting to be written
+static uint8_t flush_posted = 0;                                          ///< Flag that indicates that a flush was posted to the event loop
+static uint32_t next_seq = 1;                                             ///< Sequence number of the next record
+static uint16_t boot = 1;                                                 ///< Boot number
+static uint32_t records_dropped = 0;                                      ///< Number of records dropped because the batch was full
+static esp_timer_handle_t flush_timer = NULL;                             ///< Timer to write the batch FEED_LOG_FLUSH_DELAY_MS after its first record
+
+static void app_feed_log__flush_handler(void *arg);
+static void app_feed_log__shutdown_handler(void);
+
+/**
+ * @brief Compute the CRC of a record.
+ *
+ * @param record Record.
+ * @return uint32_t CRC-32 of the record fields preceding the CRC.
+ */
+static uint32_t app_feed_log__crc(const app_feed_log_record_t *record)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(app_feed_log_record_t, crc));
+}
+
+/**
+ * @brief Read a record from the partition.
+ *
+ * @param sector Sector.
+ * @param slot Record slot in the sector.
+ * @param record Record read.
+ * @return uint8_t 1 if the record is valid (written and with a matching CRC), 0 otherwise.
+ */
+static uint8_t app_feed_log__read_record(uint8_t sector, uint16_t slot, app_feed_log_record_t *record)
+{
+    if (esp_partition_read(partition, sector * FEED_LOG_SECTOR_SIZE + slot * sizeof(*record), record, sizeof(*record)) != ESP_OK)
+    {
+        return 0;
+    }
+    return record->seq != FEED_LOG_SEQ_ERASED && record->crc == app_feed_log__crc(record);
+}
+
+/**
+ * @brief Check if a record slot is erased, i.e. can be written.
+ *
+ * @param sector Sector.
+ * @param slot Record slot in the sector.
+ * @return uint8_t 1 if every byte of the slot is erased, 0 otherwise.
+ */
+static uint8_t app_feed_log__slot_is_erased(uint8_t sector, uint16_t slot)
+{
+    uint32_t words[sizeof(app_feed_log_record_t) / sizeof(uint32_t)];
+
+    if (esp_partition_read(partition, sector * FEED_LOG_SECTOR_SIZE + slot * sizeof(words), words, sizeof(words)) != ESP_OK)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+    {
+        if (words[i] != FEED_LOG_SEQ_ERASED)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Find the head of the log after a boot: the head sector is the one whose first record has the highest
+ * sequence number, and the head slot the first erased slot of that sector, found by binary search since the slots
+ * are written in order. If no sector has a valid first record, the partition is erased and the log starts over.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code of the partition erase otherwise.
+ */
+static esp_err_t app_feed_log__recover(void)
+{
+    app_feed_log_record_t record;
+    uint8_t found = 0;
+
+    for (uint8_t sector = 0; sector < sectors_count; sector++)
+    {
+        sector_first_seq[sector] = FEED_LOG_SEQ_ERASED;
+        if (app_feed_log__read_record(sector, 0, &record))
+        {
+            sector_first_seq[sector] = record.seq;
+            if (!found || record.seq > sector_first_seq[head_sector])
+            {
+                head_sector = sector;
+                found = 1;
+            }
+        }
+    }
+    if (!found)
+    {
+        ESP_LOGW(TAG, "No records found, erasing partition");
+        head_sector = 0;
+        head_slot = 0;
+        return esp_partition_erase_range(partition, 0, (size_t)sectors_count * FEED_LOG_SECTOR_SIZE);
+    }
+
+    uint16_t lo = 1;
+    uint16_t hi = FEED_LOG_RECORDS_PER_SECTOR;
+    while (lo < hi)
+    {
+        uint16_t mid = (lo + hi) / 2;
+        uint32_t seq = 0;
+        esp_partition_read(partition, head_sector * FEED_LOG_SECTOR_SIZE + mid * sizeof(record), &seq, sizeof(seq));
+        if (seq == FEED_LOG_SEQ_ERASED)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    // a write torn by a power cut may have left the rest of the slot programmed
+    while (lo < FEED_LOG_RECORDS_PER_SECTOR && !app_feed_log__slot_is_erased(head_sector, lo))
+    {
+        lo++;
+    }
+    head_slot = lo;
+
+    // the last valid record gives the sequence and boot numbers to continue from
+    next_seq = sector_first_seq[head_sector] + 1;
+    boot = 1;
+    for (int slot = head_slot - 1; slot >= 0; slot--)
+    {
+        if (app_feed_log__read_record(head_sector, slot, &record))
+        {
+            next_seq = record.seq + 1;
+            boot = record.boot + 1;
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Initialize the feeding log: find the log head in the feedlog partition and record the boot. Must be
+ * called after the event loop is initialized.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK if the feeding log is successfully initialized.
+ * @retval ESP_FAIL otherwise.
+ */
+esp_err_t app_feed_log__init(void)
+{
+    if (partition != NULL)
+    {
+        return ESP_OK;
+    }
+
+    const esp_partition_t *feed_log_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                                                         FEED_LOG_PARTITION_LABEL);
+    if (feed_log_partition == NULL || feed_log_partition->size < 2 * FEED_LOG_SECTOR_SIZE)
+    {
+        ESP_LOGE(TAG, "Partition %s not found or smaller than 2 sectors", FEED_LOG_PARTITION_LABEL);
+        return ESP_FAIL;
+    }
+    flash_lock = xSemaphoreCreateMutex();
+    if (flash_lock == NULL)
+    {
+        ESP_LOGE(TAG, "Error creating flash lock");
+        return ESP_FAIL;
+    }
+    esp_err_t err = app_event__timer_create("feed_log", app_feed_log__flush_handler, NULL, &flush_timer);
+    if (err != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    partition = feed_log_partition;
+    sectors_count = partition->size / FEED_LOG_SECTOR_SIZE;
+    if (sectors_count > FEED_LOG_SECTORS_MAX)
+    {
+        sectors_count = FEED_LOG_SECTORS_MAX;
+    }
+    int64_t start_us = esp_timer_get_time();
+    err = app_feed_log__recover();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d recovering feeding log: %s", err, esp_err_to_name(err));
+        partition = NULL;
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Feeding log recovered in %d us: boot %d, next record %d (sector %d, slot %d)",
+             (int)(esp_timer_get_time() - start_us), boot, (int)next_seq, head_sector, head_slot);
+    err = esp_register_shutdown_handler(app_feed_log__shutdown_handler);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d registering shutdown handler: %s", err, esp_err_to_name(err));
+        partition = NULL;
+        return ESP_FAIL;
+    }
+
+    app_feed_log__append(app_feed_log_event_boot, NULL, 0, 0);
+    return ESP_OK;
+}
+
+/**
+ * @brief Append an event to the feeding log. The record is only batched in RAM, so this is cheap and never waits
+ * for the flash. Can be called from any task, but not from a critical section or an ISR.
+ *
+ * @param event Event.
+ * @param mac MAC address of the pet beacon, NULL if not applicable.
+ * @param rssi RSSI of the pet beacon (dBm), 0 if not applicable.
+ * @param duration_ms Duration of the visit or of the lid opening (ms), 0 if not applicable.
+ */
+void app_feed_log__append(app_feed_log_event_t event, const uint8_t mac[6], int8_t rssi, uint32_t duration_ms)
+{
+    app_feed_log_record_t record = {
+        .boot = boot,
+        .event = (uint8_t)event,
+        .rssi = rssi,
+        .time_ms = (uint32_t)(esp_timer_get_time() / 1000),
+        .duration_ms = duration_ms,
+    };
+    uint8_t post_flush = 0;
+    uint8_t start_timer = 0;
+
+    if (partition == NULL)
+    {
+        return;
+    }
+    if (mac != NULL)
+    {
+        memcpy(record.mac, mac, sizeof(record.mac));
+    }
+
+    taskENTER_CRITICAL(&batch_lock);
+    if (batch_count == FEED_LOG_BATCH_LEN)
+    {
+        records_dropped++;
+        taskEXIT_CRITICAL(&batch_lock);
+        return;
+    }
+    record.seq = next_seq++;
+    record.crc = app_feed_log__crc(&record);
+    batch[batch_count++] = record;
+    start_timer = (batch_count == 1);
+    if (batch_count >= FEED_LOG_FLUSH_THRESHOLD && !flush_posted)
+    {
+        flush_posted = 1;
+        post_flush = 1;
+    }
+    taskEXIT_CRITICAL(&batch_lock);
+
+    if (start_timer)
+    {
+        esp_timer_start_once(flush_timer, (uint64_t)FEED_LOG_FLUSH_DELAY_MS * 1000);
+    }
+    if (post_flush && app_event__post(app_feed_log__flush_handler, NULL) != ESP_OK)
+    {
+        // the flush timer writes the batch anyway
+        taskENTER_CRITICAL(&batch_lock);
+        flush_posted = 0;
+        taskEXIT_CRITICAL(&batch_lock);
+    }
+}
+
+/**
+ * @brief Write records to the head of the log, erasing the oldest sector when the head sector is full. Must be
+ * called with flash_lock taken.
+ *
+ * @param records Records.
+ * @param count Number of records.
+ * @return esp_err_t
+ * @retval ESP_OK if the records are written.
+ * @retval Error code of the partition erase or write otherwise.
+ */
+static esp_err_t app_feed_log__write(const app_feed_log_record_t *records, size_t count)
+{
+    esp_err_t err = ESP_OK;
+
+    while (count > 0)
+    {
+        if (head_slot == FEED_LOG_RECORDS_PER_SECTOR)
+        {
+            head_sector = (head_sector + 1) % sectors_count;
+            head_slot = 0;
+            sector_first_seq[head_sector] = FEED_LOG_SEQ_ERASED;
+            err = esp_partition_erase_range(partition, head_sector * FEED_LOG_SECTOR_SIZE, FEED_LOG_SECTOR_SIZE);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+        }
+
+        // records that fit in the head sector are written at once
+        size_t run = FEED_LOG_RECORDS_PER_SECTOR - head_slot;
+        if (run > count)
+        {
+            run = count;
+        }
+        err = esp_partition_write(partition, head_sector * FEED_LOG_SECTOR_SIZE + head_slot * sizeof(*records), records,
+                                  run * sizeof(*records));
+        if (head_slot == 0)
+        {
+            sector_first_seq[head_sector] = records[0].seq;
+        }
+        // on error the slots may be partly programmed, they are skipped
+        head_slot += run;
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        records += run;
+        count -= run;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Write the records batched in RAM to the flash. Blocks while the flash is written, and for tens of
+ * milliseconds when a sector must be erased, so it is normally left to the event loop. Can be called from any task,
+ * e.g. before a restart.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK if the batched records are written.
+ * @retval ESP_FAIL otherwise (the records are lost).
+ */
+esp_err_t app_feed_log__flush(void)
+{
+    app_feed_log_record_t records[FEED_LOG_BATCH_LEN];
+    uint8_t count;
+
+    if (partition == NULL)
+    {
+        return ESP_FAIL;
+    }
+    xSemaphoreTake(flash_lock, portMAX_DELAY);
+    // stopped before the batch is taken, so that a record appended right after starts it again
+    esp_timer_stop(flush_timer);
+    taskENTER_CRITICAL(&batch_lock);
+    count = batch_count;
+    memcpy(records, batch, count * sizeof(records[0]));
+    batch_count = 0;
+    flush_posted = 0;
+    taskEXIT_CRITICAL(&batch_lock);
+
+    esp_err_t err = app_feed_log__write(records, count);
+    xSemaphoreGive(flash_lock);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d writing %d records: %s", err, count, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    if (records_dropped)
+    {
+        ESP_LOGW(TAG, "%d records dropped so far, batch full", (int)records_dropped);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Handler of the flushes posted by app_feed_log__append and of flush_timer, run by the event loop.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_feed_log__flush_handler(void *arg)
+{
+    app_feed_log__flush();
+}
+
+/**
+ * @brief Shutdown handler, run by esp_restart: write the batched records, so that no record is lost by a restart.
+ *
+ */
+static void app_feed_log__shutdown_handler(void)
+{
+    app_feed_log__flush();
+}
+
+/**
+ * @brief Read records from the feeding log, oldest first. Only the records already written to the flash are read.
+ * Can be called from any task.
+ *
+ * @param from_seq Sequence number of the first record to be read; older records are skipped. A record following the
+ * last one read is read with its sequence number plus one.
+ * @param records Records read.
+ * @param max Maximum number of records to be read.
+ * @return size_t Number of records read.
+ */
+size_t app_feed_log__read(uint32_t from_seq, app_feed_log_record_t *records, size_t max)
+{
+    app_feed_log_record_t chunk[FEED_LOG_READ_CHUNK];
+    size_t count = 0;
+
+    if (partition == NULL)
+    {
+        return 0;
+    }
+    xSemaphoreTake(flash_lock, portMAX_DELAY);
+    for (uint8_t i = 1; i <= sectors_count && count < max; i++)
+    {
+        // from the sector after the head (oldest) to the head
+        uint8_t sector = (head_sector + i) % sectors_count;
+        uint8_t next_sector = (sector + 1) % sectors_count;
+        if (sector_first_seq[sector] == FEED_LOG_SEQ_ERASED)
+        {
+            continue;
+        }
+        if (sector != head_sector && sector_first_seq[next_sector] != FEED_LOG_SEQ_ERASED &&
+            sector_first_seq[next_sector] <= from_seq)
+        {
+            // every record of the sector is older than from_seq
+            continue;
+        }
+        uint16_t slots = (sector == head_sector) ? head_slot : FEED_LOG_RECORDS_PER_SECTOR;
+        for (uint16_t slot = 0; slot < slots && count < max; slot += FEED_LOG_READ_CHUNK)
+        {
+            uint16_t chunk_len = (slots - slot < FEED_LOG_READ_CHUNK) ? slots - slot : FEED_LOG_READ_CHUNK;
+            if (esp_partition_read(partition, sector * FEED_LOG_SECTOR_SIZE + slot * sizeof(chunk[0]), chunk,
+                                   chunk_len * sizeof(chunk[0])) != ESP_OK)
+            {
+                continue;
+            }
+            for (uint16_t j = 0; j < chunk_len && count < max; j++)
+            {
+                if (chunk[j].seq != FEED_LOG_SEQ_ERASED && chunk[j].seq >= from_seq &&
+                    chunk[j].crc == app_feed_log__crc(&chunk[j]))
+                {
+                    records[count++] = chunk[j];
+                }
+            }
+        }
+    }
+    xSemaphoreGive(flash_lock);
+    return count;
+}
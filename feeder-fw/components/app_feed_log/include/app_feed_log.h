@@ -0,0 +1,47 @@
+/**
+ * @file app_feed_log.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Main header file of the app_feed_log component.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/// @brief Enum of the events recorded in the feeding log.
+typedef enum
+{
+    app_feed_log_event_boot = 0,    ///< Feeder booted
+    app_feed_log_event_visit_start, ///< Pet (authorized beacon) found at the feeder, with its MAC and RSSI
+    app_feed_log_event_visit_end,   ///< Pet lost, with its MAC and the visit duration
+    app_feed_log_event_lid_open,    ///< Lid reached the open position
+    app_feed_log_event_lid_close,   ///< Lid reached the closed position, with the time it was open
+    app_feed_log_event_lid_stall,   ///< Lid servo stalled
+} app_feed_log_event_t;
+
+/// @brief Typedef for a feeding log record, stored as is (little-endian) in the feedlog partition.
+typedef struct
+{
+    uint32_t seq;         ///< Sequence number, increasing across boots
+    uint16_t boot;        ///< Boot number
+    uint8_t event;        ///< Event (app_feed_log_event_t)
+    int8_t rssi;          ///< RSSI of the pet beacon (dBm), 0 if not applicable
+    uint32_t time_ms;     ///< Time of the event (ms since boot)
+    uint32_t duration_ms; ///< Duration of the visit or of the lid opening (ms), 0 if not applicable
+    uint8_t mac[6];       ///< MAC address of the pet beacon, all zero if not applicable
+    uint8_t reserved[6];  ///< Reserved, all zero
+    uint32_t crc;         ///< CRC-32 of the preceding fields
+} app_feed_log_record_t;
+
+esp_err_t app_feed_log__init(void);
+void app_feed_log__append(app_feed_log_event_t event, const uint8_t mac[6], int8_t rssi, uint32_t duration_ms);
+esp_err_t app_feed_log__flush(void);
+size_t app_feed_log__read(uint32_t from_seq, app_feed_log_record_t *records, size_t max);
@@ -23,7 +23,9 @@
 #define LOG_LOCAL_LEVEL ESP_LOG_INFO
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_system.h"
 #include "esp_intr_alloc.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -31,6 +33,7 @@
 
 #include "app_gpio.h"
 #include "app_wifi.h"
+#include "app_event.h"
 
 #define GPIO_BLUE_LED (2)                                                                        ///< Blue LED GPIO
 #define GPIO_RED_LED (4)                                                                         ///< Red LED GPIO
@@ -38,22 +41,92 @@
 #define GPIO_OUTPUT_PIN_SEL ((((uint64_t)1) << GPIO_BLUE_LED) | (((uint64_t)1) << GPIO_RED_LED)) ///< LEDs pin mask
 #define GPIO_INPUT_PIN_SEL (((uint64_t)1) << GPIO_BUTTON)                                        ///< Button pin mask
 #define BUTTON_HOLD_TIME_SECS (3)
+#define BUTTON_CHECK_PERIOD_MS (50) ///< Period for checking if the button is still pressed
+#define LED_REQUESTS_MAX (4)        ///< Maximum number of patterns queued or running per LED
+#define LED_BLINK_SLOW_MS (1000)    ///< Time on and time off of a slow blink (ms)
+#define LED_BLINK_FAST_MS (250)     ///< Time on and time off of a fast blink (ms)
+#define RESTART_DELAY_MS (3000)     ///< Time from a fatal error to the restart (ms)
+
+/* LED patterns are run asynchronously by a one-shot esp_timer per LED, whose callback sets the LED and arms the timer
+ * for the next step, so callers return immediately. Each LED runs the highest priority pattern requested for it (the
+ * oldest one among those with the same priority). A pattern that is preempted by a higher priority one starts over
+ * when it runs again. Patterns are removed when they have been repeated the requested number of times, or when they
+ * are stopped if they loop.
+ */
+
+/// @brief Typedef to store a pattern requested for a LED.
+typedef struct
+{
+    const app_gpio_led_pattern_t *pattern; ///< Pattern
+    uint8_t repeat;                        ///< Number of times the pattern must be run, APP_GPIO_LED_LOOP to loop until stopped
+    uint8_t priority;                      ///< Priority, higher values preempt lower ones
+    uint32_t sequence;                     ///< Request order, used to run the oldest request among those with the same priority
+} led_request_t;
+
+/// @brief Typedef to store the state of a LED.
+typedef struct
+{
+    gpio_num_t gpio;                           ///< LED GPIO
+    esp_timer_handle_t timer;                  ///< Timer to go to the next step of the running pattern
+    led_request_t requests[LED_REQUESTS_MAX];  ///< Patterns requested for the LED, unordered
+    uint8_t requests_count;                    ///< Number of patterns requested for the LED
+    int8_t running;                            ///< Index of the running request in requests, -1 if none
+    uint8_t step;                              ///< Running step of the running pattern
+    uint8_t repeat_count;                      ///< Number of times the running pattern has been completed
+} led_t;
 
 static const char *TAG = "app_gpio";                           ///< Tag to be used when logging
-static uint8_t button_pressed = 0;                             ///< Button state, 1 if pressed, 0 otherwise
-static TaskHandle_t app_gpio__check_button_task_handle = NULL; ///< Button state check task handle
+static esp_timer_handle_t button_timer = NULL;                 ///< Timer to check if the button is still pressed
+static esp_timer_handle_t restart_timer = NULL;                ///< Timer to restart after a fatal error
+static uint16_t button_hold_time_miliseconds = 0;              ///< Time the button has been held (ms)
+static volatile int64_t button_isr_us = 0;                     ///< Time of the last button interrupt (us since boot)
+static int64_t button_latency_max_us = 0;                      ///< Maximum time from button interrupt to its handler (us)
+static app_event_signal_t button_pressed_signal;               ///< Signal of a button press, raised by the button ISR
+static portMUX_TYPE leds_lock = portMUX_INITIALIZER_UNLOCKED;  ///< Lock protecting leds
+static uint32_t led_requests_sequence = 0;                     ///< Sequence number of the next LED pattern request
+static led_t leds[app_gpio_led_max] = {
+    [app_gpio_led_blue] = {.gpio = GPIO_BLUE_LED, .running = -1},
+    [app_gpio_led_red] = {.gpio = GPIO_RED_LED, .running = -1},
+};                                                             ///< LEDs
+static const uint16_t led_blink_slow_steps_ms[] = {LED_BLINK_SLOW_MS, LED_BLINK_SLOW_MS}; ///< Steps of a slow blink
+static const uint16_t led_blink_fast_steps_ms[] = {LED_BLINK_FAST_MS, LED_BLINK_FAST_MS}; ///< Steps of a fast blink
+static const app_gpio_led_pattern_t led_blink_slow = {
+    .steps_ms = led_blink_slow_steps_ms,
+    .steps_count = sizeof(led_blink_slow_steps_ms) / sizeof(led_blink_slow_steps_ms[0]),
+}; ///< Slow blink pattern
+static const app_gpio_led_pattern_t led_blink_fast = {
+    .steps_ms = led_blink_fast_steps_ms,
+    .steps_count = sizeof(led_blink_fast_steps_ms) / sizeof(led_blink_fast_steps_ms[0]),
+}; ///< Fast blink pattern
 
 static void IRAM_ATTR app_gpio__isr_handler(void *arg);
-static void app_gpio__check_button_task(void *arg);
+static void app_gpio__button_pressed_handler(void *arg);
+static void app_gpio__button_timer_handler(void *arg);
+static void app_gpio__led_timer_cb(void *arg);
 
-static void app_error_handling__restart(void)
+/**
+ * @brief Callback of restart_timer, run by the esp_timer task: restart.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_gpio__restart_timer_cb(void *arg)
 {
-    uint8_t reboot_delay_sec = 3;
-    ESP_LOGE(TAG, "Fatal error found, rebooting in %d seconds..", (int)reboot_delay_sec);
-    vTaskDelay((1000 * reboot_delay_sec) / portTICK_PERIOD_MS);
     esp_restart();
 }
 
+/**
+ * @brief Restart after RESTART_DELAY_MS, from restart_timer, so that the event loop is not blocked meanwhile. If the
+ * timer can not be started, restart at once.
+ */
+static void app_error_handling__restart(void)
+{
+    ESP_LOGE(TAG, "Fatal error found, rebooting in %d seconds..", RESTART_DELAY_MS / 1000);
+    if (restart_timer == NULL || esp_timer_start_once(restart_timer, (uint64_t)RESTART_DELAY_MS * 1000) != ESP_OK)
+    {
+        esp_restart();
+    }
+}
+
 /**
  * @brief Initialize GPIOs.
  *
@@ -80,8 +153,6 @@ esp_err_t app_gpio__init(void)
     // gpio_install_isr_service(ESP_INTR_FLAG_LEVEL1 | ESP_INTR_FLAG_EDGE | ESP_INTR_FLAG_SHARED | ESP_INTR_FLAG_IRAM);
     gpio_install_isr_service(0);
 
-    gpio_isr_handler_add(GPIO_BUTTON, app_gpio__isr_handler, NULL);
-
     config.pin_bit_mask = GPIO_OUTPUT_PIN_SEL;
     config.mode = GPIO_MODE_OUTPUT;
     config.pull_up_en = GPIO_PULLUP_DISABLE;
@@ -111,200 +182,377 @@ esp_err_t app_gpio__init(void)
     }
     ESP_LOGI(TAG, "Set blue LED GPIO to low");
 
-    if (xTaskCreate(app_gpio__check_button_task,
-                    "app_gpio__check_button_task", 2048, NULL, 10,
-                    &app_gpio__check_button_task_handle) != pdPASS)
+    for (int i = 0; i < app_gpio_led_max; i++)
     {
-        ESP_LOGE(TAG, "Error creating app_gpio__check_button_task");
+        const esp_timer_create_args_t led_timer_args = {
+            .callback = app_gpio__led_timer_cb,
+            .arg = &leds[i],
+            .name = "led",
+        };
+        if (leds[i].timer != NULL)
+        {
+            continue;
+        }
+        err = esp_timer_create(&led_timer_args, &leds[i].timer);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error %d creating LED timer: %s", err, esp_err_to_name(err));
+            return ESP_FAIL;
+        }
+    }
+
+    if (restart_timer == NULL)
+    {
+        const esp_timer_create_args_t restart_timer_args = {
+            .callback = app_gpio__restart_timer_cb,
+            .name = "restart",
+        };
+        err = esp_timer_create(&restart_timer_args, &restart_timer);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error %d creating restart timer: %s", err, esp_err_to_name(err));
+            return ESP_FAIL;
+        }
+    }
+
+    err = app_event__timer_create("button", app_gpio__button_timer_handler, NULL, &button_timer);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d creating button timer: %s", err, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+
+    // a signal, so that a press is never dropped and the button interrupt is always enabled again
+    err = app_event__signal_create(app_gpio__button_pressed_handler, NULL, &button_pressed_signal);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d creating button signal: %s", err, esp_err_to_name(err));
         return ESP_FAIL;
     }
-    vTaskSuspend(app_gpio__check_button_task_handle);
-    ESP_LOGI(TAG, "Created app_gpio__check_button_task");
+
+    // the handler raises a signal that uses button_timer, so it is only added once both exist
+    gpio_isr_handler_add(GPIO_BUTTON, app_gpio__isr_handler, NULL);
 
     return ESP_OK;
 }
 
 /**
- * @brief Slowly blink blue LED for the specified number of times.
+ * @brief Run LED step: set the LED and arm its timer for the duration of the step. If no pattern is selected to
+ * run, select the highest priority request, and if there are none turn the LED off. Must be called with leds_lock
+ * taken.
  *
- * @param times Number of times to blink the LED.
- * @return esp_err_t
- * @retval ESP_OK if LED is successfully blinked.
- * @retval ESP_FAIL otherwise.
+ * @param led LED.
  */
-esp_err_t app_gpio__blink_blue_led_slow(uint8_t times)
+static void app_gpio__led_run_step(led_t *led)
 {
-    for (uint8_t i = 0; i < times; i++)
+    if (led->running < 0)
     {
-        esp_err_t err = gpio_set_level(GPIO_BLUE_LED, 1);
-        if (err != ESP_OK)
+        for (int i = 0; i < led->requests_count; i++)
         {
-            ESP_LOGE(TAG, "Error %d setting blue LED GPIO to high: %s", err, esp_err_to_name(err));
-            return ESP_FAIL;
-        }
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        gpio_set_level(GPIO_BLUE_LED, 0);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Error %d setting blue LED GPIO to low: %s", err, esp_err_to_name(err));
-            return ESP_FAIL;
+            led_request_t *request = &led->requests[i];
+            if (led->running < 0 || request->priority > led->requests[led->running].priority ||
+                (request->priority == led->requests[led->running].priority &&
+                 request->sequence < led->requests[led->running].sequence))
+            {
+                led->running = i;
+            }
         }
-        if (i != times - 1)
+        led->step = 0;
+        led->repeat_count = 0;
+    }
+    if (led->running < 0)
+    {
+        gpio_set_level(led->gpio, 0);
+        return;
+    }
+
+    const app_gpio_led_pattern_t *pattern = led->requests[led->running].pattern;
+    gpio_set_level(led->gpio, (led->step % 2) == 0);
+    esp_timer_start_once(led->timer, (uint64_t)pattern->steps_ms[led->step] * 1000);
+}
+
+/**
+ * @brief Remove LED request. Must be called with leds_lock taken.
+ *
+ * @param led LED.
+ * @param index Index of the request to be removed.
+ */
+static void app_gpio__led_remove_request(led_t *led, int index)
+{
+    led->requests_count--;
+    led->requests[index] = led->requests[led->requests_count];
+    if (led->running == index)
+    {
+        led->running = -1;
+    }
+    else if (led->running == led->requests_count)
+    {
+        // the running request was moved to the removed one's place
+        led->running = index;
+    }
+}
+
+/**
+ * @brief Callback of the LED timers, goes to the next step of the running pattern. Does nothing if the timer was
+ * re-armed, by a pattern started or stopped, after it expired.
+ *
+ * @param arg LED (led_t).
+ */
+static void app_gpio__led_timer_cb(void *arg)
+{
+    led_t *led = (led_t *)arg;
+
+    taskENTER_CRITICAL(&leds_lock);
+    if (led->running >= 0 && !esp_timer_is_active(led->timer))
+    {
+        led_request_t *request = &led->requests[led->running];
+        led->step++;
+        if (led->step == request->pattern->steps_count)
         {
-            vTaskDelay(pdMS_TO_TICKS(1000));
+            led->step = 0;
+            led->repeat_count++;
+            if (request->repeat != APP_GPIO_LED_LOOP && led->repeat_count >= request->repeat)
+            {
+                app_gpio__led_remove_request(led, led->running);
+            }
         }
+        app_gpio__led_run_step(led);
     }
-    return ESP_OK;
+    taskEXIT_CRITICAL(&leds_lock);
 }
 
 /**
- * @brief Fastly blink blue LED for the specified number of times.
+ * @brief Start LED pattern. Returns immediately, the pattern is run asynchronously: right away if it has a higher
+ * priority than the running one (which is preempted and starts over when it runs again), otherwise once the
+ * patterns with the same or higher priority are done. Can be called from any task.
  *
- * @param times Number of times to blink the LED.
+ * @param led_id LED.
+ * @param pattern Pattern, must remain valid until it is done or stopped.
+ * @param repeat Number of times the pattern is run, APP_GPIO_LED_LOOP to loop until app_gpio__led_pattern_stop is
+ * called.
+ * @param priority Priority, e.g. APP_GPIO_LED_PRIORITY_STATUS or APP_GPIO_LED_PRIORITY_EVENT.
  * @return esp_err_t
- * @retval ESP_OK if LED is successfully blinked.
- * @retval ESP_FAIL otherwise.
+ * @retval ESP_OK if the pattern is successfully started or queued.
+ * @retval ESP_ERR_INVALID_ARG if the LED or the pattern are invalid.
+ * @retval ESP_ERR_INVALID_STATE if app_gpio was not initialized.
+ * @retval ESP_ERR_NO_MEM if LED_REQUESTS_MAX patterns are already requested for the LED.
  */
-esp_err_t app_gpio__blink_blue_led_fast(uint8_t times)
+esp_err_t app_gpio__led_pattern_start(app_gpio_led_t led_id, const app_gpio_led_pattern_t *pattern, uint8_t repeat, uint8_t priority)
 {
-    for (uint8_t i = 0; i < times; i++)
+    if (led_id >= app_gpio_led_max || pattern == NULL || pattern->steps_count == 0 || (pattern->steps_count % 2) != 0)
     {
-        esp_err_t err = gpio_set_level(GPIO_BLUE_LED, 1);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Error %d setting blue LED GPIO to high: %s", err, esp_err_to_name(err));
-            return ESP_FAIL;
-        }
-        vTaskDelay(pdMS_TO_TICKS(250));
-        gpio_set_level(GPIO_BLUE_LED, 0);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Error %d setting blue LED GPIO to low: %s", err, esp_err_to_name(err));
-            return ESP_FAIL;
-        }
-        if (i != times - 1)
+        return ESP_ERR_INVALID_ARG;
+    }
+    led_t *led = &leds[led_id];
+    if (led->timer == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = ESP_OK;
+    taskENTER_CRITICAL(&leds_lock);
+    if (led->requests_count == LED_REQUESTS_MAX)
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    else
+    {
+        led->requests[led->requests_count++] = (led_request_t){
+            .pattern = pattern,
+            .repeat = repeat,
+            .priority = priority,
+            .sequence = led_requests_sequence++,
+        };
+        if (led->running < 0 || priority > led->requests[led->running].priority)
         {
-            vTaskDelay(pdMS_TO_TICKS(250));
+            esp_timer_stop(led->timer);
+            led->running = -1;
+            app_gpio__led_run_step(led);
         }
     }
-    return ESP_OK;
+    taskEXIT_CRITICAL(&leds_lock);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error starting LED pattern, %d patterns already requested", LED_REQUESTS_MAX);
+    }
+    return err;
 }
 
 /**
- * @brief Slowly blink red LED for the specified number of times.
+ * @brief Stop LED pattern, removing all the requests of the pattern for the LED. If the pattern is running, the
+ * next requested one (if any) is started. Can be called from any task.
  *
- * @param times Number of times to blink the LED.
+ * @param led_id LED.
+ * @param pattern Pattern.
  * @return esp_err_t
- * @retval ESP_OK if LED is successfully blinked.
- * @retval ESP_FAIL otherwise.
+ * @retval ESP_OK if the pattern is successfully stopped or if it was not requested.
+ * @retval ESP_ERR_INVALID_ARG if the LED is invalid.
  */
-esp_err_t app_gpio__blink_red_led_slow(uint8_t times)
+esp_err_t app_gpio__led_pattern_stop(app_gpio_led_t led_id, const app_gpio_led_pattern_t *pattern)
 {
-    for (uint8_t i = 0; i < times; i++)
+    if (led_id >= app_gpio_led_max)
     {
-        esp_err_t err = gpio_set_level(GPIO_RED_LED, 1);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Error %d setting red LED GPIO to high: %s", err, esp_err_to_name(err));
-            return ESP_FAIL;
-        }
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        gpio_set_level(GPIO_RED_LED, 0);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Error %d setting red LED GPIO to low: %s", err, esp_err_to_name(err));
-            return ESP_FAIL;
-        }
-        if (i != times - 1)
+        return ESP_ERR_INVALID_ARG;
+    }
+    led_t *led = &leds[led_id];
+
+    taskENTER_CRITICAL(&leds_lock);
+    uint8_t running_stopped = 0;
+    for (int i = led->requests_count - 1; i >= 0; i--)
+    {
+        if (led->requests[i].pattern == pattern)
         {
-            vTaskDelay(pdMS_TO_TICKS(1000));
+            running_stopped |= (led->running == i);
+            app_gpio__led_remove_request(led, i);
         }
     }
+    if (running_stopped)
+    {
+        esp_timer_stop(led->timer);
+        app_gpio__led_run_step(led);
+    }
+    taskEXIT_CRITICAL(&leds_lock);
+
     return ESP_OK;
 }
 
 /**
- * @brief Fastly blink red LED for the specified number of times.
+ * @brief Blink LED for the specified number of times, as an event indication.
  *
- * @param times Number of times to blink the LED.
+ * @param led_id LED.
+ * @param pattern Blink pattern.
+ * @param times Number of times to blink the LED, nothing is done if 0.
  * @return esp_err_t
- * @retval ESP_OK if LED is successfully blinked.
- * @retval ESP_FAIL otherwise.
+ * @retval ESP_OK if blinking is successfully started or queued.
+ * @retval Error code of app_gpio__led_pattern_start otherwise.
  */
-esp_err_t app_gpio__blink_red_led_fast(uint8_t times)
+static esp_err_t app_gpio__blink_led(app_gpio_led_t led_id, const app_gpio_led_pattern_t *pattern, uint8_t times)
 {
-    for (uint8_t i = 0; i < times; i++)
+    if (times == 0)
     {
-        esp_err_t err = gpio_set_level(GPIO_RED_LED, 1);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Error %d setting red LED GPIO to high: %s", err, esp_err_to_name(err));
-            return ESP_FAIL;
-        }
-        vTaskDelay(pdMS_TO_TICKS(250));
-        gpio_set_level(GPIO_RED_LED, 0);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Error %d setting red LED GPIO to low: %s", err, esp_err_to_name(err));
-            return ESP_FAIL;
-        }
-        if (i != times - 1)
-        {
-            vTaskDelay(pdMS_TO_TICKS(250));
-        }
+        return ESP_OK;
     }
-    return ESP_OK;
+    return app_gpio__led_pattern_start(led_id, pattern, times, APP_GPIO_LED_PRIORITY_EVENT);
+}
+
+/**
+ * @brief Slowly blink blue LED for the specified number of times. Returns immediately, the LED is blinked
+ * asynchronously (see app_gpio__led_pattern_start).
+ *
+ * @param times Number of times to blink the LED.
+ * @return esp_err_t
+ * @retval ESP_OK if blinking is successfully started or queued.
+ * @retval Error code of app_gpio__led_pattern_start otherwise.
+ */
+esp_err_t app_gpio__blink_blue_led_slow(uint8_t times)
+{
+    return app_gpio__blink_led(app_gpio_led_blue, &led_blink_slow, times);
 }
 
+/**
+ * @brief Fastly blink blue LED for the specified number of times. Returns immediately, the LED is blinked
+ * asynchronously (see app_gpio__led_pattern_start).
+ *
+ * @param times Number of times to blink the LED.
+ * @return esp_err_t
+ * @retval ESP_OK if blinking is successfully started or queued.
+ * @retval Error code of app_gpio__led_pattern_start otherwise.
+ */
+esp_err_t app_gpio__blink_blue_led_fast(uint8_t times)
+{
+    return app_gpio__blink_led(app_gpio_led_blue, &led_blink_fast, times);
+}
+
+/**
+ * @brief Slowly blink red LED for the specified number of times. Returns immediately, the LED is blinked
+ * asynchronously (see app_gpio__led_pattern_start).
+ *
+ * @param times Number of times to blink the LED.
+ * @return esp_err_t
+ * @retval ESP_OK if blinking is successfully started or queued.
+ * @retval Error code of app_gpio__led_pattern_start otherwise.
+ */
+esp_err_t app_gpio__blink_red_led_slow(uint8_t times)
+{
+    return app_gpio__blink_led(app_gpio_led_red, &led_blink_slow, times);
+}
+
+/**
+ * @brief Fastly blink red LED for the specified number of times. Returns immediately, the LED is blinked
+ * asynchronously (see app_gpio__led_pattern_start).
+ *
+ * @param times Number of times to blink the LED.
+ * @return esp_err_t
+ * @retval ESP_OK if blinking is successfully started or queued.
+ * @retval Error code of app_gpio__led_pattern_start otherwise.
+ */
+esp_err_t app_gpio__blink_red_led_fast(uint8_t times)
+{
+    return app_gpio__blink_led(app_gpio_led_red, &led_blink_fast, times);
+}
+
+/**
+ * @brief Button interrupt handler. Disables the button interrupt, so that contact bounces do not flood the CPU, and
+ * signals the press to the event loop, which enables it again once the press is handled.
+ *
+ * @param arg Optional argument (not being used).
+ */
 static void IRAM_ATTR app_gpio__isr_handler(void *arg)
 {
     gpio_intr_disable(GPIO_BUTTON);
-    gpio_isr_handler_remove(GPIO_BUTTON);
-    if (!button_pressed)
+    button_isr_us = esp_timer_get_time();
+    app_event__signal_from_isr(button_pressed_signal);
+}
+
+/**
+ * @brief Handler of a button press, run by the event loop. Starts checking every BUTTON_CHECK_PERIOD_MS if the button
+ * is still pressed.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_gpio__button_pressed_handler(void *arg)
+{
+    int64_t latency_us = esp_timer_get_time() - button_isr_us;
+    if (latency_us > button_latency_max_us)
     {
-        button_pressed = 1;
-        vTaskResume(app_gpio__check_button_task_handle);
+        button_latency_max_us = latency_us;
+    }
+    ESP_LOGI(TAG, "Button interrupt handled after %d us (max %d us)", (int)latency_us, (int)button_latency_max_us);
+
+    button_hold_time_miliseconds = 0;
+    if (esp_timer_start_periodic(button_timer, BUTTON_CHECK_PERIOD_MS * 1000) != ESP_OK)
+    {
+        gpio_intr_enable(GPIO_BUTTON);
     }
-    gpio_isr_handler_add(GPIO_BUTTON, app_gpio__isr_handler, NULL);
-    gpio_intr_enable(GPIO_BUTTON);
 }
 
 /**
- * @brief Task to check if button is being holded for a specified amount of time.
+ * @brief Handler of button_timer, run by the event loop. Checks if button is being holded for a specified amount of
+ * time, and enables the button interrupt again when it is released or the time is reached.
  *
  * @param arg Optional argument (not being used).
  */
-static void app_gpio__check_button_task(void *arg)
+static void app_gpio__button_timer_handler(void *arg)
 {
-    uint16_t button_hold_time_miliseconds = 0;
-    uint8_t time_increment_miliseconds = 50;
-    esp_err_t err;
-    for (;;)
+    if (gpio_get_level(GPIO_BUTTON) != 0)
     {
-        if (gpio_get_level(GPIO_BUTTON) != 0)
-        {
-            button_hold_time_miliseconds = 0;
-            button_pressed = 0;
-            vTaskSuspend(NULL);
-        }
-        else
+        esp_timer_stop(button_timer);
+        gpio_intr_enable(GPIO_BUTTON);
+        return;
+    }
+
+    button_hold_time_miliseconds += BUTTON_CHECK_PERIOD_MS;
+    if (button_hold_time_miliseconds >= (BUTTON_HOLD_TIME_SECS * 1000))
+    {
+        esp_timer_stop(button_timer);
+        ESP_LOGI(TAG, "Button pressed for %d seconds, (re)starting web Wi-Fi", BUTTON_HOLD_TIME_SECS);
+        esp_err_t err = app_wifi__start();
+        if (err != ESP_OK)
         {
-            vTaskDelay(time_increment_miliseconds / portTICK_PERIOD_MS);
-            button_hold_time_miliseconds += time_increment_miliseconds;
-            if (button_hold_time_miliseconds >= (BUTTON_HOLD_TIME_SECS * 1000))
-            {
-                ESP_LOGI(TAG, "Button pressed for %d seconds, (re)starting web Wi-Fi", BUTTON_HOLD_TIME_SECS);
-                err = app_wifi__start();
-                if (err != ESP_OK)
-                {
-                    ESP_LOGE(TAG, "Error starting Wi-Fi from %s", __func__);
-                    app_error_handling__restart();
-                }
-                button_hold_time_miliseconds = 0;
-                button_pressed = 0;
-                vTaskSuspend(NULL);
-            }
+            ESP_LOGE(TAG, "Error starting Wi-Fi from %s", __func__);
+            app_error_handling__restart();
         }
+        gpio_intr_enable(GPIO_BUTTON);
     }
-    vTaskDelete(NULL);
 }
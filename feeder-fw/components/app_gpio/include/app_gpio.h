@@ -11,9 +11,32 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include "esp_err.h"
 
+#define APP_GPIO_LED_PRIORITY_STATUS (0) ///< Priority of the status indications, usually looping
+#define APP_GPIO_LED_PRIORITY_EVENT (1)  ///< Priority of the event indications (e.g. Wi-Fi started), shown over the status ones
+#define APP_GPIO_LED_LOOP (0)            ///< Repeat count of a pattern that loops until it is stopped
+
+/// @brief Typedef for the LEDs.
+typedef enum
+{
+    app_gpio_led_blue = 0, /**< Blue LED */
+    app_gpio_led_red,      /**< Red LED */
+    app_gpio_led_max,      /**< Number of LEDs */
+} app_gpio_led_t;
+
+/// @brief Typedef for a LED pattern: a sequence of steps, alternately with the LED on and off, starting with on.
+typedef struct
+{
+    const uint16_t *steps_ms; ///< Duration of each step (ms)
+    uint8_t steps_count;      ///< Number of steps, must be even so that the pattern ends with the LED off
+} app_gpio_led_pattern_t;
+
 esp_err_t app_gpio__init(void);
+esp_err_t app_gpio__led_pattern_start(app_gpio_led_t led, const app_gpio_led_pattern_t *pattern, uint8_t repeat, uint8_t priority);
+esp_err_t app_gpio__led_pattern_stop(app_gpio_led_t led, const app_gpio_led_pattern_t *pattern);
 esp_err_t app_gpio__blink_blue_led_slow(uint8_t times);
 esp_err_t app_gpio__blink_blue_led_fast(uint8_t times);
 esp_err_t app_gpio__blink_red_led_slow(uint8_t times);
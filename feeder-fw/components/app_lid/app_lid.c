@@ -0,0 +1,394 @@
+/**
+ * @file app_lid.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the lid controller: a state machine that moves the lid servo with app_pwm and watches the servo
+ * supply current, so that a lid jammed (e.g. on food) is detected, the servo stopped and the movement retried later.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "app_lid.h"
+#include "app_pwm.h"
+#include "app_measure_vcc.h"
+#include "app_event.h"
+#include "app_status.h"
+#include "app_feed_log.h"
+#include "app_nvs.h"
+
+#define LID_SETTLE_MS (100)              ///< Time the servo is still driven after the ramp (ms)
+#define LID_INIT_SETTLE_MS (500)         ///< Time the servo is driven at init, when the lid position is unknown (ms)
+#define SENSE_ADC_CHANNEL ADC_CHANNEL_3  ///< Channel of the servo current sense, GPIO 39 (VN in DevKitC V4)
+#define SENSE_SHUNT_MOHM (100)           ///< Shunt resistor between the servo ground and GND (mOhm)
+#define SENSE_PERIOD_MS (10)             ///< Period of the current readings while the servo moves (ms)
+#define STALL_TIME_MS (100)              ///< Time above the stall current, net of the time below it, to declare a stall (ms)
+#define RETRIES_MAX (3)                  ///< Number of retries after a stall before giving up until the next command
+#define RETRY_BACKOFF_MS (1000)          ///< Wait before the first retry, doubled on each retry (ms)
+
+/* The lid angles, the ramp time and the stall current are part of the configuration (see app_nvs.h), a change
+ * takes effect from the next movement.
+ *
+ * The servo has no position feedback, so the lid is considered to have reached its position when the movement ends
+ * without a stall. A servo moving freely draws a fraction of its stall current, which it only reaches when it is
+ * pushing against something. Below the stall current the stall time decreases, so the current pulses of each PWM
+ * period are not mistaken for a stall, nor a stall missed because a reading fell between pulses.
+ */
+
+static const char *TAG = "app_lid"; ///< Tag to be used when logging
+
+static app_pwm_motion_profile_t lid_closed_init_profile = {
+    .ramp_ms = 0,
+    .easing = app_pwm_easing_linear,
+    .settle_ms = LID_INIT_SETTLE_MS,
+}; ///< Profile to close the lid at init, jumping since the servo angle is unknown
+static app_pwm_motion_profile_t lid_closed_profile = {
+    .easing = app_pwm_easing_in_out,
+    .settle_ms = LID_SETTLE_MS,
+}; ///< Profile to close the lid
+static app_pwm_motion_profile_t lid_open_profile = {
+    .easing = app_pwm_easing_in_out,
+    .settle_ms = LID_SETTLE_MS,
+}; ///< Profile to open the lid
+
+static SemaphoreHandle_t lid_lock = NULL;               ///< Mutex protecting the lid state, app_pwm__move can not be called in a critical section
+static app_lid_state_t lid_state = app_lid_state_closed; ///< Current lid state
+static app_lid_state_t lid_target = app_lid_state_closed; ///< Target lid state, app_lid_state_open or app_lid_state_closed
+static uint8_t lid_retries = 0;                          ///< Number of retries of the current command
+static int64_t motion_end_us = 0;                        ///< Time at which the movement in progress ends (us since boot)
+static uint16_t stall_ms = 0;                            ///< Time above stall_current_ma, net of the time below it (ms)
+static uint16_t stall_current_ma = 0;                    ///< Servo current considered a stall (mA), from the configuration
+static int current_max_ma = 0;                           ///< Highest servo current of the movement in progress (mA)
+static int64_t opened_at_us = 0;                         ///< Time at which the lid reached the open position (us since boot), 0 if it is not open
+static esp_timer_handle_t lid_sense_timer = NULL;        ///< Timer to read the servo current while it moves
+static esp_timer_handle_t lid_retry_timer = NULL;        ///< Timer to retry a movement after a stall
+
+static esp_err_t app_lid__start_motion(app_lid_state_t target, const app_pwm_motion_profile_t *profile);
+static uint32_t app_lid__schedule_retry(void);
+static esp_err_t app_lid__command(app_lid_state_t target);
+static void app_lid__sense_timer_handler(void *arg);
+static void app_lid__retry_timer_handler(void *arg);
+static void app_lid__apply_config(const app_nvs_config_t *config);
+
+/**
+ * @brief Initialize lid controller: configure the servo current sense channel and close the lid. Must be called after
+ * app_measure_vcc__init and app_pwm__init.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK if the lid controller is successfully initialized.
+ * @retval ESP_FAIL otherwise.
+ */
+esp_err_t app_lid__init(void)
+{
+    // 0 dB attenuation, the shunt voltage stays below 950 mV up to 9.5 A
+    esp_err_t err = app_measure_vcc__config_channel(SENSE_ADC_CHANNEL, ADC_ATTEN_DB_0);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d configuring servo current sense: %s", err, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+
+    if (lid_lock == NULL)
+    {
+        lid_lock = xSemaphoreCreateMutex();
+        if (lid_lock == NULL)
+        {
+            ESP_LOGE(TAG, "Error creating lid lock");
+            return ESP_FAIL;
+        }
+        app_nvs_config_t config;
+        app_nvs__get_config(&config);
+        app_lid__apply_config(&config);
+        if (app_nvs__subscribe(app_lid__apply_config) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+    }
+    if (lid_sense_timer == NULL)
+    {
+        err = app_event__timer_create("lid_sense", app_lid__sense_timer_handler, NULL, &lid_sense_timer);
+        if (err != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+    }
+    if (lid_retry_timer == NULL)
+    {
+        err = app_event__timer_create("lid_retry", app_lid__retry_timer_handler, NULL, &lid_retry_timer);
+        if (err != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+    }
+
+    ESP_LOGI(TAG, "Closing lid...");
+    xSemaphoreTake(lid_lock, portMAX_DELAY);
+    lid_retries = 0;
+    err = app_lid__start_motion(app_lid_state_closed, &lid_closed_init_profile);
+    xSemaphoreGive(lid_lock);
+    return err;
+}
+
+/**
+ * @brief Open lid. Does nothing if the lid is open or opening. Can be called from any task.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK if the lid starts opening.
+ * @retval ESP_FAIL otherwise.
+ */
+esp_err_t app_lid__open(void)
+{
+    ESP_LOGI(TAG, "Opening lid");
+    return app_lid__command(app_lid_state_open);
+}
+
+/**
+ * @brief Close lid. Does nothing if the lid is closed or closing. Can be called from any task.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK if the lid starts closing.
+ * @retval ESP_FAIL otherwise.
+ */
+esp_err_t app_lid__close(void)
+{
+    ESP_LOGI(TAG, "Closing lid");
+    return app_lid__command(app_lid_state_closed);
+}
+
+/**
+ * @brief Get lid state.
+ *
+ * @return app_lid_state_t Lid state.
+ */
+app_lid_state_t app_lid__get_state(void)
+{
+    return lid_state;
+}
+
+/**
+ * @brief Move lid to a target state. A lid blocked on its way to the same target is moved again right away, with its
+ * retries reset.
+ *
+ * @param target Target state, app_lid_state_open or app_lid_state_closed.
+ * @return esp_err_t
+ * @retval ESP_OK if the lid starts moving, or is already at or moving to the target.
+ * @retval ESP_ERR_INVALID_STATE if the lid controller is not initialized.
+ * @retval ESP_FAIL otherwise.
+ */
+static esp_err_t app_lid__command(app_lid_state_t target)
+{
+    if (lid_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(lid_lock, portMAX_DELAY);
+    if (lid_target != target || lid_state == app_lid_state_blocked)
+    {
+        esp_timer_stop(lid_retry_timer);
+        lid_retries = 0;
+        err = app_lid__start_motion(target, (target == app_lid_state_open) ? &lid_open_profile : &lid_closed_profile);
+    }
+    xSemaphoreGive(lid_lock);
+    return err;
+}
+
+/**
+ * @brief Start moving the servo towards a target and reading its current. Must be called with lid_lock taken.
+ * lid_target only becomes the target once the servo starts moving, so that a failed command is not taken for one in
+ * progress and the next command for the same target moves the lid.
+ *
+ * @param target Target state, app_lid_state_open or app_lid_state_closed.
+ * @param profile Motion profile.
+ * @return esp_err_t
+ * @retval ESP_OK if the servo starts moving.
+ * @retval ESP_FAIL otherwise.
+ */
+static esp_err_t app_lid__start_motion(app_lid_state_t target, const app_pwm_motion_profile_t *profile)
+{
+    esp_err_t err = app_pwm__move(profile);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error moving lid servo");
+        return ESP_FAIL;
+    }
+    lid_target = target;
+    lid_state = (target == app_lid_state_open) ? app_lid_state_opening : app_lid_state_closing;
+    motion_end_us = esp_timer_get_time() + ((int64_t)profile->ramp_ms + profile->settle_ms) * 1000;
+    stall_ms = 0;
+    current_max_ma = 0;
+    esp_timer_stop(lid_sense_timer);
+    err = esp_timer_start_periodic(lid_sense_timer, SENSE_PERIOD_MS * 1000);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d starting lid_sense timer: %s", err, esp_err_to_name(err));
+        // without the current readings the movement would never end, so the lid is left blocked
+        app_pwm__stop();
+        lid_state = app_lid_state_blocked;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Handler of lid_sense_timer, reads the servo current. On a stall the servo is stopped and, unless RETRIES_MAX
+ * retries were already made, the movement is retried after a back-off. When the movement ends without a stall, the
+ * lid is at its target.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_lid__sense_timer_handler(void *arg)
+{
+    int sense_mv = 0;
+
+    xSemaphoreTake(lid_lock, portMAX_DELAY);
+    if (lid_state != app_lid_state_opening && lid_state != app_lid_state_closing)
+    {
+        esp_timer_stop(lid_sense_timer);
+        xSemaphoreGive(lid_lock);
+        return;
+    }
+
+    // the reading fails if a battery voltage burst is being converted, the sample is then skipped
+    int current_ma = 0;
+    if (app_measure_vcc__read_mv(SENSE_ADC_CHANNEL, &sense_mv) == ESP_OK)
+    {
+        current_ma = sense_mv * 1000 / SENSE_SHUNT_MOHM;
+        if (current_ma > current_max_ma)
+        {
+            current_max_ma = current_ma;
+        }
+        if (current_ma >= stall_current_ma)
+        {
+            stall_ms += SENSE_PERIOD_MS;
+        }
+        else
+        {
+            stall_ms = (stall_ms > SENSE_PERIOD_MS) ? stall_ms - SENSE_PERIOD_MS : 0;
+        }
+    }
+
+    if (stall_ms >= STALL_TIME_MS)
+    {
+        esp_timer_stop(lid_sense_timer);
+        app_pwm__stop();
+        lid_state = app_lid_state_blocked;
+        app_status__increment(app_status_counter_lid_stall);
+        app_feed_log__append(app_feed_log_event_lid_stall, NULL, 0, 0);
+        uint32_t backoff_ms = app_lid__schedule_retry();
+        if (backoff_ms != 0)
+        {
+            ESP_LOGW(TAG, "Lid servo stalled at %d mA, retry %d in %d ms", current_ma, lid_retries, (int)backoff_ms);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Lid servo stalled at %d mA, giving up after %d retries", current_ma, RETRIES_MAX);
+        }
+    }
+    else if (esp_timer_get_time() >= motion_end_us)
+    {
+        esp_timer_stop(lid_sense_timer);
+        lid_state = lid_target;
+        if (lid_state == app_lid_state_open)
+        {
+            app_status__increment(app_status_counter_lid_open);
+            app_feed_log__append(app_feed_log_event_lid_open, NULL, 0, 0);
+            opened_at_us = esp_timer_get_time();
+        }
+        else
+        {
+            app_status__increment(app_status_counter_lid_close);
+            app_feed_log__append(app_feed_log_event_lid_close, NULL, 0,
+                                 opened_at_us ? (uint32_t)((esp_timer_get_time() - opened_at_us) / 1000) : 0);
+            opened_at_us = 0;
+        }
+        ESP_LOGI(TAG, "Lid %s, peak servo current %d mA", (lid_state == app_lid_state_open) ? "open" : "closed", current_max_ma);
+    }
+    xSemaphoreGive(lid_lock);
+}
+
+/**
+ * @brief Start lid_retry_timer to retry the movement towards lid_target after a back-off, unless RETRIES_MAX retries
+ * were already made. Must be called with lid_lock taken.
+ *
+ * @return uint32_t Back-off before the retry (ms), 0 if no retry is left.
+ */
+static uint32_t app_lid__schedule_retry(void)
+{
+    if (lid_retries >= RETRIES_MAX)
+    {
+        return 0;
+    }
+    uint32_t backoff_ms = RETRY_BACKOFF_MS << lid_retries;
+    lid_retries++;
+    esp_timer_start_once(lid_retry_timer, (uint64_t)backoff_ms * 1000);
+    return backoff_ms;
+}
+
+/**
+ * @brief Handler of lid_retry_timer, moves the blocked lid towards its target again. If the servo does not start
+ * moving, the retry counts as one and the next one is scheduled.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_lid__retry_timer_handler(void *arg)
+{
+    xSemaphoreTake(lid_lock, portMAX_DELAY);
+    if (lid_state == app_lid_state_blocked)
+    {
+        ESP_LOGI(TAG, "Retrying to %s lid", (lid_target == app_lid_state_open) ? "open" : "close");
+        const app_pwm_motion_profile_t *profile = (lid_target == app_lid_state_open) ? &lid_open_profile : &lid_closed_profile;
+        if (app_lid__start_motion(lid_target, profile) != ESP_OK)
+        {
+            uint32_t backoff_ms = app_lid__schedule_retry();
+            if (backoff_ms != 0)
+            {
+                ESP_LOGW(TAG, "Lid servo did not start, retry %d in %d ms", lid_retries, (int)backoff_ms);
+            }
+            else
+            {
+                ESP_LOGE(TAG, "Lid servo did not start, giving up after %d retries", RETRIES_MAX);
+            }
+        }
+    }
+    xSemaphoreGive(lid_lock);
+}
+
+/**
+ * @brief Apply the configuration: lid angles, ramp time and stall current. Subscribed to the configuration changes,
+ * see app_nvs__subscribe.
+ *
+ * @param config Configuration.
+ */
+static void app_lid__apply_config(const app_nvs_config_t *config)
+{
+    xSemaphoreTake(lid_lock, portMAX_DELAY);
+    lid_closed_init_profile.target_angle_deg = config->lid_closed_angle_deg;
+    lid_closed_profile.target_angle_deg = config->lid_closed_angle_deg;
+    lid_closed_profile.ramp_ms = config->lid_ramp_ms;
+    lid_open_profile.target_angle_deg = config->lid_open_angle_deg;
+    lid_open_profile.ramp_ms = config->lid_ramp_ms;
+    stall_current_ma = config->lid_stall_current_ma;
+    xSemaphoreGive(lid_lock);
+}
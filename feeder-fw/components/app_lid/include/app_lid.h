@@ -0,0 +1,29 @@
+/**
+ * @file app_lid.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Main header file of the app_lid component.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+/// @brief Enum of the lid states.
+typedef enum
+{
+    app_lid_state_closed = 0, ///< Lid closed
+    app_lid_state_opening,    ///< Servo moving towards the open position
+    app_lid_state_open,       ///< Lid open
+    app_lid_state_closing,    ///< Servo moving towards the closed position
+    app_lid_state_blocked,    ///< Servo stalled before reaching its position, waiting to retry or given up
+} app_lid_state_t;
+
+esp_err_t app_lid__init(void);
+esp_err_t app_lid__open(void);
+esp_err_t app_lid__close(void);
+app_lid_state_t app_lid__get_state(void);
@@ -1,7 +1,8 @@
 /**
  * @file app_measure_vcc.c
  * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
- * @brief Contains code (buttons and LEDs) to measure the battery voltage.
+ * @brief Contains code (buttons and LEDs) to measure the battery voltage. Also owns the ADC unit, whose other
+ * channels are configured and read by the components that need them (e.g. the servo current sense of app_lid).
  * @version 0.1
  * @date 2024-03-23
  *
@@ -24,28 +25,64 @@
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/queue.h"
 
 #include "app_measure_vcc.h"
 #include "app_status.h"
+#include "app_event.h"
+#include "app_pwm.h"
+#include "app_pm.h"
+#include "app_measure_vcc_soc.h"
 
-#define VOLTAGE_MEAS_AVG_ARR_SIZE 10 ///< Voltage measurements average array size
+#define VCC_BURST_MODE (1)           ///< Read the battery voltage in bursts with the ADC continuous (DMA) mode (0: one oneshot reading at a time, other: bursts)
+#define VOLTAGE_MEAS_AVG_ARR_SIZE 10 ///< Voltage measurements average array size (oneshot mode)
+#define ADC_READ_PERIOD_MS 10000     ///< Period of the ADC readings
+#define BATTERY_LOW_MV (2500)        ///< Open-circuit battery voltage below which the battery is low (mV)
+#define LOAD_BASE_MA (40)            ///< Estimated load current with only the BLE scan running (mA)
+#define LOAD_BLE_ACTIVE_MA (60)      ///< Estimated extra load current while the BLE scan is active (mA)
+#define LOAD_WIFI_MA (100)           ///< Estimated extra load current while the Wi-Fi AP is on (mA)
+#define LOAD_SERVO_MA (250)          ///< Estimated extra load current while the servo is driven (mA)
+#if VCC_BURST_MODE
+#define VCC_BURST_SAMPLES (256)          ///< Number of samples averaged in a burst
+#define VCC_BURST_SAMPLE_FREQ_HZ (20000) ///< Sample frequency of the bursts, the lowest supported by the ESP32 (Hz)
+#define VCC_BURST_RETRY_MS (200)         ///< Wait before retrying a burst postponed or discarded because the servo was moving (ms)
+#endif // VCC_BURST_MODE
+#define ADC_CHANNELS_MAX (10)        ///< Number of channels of ADC unit 1
+#define VCC_ADC_CHANNEL ADC_CHANNEL_0 ///< Channel of the battery voltage divider, GPIO 36 (VP in DevKitC V4)
+
+/* In burst mode, the DMA fills a frame of VCC_BURST_SAMPLES samples (12.8 ms) while the CPU is idle, and the frame is
+ * averaged in a single pass, so each reading gives a battery verdict instead of one every VOLTAGE_MEAS_AVG_ARR_SIZE
+ * readings. Bursts are taken only while the servo is not driven, since its current drops the battery voltage.
+ * The oneshot readings of the other channels (e.g. the servo current sense) fail with ESP_ERR_TIMEOUT during a burst.
+ */
 
 static esp_err_t app_measure_vcc__calibrate_adc(adc_unit_t unit, adc_channel_t channel, adc_atten_t atten, adc_cali_handle_t *out_handle);
-static void app_measure_vcc__adc_read_task(void *args);
+static void app_measure_vcc__adc_read_handler(void *args);
+#if VCC_BURST_MODE
+static esp_err_t app_measure_vcc__burst_init(void);
+static bool app_measure_vcc__burst_done_cb(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data);
+static void app_measure_vcc__burst_done_handler(void *args);
+#endif // VCC_BURST_MODE
 
 static const char *TAG = "app_measure_vcc";  ///< Tag to be used when logging
-static adc_oneshot_unit_handle_t adc_handle; ///< ADC handle
+static adc_oneshot_unit_handle_t adc_handle = NULL; ///< ADC handle
 static adc_oneshot_unit_init_cfg_t init_config = {
     .unit_id = ADC_UNIT_1,
 }; ///< ADC initialization configuration
-static adc_cali_handle_t adc_cal_handle = NULL;                   ///< ADC calibration handle
-uint8_t calibration_successful = 0;                               ///< Flag to indicate if calibration was successful
+static adc_cali_handle_t adc_cal_handles[ADC_CHANNELS_MAX] = {NULL}; ///< ADC calibration handle of each channel, NULL if calibration failed
+#if !VCC_BURST_MODE
 int voltage_measurements[VOLTAGE_MEAS_AVG_ARR_SIZE] = {0};        ///< Array to store voltage measurements to calculate average
 int voltage_measurements_index = 0;                               ///< Index to keep track of the current measurement
-static TaskHandle_t app_measure_vcc__adc_read_task_handle = NULL; ///< Read ADC task handle
+#endif // !VCC_BURST_MODE
+static esp_timer_handle_t adc_read_timer = NULL;                  ///< Timer to perform the ADC readings periodically
+#if VCC_BURST_MODE
+static adc_continuous_handle_t adc_burst_handle = NULL;           ///< ADC continuous mode handle
+static adc_digi_output_data_t adc_burst_frame[VCC_BURST_SAMPLES]; ///< Samples of a burst
+static uint8_t burst_running = 0;                                 ///< Flag that indicates if a burst is being converted
+static app_event_signal_t burst_done_signal;                      ///< Signal of the end of a burst, raised by the ADC DMA ISR
+#endif // VCC_BURST_MODE
 
 /**
  * @brief Initialize VCC measurement.
@@ -56,10 +93,6 @@ static TaskHandle_t app_measure_vcc__adc_read_task_handle = NULL; ///< Read ADC
  */
 esp_err_t app_measure_vcc__init(void)
 {
-    adc_oneshot_chan_cfg_t adc_config = {
-        .bitwidth = ADC_BITWIDTH_12,
-        .atten = ADC_ATTEN_DB_12,
-    };
     esp_err_t err = adc_oneshot_new_unit(&init_config, &adc_handle);
     if (err != ESP_OK)
     {
@@ -67,33 +100,133 @@ esp_err_t app_measure_vcc__init(void)
         return ESP_FAIL;
     }
     ESP_LOGI(TAG, "Success creating new ADC unit!");
-    err = adc_oneshot_config_channel(adc_handle, ADC_CHANNEL_0, &adc_config); // GPIO 36 (VP in DevKitC V4)
+    err = app_measure_vcc__config_channel(VCC_ADC_CHANNEL, ADC_ATTEN_DB_12);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Error %d configuring ADC channel: %s", err, esp_err_to_name(err));
         return ESP_FAIL;
     }
-    ESP_LOGI(TAG, "Success configuring ADC channel!");
 
-    err = app_measure_vcc__calibrate_adc(ADC_UNIT_1, ADC_CHANNEL_0, ADC_ATTEN_DB_12, &adc_cal_handle);
+#if VCC_BURST_MODE
+    // a signal, so that the end of a burst is never dropped and the readings always go on
+    err = app_event__signal_create(app_measure_vcc__burst_done_handler, NULL, &burst_done_signal);
     if (err == ESP_OK)
     {
-        ESP_LOGI(TAG, "Success calibrating ADC!");
-        calibration_successful = 1;
+        err = app_measure_vcc__burst_init();
     }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d configuring ADC continuous mode: %s", err, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+#endif // VCC_BURST_MODE
 
-    if (xTaskCreate(app_measure_vcc__adc_read_task,
-                    "app_measure_vcc__adc_read_task", 2048, NULL, 10,
-                    &app_measure_vcc__adc_read_task_handle) != pdPASS)
+    // in burst mode the timer is one-shot, armed when each reading ends, so the first reading must not be dropped
+    err = app_event__timer_create("adc_read", app_measure_vcc__adc_read_handler, NULL, &adc_read_timer);
+#if VCC_BURST_MODE
+    if (err == ESP_OK)
     {
-        ESP_LOGE(TAG, "Error creating app_measure_vcc__adc_read_task");
+        err = esp_timer_start_once(adc_read_timer, 0);
+    }
+#else
+    if (err == ESP_OK)
+    {
+        err = esp_timer_start_periodic(adc_read_timer, ADC_READ_PERIOD_MS * 1000);
+    }
+#endif // VCC_BURST_MODE
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d starting ADC read timer: %s", err, esp_err_to_name(err));
         return ESP_FAIL;
     }
-    ESP_LOGI(TAG, "Created app_measure_vcc__adc_read_task");
+#if !VCC_BURST_MODE
+    // first reading right away, the next ones when the timer expires
+    app_event__post(app_measure_vcc__adc_read_handler, NULL);
+#endif // !VCC_BURST_MODE
+    ESP_LOGI(TAG, "Started ADC read timer");
     ESP_LOGI(TAG, "Success initializing app_measure_vcc component");
     return ESP_OK;
 }
 
+/**
+ * @brief Convert raw reading to voltage, with the channel calibration. If the channel could not be calibrated, the
+ * raw reading is scaled to 0-3300 mV.
+ *
+ * @param channel ADC channel.
+ * @param adc_raw Raw reading.
+ * @return int Voltage (mV).
+ */
+static int app_measure_vcc__raw_to_mv(adc_channel_t channel, int adc_raw)
+{
+    int voltage;
+    if (adc_cal_handles[channel] == NULL || adc_cali_raw_to_voltage(adc_cal_handles[channel], adc_raw, &voltage) != ESP_OK)
+    {
+        voltage = (adc_raw * 3300) / 4095;
+    }
+    return voltage;
+}
+
+/**
+ * @brief Configure and calibrate a channel of the ADC unit. Must be called after app_measure_vcc__init.
+ *
+ * @param channel ADC channel.
+ * @param atten ADC attenuation.
+ * @return esp_err_t
+ * @retval ESP_OK if the channel is successfully configured, even if its calibration failed.
+ * @retval ESP_ERR_INVALID_STATE if the ADC unit is not created.
+ * @retval ESP_FAIL otherwise.
+ */
+esp_err_t app_measure_vcc__config_channel(adc_channel_t channel, adc_atten_t atten)
+{
+    adc_oneshot_chan_cfg_t adc_config = {
+        .bitwidth = ADC_BITWIDTH_12,
+        .atten = atten,
+    };
+
+    if (adc_handle == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (channel >= ADC_CHANNELS_MAX)
+    {
+        return ESP_FAIL;
+    }
+    esp_err_t err = adc_oneshot_config_channel(adc_handle, channel, &adc_config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d configuring ADC channel %d: %s", err, channel, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Success configuring ADC channel %d!", channel);
+
+    if (adc_cal_handles[channel] == NULL)
+    {
+        app_measure_vcc__calibrate_adc(ADC_UNIT_1, channel, atten, &adc_cal_handles[channel]);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Read a channel of the ADC unit, configured with app_measure_vcc__config_channel.
+ *
+ * @param channel ADC channel.
+ * @param out_mv Voltage read (mV).
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval ESP_ERR_TIMEOUT if a burst is being converted.
+ * @retval Error code of adc_oneshot_read otherwise.
+ */
+esp_err_t app_measure_vcc__read_mv(adc_channel_t channel, int *out_mv)
+{
+    int adc_raw;
+    esp_err_t err = adc_oneshot_read(adc_handle, channel, &adc_raw);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    *out_mv = app_measure_vcc__raw_to_mv(channel, adc_raw);
+    return ESP_OK;
+}
+
 /**
  * @brief Calibrate ADC.
  *
@@ -132,58 +265,239 @@ static esp_err_t app_measure_vcc__calibrate_adc(adc_unit_t unit, adc_channel_t c
 }
 
 /**
- * @brief Task to perform the ADC readings.
+ * @brief Estimate the load current from the activities running, given by the power management locks held. The
+ * currents are nominal values, to be tuned with measurements of the actual board.
+ *
+ * @return int Estimated load current (mA).
+ */
+static int app_measure_vcc__load_ma(void)
+{
+    int load_ma = LOAD_BASE_MA;
+
+    if (app_pm__lock_is_held(app_pm_lock_ble_active))
+    {
+        load_ma += LOAD_BLE_ACTIVE_MA;
+    }
+    if (app_pm__lock_is_held(app_pm_lock_wifi))
+    {
+        load_ma += LOAD_WIFI_MA;
+    }
+    if (app_pm__lock_is_held(app_pm_lock_servo))
+    {
+        load_ma += LOAD_SERVO_MA;
+    }
+    return load_ma;
+}
+
+/**
+ * @brief Update the battery state estimate and the battery low status with a new battery voltage reading. The low
+ * status is given by the open-circuit voltage, so that a reading under load does not flag a good battery as low.
+ *
+ * @param avg Average battery voltage (mV).
+ */
+static void app_measure_vcc__check_battery(int avg)
+{
+    app_measure_vcc_battery_t battery;
+
+    app_measure_vcc_soc__update(avg, app_measure_vcc__load_ma(), esp_timer_get_time());
+    app_measure_vcc_soc__get(&battery);
+    ESP_LOGI(TAG, "Average voltage: %d mV, load %d mA, OCV %d mV, %d%%, runtime %d min", avg, battery.load_ma,
+             battery.ocv_mv, battery.percent, (int)battery.runtime_min);
+    app_status__set_gateway_battery(avg, battery.percent);
+    if (battery.ocv_mv < BATTERY_LOW_MV)
+    {
+        ESP_LOGW(TAG, "Battery voltage is low!");
+        app_status__set_battery_low_status(1);
+    }
+    else
+    {
+        ESP_LOGD(TAG, "Battery voltage is ok!");
+        app_status__set_battery_low_status(0);
+    }
+}
+
+/**
+ * @brief Get battery state estimate: voltage, state of charge and projected runtime. Can be called from any task.
+ *
+ * @param battery Battery state estimate. battery->valid is 0 until the first reading.
+ */
+void app_measure_vcc__get_battery(app_measure_vcc_battery_t *battery)
+{
+    app_measure_vcc_soc__get(battery);
+}
+
+#if VCC_BURST_MODE
+/**
+ * @brief Handler of adc_read_timer, run by the event loop to start a burst. The burst is postponed while the servo
+ * is being driven.
  *
  * @param args Optional argument (not being used).
  */
-static void app_measure_vcc__adc_read_task(void *args)
+static void app_measure_vcc__adc_read_handler(void *args)
 {
-    for (;;)
+    if (burst_running)
     {
-        int adc_raw;
-        int voltage;
-        esp_err_t err = adc_oneshot_read(adc_handle, ADC_CHANNEL_0, &adc_raw);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Error %d reading ADC: %s", err, esp_err_to_name(err));
-        }
-        else
+        return;
+    }
+    if (app_pwm__is_moving())
+    {
+        ESP_LOGD(TAG, "Servo moving, battery reading postponed");
+        esp_timer_start_once(adc_read_timer, VCC_BURST_RETRY_MS * 1000);
+        return;
+    }
+
+    burst_running = 1;
+    esp_err_t err = adc_continuous_start(adc_burst_handle);
+    if (err != ESP_OK)
+    {
+        burst_running = 0;
+        ESP_LOGE(TAG, "Error %d starting ADC burst: %s", err, esp_err_to_name(err));
+        esp_timer_start_once(adc_read_timer, ADC_READ_PERIOD_MS * 1000);
+    }
+}
+
+/**
+ * @brief Create ADC continuous mode handle, converting the battery channel only, one frame per burst.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code of the ADC continuous driver otherwise.
+ */
+static esp_err_t app_measure_vcc__burst_init(void)
+{
+    adc_continuous_handle_cfg_t handle_config = {
+        .max_store_buf_size = sizeof(adc_burst_frame),
+        .conv_frame_size = sizeof(adc_burst_frame),
+    };
+    adc_digi_pattern_config_t pattern = {
+        .atten = ADC_ATTEN_DB_12,
+        .channel = VCC_ADC_CHANNEL,
+        .unit = ADC_UNIT_1,
+        .bit_width = ADC_BITWIDTH_12,
+    };
+    adc_continuous_config_t config = {
+        .pattern_num = 1,
+        .adc_pattern = &pattern,
+        .sample_freq_hz = VCC_BURST_SAMPLE_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+    adc_continuous_evt_cbs_t cbs = {
+        .on_conv_done = app_measure_vcc__burst_done_cb,
+    };
+
+    if (adc_burst_handle != NULL)
+    {
+        return ESP_OK;
+    }
+    esp_err_t err = adc_continuous_new_handle(&handle_config, &adc_burst_handle);
+    if (err == ESP_OK)
+    {
+        err = adc_continuous_config(adc_burst_handle, &config);
+    }
+    if (err == ESP_OK)
+    {
+        err = adc_continuous_register_event_callbacks(adc_burst_handle, &cbs, NULL);
+    }
+    return err;
+}
+
+/**
+ * @brief ADC continuous mode conversion done callback, signals the end of the burst to the event loop. Runs in the
+ * ADC DMA ISR.
+ *
+ * @param handle ADC continuous mode handle.
+ * @param edata Converted frame.
+ * @param user_data Optional argument (not being used).
+ * @return bool Whether a higher priority task was woken, the event loop yields by itself.
+ */
+static bool IRAM_ATTR app_measure_vcc__burst_done_cb(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data)
+{
+    app_event__signal_from_isr(burst_done_signal);
+    return false;
+}
+
+/**
+ * @brief Handler of the end of a burst: stop the conversions and average the frame samples into a battery voltage
+ * reading. The reading is discarded, and retried shortly, if the servo started moving during the burst.
+ *
+ * @param args Optional argument (not being used).
+ */
+static void app_measure_vcc__burst_done_handler(void *args)
+{
+    uint32_t length = 0;
+    uint32_t raw_sum = 0;
+    uint32_t samples = 0;
+
+    if (!burst_running)
+    {
+        return;
+    }
+    esp_err_t err = adc_continuous_read(adc_burst_handle, (uint8_t *)adc_burst_frame, sizeof(adc_burst_frame), &length, 0);
+    adc_continuous_stop(adc_burst_handle);
+    burst_running = 0;
+    uint8_t servo_moved = app_pwm__is_moving();
+
+    if (err == ESP_OK && !servo_moved)
+    {
+        for (uint32_t i = 0; i < length / sizeof(adc_digi_output_data_t); i++)
         {
-            ESP_LOGI(TAG, "Raw ADC value: %d", adc_raw);
-            if (calibration_successful)
-            {
-                err = adc_cali_raw_to_voltage(adc_cal_handle, adc_raw, &voltage);
-                ESP_LOGI(TAG, "Voltage: %d mV", voltage);
-            }
-            else
+            if (adc_burst_frame[i].type1.channel == VCC_ADC_CHANNEL)
             {
-                voltage = (adc_raw * 3300) / 4095;
+                raw_sum += adc_burst_frame[i].type1.data;
+                samples++;
             }
-            voltage_measurements[voltage_measurements_index] = voltage;
-            voltage_measurements_index++;
-            if (voltage_measurements_index == VOLTAGE_MEAS_AVG_ARR_SIZE)
+        }
+    }
+    // discard the frames converted after this one, before the conversions were stopped
+    while (adc_continuous_read(adc_burst_handle, (uint8_t *)adc_burst_frame, sizeof(adc_burst_frame), &length, 0) == ESP_OK)
+    {
+    }
+
+    if (samples == 0)
+    {
+        if (!servo_moved)
+        {
+            ESP_LOGE(TAG, "Error %d reading ADC burst: %s", err, esp_err_to_name(err));
+        }
+        esp_timer_start_once(adc_read_timer, (servo_moved ? VCC_BURST_RETRY_MS : ADC_READ_PERIOD_MS) * 1000);
+        return;
+    }
+    int voltage = app_measure_vcc__raw_to_mv(VCC_ADC_CHANNEL, (raw_sum + samples / 2) / samples);
+    ESP_LOGI(TAG, "Voltage: %d mV (%d samples)", voltage, (int)samples);
+    app_measure_vcc__check_battery(voltage);
+    esp_timer_start_once(adc_read_timer, ADC_READ_PERIOD_MS * 1000);
+}
+#else
+/**
+ * @brief Handler of adc_read_timer, run by the event loop to perform an ADC reading.
+ *
+ * @param args Optional argument (not being used).
+ */
+static void app_measure_vcc__adc_read_handler(void *args)
+{
+    int voltage;
+    esp_err_t err = app_measure_vcc__read_mv(VCC_ADC_CHANNEL, &voltage);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d reading ADC: %s", err, esp_err_to_name(err));
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Voltage: %d mV", voltage);
+        voltage_measurements[voltage_measurements_index] = voltage;
+        voltage_measurements_index++;
+        if (voltage_measurements_index == VOLTAGE_MEAS_AVG_ARR_SIZE)
+        {
+            voltage_measurements_index = 0;
+            int avg = 0;
+            for (int i = 0; i < VOLTAGE_MEAS_AVG_ARR_SIZE; i++)
             {
-                voltage_measurements_index = 0;
-                int avg = 0;
-                for (int i = 0; i < VOLTAGE_MEAS_AVG_ARR_SIZE; i++)
-                {
-                    avg += voltage_measurements[i];
-                }
-                avg /= VOLTAGE_MEAS_AVG_ARR_SIZE;
-                ESP_LOGI(TAG, "Average voltage: %d mV", voltage);
-                if (avg < 2500)
-                {
-                    ESP_LOGW(TAG, "Battery voltage is low!");
-                    app_status__set_battery_low_status(1);
-                }
-                else
-                {
-                    ESP_LOGD(TAG, "Battery voltage is ok!");
-                    app_status__set_battery_low_status(0);
-                }
+                avg += voltage_measurements[i];
             }
+            avg /= VOLTAGE_MEAS_AVG_ARR_SIZE;
+            app_measure_vcc__check_battery(avg);
         }
-        vTaskDelay(10000 / portTICK_PERIOD_MS);
     }
-    vTaskDelete(NULL);
 }
+#endif // VCC_BURST_MODE
@@ -0,0 +1,231 @@
+/**
+ * @file app_measure_vcc_soc.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the battery state of charge estimator: the voltage readings are compensated for the load during
+ * the reading, mapped to a state of charge with the discharge curve of the battery, and the state of charge history
+ * is fitted to project the remaining runtime.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "app_measure_vcc_soc.h"
+
+#define SOC_R_INIT_MOHM (400)                          ///< Initial internal resistance estimate, two AA alkaline cells (mOhm)
+#define SOC_R_MIN_MOHM (50)                            ///< Minimum internal resistance estimate (mOhm)
+#define SOC_R_MAX_MOHM (3000)                          ///< Maximum internal resistance estimate (mOhm)
+#define SOC_R_MIN_LOAD_STEP_MA (50)                    ///< Minimum load step between two readings to estimate the internal resistance (mA)
+#define SOC_R_MAX_READINGS_GAP_US (60LL * 1000000)     ///< Maximum time between two readings to estimate the internal resistance (us)
+#define SOC_R_EWMA_SHIFT (2)                           ///< Weight of a new internal resistance estimate, 1 / 2^SOC_R_EWMA_SHIFT
+#define SOC_OCV_EWMA_SHIFT (2)                         ///< Weight of a new open-circuit voltage, 1 / 2^SOC_OCV_EWMA_SHIFT
+#define SOC_SWAP_STEP_PERMILLE (200)                   ///< State of charge rise considered a battery swap, restarting the estimate (per mille)
+#define SOC_HISTORY_LEN (96)                           ///< Number of state of charge points fitted to project the runtime
+#define SOC_HISTORY_PERIOD_US (15LL * 60 * 1000000)    ///< Time between two state of charge points (us), the history spans 24 h
+#define SOC_RUNTIME_MIN_SPAN_US (2LL * 60 * 60 * 1000000) ///< Minimum history span to project the runtime (us)
+
+/* The battery is modelled as an open-circuit voltage (OCV), which depends only on the state of charge, in series with
+ * an internal resistance. The load current is estimated by the caller from the activities running during the reading,
+ * and the resistance is learnt from consecutive readings taken under different loads. The discharge curve is the OCV
+ * at the ADC input of two AA alkaline cells at low drain; it must be replaced if the feeder is powered otherwise.
+ */
+
+/// @brief Typedef to store a point of the discharge curve.
+typedef struct
+{
+    uint16_t ocv_mv;   ///< Open-circuit voltage (mV)
+    uint16_t permille; ///< State of charge (per mille)
+} soc_curve_point_t;
+
+/// @brief Typedef to store a point of the state of charge history.
+typedef struct
+{
+    int64_t time_us;   ///< Time of the point (us since boot)
+    uint16_t permille; ///< State of charge (per mille)
+} soc_history_point_t;
+
+static const soc_curve_point_t soc_curve[] = {
+    {3200, 1000},
+    {3000, 900},
+    {2900, 800},
+    {2800, 700},
+    {2700, 550},
+    {2600, 400},
+    {2500, 250},
+    {2400, 150},
+    {2300, 80},
+    {2200, 30},
+    {2000, 0},
+}; ///< Discharge curve, in decreasing voltage order
+
+static portMUX_TYPE soc_lock = portMUX_INITIALIZER_UNLOCKED; ///< Lock protecting battery
+static app_measure_vcc_battery_t battery = {
+    .resistance_mohm = SOC_R_INIT_MOHM,
+    .runtime_min = -1,
+};                                                  ///< Battery state estimate
+static int prev_voltage_mv = 0;                     ///< Voltage of the previous reading (mV)
+static int prev_load_ma = 0;                        ///< Load during the previous reading (mA)
+static int64_t prev_time_us = 0;                    ///< Time of the previous reading (us since boot)
+static int32_t soc_q8 = 0;                          ///< State of charge (per mille, Q8), its fraction lets the average reach the readings
+static uint16_t soc_permille = 0;                   ///< State of charge, soc_q8 rounded (per mille)
+static soc_history_point_t history[SOC_HISTORY_LEN]; ///< State of charge history, ring buffer
+static uint8_t history_count = 0;                   ///< Number of points in the history
+static uint8_t history_index = 0;                   ///< Index of the next point of the history
+
+/**
+ * @brief Map open-circuit voltage to state of charge, interpolating the discharge curve.
+ *
+ * @param ocv_mv Open-circuit voltage (mV).
+ * @return uint16_t State of charge (per mille).
+ */
+static uint16_t app_measure_vcc_soc__ocv_to_permille(int ocv_mv)
+{
+    const int points = sizeof(soc_curve) / sizeof(soc_curve[0]);
+
+    if (ocv_mv >= soc_curve[0].ocv_mv)
+    {
+        return soc_curve[0].permille;
+    }
+    for (int i = 1; i < points; i++)
+    {
+        if (ocv_mv >= soc_curve[i].ocv_mv)
+        {
+            const soc_curve_point_t *hi = &soc_curve[i - 1];
+            const soc_curve_point_t *lo = &soc_curve[i];
+            return lo->permille + (ocv_mv - lo->ocv_mv) * (hi->permille - lo->permille) / (hi->ocv_mv - lo->ocv_mv);
+        }
+    }
+    return soc_curve[points - 1].permille;
+}
+
+/**
+ * @brief Project the time until the battery is empty with a least squares line fitted to the state of charge history.
+ *
+ * @return int32_t Projected runtime, -1 if the history is too short or the state of charge is not decreasing (min).
+ */
+static int32_t app_measure_vcc_soc__project_runtime_min(void)
+{
+    if (history_count < 2)
+    {
+        return -1;
+    }
+    uint8_t oldest = (history_index + SOC_HISTORY_LEN - history_count) % SOC_HISTORY_LEN;
+    int64_t t0_us = history[oldest].time_us;
+    int64_t newest_us = history[(history_index + SOC_HISTORY_LEN - 1) % SOC_HISTORY_LEN].time_us;
+    if (newest_us - t0_us < SOC_RUNTIME_MIN_SPAN_US)
+    {
+        return -1;
+    }
+
+    // times in hours from the oldest point, to keep the sums within single precision
+    float sum_t = 0, sum_s = 0, sum_tt = 0, sum_ts = 0;
+    for (uint8_t i = 0; i < history_count; i++)
+    {
+        const soc_history_point_t *point = &history[(oldest + i) % SOC_HISTORY_LEN];
+        float t = (float)(point->time_us - t0_us) / 3.6e9f;
+        float s = point->permille;
+        sum_t += t;
+        sum_s += s;
+        sum_tt += t * t;
+        sum_ts += t * s;
+    }
+    float n = history_count;
+    float slope_per_h = (n * sum_ts - sum_t * sum_s) / (n * sum_tt - sum_t * sum_t);
+    if (!(slope_per_h < 0))
+    {
+        return -1;
+    }
+    return (int32_t)(soc_permille / -slope_per_h * 60);
+}
+
+/**
+ * @brief Update the estimate with a new battery voltage reading. Must not be called concurrently (it is called by
+ * the event loop only).
+ *
+ * @param voltage_mv Battery voltage reading (mV).
+ * @param load_ma Estimated load current during the reading (mA).
+ * @param time_us Time of the reading (us since boot).
+ */
+void app_measure_vcc_soc__update(int voltage_mv, int load_ma, int64_t time_us)
+{
+    int resistance_mohm = battery.resistance_mohm;
+
+    // internal resistance from the voltage step between two close readings under different loads
+    if (prev_time_us != 0 && time_us - prev_time_us <= SOC_R_MAX_READINGS_GAP_US &&
+        (load_ma - prev_load_ma >= SOC_R_MIN_LOAD_STEP_MA || prev_load_ma - load_ma >= SOC_R_MIN_LOAD_STEP_MA))
+    {
+        int estimate_mohm = (prev_voltage_mv - voltage_mv) * 1000 / (load_ma - prev_load_ma);
+        if (estimate_mohm >= SOC_R_MIN_MOHM && estimate_mohm <= SOC_R_MAX_MOHM)
+        {
+            resistance_mohm += (estimate_mohm - resistance_mohm) / (1 << SOC_R_EWMA_SHIFT);
+        }
+    }
+    prev_voltage_mv = voltage_mv;
+    prev_load_ma = load_ma;
+    prev_time_us = time_us;
+
+    int ocv_mv = voltage_mv + load_ma * resistance_mohm / 1000;
+    uint16_t reading_permille = app_measure_vcc_soc__ocv_to_permille(ocv_mv);
+    if (history_count == 0 || reading_permille >= soc_permille + SOC_SWAP_STEP_PERMILLE)
+    {
+        // first reading or new battery, the history of the previous one is useless
+        soc_q8 = (int32_t)reading_permille * 256;
+        history_count = 0;
+    }
+    else
+    {
+        // averaged in Q8, as a step truncated to whole per mille would stop short of the readings
+        soc_q8 += ((int32_t)reading_permille * 256 - soc_q8) / (1 << SOC_OCV_EWMA_SHIFT);
+    }
+    soc_permille = (uint16_t)((soc_q8 + 128) / 256);
+
+    if (history_count == 0 || time_us - history[(history_index + SOC_HISTORY_LEN - 1) % SOC_HISTORY_LEN].time_us >= SOC_HISTORY_PERIOD_US)
+    {
+        history[history_index].time_us = time_us;
+        history[history_index].permille = soc_permille;
+        history_index = (history_index + 1) % SOC_HISTORY_LEN;
+        if (history_count < SOC_HISTORY_LEN)
+        {
+            history_count++;
+        }
+    }
+    int32_t runtime_min = app_measure_vcc_soc__project_runtime_min();
+
+    taskENTER_CRITICAL(&soc_lock);
+    battery.valid = 1;
+    battery.voltage_mv = voltage_mv;
+    battery.load_ma = load_ma;
+    battery.resistance_mohm = resistance_mohm;
+    battery.ocv_mv = ocv_mv;
+    battery.percent = (soc_permille + 5) / 10;
+    battery.runtime_min = runtime_min;
+    taskEXIT_CRITICAL(&soc_lock);
+}
+
+/**
+ * @brief Get battery state estimate. Can be called from any task.
+ *
+ * @param out Battery state estimate.
+ */
+void app_measure_vcc_soc__get(app_measure_vcc_battery_t *out)
+{
+    taskENTER_CRITICAL(&soc_lock);
+    memcpy(out, &battery, sizeof(*out));
+    taskEXIT_CRITICAL(&soc_lock);
+}
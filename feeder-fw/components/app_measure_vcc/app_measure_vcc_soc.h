@@ -0,0 +1,19 @@
+/**
+ * @file app_measure_vcc_soc.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Private header of the battery state of charge estimator of the app_measure_vcc component.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "app_measure_vcc.h"
+
+void app_measure_vcc_soc__update(int voltage_mv, int load_ma, int64_t time_us);
+void app_measure_vcc_soc__get(app_measure_vcc_battery_t *battery);
@@ -11,6 +11,24 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include "esp_err.h"
+#include "esp_adc/adc_oneshot.h"
+
+/// @brief Typedef to store the battery state estimate.
+typedef struct
+{
+    uint8_t valid;            ///< Flag that indicates if a reading was already taken
+    uint16_t voltage_mv;      ///< Last battery voltage reading, under load (mV)
+    uint16_t load_ma;         ///< Estimated load current during the last reading (mA)
+    uint16_t resistance_mohm; ///< Estimated battery internal resistance (mOhm)
+    uint16_t ocv_mv;          ///< Estimated open-circuit voltage, i.e. compensated for the load (mV)
+    uint8_t percent;          ///< State of charge (%)
+    int32_t runtime_min;      ///< Projected time until the battery is empty, -1 if not known yet (min)
+} app_measure_vcc_battery_t;
 
 esp_err_t app_measure_vcc__init(void);
+esp_err_t app_measure_vcc__config_channel(adc_channel_t channel, adc_atten_t atten);
+esp_err_t app_measure_vcc__read_mv(adc_channel_t channel, int *out_mv);
+void app_measure_vcc__get_battery(app_measure_vcc_battery_t *battery);
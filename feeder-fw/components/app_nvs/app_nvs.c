@@ -1,7 +1,8 @@
 /**
  * @file app_nvs.c
  * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
- * @brief Contains NVS-related code.
+ * @brief Contains NVS-related code: the configuration is read at boot, in a single versioned blob, into a RAM cache,
+ * read from RAM, and written back to NVS in debounced commits when it changes.
  * @version 0.1
  * @date 2024-03-16
  *
@@ -9,21 +10,145 @@
  *
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #define LOG_LOCAL_LEVEL ESP_LOG_NONE
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "nvs_flash.h"
 
 #include "app_nvs.h"
-#include "app_beacon.h"
+#include "app_event.h"
 
 #define MAIN_NVS_NAMESPACE "nvs_main"       ///< Main NVS namespace
-#define AUTHORIZED_MAC_ENTRY_KEY "auth_mac" ///< Authorized MAC entry key
+#define CONFIG_ENTRY_KEY "config"           ///< Configuration entry key (header followed by app_nvs_config_t)
+#define AUTHORIZED_MAC_ENTRY_KEY "auth_mac" ///< Authorized MAC entry key (single authorized MAC, written before the list of authorized MACs, read by the migration from version 0)
+#define AUTHORIZED_MACS_ENTRY_KEY "auth_macs" ///< Authorized MACs entry key (list of authorized MACs, written before the configuration blob, read by the migration from version 0)
+#define COMMIT_DELAY_MS (2000)              ///< Time without changes after which the changed keys are committed (ms)
+#define COMMIT_MAX_DELAY_MS (10000)         ///< Maximum time a change waits to be committed, however often the configuration changes (ms)
+#define CONFIG_SUBSCRIBERS_MAX (4)          ///< Maximum number of functions called when the configuration changes
+
+#define DIRTY_CONFIG (1 << 0)  ///< Dirty flag of the configuration key
+#define DIRTY_V0_KEYS (1 << 1) ///< Dirty flag of the version 0 keys, erased once the configuration migrated from them is written
+
+/* Defaults of the configuration fields, used when they are not in NVS or hold an invalid value. The detection
+ * thresholds can be overridden at build time (e.g. by the host replay benchmark, see host/beacon_replay.c) to tune
+ * them against recorded advertisement traces.
+ */
+#ifndef MIN_RSSI_FOR_DETECTION_DBM
+#define MIN_RSSI_FOR_DETECTION_DBM (-48) ///< Minimum RSSI for detection (dBm)
+#endif
+#ifndef MIN_TIMES_SEEN_FOR_DETECTION
+#define MIN_TIMES_SEEN_FOR_DETECTION (3) ///< Minimum times the beacon has to be seen with a sufficient RSSI and within a short period of time for detection
+#endif
+#define SCAN_IDLE_INTERVAL (1600)         ///< Scan interval while idle, 1600 * 0.625 = 1 s
+#define SCAN_IDLE_WINDOW (320)            ///< Scan window while idle, 320 * 0.625 = 200 ms (20% duty cycle). Spans two advertising events of a beacon advertising every 100 ms, so a single lost advertisement does not delay detection by a whole interval
+#define SCAN_ACTIVE_INTERVAL (400)        ///< Scan interval while active, 400 * 0.625 = 250 ms
+#define SCAN_ACTIVE_WINDOW (400)          ///< Scan window while active, 400 * 0.625 = 250 ms (continuous scan)
+#define LID_CLOSED_ANGLE_DEG (0)          ///< Servo angle with the lid closed (0.5 ms pulse)
+#define LID_OPEN_ANGLE_DEG (89)           ///< Servo angle with the lid open (1.49 ms pulse)
+#define LID_RAMP_MS (300)                 ///< Time to open or close the lid (ms)
+#define LID_STALL_CURRENT_MA (500)        ///< Servo current considered a stall (mA)
+#define WIFI_AP_SSID "PetDog ComeInt"     ///< Wi-Fi AP SSID
+#define WIFI_AP_PWD "Senha12345"          ///< Wi-Fi AP password
+#define WIFI_TIMEOUT_SECS (180)           ///< Time Wi-Fi is kept on after it is started (s)
+
+/* Limits of the configuration fields. */
+#define RSSI_MIN_DBM (-100)               ///< Lowest RSSI for detection (dBm)
+#define TIMES_SEEN_MAX (4)                ///< Highest minimum times seen for detection, MAX_TIMES_SEEN of app_beacon
+#define SCAN_INTERVAL_MIN (0x0004)        ///< Shortest scan interval and window allowed by the BLE specification (0.625 ms units)
+#define SCAN_INTERVAL_MAX (0x4000)        ///< Longest scan interval and window allowed by the BLE specification (0.625 ms units)
+#define LID_ANGLE_MAX_DEG (180)           ///< Servo travel, APP_PWM_SERVO_RANGE_DEG of app_pwm (degrees)
+#define LID_RAMP_MAX_MS (5000)            ///< Longest time to open or close the lid (ms)
+#define LID_STALL_CURRENT_MIN_MA (50)     ///< Lowest stall current (mA)
+#define LID_STALL_CURRENT_MAX_MA (5000)   ///< Highest stall current (mA)
+#define WIFI_TIMEOUT_MIN_SECS (10)        ///< Shortest time Wi-Fi is kept on (s)
+#define WIFI_PASSWORD_MIN_LEN (8)         ///< Shortest WPA2 password
+
+/// @brief Typedef for the header of the configuration blob.
+typedef struct
+{
+    uint16_t version; ///< Schema version (APP_NVS_CONFIG_VERSION when written by this firmware)
+    uint16_t size;    ///< Size of the configuration that follows the header (sizeof(app_nvs_config_t) of that version)
+} config_header_t;
 
-static const char *TAG = "app_nvs"; ///< Tag to be used when logging
+/// @brief Typedef to store the configuration blob.
+typedef struct
+{
+    config_header_t header;  ///< Header
+    app_nvs_config_t config; ///< Configuration
+} config_blob_t;
 
 /**
- * @brief Initialize NVS.
+ * @brief Typedef for the migrations of the configuration from a schema version to the next one.
+ *
+ * @param config Configuration, with the fields of the previous version loaded over the defaults.
+ */
+typedef void (*config_migration_t)(app_nvs_config_t *config);
+
+_Static_assert(sizeof(app_nvs_config_t) == 310, "app_nvs_config_t layout changed, see the schema in app_nvs.h");
+_Static_assert(APP_NVS_MAX_AUTHORIZED_MACS <= UINT8_MAX, "authorized_macs_count is a uint8_t");
+
+/* The NVS namespace is opened once, in app_nvs__init, and the handle is kept open. The configuration is read from
+ * NVS into the RAM cache by app_nvs__get_data, in a single read of the configuration blob, so reads never touch the
+ * flash. A setter changes the cache and marks its key as dirty, and the dirty keys are written and committed by the
+ * event loop COMMIT_DELAY_MS after the last change (or COMMIT_MAX_DELAY_MS after the first one), so a burst of
+ * changes costs a single write per key. A setting that must be durable before the caller goes on (e.g. before
+ * answering the web server request that set it) is committed right away with app_nvs__commit, and the dirty keys
+ * are also committed when the firmware restarts (esp_restart).
+ *
+ * The components that use the configuration read it when they are initialized and subscribe to its changes, so this
+ * component does not depend on them. The changes are notified by the event loop (notify_signal), not by the task that
+ * made them, so the subscribers do not run on the stack of the caller (e.g. an httpd request) nor race with the event
+ * loop handlers that read the state they apply the configuration to.
+ */
+
+static void app_nvs__migrate_v0(app_nvs_config_t *config);
+
+static const char *TAG = "app_nvs";                             ///< Tag to be used when logging
+static const app_nvs_config_t config_defaults = {
+    .authorized_macs_count = 0,
+    .min_rssi_for_detection_dbm = MIN_RSSI_FOR_DETECTION_DBM,
+    .min_times_seen_for_detection = MIN_TIMES_SEEN_FOR_DETECTION,
+    .lid_closed_angle_deg = LID_CLOSED_ANGLE_DEG,
+    .lid_open_angle_deg = LID_OPEN_ANGLE_DEG,
+    .scan_idle_interval = SCAN_IDLE_INTERVAL,
+    .scan_idle_window = SCAN_IDLE_WINDOW,
+    .scan_active_interval = SCAN_ACTIVE_INTERVAL,
+    .scan_active_window = SCAN_ACTIVE_WINDOW,
+    .lid_ramp_ms = LID_RAMP_MS,
+    .lid_stall_current_ma = LID_STALL_CURRENT_MA,
+    .wifi_timeout_secs = WIFI_TIMEOUT_SECS,
+    .wifi_ssid = WIFI_AP_SSID,
+    .wifi_password = WIFI_AP_PWD,
+}; ///< Configuration defaults
+static const config_migration_t config_migrations[APP_NVS_CONFIG_VERSION] = {
+    [0] = app_nvs__migrate_v0,
+}; ///< Migration from each schema version to the next one, NULL if the next version only appends fields
+static nvs_handle_t nvs_handle;                                 ///< Handle of the main NVS namespace, open since app_nvs__init
+static SemaphoreHandle_t nvs_lock = NULL;                       ///< Mutex serializing the writes to NVS
+static portMUX_TYPE config_lock = portMUX_INITIALIZER_UNLOCKED; ///< Lock protecting config, dirty, dirty_since_us and the subscribers
+static app_nvs_config_t config;                                 ///< Configuration cache
+static uint32_t dirty = 0;                                      ///< Keys changed in the cache and not committed yet (DIRTY_* flags)
+static int64_t dirty_since_us = 0;                              ///< Time of the first change not committed yet (us since boot)
+static esp_timer_handle_t commit_timer = NULL;                  ///< Timer to commit the dirty keys COMMIT_DELAY_MS after the last change
+static app_nvs_config_cb_t subscribers[CONFIG_SUBSCRIBERS_MAX]; ///< Functions called when the configuration changes
+static uint8_t subscribers_count = 0;                           ///< Number of subscribers
+static app_event_signal_t notify_signal;                        ///< Signal of a configuration change, notified by the event loop
+
+static void app_nvs__commit_handler(void *arg);
+static void app_nvs__notify_handler(void *arg);
+static void app_nvs__shutdown_handler(void);
+
+/**
+ * @brief Initialize NVS: open the main namespace, keeping the handle open. The configuration cache holds the
+ * defaults until app_nvs__get_data reads the configuration from NVS. Must be called after app_event__init and before
+ * any other function of this component.
  *
  * @return esp_err_t
  * @retval ESP_OK if NVS is initialized successfully.
@@ -32,124 +157,510 @@ static const char *TAG = "app_nvs"; ///< Tag to be used when logging
 esp_err_t app_nvs__init(void)
 {
     ESP_LOGI(TAG, "Initializing NVS");
+    if (nvs_lock != NULL)
+    {
+        return ESP_OK;
+    }
+    config = config_defaults;
     esp_err_t err = nvs_flash_init();
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Error %d initializing NVS: %s", err, esp_err_to_name(err));
         return ESP_FAIL;
     }
+    err = nvs_open(MAIN_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d opening NVS: %s", err, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+
+    nvs_lock = xSemaphoreCreateMutex();
+    if (nvs_lock == NULL)
+    {
+        ESP_LOGE(TAG, "Error creating NVS mutex");
+        nvs_close(nvs_handle);
+        return ESP_FAIL;
+    }
+    err = app_event__timer_create("nvs_commit", app_nvs__commit_handler, NULL, &commit_timer);
+    if (err == ESP_OK)
+    {
+        err = app_event__signal_create(app_nvs__notify_handler, NULL, &notify_signal);
+    }
+    if (err != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    err = esp_register_shutdown_handler(app_nvs__shutdown_handler);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d registering shutdown handler: %s", err, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
     ESP_LOGI(TAG, "Success initializing NVS!");
     return ESP_OK;
 }
 
 /**
- * @brief Read all relevant data from NVS.
+ * @brief Migration from version 0, the individual keys written before the configuration blob: read the list of
+ * authorized MACs or, if it is not found, the single authorized MAC written by earlier firmware versions.
+ *
+ * @param config Configuration, holding the defaults.
+ */
+static void app_nvs__migrate_v0(app_nvs_config_t *config)
+{
+    size_t authorized_macs_len = sizeof(config->authorized_macs);
+    esp_err_t err = nvs_get_blob(nvs_handle, AUTHORIZED_MACS_ENTRY_KEY, config->authorized_macs, &authorized_macs_len);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        authorized_macs_len = 6;
+        err = nvs_get_blob(nvs_handle, AUTHORIZED_MAC_ENTRY_KEY, config->authorized_macs[0], &authorized_macs_len);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "No MAC address written to NVS yet");
+        return;
+    }
+    config->authorized_macs_count = authorized_macs_len / 6;
+    ESP_LOGI(TAG, "Migrated %d authorized MACs from version 0", (int)config->authorized_macs_count);
+}
+
+/**
+ * @brief Check the fields of a configuration, optionally replacing the invalid ones with their defaults.
+ *
+ * @param config Configuration.
+ * @param fix Replace the invalid fields with their defaults (0: False, other: True).
+ * @return int Number of invalid fields.
+ */
+static int app_nvs__validate(app_nvs_config_t *config, uint8_t fix)
+{
+    int invalid = 0;
+
+/// Count field as invalid if the condition is false and, if fixing, replace it with its default.
+#define CONFIG_CHECK(condition, field)                                                 \
+    do                                                                                 \
+    {                                                                                  \
+        if (!(condition))                                                              \
+        {                                                                              \
+            ESP_LOGW(TAG, "Invalid config field " #field);                             \
+            invalid++;                                                                 \
+            if (fix)                                                                   \
+            {                                                                          \
+                memcpy(&config->field, &config_defaults.field, sizeof(config->field)); \
+            }                                                                          \
+        }                                                                              \
+    } while (0)
+
+    CONFIG_CHECK(config->authorized_macs_count <= APP_NVS_MAX_AUTHORIZED_MACS, authorized_macs_count);
+    CONFIG_CHECK(config->min_rssi_for_detection_dbm >= RSSI_MIN_DBM && config->min_rssi_for_detection_dbm <= 0, min_rssi_for_detection_dbm);
+    CONFIG_CHECK(config->min_times_seen_for_detection >= 1 && config->min_times_seen_for_detection <= TIMES_SEEN_MAX, min_times_seen_for_detection);
+    CONFIG_CHECK(config->lid_closed_angle_deg <= LID_ANGLE_MAX_DEG, lid_closed_angle_deg);
+    CONFIG_CHECK(config->lid_open_angle_deg <= LID_ANGLE_MAX_DEG, lid_open_angle_deg);
+    CONFIG_CHECK(config->scan_idle_interval >= SCAN_INTERVAL_MIN && config->scan_idle_interval <= SCAN_INTERVAL_MAX, scan_idle_interval);
+    CONFIG_CHECK(config->scan_idle_window >= SCAN_INTERVAL_MIN && config->scan_idle_window <= config->scan_idle_interval, scan_idle_window);
+    CONFIG_CHECK(config->scan_active_interval >= SCAN_INTERVAL_MIN && config->scan_active_interval <= SCAN_INTERVAL_MAX, scan_active_interval);
+    CONFIG_CHECK(config->scan_active_window >= SCAN_INTERVAL_MIN && config->scan_active_window <= config->scan_active_interval, scan_active_window);
+    CONFIG_CHECK(config->lid_ramp_ms <= LID_RAMP_MAX_MS, lid_ramp_ms);
+    CONFIG_CHECK(config->lid_stall_current_ma >= LID_STALL_CURRENT_MIN_MA && config->lid_stall_current_ma <= LID_STALL_CURRENT_MAX_MA, lid_stall_current_ma);
+    CONFIG_CHECK(config->wifi_timeout_secs >= WIFI_TIMEOUT_MIN_SECS, wifi_timeout_secs);
+    size_t ssid_len = strnlen(config->wifi_ssid, sizeof(config->wifi_ssid));
+    CONFIG_CHECK(ssid_len > 0 && ssid_len < sizeof(config->wifi_ssid), wifi_ssid);
+    size_t password_len = strnlen(config->wifi_password, sizeof(config->wifi_password));
+    CONFIG_CHECK((password_len == 0 || password_len >= WIFI_PASSWORD_MIN_LEN) && password_len < sizeof(config->wifi_password), wifi_password);
+#undef CONFIG_CHECK
+
+    return invalid;
+}
+
+/**
+ * @brief Handler of notify_signal, run by the event loop: call the subscribers with the current configuration.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_nvs__notify_handler(void *arg)
+{
+    app_nvs_config_t config_copy;
+    app_nvs_config_cb_t subscribers_copy[CONFIG_SUBSCRIBERS_MAX];
+
+    taskENTER_CRITICAL(&config_lock);
+    config_copy = config;
+    uint8_t count = subscribers_count;
+    memcpy(subscribers_copy, subscribers, sizeof(subscribers_copy));
+    taskEXIT_CRITICAL(&config_lock);
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        subscribers_copy[i](&config_copy);
+    }
+}
+
+/**
+ * @brief Notify the subscribers of a configuration change, from the event loop. Changes made before the notification
+ * runs are notified once.
+ *
+ */
+static void app_nvs__notify(void)
+{
+    app_event__signal(notify_signal);
+}
+
+/**
+ * @brief Mark key as changed in the cache and (re)start the commit timer. The timer is not restarted once the first
+ * change not committed yet is older than COMMIT_MAX_DELAY_MS - COMMIT_DELAY_MS, so that a steady stream of changes
+ * is still committed. Must not be called with config_lock taken.
+ *
+ * @param key Dirty flag of the key (DIRTY_* flag).
+ */
+static void app_nvs__mark_dirty(uint32_t key)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&config_lock);
+    if (!dirty)
+    {
+        dirty_since_us = now_us;
+    }
+    dirty |= key;
+    uint8_t restart_timer = (now_us - dirty_since_us) < (int64_t)(COMMIT_MAX_DELAY_MS - COMMIT_DELAY_MS) * 1000;
+    taskEXIT_CRITICAL(&config_lock);
+
+    if (restart_timer || !esp_timer_is_active(commit_timer))
+    {
+        esp_timer_stop(commit_timer);
+        esp_timer_start_once(commit_timer, (uint64_t)COMMIT_DELAY_MS * 1000);
+    }
+}
+
+/**
+ * @brief Read the configuration from NVS into the cache, with a single read of the configuration blob, and notify
+ * the subscribers. A blob written by a previous schema version is migrated to the current one, and written back by
+ * the next commit, which also erases the version 0 keys. A blob written by a newer schema version can not be read,
+ * since its fields may have changed meaning, so the defaults are used and the blob is left as is, until the
+ * configuration is set again (e.g. from the web server). Invalid fields are replaced with their defaults.
  *
  * @return esp_err_t
- * @retval ESP_OK if data is successfully read from NVS.
- * @retval ESP_ERR_NOT_FOUND if some data is not found in NVS.
+ * @retval ESP_OK if the configuration is successfully read.
+ * @retval ESP_ERR_NOT_FOUND if there is no configuration in NVS, the defaults are used.
  * @retval ESP_FAIL otherwise.
  */
 esp_err_t app_nvs__get_data(void)
 {
     ESP_LOGI(TAG, "Getting NVS data");
-    uint8_t authorized_mac[6] = {0};
-    esp_err_t err = app_nvs__get_authorized_mac(authorized_mac);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND)
+    app_nvs_config_t new_config = config_defaults;
+    config_blob_t blob_buf;
+    config_blob_t *blob = &blob_buf;
+    size_t blob_len = sizeof(blob_buf);
+    uint16_t version = 0;
+
+    esp_err_t err = nvs_get_blob(nvs_handle, CONFIG_ENTRY_KEY, blob, &blob_len);
+    if (err == ESP_ERR_NVS_INVALID_LENGTH)
+    {
+        // written by a newer firmware version, with fields appended that this version does not know
+        blob = malloc(blob_len);
+        if (blob == NULL)
+        {
+            return ESP_FAIL;
+        }
+        err = nvs_get_blob(nvs_handle, CONFIG_ENTRY_KEY, blob, &blob_len);
+    }
+    if (err == ESP_OK && (blob_len < sizeof(config_header_t) || blob->header.version == 0 ||
+                          blob->header.size != blob_len - sizeof(config_header_t)))
+    {
+        ESP_LOGE(TAG, "Invalid configuration blob (%d bytes), using the defaults", (int)blob_len);
+        version = APP_NVS_CONFIG_VERSION;
+    }
+    else if (err == ESP_OK && blob->header.version > APP_NVS_CONFIG_VERSION)
+    {
+        // not marked dirty, so the blob is not downgraded unless the configuration is set again
+        ESP_LOGW(TAG, "Configuration written by schema version %d, newer than %d, using the defaults",
+                 (int)blob->header.version, APP_NVS_CONFIG_VERSION);
+        version = APP_NVS_CONFIG_VERSION;
+    }
+    else if (err == ESP_OK)
+    {
+        version = blob->header.version;
+        memcpy(&new_config, &blob->config, blob->header.size < sizeof(new_config) ? blob->header.size : sizeof(new_config));
+    }
+    else if (err != ESP_ERR_NVS_NOT_FOUND)
     {
-        ESP_LOGE(TAG, "Error %d getting authorized MAC from NVS: %s", err, esp_err_to_name(err));
+        ESP_LOGE(TAG, "Error %d getting blob from NVS: %s", err, esp_err_to_name(err));
+        if (blob != &blob_buf)
+        {
+            free(blob);
+        }
         return ESP_FAIL;
     }
-    else if (err == ESP_ERR_NVS_NOT_FOUND)
+    if (blob != &blob_buf)
     {
-        ESP_LOGW(TAG, "Could not find authorized MAC in NVS");
-        return ESP_ERR_NOT_FOUND;
+        free(blob);
     }
+
+    for (uint16_t i = version; i < APP_NVS_CONFIG_VERSION; i++)
     {
-        ESP_LOGI(TAG, "Success getting MAC address from NVS: 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x",
-                 authorized_mac[0], authorized_mac[1], authorized_mac[2], authorized_mac[3], authorized_mac[4], authorized_mac[5]);
-        ESP_LOGI(TAG, "Success getting data from NVS!");
-        return ESP_OK;
+        if (config_migrations[i] != NULL)
+        {
+            config_migrations[i](&new_config);
+        }
+    }
+    app_nvs__validate(&new_config, 1);
+
+    taskENTER_CRITICAL(&config_lock);
+    config = new_config;
+    taskEXIT_CRITICAL(&config_lock);
+    if (version < APP_NVS_CONFIG_VERSION && (err == ESP_OK || new_config.authorized_macs_count > 0))
+    {
+        ESP_LOGI(TAG, "Configuration migrated from version %d to %d", (int)version, APP_NVS_CONFIG_VERSION);
+        app_nvs__mark_dirty(DIRTY_CONFIG | ((version == 0) ? DIRTY_V0_KEYS : 0));
+    }
+    app_nvs__notify();
+
+    if (err == ESP_ERR_NVS_NOT_FOUND && new_config.authorized_macs_count == 0)
+    {
+        ESP_LOGW(TAG, "Could not find configuration in NVS, using the defaults");
+        return ESP_ERR_NOT_FOUND;
     }
+    ESP_LOGI(TAG, "Success getting data from NVS, %d authorized MACs", (int)new_config.authorized_macs_count);
+    return ESP_OK;
 }
 
 /**
- * @brief Write authorized MAC to NVS.
+ * @brief Add authorized MAC to the list of authorized MACs, and notify the subscribers. Adding a MAC that is already
+ * authorized does nothing. The list is committed to NVS by the event loop after COMMIT_DELAY_MS without changes, see
+ * app_nvs__commit to commit it right away.
  *
  * @param authorized_mac 6 bytes array with authorized MAC to be written.
  * @return esp_err_t
- * @retval ESP_OK if authorized MAC is sucessfully written to NVS.
- * @retval ESP_FAIL otherwise.
+ * @retval ESP_OK if authorized MAC is sucessfully added.
+ * @retval ESP_ERR_INVALID_ARG if MAC address is 00:00:00:00:00:00.
+ * @retval ESP_ERR_NO_MEM if the maximum number of authorized MACs has been reached.
  */
 esp_err_t app_nvs__set_authorized_mac(uint8_t authorized_mac[6])
 {
+    static const uint8_t zero_mac[6] = {0};
+
     ESP_LOGI(TAG, "Setting authorized MAC address in NVS");
-    nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open(MAIN_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
-    if (err != ESP_OK)
+    if (memcmp(authorized_mac, zero_mac, sizeof(zero_mac)) == 0)
     {
-        ESP_LOGE(TAG, "Error %d opening NVS: %s", err, esp_err_to_name(err));
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_ARG;
     }
-    else
+
+    taskENTER_CRITICAL(&config_lock);
+    for (size_t i = 0; i < config.authorized_macs_count; i++)
     {
-        ESP_LOGD(TAG, "Success opening NVS!");
-        err = nvs_set_blob(nvs_handle, AUTHORIZED_MAC_ENTRY_KEY, authorized_mac, 6);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Error %d setting blob in NVS: %s", err, esp_err_to_name(err));
-            return ESP_FAIL;
-        }
-        else
+        if (memcmp(config.authorized_macs[i], authorized_mac, 6) == 0)
         {
-            ESP_LOGD(TAG, "Success setting blob in NVS, authorized MAC: 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x",
-                     authorized_mac[0], authorized_mac[1], authorized_mac[2], authorized_mac[3], authorized_mac[4], authorized_mac[5]);
-            app_beacon__set_auth_mac(authorized_mac);
+            taskEXIT_CRITICAL(&config_lock);
+            ESP_LOGI(TAG, "MAC address already authorized");
             return ESP_OK;
         }
     }
+    if (config.authorized_macs_count == APP_NVS_MAX_AUTHORIZED_MACS)
+    {
+        taskEXIT_CRITICAL(&config_lock);
+        ESP_LOGE(TAG, "Maximum number of authorized MACs reached");
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(config.authorized_macs[config.authorized_macs_count], authorized_mac, 6);
+    config.authorized_macs_count++;
+    taskEXIT_CRITICAL(&config_lock);
+
+    ESP_LOGD(TAG, "Authorized MAC added to the cache: 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x",
+             authorized_mac[0], authorized_mac[1], authorized_mac[2], authorized_mac[3], authorized_mac[4], authorized_mac[5]);
+    app_nvs__mark_dirty(DIRTY_CONFIG);
+    app_nvs__notify();
+    return ESP_OK;
 }
 
 /**
- * @brief Reads authorized MAC from NVS.
+ * @brief Get authorized MACs from the cache.
  *
- * @param authorized_mac 6 bytes array where the authorized MAC will be stored.
+ * @param authorized_macs Array where the authorized MACs will be stored.
+ * @param authorized_macs_count Number of authorized MACs read.
  * @return esp_err_t
- * @retval ESP_OK if authorized MAC is successfully read from NVS.
- * @retval ESP_ERR_NVS_NOT_FOUND if authorized MAC is not found in NVS.
- * @retval ESP_FAIL otherwise.
+ * @retval ESP_OK if authorized MACs are successfully read.
+ * @retval ESP_ERR_NVS_NOT_FOUND if there is no authorized MAC.
  */
-esp_err_t app_nvs__get_authorized_mac(uint8_t authorized_mac[6])
+esp_err_t app_nvs__get_authorized_macs(uint8_t authorized_macs[APP_NVS_MAX_AUTHORIZED_MACS][6], size_t *authorized_macs_count)
 {
-    ESP_LOGI(TAG, "Getting authorized MAC address from NVS");
-    nvs_handle_t nvs_handle;
-    uint8_t authorized_mac_len = 6;
-    esp_err_t err = nvs_open(MAIN_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
-    if (err != ESP_OK)
+    taskENTER_CRITICAL(&config_lock);
+    *authorized_macs_count = config.authorized_macs_count;
+    memcpy(authorized_macs, config.authorized_macs, config.authorized_macs_count * 6);
+    taskEXIT_CRITICAL(&config_lock);
+
+    return (*authorized_macs_count > 0) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+/**
+ * @brief Get copy of the configuration cache.
+ *
+ * @param out_config Configuration.
+ */
+void app_nvs__get_config(app_nvs_config_t *out_config)
+{
+    taskENTER_CRITICAL(&config_lock);
+    *out_config = config;
+    taskEXIT_CRITICAL(&config_lock);
+}
+
+/**
+ * @brief Replace the configuration, and notify the subscribers. The configuration is committed to NVS by the event
+ * loop after COMMIT_DELAY_MS without changes, see app_nvs__commit to commit it right away.
+ *
+ * @param new_config New configuration.
+ * @return esp_err_t
+ * @retval ESP_OK if the configuration is replaced.
+ * @retval ESP_ERR_INVALID_ARG if a field of the configuration is invalid, the configuration is not changed.
+ */
+esp_err_t app_nvs__set_config(const app_nvs_config_t *new_config)
+{
+    app_nvs_config_t checked_config = *new_config;
+    if (app_nvs__validate(&checked_config, 0) != 0)
     {
-        ESP_LOGE(TAG, "Error %d opening NVS: %s", err, esp_err_to_name(err));
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_ARG;
+    }
+    checked_config.reserved = 0;
+
+    taskENTER_CRITICAL(&config_lock);
+    uint8_t changed = (memcmp(&config, &checked_config, sizeof(config)) != 0);
+    config = checked_config;
+    taskEXIT_CRITICAL(&config_lock);
+
+    if (changed)
+    {
+        app_nvs__mark_dirty(DIRTY_CONFIG);
+        app_nvs__notify();
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Subscribe to the configuration changes. The function is called by the event loop after the configuration
+ * changes (including when it is read from NVS by app_nvs__get_data), once for any number of changes made since its
+ * last run, so it must not block for long.
+ *
+ * @param cb Function to be called.
+ * @return esp_err_t
+ * @retval ESP_OK if the function is subscribed.
+ * @retval ESP_ERR_NO_MEM if CONFIG_SUBSCRIBERS_MAX functions are already subscribed.
+ */
+esp_err_t app_nvs__subscribe(app_nvs_config_cb_t cb)
+{
+    esp_err_t err = ESP_OK;
+
+    taskENTER_CRITICAL(&config_lock);
+    if (subscribers_count == CONFIG_SUBSCRIBERS_MAX)
+    {
+        err = ESP_ERR_NO_MEM;
     }
     else
     {
-        ESP_LOGD(TAG, "Success opening NVS!");
-        err = nvs_get_blob(nvs_handle, AUTHORIZED_MAC_ENTRY_KEY, authorized_mac, (size_t *)&authorized_mac_len);
-        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND)
+        subscribers[subscribers_count++] = cb;
+    }
+    taskEXIT_CRITICAL(&config_lock);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Maximum number of configuration subscribers reached");
+    }
+    return err;
+}
+
+/**
+ * @brief Write the dirty keys to NVS and commit them. Can be called from any task, but not from an ISR. If a write
+ * fails, its key stays dirty and is retried by the next commit.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK if every dirty key is committed, or if there is none.
+ * @retval ESP_FAIL otherwise.
+ */
+esp_err_t app_nvs__commit(void)
+{
+    esp_err_t err = ESP_OK;
+    config_blob_t blob = {
+        .header = {
+            .version = APP_NVS_CONFIG_VERSION,
+            .size = sizeof(app_nvs_config_t),
+        },
+    };
+
+    xSemaphoreTake(nvs_lock, portMAX_DELAY);
+    taskENTER_CRITICAL(&config_lock);
+    uint32_t keys = dirty;
+    dirty = 0;
+    blob.config = config;
+    taskEXIT_CRITICAL(&config_lock);
+
+    if (keys & DIRTY_CONFIG)
+    {
+        err = nvs_set_blob(nvs_handle, CONFIG_ENTRY_KEY, &blob, sizeof(blob));
+        if (err != ESP_OK)
         {
-            ESP_LOGE(TAG, "Error %d getting blob from NVS: %s", err, esp_err_to_name(err));
-            return ESP_FAIL;
+            ESP_LOGE(TAG, "Error %d setting blob in NVS: %s", err, esp_err_to_name(err));
         }
-        else if (err == ESP_ERR_NVS_NOT_FOUND)
+    }
+    if ((keys & DIRTY_V0_KEYS) && err == ESP_OK)
+    {
+        // only once the configuration migrated from them is written, so that the authorized MACs are never lost
+        const char *v0_keys[] = {AUTHORIZED_MAC_ENTRY_KEY, AUTHORIZED_MACS_ENTRY_KEY};
+        for (size_t i = 0; (i < sizeof(v0_keys) / sizeof(v0_keys[0])) && (err == ESP_OK); i++)
         {
-            ESP_LOGW(TAG, "No MAC address written to NVS yet");
-            return ESP_ERR_NVS_NOT_FOUND;
+            err = nvs_erase_key(nvs_handle, v0_keys[i]);
+            if (err == ESP_ERR_NVS_NOT_FOUND)
+            {
+                err = ESP_OK;
+            }
+            else if (err != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Error %d erasing %s from NVS: %s", err, v0_keys[i], esp_err_to_name(err));
+            }
         }
-        else
+    }
+    if (keys && err == ESP_OK)
+    {
+        err = nvs_commit(nvs_handle);
+        if (err != ESP_OK)
         {
-            ESP_LOGD(TAG, "Success getting blob from NVS, authorized MAC: 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x",
-                     authorized_mac[0], authorized_mac[1], authorized_mac[2], authorized_mac[3], authorized_mac[4], authorized_mac[5]);
-            app_beacon__set_auth_mac(authorized_mac);
-            return ESP_OK;
+            ESP_LOGE(TAG, "Error %d committing NVS: %s", err, esp_err_to_name(err));
         }
     }
+    if (err != ESP_OK)
+    {
+        taskENTER_CRITICAL(&config_lock);
+        if (!dirty)
+        {
+            dirty_since_us = esp_timer_get_time();
+        }
+        dirty |= keys;
+        taskEXIT_CRITICAL(&config_lock);
+    }
+    xSemaphoreGive(nvs_lock);
+
+    if (err != ESP_OK)
+    {
+        esp_timer_stop(commit_timer);
+        esp_timer_start_once(commit_timer, (uint64_t)COMMIT_DELAY_MS * 1000);
+        return ESP_FAIL;
+    }
+    ESP_LOGD(TAG, "Success committing NVS, keys 0x%x", (unsigned int)keys);
+    return ESP_OK;
+}
+
+/**
+ * @brief Handler of commit_timer, run by the event loop: commit the dirty keys.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_nvs__commit_handler(void *arg)
+{
+    app_nvs__commit();
+}
+
+/**
+ * @brief Shutdown handler, run by esp_restart: commit the dirty keys, so that no setting is lost by a restart.
+ *
+ */
+static void app_nvs__shutdown_handler(void)
+{
+    esp_timer_stop(commit_timer);
+    app_nvs__commit();
 }
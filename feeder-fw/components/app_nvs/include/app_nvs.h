@@ -11,9 +11,64 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
+#define APP_NVS_MAX_AUTHORIZED_MACS (32) ///< Maximum number of authorized MACs stored in NVS
+#define APP_NVS_CONFIG_VERSION (1)       ///< Version of the configuration schema (app_nvs_config_t)
+#define APP_NVS_WIFI_SSID_LEN (32)       ///< Maximum Wi-Fi AP SSID length, not including the terminator
+#define APP_NVS_WIFI_PASSWORD_LEN (64)   ///< Maximum Wi-Fi AP password length, not including the terminator
+
+/* The configuration is stored in NVS as a single blob: a header with the schema version and the size of the
+ * configuration, followed by app_nvs_config_t as laid out in memory. To keep the blobs written by previous versions
+ * readable, fields are only ever appended to the end of app_nvs_config_t, and the fields of a blob smaller than
+ * app_nvs_config_t keep their defaults. Any other change to the schema (e.g. the unit of a field) increments
+ * APP_NVS_CONFIG_VERSION and adds the migration from the previous version to app_nvs.c.
+ *
+ * Version 1 (310 bytes):
+ *   offset 0    authorized_macs[32][6]
+ *   offset 192  authorized_macs_count, min_rssi_for_detection_dbm, min_times_seen_for_detection, lid_closed_angle_deg,
+ *               lid_open_angle_deg, 1 reserved byte
+ *   offset 198  scan_idle_interval, scan_idle_window, scan_active_interval, scan_active_window, lid_ramp_ms,
+ *               lid_stall_current_ma, wifi_timeout_secs (2 bytes each)
+ *   offset 212  wifi_ssid[33], wifi_password[65]
+ */
+
+/// @brief Typedef to store the configuration kept in NVS, as cached in RAM.
+typedef struct
+{
+    uint8_t authorized_macs[APP_NVS_MAX_AUTHORIZED_MACS][6]; ///< Authorized beacon MACs
+    uint8_t authorized_macs_count;                           ///< Number of authorized MACs
+    int8_t min_rssi_for_detection_dbm;                       ///< Minimum RSSI for detection (dBm)
+    uint8_t min_times_seen_for_detection;                    ///< Minimum times the beacon has to be seen with a sufficient RSSI and within a short period of time for detection
+    uint8_t lid_closed_angle_deg;                            ///< Servo angle with the lid closed (degrees)
+    uint8_t lid_open_angle_deg;                              ///< Servo angle with the lid open (degrees)
+    uint8_t reserved;                                        ///< Reserved, 0
+    uint16_t scan_idle_interval;                             ///< BLE scan interval while idle (0.625 ms units)
+    uint16_t scan_idle_window;                               ///< BLE scan window while idle (0.625 ms units)
+    uint16_t scan_active_interval;                           ///< BLE scan interval while active (0.625 ms units)
+    uint16_t scan_active_window;                             ///< BLE scan window while active (0.625 ms units)
+    uint16_t lid_ramp_ms;                                    ///< Time to open or close the lid (ms)
+    uint16_t lid_stall_current_ma;                           ///< Servo current considered a stall (mA)
+    uint16_t wifi_timeout_secs;                              ///< Time Wi-Fi is kept on after it is started (s)
+    char wifi_ssid[APP_NVS_WIFI_SSID_LEN + 1];               ///< Wi-Fi AP SSID
+    char wifi_password[APP_NVS_WIFI_PASSWORD_LEN + 1];       ///< Wi-Fi AP password, empty for an open AP
+} app_nvs_config_t;
+
+/**
+ * @brief Typedef for the functions called when the configuration changes.
+ *
+ * @param config New configuration.
+ */
+typedef void (*app_nvs_config_cb_t)(const app_nvs_config_t *config);
+
 esp_err_t app_nvs__init(void);
 esp_err_t app_nvs__get_data(void);
 esp_err_t app_nvs__set_authorized_mac(uint8_t authorized_mac[6]);
-esp_err_t app_nvs__get_authorized_mac(uint8_t authorized_mac[6]);
\ No newline at end of file
+esp_err_t app_nvs__get_authorized_macs(uint8_t authorized_macs[APP_NVS_MAX_AUTHORIZED_MACS][6], size_t *authorized_macs_count);
+void app_nvs__get_config(app_nvs_config_t *out_config);
+esp_err_t app_nvs__set_config(const app_nvs_config_t *new_config);
+esp_err_t app_nvs__subscribe(app_nvs_config_cb_t cb);
+esp_err_t app_nvs__commit(void);
@@ -0,0 +1,279 @@
+/**
+ * @file app_pm.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains power management code: dynamic frequency scaling (DFS), automatic light sleep and the power
+ * management locks taken by the application around BLE, Wi-Fi and servo (LEDC) activity.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#include <stdio.h>
+
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif // CONFIG_PM_ENABLE
+
+#include "app_pm.h"
+
+#define LIGHT_SLEEP_ENABLE (1)                     ///< Enter light sleep automatically when idle (0: False, other: True)
+#define PRINT_STATS (0)                            ///< Print power management statistics periodically (0: False, other: True)
+#define PRINT_STATS_PERIOD_MS (10 * 60 * 1000)     ///< Period for printing power management statistics (ms)
+
+/* Every application lock is non-recursive: acquiring a lock that is already held (e.g. the servo is moved again
+ * before its PWM timer is paused) does nothing, so a single release always frees it. The time each lock is held
+ * is accounted even when power management is disabled, which is how the host simulation reports it.
+ *
+ * pm_locks_lock only covers the held flag and the statistics: the ESP-IDF lock is acquired or released after
+ * leaving the critical section, since esp_pm takes its own locks and may switch the CPU frequency. Each lock is
+ * acquired and released by a single owner (ble_active by the app_beacon scan state machine, servo under the app_pwm
+ * motion lock, wifi by app_wifi__start and app_wifi__stop), so the calls for the same lock never overlap.
+ */
+
+/// @brief Typedef to store an application power management lock and its statistics.
+typedef struct
+{
+    const char *name;            ///< Lock name
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_type_t type;     ///< Type of the ESP-IDF lock
+    esp_pm_lock_handle_t handle; ///< Handle of the ESP-IDF lock
+#endif // CONFIG_PM_ENABLE
+    uint8_t held;                ///< Flag that indicates if the lock is held
+    uint32_t acquired_count;     ///< Number of times the lock was acquired
+    int64_t acquired_at_us;      ///< Time when the lock was last acquired (us since boot)
+    int64_t held_us;             ///< Total time the lock was held, not including the current acquisition (us)
+} pm_lock_t;
+
+static const char *TAG = "app_pm"; ///< Tag to be used when logging
+static portMUX_TYPE pm_locks_lock = portMUX_INITIALIZER_UNLOCKED; ///< Lock protecting pm_locks
+static pm_lock_t pm_locks[app_pm_lock_max] = {
+#if CONFIG_PM_ENABLE
+    [app_pm_lock_ble_active] = {.name = "ble_active", .type = ESP_PM_CPU_FREQ_MAX},
+    [app_pm_lock_wifi] = {.name = "wifi", .type = ESP_PM_NO_LIGHT_SLEEP},
+    [app_pm_lock_servo] = {.name = "servo", .type = ESP_PM_APB_FREQ_MAX},
+#else
+    [app_pm_lock_ble_active] = {.name = "ble_active"},
+    [app_pm_lock_wifi] = {.name = "wifi"},
+    [app_pm_lock_servo] = {.name = "servo"},
+#endif // CONFIG_PM_ENABLE
+}; ///< Application power management locks
+#if PRINT_STATS
+static esp_timer_handle_t print_stats_timer = NULL; ///< Timer to print power management statistics periodically
+#endif // PRINT_STATS
+
+#if PRINT_STATS
+/**
+ * @brief Callback of print_stats_timer.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_pm__print_stats_timer_cb(void *arg)
+{
+    app_pm__print_stats();
+}
+#endif // PRINT_STATS
+
+/**
+ * @brief Initialize power management: configure DFS (CPU between the XTAL frequency and the default CPU frequency)
+ * and automatic light sleep, and create the application locks. Must be called before any other component that
+ * takes the locks is initialized.
+ *
+ * Note that the BT controller holds its own lock against light sleep while it is enabled, unless its low power
+ * clock is an external 32 kHz crystal (CONFIG_BTDM_CTRL_LPCLK_SEL_EXT_32K_XTAL). The sdkconfig keeps the main XTAL
+ * (CONFIG_BTDM_CTRL_LPCLK_SEL_MAIN_XTAL, with the RTC clock on the internal RC) and the controller is enabled from
+ * boot, so light sleep never engages: LIGHT_SLEEP_ENABLE is inert, and the savings come from DFS and the
+ * controller's modem sleep between scan windows.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code on failure.
+ */
+esp_err_t app_pm__init(void)
+{
+    esp_err_t err = ESP_OK;
+
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_XTAL_FREQ,
+        .light_sleep_enable = LIGHT_SLEEP_ENABLE,
+    };
+    err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error configuring power management: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    for (int i = 0; i < app_pm_lock_max; i++)
+    {
+        if (pm_locks[i].handle != NULL)
+        {
+            continue;
+        }
+        err = esp_pm_lock_create(pm_locks[i].type, 0, pm_locks[i].name, &pm_locks[i].handle);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error creating %s lock: %s", pm_locks[i].name, esp_err_to_name(err));
+            return err;
+        }
+    }
+    ESP_LOGI(TAG, "Power management configured, CPU %d-%d MHz, light sleep %s", pm_config.min_freq_mhz,
+             pm_config.max_freq_mhz, pm_config.light_sleep_enable ? "enabled" : "disabled");
+#else
+    ESP_LOGI(TAG, "Power management disabled (CONFIG_PM_ENABLE), only accounting lock usage");
+#endif // CONFIG_PM_ENABLE
+
+#if PRINT_STATS
+    const esp_timer_create_args_t print_stats_timer_args = {
+        .callback = app_pm__print_stats_timer_cb,
+        .name = "pm_stats",
+    };
+    if (print_stats_timer == NULL)
+    {
+        err = esp_timer_create(&print_stats_timer_args, &print_stats_timer);
+        if (err == ESP_OK)
+        {
+            err = esp_timer_start_periodic(print_stats_timer, (uint64_t)PRINT_STATS_PERIOD_MS * 1000);
+        }
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error starting pm_stats timer: %s", esp_err_to_name(err));
+        }
+    }
+#endif // PRINT_STATS
+
+    return err;
+}
+
+/**
+ * @brief Acquire application power management lock. Does nothing if the lock is already held. Can be called from
+ * any task.
+ *
+ * @param lock Lock to be acquired.
+ */
+void app_pm__lock_acquire(app_pm_lock_t lock)
+{
+    pm_lock_t *pm_lock = &pm_locks[lock];
+
+    taskENTER_CRITICAL(&pm_locks_lock);
+    uint8_t acquire = !pm_lock->held;
+    if (acquire)
+    {
+        pm_lock->held = 1;
+        pm_lock->acquired_count++;
+        pm_lock->acquired_at_us = esp_timer_get_time();
+    }
+    taskEXIT_CRITICAL(&pm_locks_lock);
+
+#if CONFIG_PM_ENABLE
+    if (acquire && (pm_lock->handle != NULL))
+    {
+        esp_pm_lock_acquire(pm_lock->handle);
+    }
+#else
+    (void)acquire;
+#endif // CONFIG_PM_ENABLE
+}
+
+/**
+ * @brief Release application power management lock. Does nothing if the lock is not held. Can be called from any
+ * task.
+ *
+ * @param lock Lock to be released.
+ */
+void app_pm__lock_release(app_pm_lock_t lock)
+{
+    pm_lock_t *pm_lock = &pm_locks[lock];
+
+    taskENTER_CRITICAL(&pm_locks_lock);
+    uint8_t release = pm_lock->held;
+    if (release)
+    {
+        pm_lock->held = 0;
+        pm_lock->held_us += esp_timer_get_time() - pm_lock->acquired_at_us;
+    }
+    taskEXIT_CRITICAL(&pm_locks_lock);
+
+#if CONFIG_PM_ENABLE
+    if (release && (pm_lock->handle != NULL))
+    {
+        esp_pm_lock_release(pm_lock->handle);
+    }
+#else
+    (void)release;
+#endif // CONFIG_PM_ENABLE
+}
+
+/**
+ * @brief Check if an application power management lock is held, i.e. if the activity it covers is running.
+ *
+ * @param lock Lock.
+ * @return uint8_t 1 if the lock is held, 0 otherwise.
+ */
+uint8_t app_pm__lock_is_held(app_pm_lock_t lock)
+{
+    return pm_locks[lock].held;
+}
+
+/**
+ * @brief Get total time an application power management lock has been held since boot.
+ *
+ * @param lock Lock.
+ * @return int64_t Time the lock has been held, including the current acquisition if it is held (us).
+ */
+int64_t app_pm__get_lock_held_us(app_pm_lock_t lock)
+{
+    pm_lock_t *pm_lock = &pm_locks[lock];
+
+    taskENTER_CRITICAL(&pm_locks_lock);
+    int64_t held_us = pm_lock->held_us;
+    if (pm_lock->held)
+    {
+        held_us += esp_timer_get_time() - pm_lock->acquired_at_us;
+    }
+    taskEXIT_CRITICAL(&pm_locks_lock);
+
+    return held_us;
+}
+
+/**
+ * @brief Print the residency of each application lock and, if CONFIG_PM_PROFILING is enabled, the residency of each
+ * power mode (CPU_MAX, APB_MAX, APB_MIN, LIGHT_SLEEP) and of all the locks in the system, including the ones taken by
+ * the BT and Wi-Fi drivers.
+ *
+ */
+void app_pm__print_stats(void)
+{
+    int64_t uptime_us = esp_timer_get_time();
+
+    for (int i = 0; i < app_pm_lock_max; i++)
+    {
+        int64_t held_us = app_pm__get_lock_held_us((app_pm_lock_t)i);
+        ESP_LOGI(TAG, "Lock %-10s acquired %6d times, held %10lld ms (%5.2f%%)", pm_locks[i].name,
+                 (int)pm_locks[i].acquired_count, (long long)(held_us / 1000),
+                 uptime_us ? 100.0 * held_us / uptime_us : 0.0);
+    }
+#if CONFIG_PM_ENABLE && CONFIG_PM_PROFILING
+    esp_pm_dump_locks(stdout);
+#endif // CONFIG_PM_ENABLE && CONFIG_PM_PROFILING
+}
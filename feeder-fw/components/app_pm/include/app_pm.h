@@ -0,0 +1,32 @@
+/**
+ * @file app_pm.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Main header file of the app_pm component.
+ * @version 0.1
+ * @date 2024-04-06
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/// @brief Typedef for the power management locks taken by the application.
+typedef enum
+{
+    app_pm_lock_ble_active = 0, /**< CPU at maximum frequency while the BLE scan is active (an authorized beacon is close) */
+    app_pm_lock_wifi,           /**< No light sleep while the Wi-Fi AP is on */
+    app_pm_lock_servo,          /**< APB at maximum frequency while the servo PWM (LEDC) timer is running */
+    app_pm_lock_max,            /**< Number of locks */
+} app_pm_lock_t;
+
+esp_err_t app_pm__init(void);
+void app_pm__lock_acquire(app_pm_lock_t lock);
+void app_pm__lock_release(app_pm_lock_t lock);
+uint8_t app_pm__lock_is_held(app_pm_lock_t lock);
+int64_t app_pm__get_lock_held_us(app_pm_lock_t lock);
+void app_pm__print_stats(void);
@@ -1,7 +1,8 @@
 /**
  * @file app_pwm.c
  * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
- * @brief Contains PWM-related code to control the feeder lid.
+ * @brief Contains PWM-related code to drive the feeder lid servo: motion profiles executed with LEDC hardware
+ * fades, the PWM timer being paused once the servo has settled.
  * @version 0.1
  * @date 2024-03-24
  *
@@ -20,25 +21,70 @@
     limitations under the License.
  */
 
+#include <stdint.h>
+
 #define LOG_LOCAL_LEVEL ESP_LOG_INFO
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/ledc.h"
 
 #include "app_pwm.h"
+#include "app_pm.h"
+#include "app_event.h"
+
+#define PWM_FREQ_HZ (50)                            ///< Servo PWM frequency (Hz)
+#define PWM_DUTY_RESOLUTION (LEDC_TIMER_16_BIT)     ///< Duty resolution of the servo PWM timer (bits)
+#define SERVO_MIN_PULSE_US (500)                    ///< Pulse width at 0 degrees (us)
+#define SERVO_MAX_PULSE_US (2500)                    ///< Pulse width at APP_PWM_SERVO_RANGE_DEG degrees (us)
+#define EASING_SEGMENTS_MAX (5)                      ///< Maximum number of linear fades approximating an easing curve
+#define FADE_SEGMENT_MIN_MS (3 * 1000 / PWM_FREQ_HZ) ///< Minimum duration of a linear fade, in whole PWM periods (ms)
 
-#define PWM_TIMER_TIME_TO_PAUSE_MS (500) ///< Time to wait after resuming PWM timer to pause it, in order to save energy
+/* Hardware fades change the duty by at most 1023 LSBs per PWM period, so the resolution must stay coarse enough for
+ * a 300 ms ramp at 50 Hz: at 16 bits an LSB is 0.3 us (0.03 degrees), at 20 bits the full travel would take 1 s.
+ */
+
+/// @brief Enum of the states of the servo motion.
+typedef enum
+{
+    pwm_motion_idle = 0, ///< PWM timer paused
+    pwm_motion_ramping,  ///< Fading towards the target duty cycle, segment by segment
+    pwm_motion_settling, ///< Target duty cycle reached, waiting settle_ms before pausing PWM timer
+} pwm_motion_state_t;
+
+/// @brief Typedef to store the servo motion in progress.
+typedef struct
+{
+    pwm_motion_state_t state;
+    uint32_t start_duty;     ///< Duty cycle when the motion started
+    uint32_t target_duty;    ///< Duty cycle of the target angle
+    app_pwm_easing_t easing; ///< Easing curve
+    uint8_t segments;        ///< Number of linear fades of the ramp, 0 to jump to target_duty
+    uint8_t segment;         ///< Linear fade in progress
+    uint16_t segment_ms;     ///< Duration of each linear fade (ms)
+    uint16_t settle_ms;      ///< Time to keep driving the servo after the ramp (ms)
+    int64_t settle_end_us;   ///< Time at which the settling ends (us since boot)
+} pwm_motion_t;
 
 static const char *TAG = "app_pwm"; ///< Tag to be used when logging
 
-static TaskHandle_t app_pwm__pwm_timer_pause_task_handle = NULL; ///< PWM timer pause task handle
+static SemaphoreHandle_t motion_lock = NULL;       ///< Mutex protecting motion, LEDC fades can not be started in a critical section
+static pwm_motion_t motion = {0};                  ///< Servo motion in progress
+static esp_timer_handle_t pwm_settle_timer = NULL; ///< Timer to pause PWM timer when the servo has settled
+static app_event_signal_t fade_end_signal;         ///< Signal of the fade end events, raised by the LEDC ISR
+static uint8_t fade_end_signal_created = 0;        ///< Flag that indicates that fade_end_signal was created
+static uint32_t fade_end_duty = 0;                 ///< Duty cycle reached by the last fade that ended
 
-static void app_pwm__pwm_timer_pause_task(void *arg);
+static bool app_pwm__fade_end_cb(const ledc_cb_param_t *param, void *user_arg);
+static void app_pwm__fade_end_handler(void *arg);
+static void app_pwm__settle_timer_handler(void *arg);
+static esp_err_t app_pwm__motion_continue(void);
+static esp_err_t app_pwm__motion_end(void);
 
 /**
- * @brief Initialize PWM and pause related timer.
+ * @brief Initialize PWM, hardware fades and settle timer. The servo is not driven until the first movement.
  *
  * @return esp_err_t
  * @retval ESP_OK if PWM is successfully initialized.
@@ -48,9 +94,9 @@ esp_err_t app_pwm__init(void)
 {
     ledc_timer_config_t pwm_timer_config = {
         .speed_mode = LEDC_LOW_SPEED_MODE,
-        .duty_resolution = LEDC_TIMER_20_BIT,
+        .duty_resolution = PWM_DUTY_RESOLUTION,
         .timer_num = LEDC_TIMER_0,
-        .freq_hz = 50,
+        .freq_hz = PWM_FREQ_HZ,
         .clk_cfg = LEDC_AUTO_CLK,
     };
     ledc_channel_config_t pwm_channel_config = {
@@ -61,6 +107,9 @@ esp_err_t app_pwm__init(void)
         .timer_sel = LEDC_TIMER_0,
         .duty = 0,
         .hpoint = 0};
+    ledc_cbs_t pwm_cbs = {
+        .fade_cb = app_pwm__fade_end_cb,
+    };
     esp_err_t err = ledc_timer_config(&pwm_timer_config);
     if (err != ESP_OK)
     {
@@ -74,113 +123,349 @@ esp_err_t app_pwm__init(void)
         ESP_LOGE(TAG, "Error configuring PWM channel");
         return ESP_FAIL;
     }
-    ESP_LOGI(TAG, "Setting duty cycle to 0.5 ms...");
 
-    err = ledc_timer_pause(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+    err = ledc_timer_pause(LEDC_LOW_SPEED_MODE, LEDC_TIMER_0);
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Error pausing PWM timer");
         return ESP_FAIL;
     }
 
-    if (xTaskCreate(app_pwm__pwm_timer_pause_task,
-                    "app_pwm__pwm_timer_pause_task", 2048, NULL, 10,
-                    &app_pwm__pwm_timer_pause_task_handle) != pdPASS)
+    // ESP_ERR_INVALID_STATE: fade function already installed
+    err = ledc_fade_func_install(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
     {
-        ESP_LOGE(TAG, "Error creating app_pwm__pwm_timer_pause_task");
+        ESP_LOGE(TAG, "Error %d installing PWM fade function: %s", err, esp_err_to_name(err));
         return ESP_FAIL;
     }
+    err = ledc_cb_register(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, &pwm_cbs, NULL);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error registering PWM fade end callback");
+        return ESP_FAIL;
+    }
+
+    if (motion_lock == NULL)
+    {
+        motion_lock = xSemaphoreCreateMutex();
+        if (motion_lock == NULL)
+        {
+            ESP_LOGE(TAG, "Error creating motion lock");
+            return ESP_FAIL;
+        }
+    }
+    if (pwm_settle_timer == NULL)
+    {
+        err = app_event__timer_create("pwm_settle", app_pwm__settle_timer_handler, NULL, &pwm_settle_timer);
+        if (err != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+    }
+    if (!fade_end_signal_created)
+    {
+        // a signal, so that the end of a fade is never dropped and the motion always goes on
+        if (app_event__signal_create(app_pwm__fade_end_handler, NULL, &fade_end_signal) != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
+        fade_end_signal_created = 1;
+    }
 
-    return app_pwm__set_duty_min();
+    return ESP_OK;
 }
 
 /**
- * @brief Set PWM duty cycle to minimum (close feeder lid), resume and pause timer.
+ * @brief Move the servo to an angle following a motion profile. The ramp is executed by LEDC hardware fades and
+ * returns immediately; PWM timer is resumed for the motion and paused settle_ms after the ramp ends. A new
+ * movement stops the one in progress and starts from the angle where the servo is.
+ *
+ * The first movement after boot jumps to the target angle, since the angle of the servo is unknown.
  *
+ * @param profile Motion profile.
  * @return esp_err_t
- * @retval ESP_OK if PWM duty cycle is successfully set to minimum.
+ * @retval ESP_OK if the movement is started.
+ * @retval ESP_ERR_INVALID_ARG if the profile is NULL or its angle is out of range.
+ * @retval ESP_ERR_INVALID_STATE if PWM is not initialized.
  * @retval ESP_FAIL otherwise.
  */
-esp_err_t app_pwm__set_duty_min(void)
+esp_err_t app_pwm__move(const app_pwm_motion_profile_t *profile)
 {
-    esp_err_t err = ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, 26214); // 0.5 ms (min)
-    if (err != ESP_OK)
+    if (profile == NULL || profile->target_angle_deg > APP_PWM_SERVO_RANGE_DEG)
     {
-        ESP_LOGE(TAG, "Error setting PWM duty cycle");
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_ARG;
     }
-    err = ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
-    if (err != ESP_OK)
+    if (motion_lock == NULL)
     {
-        ESP_LOGE(TAG, "Error updating PWM duty cycle");
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_STATE;
     }
-    ESP_LOGI(TAG, "Duty cycle set to minimum");
 
-    err = ledc_timer_resume(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
-    if (err != ESP_OK)
+    uint32_t pulse_us = SERVO_MIN_PULSE_US + (uint32_t)profile->target_angle_deg * (SERVO_MAX_PULSE_US - SERVO_MIN_PULSE_US) / APP_PWM_SERVO_RANGE_DEG;
+
+    xSemaphoreTake(motion_lock, portMAX_DELAY);
+    esp_timer_stop(pwm_settle_timer);
+    if (motion.state == pwm_motion_ramping)
     {
-        ESP_LOGE(TAG, "Error resuming PWM timer");
-        return ESP_FAIL;
+        ledc_fade_stop(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
     }
+    // LEDC is clocked from APB, so its frequency must not be scaled while the servo is driven
+    app_pm__lock_acquire(app_pm_lock_servo);
+    esp_err_t err = ledc_timer_resume(LEDC_LOW_SPEED_MODE, LEDC_TIMER_0);
 
-    vTaskResume(app_pwm__pwm_timer_pause_task_handle);
+    motion.start_duty = ledc_get_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+    motion.target_duty = (uint32_t)(((uint64_t)pulse_us << PWM_DUTY_RESOLUTION) * PWM_FREQ_HZ / 1000000);
+    motion.easing = profile->easing;
+    motion.segment = 0;
+    motion.settle_ms = profile->settle_ms;
+    if (profile->ramp_ms == 0 || motion.start_duty == 0)
+    {
+        motion.segments = 0;
+        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, motion.target_duty);
+        ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+    }
+    else
+    {
+        motion.segments = (profile->easing == app_pwm_easing_linear) ? 1 : profile->ramp_ms / FADE_SEGMENT_MIN_MS;
+        if (motion.segments > EASING_SEGMENTS_MAX)
+        {
+            motion.segments = EASING_SEGMENTS_MAX;
+        }
+        else if (motion.segments == 0)
+        {
+            motion.segments = 1;
+        }
+        motion.segment_ms = profile->ramp_ms / motion.segments;
+    }
+    ESP_LOGD(TAG, "Moving servo to %d degrees, duty cycle %d -> %d in %d segments", profile->target_angle_deg,
+             (int)motion.start_duty, (int)motion.target_duty, motion.segments);
+    if (err == ESP_OK)
+    {
+        err = app_pwm__motion_continue();
+    }
+    else
+    {
+        // the servo is not driven, so the PM lock must not stay held
+        app_pwm__motion_end();
+    }
+    xSemaphoreGive(motion_lock);
 
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d moving servo: %s", err, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
     return ESP_OK;
 }
 
 /**
- * @brief Set PWM duty cycle to maximum (open feeder lid), resume and pause timer.
+ * @brief Stop the servo where it is: stop the movement in progress and pause PWM timer right away, so that a servo
+ * that can not reach its target angle does not keep drawing current.
  *
  * @return esp_err_t
- * @retval ESP_OK if PWM duty cycle is successfully set to maximum.
+ * @retval ESP_OK on success.
+ * @retval ESP_ERR_INVALID_STATE if PWM is not initialized.
  * @retval ESP_FAIL otherwise.
  */
-esp_err_t app_pwm__set_duty_max(void)
+esp_err_t app_pwm__stop(void)
 {
-    esp_err_t err = ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, 78000);
-    if (err != ESP_OK)
+    if (motion_lock == NULL)
     {
-        ESP_LOGE(TAG, "Error setting PWM duty cycle");
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_STATE;
     }
-    err = ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
-    if (err != ESP_OK)
+
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(motion_lock, portMAX_DELAY);
+    esp_timer_stop(pwm_settle_timer);
+    if (motion.state == pwm_motion_ramping)
     {
-        ESP_LOGE(TAG, "Error updating PWM duty cycle");
-        return ESP_FAIL;
+        ledc_fade_stop(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+    }
+    if (motion.state != pwm_motion_idle)
+    {
+        err = app_pwm__motion_end();
     }
-    ESP_LOGI(TAG, "Duty cycle set to maximum");
+    xSemaphoreGive(motion_lock);
 
-    err = ledc_timer_resume(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Error resuming PWM timer");
+        ESP_LOGE(TAG, "Error pausing PWM timer");
         return ESP_FAIL;
     }
+    return ESP_OK;
+}
 
-    vTaskResume(app_pwm__pwm_timer_pause_task_handle);
+/**
+ * @brief Check if the servo is being driven, i.e. moving or settling. Measurements disturbed by the servo current
+ * (e.g. the battery voltage) should not be taken while it is.
+ *
+ * @return uint8_t 1 if the servo is being driven, 0 otherwise.
+ */
+uint8_t app_pwm__is_moving(void)
+{
+    return motion.state != pwm_motion_idle;
+}
 
-    return ESP_OK;
+/**
+ * @brief Get position of the easing curve at some point of the ramp.
+ *
+ * @param easing Easing curve.
+ * @param t Point of the ramp, from 0 (start) to 1000 (end).
+ * @return uint32_t Position, from 0 (start duty cycle) to 1000 (target duty cycle).
+ */
+static uint32_t app_pwm__ease(app_pwm_easing_t easing, uint32_t t)
+{
+    switch (easing)
+    {
+    case app_pwm_easing_in:
+        return t * t / 1000;
+    case app_pwm_easing_out:
+        return 1000 - (1000 - t) * (1000 - t) / 1000;
+    case app_pwm_easing_in_out:
+        return (t < 500) ? 2 * t * t / 1000 : 1000 - 2 * (1000 - t) * (1000 - t) / 1000;
+    default:
+        return t;
+    }
+}
+
+/**
+ * @brief Get duty cycle at the end of a linear fade of the motion in progress. Must be called with motion_lock taken.
+ *
+ * @param segment Linear fade.
+ * @return uint32_t Duty cycle.
+ */
+static uint32_t app_pwm__segment_duty(uint8_t segment)
+{
+    int64_t delta = (int64_t)motion.target_duty - motion.start_duty;
+    uint32_t position = app_pwm__ease(motion.easing, (uint32_t)(segment + 1) * 1000 / motion.segments);
+    return (uint32_t)(motion.start_duty + delta * position / 1000);
+}
+
+/**
+ * @brief Pause PWM timer once the servo has settled. Must be called with motion_lock taken.
+ *
+ * @return esp_err_t Error code of ledc_timer_pause.
+ */
+static esp_err_t app_pwm__motion_end(void)
+{
+    motion.state = pwm_motion_idle;
+    esp_err_t err = ledc_timer_pause(LEDC_LOW_SPEED_MODE, LEDC_TIMER_0);
+    app_pm__lock_release(app_pm_lock_servo);
+    return err;
 }
 
 /**
- * @brief Task to pause PWM timer after a specified time.
+ * @brief Start the next linear fade of the motion in progress or, if the ramp has ended, its settling. Fades that
+ * would not change the duty cycle are skipped, since they may never signal their end. If a fade can not be started
+ * the servo jumps to the target duty cycle instead. If the settling can not be timed, the motion ends right away.
+ * Must be called with motion_lock taken.
  *
- * @param arg
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code of the LEDC or esp_timer functions otherwise.
  */
-static void app_pwm__pwm_timer_pause_task(void *arg)
+static esp_err_t app_pwm__motion_continue(void)
 {
-    vTaskSuspend(NULL);
-    for (;;)
+    esp_err_t err = ESP_OK;
+
+    for (; motion.segment < motion.segments; motion.segment++)
     {
-        vTaskDelay(pdMS_TO_TICKS(PWM_TIMER_TIME_TO_PAUSE_MS));
-        esp_err_t err = ledc_timer_pause(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
-        if (err != ESP_OK)
+        uint32_t duty = app_pwm__segment_duty(motion.segment);
+        if (duty == ledc_get_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0))
         {
-            ESP_LOGE(TAG, "Error pausing PWM timer");
+            continue;
         }
-        vTaskSuspend(NULL);
+        err = ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, duty, motion.segment_ms);
+        if (err == ESP_OK)
+        {
+            err = ledc_fade_start(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, LEDC_FADE_NO_WAIT);
+        }
+        if (err == ESP_OK)
+        {
+            motion.state = pwm_motion_ramping;
+            return ESP_OK;
+        }
+        ESP_LOGW(TAG, "Error %d starting fade, jumping to target duty cycle", err);
+        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, motion.target_duty);
+        ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+        break;
     }
-    vTaskDelete(NULL);
-}
\ No newline at end of file
+
+    motion.state = pwm_motion_settling;
+    motion.settle_end_us = esp_timer_get_time() + (int64_t)motion.settle_ms * 1000;
+    if (motion.settle_ms == 0)
+    {
+        return app_pwm__motion_end();
+    }
+    err = esp_timer_start_once(pwm_settle_timer, (uint64_t)motion.settle_ms * 1000);
+    if (err != ESP_OK)
+    {
+        // otherwise the motion would stay settling, with the servo driven, until the next movement
+        app_pwm__motion_end();
+    }
+    return err;
+}
+
+/**
+ * @brief LEDC fade end callback, signals the duty cycle reached to the event loop. Runs in the LEDC ISR.
+ *
+ * @param param Fade end event.
+ * @param user_arg Optional argument (not being used).
+ * @return bool Whether a higher priority task was woken, the event loop yields by itself.
+ */
+static bool IRAM_ATTR app_pwm__fade_end_cb(const ledc_cb_param_t *param, void *user_arg)
+{
+    if (param->event == LEDC_FADE_END_EVT)
+    {
+        __atomic_store_n(&fade_end_duty, param->duty, __ATOMIC_RELEASE);
+        app_event__signal_from_isr(fade_end_signal);
+    }
+    return false;
+}
+
+/**
+ * @brief Handler of the fade end events, starts the next linear fade of the motion. Does nothing if the fade that
+ * ended is not the one in progress, i.e. it was stopped by a new movement.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_pwm__fade_end_handler(void *arg)
+{
+    uint32_t duty = __atomic_load_n(&fade_end_duty, __ATOMIC_ACQUIRE);
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(motion_lock, portMAX_DELAY);
+    if (motion.state == pwm_motion_ramping && duty == app_pwm__segment_duty(motion.segment))
+    {
+        motion.segment++;
+        err = app_pwm__motion_continue();
+    }
+    xSemaphoreGive(motion_lock);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d continuing servo motion: %s", err, esp_err_to_name(err));
+    }
+}
+
+/**
+ * @brief Handler of pwm_settle_timer, pauses PWM timer. Does nothing if a new movement started after the timer
+ * expired, the new movement will pause PWM timer instead.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_pwm__settle_timer_handler(void *arg)
+{
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(motion_lock, portMAX_DELAY);
+    if (motion.state == pwm_motion_settling && esp_timer_get_time() >= motion.settle_end_us)
+    {
+        err = app_pwm__motion_end();
+    }
+    xSemaphoreGive(motion_lock);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error pausing PWM timer");
+    }
+}
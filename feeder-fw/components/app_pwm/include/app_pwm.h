@@ -11,8 +11,31 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include "esp_err.h"
 
+#define APP_PWM_SERVO_RANGE_DEG (180) ///< Servo travel, between the 0.5 ms and the 2.5 ms pulses (degrees)
+
+/// @brief Enum of the easing curves of a servo movement.
+typedef enum
+{
+    app_pwm_easing_linear = 0, ///< Constant speed
+    app_pwm_easing_in,         ///< Start slow and accelerate
+    app_pwm_easing_out,        ///< Start fast and decelerate
+    app_pwm_easing_in_out,     ///< Start and end slow
+} app_pwm_easing_t;
+
+/// @brief Typedef to store a servo motion profile.
+typedef struct
+{
+    uint8_t target_angle_deg; ///< Target angle, between 0 and APP_PWM_SERVO_RANGE_DEG (degrees)
+    uint16_t ramp_ms;         ///< Time to move from the current angle to the target angle, 0 to jump (ms)
+    app_pwm_easing_t easing;  ///< Easing curve of the movement
+    uint16_t settle_ms;       ///< Time the servo is still driven after the ramp ends, for it to reach the angle (ms)
+} app_pwm_motion_profile_t;
+
 esp_err_t app_pwm__init(void);
-esp_err_t app_pwm__set_duty_min(void);
-esp_err_t app_pwm__set_duty_max(void);
+esp_err_t app_pwm__move(const app_pwm_motion_profile_t *profile);
+esp_err_t app_pwm__stop(void);
+uint8_t app_pwm__is_moving(void);
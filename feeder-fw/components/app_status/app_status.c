@@ -1,7 +1,8 @@
 /**
  * @file app_status.c
  * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
- * @brief Contains code to manage product statuses.
+ * @brief Contains the product telemetry store: typed status fields written from any task, read without locks and
+ * notified to the subscribed components when they change.
  * @version 0.1
  * @date 2024-03-23
  *
@@ -21,39 +22,73 @@
  */
 
 #define LOG_LOCAL_LEVEL ESP_LOG_NONE
+#include <stdint.h>
+#include <string.h>
+
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
 
 #include "app_status.h"
 #include "app_gpio.h"
+#include "app_event.h"
 
-static void app_status__check_status_task(void *arg);
-
-static const char *TAG = "app_status";                           ///< Tag to be used when logging
-static TaskHandle_t app_status__check_status_task_handle = NULL; ///< Statuses check task
+#define STATUS_SUBSCRIBERS_MAX (4) ///< Maximum number of telemetry change subscribers
 
-/*! @var typedef struct
-         {
-            uint8_t battery_low : 1;
-            uint8_t beacon_battery_low : 1;
-         } app_status_t;
-    @brief Typedef for indicating general product statuses.
+/* The telemetry is a seqlock: writers, serialized by telemetry_write_lock, make the sequence number odd while they
+ * update the fields, and readers copy the fields without taking any lock, retrying if the sequence number was odd or
+ * changed during the copy. The changes are not notified by the writer: the changed field groups are accumulated in
+ * notify_pending and a single event is posted to the event loop until it is handled, however many writes happen in
+ * between (e.g. one per beacon advertisement). notify_posted tells whether that event is queued, apart from the
+ * changes, so that if it can not be posted (event queue full) the changes are kept and the next write posts it. Only
+ * the changes of field groups with a subscriber (subscribed_fields) are notified, so that the frequent writes of
+ * groups nobody subscribes to, like the scan statistics, do not post anything.
  */
+
+/// @brief Typedef to store a telemetry change subscriber.
 typedef struct
 {
-    uint8_t battery_low : 1;        ///< Indicate that gateway's battery is low
-    uint8_t beacon_battery_low : 1; ///< Indicate that beacon's battery is low
-} app_status_t;                     ///< status bla bla bla
+    uint32_t fields;           ///< Field groups whose changes are notified
+    app_status_notify_cb_t cb; ///< Notification callback
+} status_subscriber_t;
+
+static const char *TAG = "app_status";                                   ///< Tag to be used when logging
+static portMUX_TYPE telemetry_write_lock = portMUX_INITIALIZER_UNLOCKED; ///< Lock serializing the telemetry writers
+static uint32_t telemetry_seq = 0;                                       ///< Telemetry sequence number, odd while a write is in progress
+static app_status_telemetry_t telemetry = {
+    .beacon_temp_q8 = INT16_MIN,
+};                                                                       ///< Product telemetry
+static uint32_t notify_pending = 0;                                      ///< Field groups changed and not yet notified
+static uint32_t notify_posted = 0;                                       ///< Flag that indicates that app_status__notify_handler is queued in the event loop
+static status_subscriber_t subscribers[STATUS_SUBSCRIBERS_MAX];          ///< Telemetry change subscribers
+static uint8_t subscribers_count = 0;                                    ///< Number of telemetry change subscribers
+static uint32_t subscribed_fields = 0;                                   ///< Field groups with at least one subscriber
 
-app_status_t app_status = {
-    .battery_low = 0,
-    .beacon_battery_low = 0,
-}; ///< General product statuses
+static void app_status__update_led(uint32_t changed);
+
+/* The statuses are indicated by red LED patterns that loop until the statuses change. Each pattern ends with the
+ * LED off for 2 s before it starts over.
+ */
+static const uint16_t battery_low_steps_ms[] = {250, 250, 250, 2000};                 ///< Two fast blinks
+static const uint16_t beacon_battery_low_steps_ms[] = {1000, 2000};                    ///< One slow blink
+static const uint16_t all_batteries_low_steps_ms[] = {250, 250, 250, 250, 1000, 2000}; ///< Two fast blinks and one slow blink
+static const app_gpio_led_pattern_t battery_low_pattern = {
+    .steps_ms = battery_low_steps_ms,
+    .steps_count = sizeof(battery_low_steps_ms) / sizeof(battery_low_steps_ms[0]),
+}; ///< Pattern indicating that gateway's battery is low
+static const app_gpio_led_pattern_t beacon_battery_low_pattern = {
+    .steps_ms = beacon_battery_low_steps_ms,
+    .steps_count = sizeof(beacon_battery_low_steps_ms) / sizeof(beacon_battery_low_steps_ms[0]),
+}; ///< Pattern indicating that beacon's battery is low
+static const app_gpio_led_pattern_t all_batteries_low_pattern = {
+    .steps_ms = all_batteries_low_steps_ms,
+    .steps_count = sizeof(all_batteries_low_steps_ms) / sizeof(all_batteries_low_steps_ms[0]),
+}; ///< Pattern indicating that all batteries are low
+static const app_gpio_led_pattern_t *status_pattern = NULL; ///< Pattern being shown, NULL if all statuses are ok
 
 /**
- * @brief Initialize app_status component by creating a task to check the relevant statuses.
+ * @brief Initialize app_status component.
  *
  * @return esp_err_t
  * @retval ESP_OK if app_status is successfully initialized.
@@ -61,82 +96,337 @@ app_status_t app_status = {
  */
 esp_err_t app_status__init(void)
 {
-    if (xTaskCreate(app_status__check_status_task,
-                    "app_status__check_status_task", 2048, NULL, 10,
-                    &app_status__check_status_task_handle) != pdPASS)
+    if (app_status__subscribe(APP_STATUS_FIELD_GATEWAY_BATTERY_LOW | APP_STATUS_FIELD_BEACON_BATTERY_LOW,
+                              app_status__update_led) != ESP_OK)
     {
-        ESP_LOGE(TAG, "Error creating app_status__check_status_task");
         return ESP_FAIL;
     }
-    ESP_LOGI(TAG, "Created app_status__check_status_task");
+    ESP_LOGI(TAG, "Success initializing app_status component");
     return ESP_OK;
 }
 
 /**
- * @brief Task to keep checking the statuses.
+ * @brief Subscribe to telemetry changes. The callback is run by the event loop after the fields change, once for
+ * any number of changes made since its last run. Must be called during initialization, before the telemetry is
+ * written.
  *
- * @param arg Optional arguments (not being used).
+ * @param fields Field groups whose changes are notified (APP_STATUS_FIELD_* bits).
+ * @param cb Notification callback.
+ * @return esp_err_t
+ * @retval ESP_OK if the callback is subscribed.
+ * @retval ESP_ERR_NO_MEM if STATUS_SUBSCRIBERS_MAX callbacks were already subscribed.
  */
-static void app_status__check_status_task(void *arg)
+esp_err_t app_status__subscribe(uint32_t fields, app_status_notify_cb_t cb)
 {
-    for (;;)
+    for (uint8_t i = 0; i < subscribers_count; i++)
     {
-        if (app_status.battery_low && !app_status.beacon_battery_low)
+        if (subscribers[i].cb == cb)
         {
-            ESP_LOGW(TAG, "Battery low!");
-            app_gpio__blink_red_led_fast(2);
+            subscribers[i].fields |= fields;
+            subscribed_fields |= fields;
+            return ESP_OK;
         }
-        else if (!app_status.battery_low && app_status.beacon_battery_low)
-        {
-            ESP_LOGW(TAG, "Beacon battery low!");
-            app_gpio__blink_red_led_slow(1);
-        }
-        else if (app_status.battery_low && app_status.beacon_battery_low)
+    }
+    if (subscribers_count == STATUS_SUBSCRIBERS_MAX)
+    {
+        ESP_LOGE(TAG, "Error subscribing, maximum of %d subscribers reached", STATUS_SUBSCRIBERS_MAX);
+        return ESP_ERR_NO_MEM;
+    }
+    subscribers[subscribers_count].fields = fields;
+    subscribers[subscribers_count].cb = cb;
+    subscribers_count++;
+    subscribed_fields |= fields;
+    return ESP_OK;
+}
+
+/**
+ * @brief Handler of the telemetry change notifications, run by the event loop: runs the callbacks subscribed to the
+ * field groups that changed.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_status__notify_handler(void *arg)
+{
+    // cleared first, so that a change made from now on posts the notification again
+    __atomic_store_n(&notify_posted, 0, __ATOMIC_RELEASE);
+    uint32_t changed = __atomic_exchange_n(&notify_pending, 0, __ATOMIC_ACQ_REL);
+
+    for (uint8_t i = 0; i < subscribers_count; i++)
+    {
+        if (subscribers[i].fields & changed)
         {
-            ESP_LOGI(TAG, "All batteries low!");
-            app_gpio__blink_red_led_fast(2);
-            vTaskDelay(250 / portTICK_PERIOD_MS);
-            app_gpio__blink_red_led_slow(1);
+            subscribers[i].cb(subscribers[i].fields & changed);
         }
-        else
+    }
+}
+
+/**
+ * @brief Start a telemetry write. The fields may be modified until app_status__write_end is called, which must be
+ * done shortly, since it runs in a critical section.
+ */
+static void app_status__write_begin(void)
+{
+    taskENTER_CRITICAL(&telemetry_write_lock);
+    __atomic_store_n(&telemetry_seq, telemetry_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * @brief End a telemetry write and notify its changes.
+ *
+ * @param changed Field groups whose values were changed by the write (APP_STATUS_FIELD_* bits).
+ */
+static void app_status__write_end(uint32_t changed)
+{
+    __atomic_store_n(&telemetry_seq, telemetry_seq + 1, __ATOMIC_RELEASE);
+    taskEXIT_CRITICAL(&telemetry_write_lock);
+
+    changed &= subscribed_fields;
+    if (changed)
+    {
+        __atomic_fetch_or(&notify_pending, changed, __ATOMIC_ACQ_REL);
+        if (!__atomic_exchange_n(&notify_posted, 1, __ATOMIC_ACQ_REL) &&
+            (app_event__post(app_status__notify_handler, NULL) != ESP_OK))
         {
-            ESP_LOGI(TAG, "All batteries ok!");
+            // the changes stay in notify_pending, the next write posts the notification again
+            __atomic_store_n(&notify_posted, 0, __ATOMIC_RELEASE);
         }
-        vTaskDelay(2000 / portTICK_PERIOD_MS);
     }
-    vTaskDelete(NULL);
 }
 
 /**
- * @brief Set status of low battery.
+ * @brief Get the product telemetry. Can be called from any task, never blocks a writer.
  *
- * @param battery_low If > 0, set low battery status to 1, otherwise set it to 0.
+ * @param out Telemetry.
  */
-void app_status__set_battery_low_status(uint8_t battery_low)
+void app_status__get(app_status_telemetry_t *out)
+{
+    uint32_t seq;
+
+    do
+    {
+        seq = __atomic_load_n(&telemetry_seq, __ATOMIC_ACQUIRE);
+        memcpy(out, &telemetry, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&telemetry_seq, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief Store a 16-bit value little-endian.
+ *
+ * @param buf Buffer.
+ * @param value Value.
+ * @return uint8_t* Buffer position after the value.
+ */
+static uint8_t *app_status__put_u16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = value & 0xff;
+    buf[1] = value >> 8;
+    return buf + 2;
+}
+
+/**
+ * @brief Store a 32-bit value little-endian.
+ *
+ * @param buf Buffer.
+ * @param value Value.
+ * @return uint8_t* Buffer position after the value.
+ */
+static uint8_t *app_status__put_u32(uint8_t *buf, uint32_t value)
+{
+    buf = app_status__put_u16(buf, value & 0xffff);
+    return app_status__put_u16(buf, value >> 16);
+}
+
+/**
+ * @brief Write a binary snapshot of the telemetry, with the format described in app_status.h. Can be called from any
+ * task.
+ *
+ * @param buf Buffer for the snapshot.
+ * @param size Buffer size (bytes).
+ * @return size_t Snapshot size (APP_STATUS_SNAPSHOT_SIZE), 0 if the buffer is too small.
+ */
+size_t app_status__snapshot(uint8_t *buf, size_t size)
+{
+    app_status_telemetry_t t;
+    uint8_t *p = buf;
+
+    if (size < APP_STATUS_SNAPSHOT_SIZE)
+    {
+        return 0;
+    }
+    app_status__get(&t);
+    *p++ = APP_STATUS_SNAPSHOT_VERSION;
+    *p++ = (t.gateway_battery_low ? 0x01 : 0) | (t.beacon_battery_low ? 0x02 : 0);
+    p = app_status__put_u32(p, (uint32_t)(esp_timer_get_time() / 1000));
+    p = app_status__put_u16(p, t.gateway_mv);
+    *p++ = t.gateway_percent;
+    *p++ = (uint8_t)t.beacon_rssi;
+    p = app_status__put_u16(p, t.beacon_mv);
+    p = app_status__put_u16(p, (uint16_t)t.beacon_temp_q8);
+    p = app_status__put_u32(p, t.beacon_last_seen_ms);
+    p = app_status__put_u32(p, t.lid_open_count);
+    p = app_status__put_u32(p, t.lid_close_count);
+    p = app_status__put_u32(p, t.lid_stall_count);
+    p = app_status__put_u32(p, t.scan_adv_count);
+    p = app_status__put_u32(p, t.scan_adv_dropped);
+    p = app_status__put_u32(p, t.scan_detection_count);
+    return p - buf;
+}
+
+/**
+ * @brief Show the pattern of the current statuses on the red LED, replacing the previous one if they changed.
+ * Telemetry change callback, run by the event loop.
+ *
+ * @param changed Field groups that changed.
+ */
+static void app_status__update_led(uint32_t changed)
 {
-    if (battery_low > 0)
+    const app_gpio_led_pattern_t *pattern = NULL;
+    app_status_telemetry_t status;
+
+    app_status__get(&status);
+    if (status.gateway_battery_low && !status.beacon_battery_low)
+    {
+        ESP_LOGW(TAG, "Battery low!");
+        pattern = &battery_low_pattern;
+    }
+    else if (!status.gateway_battery_low && status.beacon_battery_low)
+    {
+        ESP_LOGW(TAG, "Beacon battery low!");
+        pattern = &beacon_battery_low_pattern;
+    }
+    else if (status.gateway_battery_low && status.beacon_battery_low)
     {
-        app_status.battery_low = 1;
+        ESP_LOGI(TAG, "All batteries low!");
+        pattern = &all_batteries_low_pattern;
     }
     else
     {
-        app_status.battery_low = 0;
+        ESP_LOGI(TAG, "All batteries ok!");
+    }
+
+    if (pattern == status_pattern)
+    {
+        return;
+    }
+    if (status_pattern != NULL)
+    {
+        app_gpio__led_pattern_stop(app_gpio_led_red, status_pattern);
+    }
+    status_pattern = pattern;
+    if (status_pattern != NULL)
+    {
+        app_gpio__led_pattern_start(app_gpio_led_red, status_pattern, APP_GPIO_LED_LOOP, APP_GPIO_LED_PRIORITY_STATUS);
     }
 }
 
 /**
- * @brief Set status of beacon low battery.
+ * @brief Set status of low battery. Can be called from any task.
+ *
+ * @param battery_low If > 0, set low battery status to 1, otherwise set it to 0.
+ */
+void app_status__set_battery_low_status(uint8_t battery_low)
+{
+    app_status__write_begin();
+    uint32_t changed = (telemetry.gateway_battery_low != (battery_low > 0)) ? APP_STATUS_FIELD_GATEWAY_BATTERY_LOW : 0;
+    telemetry.gateway_battery_low = (battery_low > 0);
+    app_status__write_end(changed);
+}
+
+/**
+ * @brief Set status of beacon low battery. Can be called from any task.
  *
- * @param battery_low If > 0, set beacon low battery status to 1, otherwise set it to 0.
+ * @param beacon_battery_low If > 0, set beacon low battery status to 1, otherwise set it to 0.
  */
 void app_status__set_beacon_battery_low_status(uint8_t beacon_battery_low)
 {
-    if (beacon_battery_low > 0)
+    app_status__write_begin();
+    uint32_t changed = (telemetry.beacon_battery_low != (beacon_battery_low > 0)) ? APP_STATUS_FIELD_BEACON_BATTERY_LOW : 0;
+    telemetry.beacon_battery_low = (beacon_battery_low > 0);
+    app_status__write_end(changed);
+}
+
+/**
+ * @brief Set gateway battery state. Can be called from any task.
+ *
+ * @param mv Battery voltage (mV).
+ * @param percent Battery state of charge (%).
+ */
+void app_status__set_gateway_battery(uint16_t mv, uint8_t percent)
+{
+    app_status__write_begin();
+    uint32_t changed = (telemetry.gateway_mv != mv || telemetry.gateway_percent != percent) ? APP_STATUS_FIELD_GATEWAY_BATTERY : 0;
+    telemetry.gateway_mv = mv;
+    telemetry.gateway_percent = percent;
+    app_status__write_end(changed);
+}
+
+/**
+ * @brief Set the last sighting of an authorized beacon. Can be called from any task.
+ *
+ * @param rssi Advertisement RSSI (dBm).
+ * @param mv Battery voltage from the TLM (mV).
+ * @param temp_q8 Temperature from the TLM (°C, Q8).
+ * @param time_us Time when the advertisement was received (us since boot).
+ */
+void app_status__set_beacon_sighting(int8_t rssi, uint16_t mv, int16_t temp_q8, int64_t time_us)
+{
+    app_status__write_begin();
+    telemetry.beacon_rssi = rssi;
+    telemetry.beacon_mv = mv;
+    telemetry.beacon_temp_q8 = temp_q8;
+    telemetry.beacon_last_seen_ms = (uint32_t)(time_us / 1000);
+    app_status__write_end(APP_STATUS_FIELD_BEACON_SIGHTING);
+}
+
+/**
+ * @brief Add to the scan statistics. Nothing is written if they do not change. Can be called from any task.
+ *
+ * @param adv_count Number of advertisements of authorized beacons processed since the last call.
+ * @param adv_dropped Total number of advertisements of authorized beacons dropped.
+ */
+void app_status__add_scan_stats(uint32_t adv_count, uint32_t adv_dropped)
+{
+    // scan_adv_dropped is only written here, so it can be compared without the lock
+    if (adv_count == 0 && __atomic_load_n(&telemetry.scan_adv_dropped, __ATOMIC_RELAXED) == adv_dropped)
     {
-        app_status.beacon_battery_low = 1;
+        return;
     }
-    else
+    app_status__write_begin();
+    telemetry.scan_adv_count += adv_count;
+    telemetry.scan_adv_dropped = adv_dropped;
+    app_status__write_end(APP_STATUS_FIELD_SCAN_STATS);
+}
+
+/**
+ * @brief Increment a telemetry counter. Can be called from any task.
+ *
+ * @param counter Counter.
+ */
+void app_status__increment(app_status_counter_t counter)
+{
+    uint32_t changed = APP_STATUS_FIELD_LID_CYCLES;
+
+    app_status__write_begin();
+    switch (counter)
     {
-        app_status.beacon_battery_low = 0;
+    case app_status_counter_lid_open:
+        telemetry.lid_open_count++;
+        break;
+    case app_status_counter_lid_close:
+        telemetry.lid_close_count++;
+        break;
+    case app_status_counter_lid_stall:
+        telemetry.lid_stall_count++;
+        break;
+    case app_status_counter_detection:
+        telemetry.scan_detection_count++;
+        changed = APP_STATUS_FIELD_SCAN_STATS;
+        break;
+    default:
+        changed = 0;
+        break;
     }
+    app_status__write_end(changed);
 }
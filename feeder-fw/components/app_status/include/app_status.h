@@ -11,8 +11,84 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
+#define APP_STATUS_SNAPSHOT_VERSION (1) ///< Version of the binary snapshot format, first byte of the snapshot
+#define APP_STATUS_SNAPSHOT_SIZE (42)   ///< Size of a binary snapshot (bytes)
+
+/* Binary snapshot format, all fields little-endian:
+ *
+ *  offset size field
+ *       0    1 version (APP_STATUS_SNAPSHOT_VERSION)
+ *       1    1 flags: bit 0 gateway battery low, bit 1 beacon battery low
+ *       2    4 uptime (ms)
+ *       6    2 gateway_mv
+ *       8    1 gateway_percent
+ *       9    1 beacon_rssi (int8)
+ *      10    2 beacon_mv
+ *      12    2 beacon_temp_q8 (int16)
+ *      14    4 beacon_last_seen_ms
+ *      18    4 lid_open_count
+ *      22    4 lid_close_count
+ *      26    4 lid_stall_count
+ *      30    4 scan_adv_count
+ *      34    4 scan_adv_dropped
+ *      38    4 scan_detection_count
+ */
+
+#define APP_STATUS_FIELD_GATEWAY_BATTERY (1 << 0)     ///< Field group: gateway_mv, gateway_percent
+#define APP_STATUS_FIELD_GATEWAY_BATTERY_LOW (1 << 1) ///< Field group: gateway_battery_low
+#define APP_STATUS_FIELD_BEACON_BATTERY_LOW (1 << 2)  ///< Field group: beacon_battery_low
+#define APP_STATUS_FIELD_BEACON_SIGHTING (1 << 3)     ///< Field group: beacon_rssi, beacon_mv, beacon_temp_q8, beacon_last_seen_ms
+#define APP_STATUS_FIELD_LID_CYCLES (1 << 4)          ///< Field group: lid_open_count, lid_close_count, lid_stall_count
+#define APP_STATUS_FIELD_SCAN_STATS (1 << 5)          ///< Field group: scan_adv_count, scan_adv_dropped, scan_detection_count
+#define APP_STATUS_FIELD_ALL ((1 << 6) - 1)           ///< All field groups
+
+/// @brief Typedef for the telemetry counters incremented with app_status__increment.
+typedef enum
+{
+    app_status_counter_lid_open = 0, /**< Lid movements that ended open */
+    app_status_counter_lid_close,    /**< Lid movements that ended closed */
+    app_status_counter_lid_stall,    /**< Lid servo stalls */
+    app_status_counter_detection,    /**< Beacon detections that opened the lid */
+} app_status_counter_t;
+
+/// @brief Typedef for the product telemetry.
+typedef struct
+{
+    uint8_t gateway_battery_low;   ///< Flag that indicates that the gateway's battery is low
+    uint8_t beacon_battery_low;    ///< Flag that indicates that a beacon's battery is low
+    uint16_t gateway_mv;           ///< Gateway battery voltage (mV), 0 until the first reading
+    uint8_t gateway_percent;       ///< Gateway battery state of charge (%)
+    int8_t beacon_rssi;            ///< RSSI of the last advertisement of an authorized beacon (dBm)
+    uint16_t beacon_mv;            ///< Battery voltage from the last TLM of an authorized beacon (mV)
+    int16_t beacon_temp_q8;        ///< Temperature from the last TLM of an authorized beacon (°C, Q8), -128 °C if not supported
+    uint32_t beacon_last_seen_ms;  ///< Time of the last advertisement of an authorized beacon (ms since boot), 0 if never seen
+    uint32_t lid_open_count;       ///< Lid movements that ended open
+    uint32_t lid_close_count;      ///< Lid movements that ended closed
+    uint32_t lid_stall_count;      ///< Lid servo stalls
+    uint32_t scan_adv_count;       ///< Advertisements of authorized beacons processed
+    uint32_t scan_adv_dropped;     ///< Advertisements of authorized beacons dropped because the detection task was late
+    uint32_t scan_detection_count; ///< Beacon detections that opened the lid
+} app_status_telemetry_t;
+
+/**
+ * @brief Typedef for the telemetry change notification callbacks, run by the event loop.
+ *
+ * @param changed Field groups that changed since the last notification (APP_STATUS_FIELD_* bits).
+ */
+typedef void (*app_status_notify_cb_t)(uint32_t changed);
+
 esp_err_t app_status__init(void);
+esp_err_t app_status__subscribe(uint32_t fields, app_status_notify_cb_t cb);
+void app_status__get(app_status_telemetry_t *telemetry);
+size_t app_status__snapshot(uint8_t *buf, size_t size);
 void app_status__set_battery_low_status(uint8_t battery_low);
 void app_status__set_beacon_battery_low_status(uint8_t beacon_battery_low);
+void app_status__set_gateway_battery(uint16_t mv, uint8_t percent);
+void app_status__set_beacon_sighting(int8_t rssi, uint16_t mv, int16_t temp_q8, int64_t time_us);
+void app_status__add_scan_stats(uint32_t adv_count, uint32_t adv_dropped);
+void app_status__increment(app_status_counter_t counter);
@@ -9,27 +9,122 @@
  *
  */
 
+#include <ctype.h>
 #include <math.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define LOG_LOCAL_LEVEL ESP_LOG_NONE
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_http_server.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "cJSON.h"
 
 #include "app_web_server.h"
+#include "app_web_server_assets.h"
+#include "app_web_server_json.h"
 #include "app_nvs.h"
+#include "app_measure_vcc.h"
+#include "app_status.h"
+#include "app_lid.h"
+#include "app_beacon.h"
+#include "app_feed_log.h"
 
-static const char *TAG = "app_web_server"; ///< Tag to be used when logging
+#define ASSET_SAVED_URI "/saved.html" ///< URI of the asset sent in response to the form submission
+#define IF_NONE_MATCH_MAX_LEN (63)     ///< Maximum length of the If-None-Match header checked, longer ones are ignored
+#define URI_HANDLERS_MAX (12)          ///< Maximum number of URI handlers (HTTPD_DEFAULT_CONFIG allows 8)
+#define CONFIG_BODY_MAX_LEN (1024)     ///< Maximum length of the body of a POST /api/config request (bytes)
+#define QUERY_MAX_LEN (63)             ///< Maximum length of the query string of a request, longer ones are rejected
+#define FEED_LOG_PAGE_LEN (64)         ///< Maximum number of records in a GET /api/feed_log response
+#define FEED_LOG_READ_LEN (8)          ///< Number of records read from the feeding log at once
 
-static const char home_page_html[] = MAIN_PAGE_GET;                 ///< Home page HTML
-static const char form_submission_response_html[] = MAIN_PAGE_POST; ///< Form submission response HTML
-static httpd_handle_t httpd_handle = NULL;                          ///< HTTP daemon handler
-static httpd_config_t httpd_config = HTTPD_DEFAULT_CONFIG();        ///< HTTP daemon configuration
+/// Integer field of app_nvs_config_t, see config_field_t.
+#define CONFIG_FIELD(field, is_signed) {#field, offsetof(app_nvs_config_t, field), sizeof(((app_nvs_config_t *)0)->field), is_signed}
 
-static esp_err_t app_web_server__get_main_handler(httpd_req_t *req);
+/* The static assets are served gzipped (all the browsers the web UI targets accept it), with an ETag and
+ * "Cache-Control: no-cache", so the browser keeps them and revalidates them on each load: a request whose
+ * If-None-Match has the ETag gets an empty 304 Not Modified. The ETag is a hash of the content, so a firmware update
+ * that changes an asset invalidates it.
+ */
+
+/* REST API, for the provisioning and audit scripts. The responses are JSON documents written by app_web_server_json
+ * straight into the response, in chunks:
+ *   GET  /api/status   uptime, battery (as GET /api/battery), lid state and the telemetry of app_status
+ *   GET  /api/battery  battery state, the fields are null until the first battery reading
+ *   GET  /api/config   configuration, the Wi-Fi password is only reported as set or not
+ *   POST /api/config   change the configuration: a JSON object with the fields to change, named as in GET /api/config
+ *                      (authorized_macs replaces the whole list and must not repeat a MAC, wifi_password is
+ *                      accepted). The configuration is committed to NVS before answering with the new
+ *                      configuration, as GET /api/config. Answers 400 Bad Request, without changing anything, if a
+ *                      field is unknown or invalid.
+ *   GET  /api/beacons  authorized beacons with their last sightings, oldest first
+ *   GET  /api/feed_log?from_seq=N
+ *                      feeding log records from sequence number N (0 if not given), oldest first, at most
+ *                      FEED_LOG_PAGE_LEN of them, and next_seq, the from_seq of the next page. The records batched in
+ *                      RAM are written to the flash first, so the log is read up to the last event.
+ */
+
+/// @brief Typedef for an integer field of the configuration, as read and written by the REST API.
+typedef struct
+{
+    const char *key;   ///< Key, the name of the field in app_nvs_config_t
+    size_t offset;     ///< Offset of the field in app_nvs_config_t
+    uint8_t size;      ///< Size of the field (1 or 2 bytes)
+    uint8_t is_signed; ///< Flag that indicates if the field is signed (0: False, other: True)
+} config_field_t;
+
+static const char *TAG = "app_web_server";                   ///< Tag to be used when logging
+static httpd_handle_t httpd_handle = NULL;                   ///< HTTP daemon handler
+static httpd_config_t httpd_config = HTTPD_DEFAULT_CONFIG(); ///< HTTP daemon configuration
+static const config_field_t config_fields[] = {
+    CONFIG_FIELD(min_rssi_for_detection_dbm, 1),
+    CONFIG_FIELD(min_times_seen_for_detection, 0),
+    CONFIG_FIELD(lid_closed_angle_deg, 0),
+    CONFIG_FIELD(lid_open_angle_deg, 0),
+    CONFIG_FIELD(scan_idle_interval, 0),
+    CONFIG_FIELD(scan_idle_window, 0),
+    CONFIG_FIELD(scan_active_interval, 0),
+    CONFIG_FIELD(scan_active_window, 0),
+    CONFIG_FIELD(lid_ramp_ms, 0),
+    CONFIG_FIELD(lid_stall_current_ma, 0),
+    CONFIG_FIELD(wifi_timeout_secs, 0),
+}; ///< Integer fields of the configuration
+static const char *lid_states_str[] = {
+    "closed",
+    "opening",
+    "open",
+    "closing",
+    "blocked",
+}; ///< Names of the lid states (app_lid_state_t)
+static const char *frame_types_str[] = {
+    "none",
+    "eddystone_uid",
+    "eddystone_tlm",
+    "ibeacon",
+}; ///< Names of the beacon frame types (app_beacon_frame_type_t)
+static const char *feed_log_events_str[] = {
+    "boot",
+    "visit_start",
+    "visit_end",
+    "lid_open",
+    "lid_close",
+    "lid_stall",
+}; ///< Names of the feeding log events (app_feed_log_event_t)
+
+static const app_web_server_asset_t *app_web_server__find_asset(const char *uri);
+static esp_err_t app_web_server__send_asset(httpd_req_t *req, const app_web_server_asset_t *asset);
+static esp_err_t app_web_server__get_asset_handler(httpd_req_t *req);
 static esp_err_t app_web_server__post_main_handler(httpd_req_t *req);
+static esp_err_t app_web_server__get_battery_handler(httpd_req_t *req);
+static esp_err_t app_web_server__get_status_handler(httpd_req_t *req);
+static esp_err_t app_web_server__get_config_handler(httpd_req_t *req);
+static esp_err_t app_web_server__post_config_handler(httpd_req_t *req);
+static esp_err_t app_web_server__get_beacons_handler(httpd_req_t *req);
+static esp_err_t app_web_server__get_feed_log_handler(httpd_req_t *req);
 
 /**
  * @brief Start web server
@@ -40,21 +135,23 @@ static esp_err_t app_web_server__post_main_handler(httpd_req_t *req);
  */
 esp_err_t app_web_server__start(void)
 {
+    httpd_config.max_uri_handlers = URI_HANDLERS_MAX;
     esp_err_t err = httpd_start(&httpd_handle, &httpd_config);
 
-    httpd_uri_t get_main = {
-        .uri = "/",
+    httpd_uri_t get_asset = {
         .method = HTTP_GET,
-        .handler = app_web_server__get_main_handler,
-        .user_ctx = NULL,
-    }; ///< URI handler for GET / request
+        .handler = app_web_server__get_asset_handler,
+    }; ///< URI handler for GET request of a static asset, the URI and asset are set for each one
 
-    httpd_uri_t post_main = {
-        .uri = "/",
-        .method = HTTP_POST,
-        .handler = app_web_server__post_main_handler,
-        .user_ctx = NULL,
-    }; ///< URI handler for POST / request
+    const httpd_uri_t uri_handlers[] = {
+        {.uri = "/", .method = HTTP_POST, .handler = app_web_server__post_main_handler},
+        {.uri = "/api/status", .method = HTTP_GET, .handler = app_web_server__get_status_handler},
+        {.uri = "/api/battery", .method = HTTP_GET, .handler = app_web_server__get_battery_handler},
+        {.uri = "/api/config", .method = HTTP_GET, .handler = app_web_server__get_config_handler},
+        {.uri = "/api/config", .method = HTTP_POST, .handler = app_web_server__post_config_handler},
+        {.uri = "/api/beacons", .method = HTTP_GET, .handler = app_web_server__get_beacons_handler},
+        {.uri = "/api/feed_log", .method = HTTP_GET, .handler = app_web_server__get_feed_log_handler},
+    }; ///< URI handlers of the form submission and of the REST API
 
     if (err != ESP_OK)
     {
@@ -65,7 +162,13 @@ esp_err_t app_web_server__start(void)
     {
         ESP_LOGI(TAG, "Success starting HTTP daemon");
 
-        err = httpd_register_uri_handler(httpd_handle, &get_main); // register GET / URI handler
+        // register GET URI handler of each static asset
+        for (size_t i = 0; (i < app_web_server_assets_count) && (err == ESP_OK); i++)
+        {
+            get_asset.uri = app_web_server_assets[i].uri;
+            get_asset.user_ctx = (void *)&app_web_server_assets[i];
+            err = httpd_register_uri_handler(httpd_handle, &get_asset);
+        }
         if (err != ESP_OK)
         {
             ESP_LOGE(TAG, "Error %d registering URI handler: %s", err, esp_err_to_name(err));
@@ -73,7 +176,10 @@ esp_err_t app_web_server__start(void)
         }
         else
         {
-            err = httpd_register_uri_handler(httpd_handle, &post_main); // register POST / URI handler
+            for (size_t i = 0; (i < sizeof(uri_handlers) / sizeof(uri_handlers[0])) && (err == ESP_OK); i++)
+            {
+                err = httpd_register_uri_handler(httpd_handle, &uri_handlers[i]);
+            }
             if (err != ESP_OK)
             {
                 ESP_LOGE(TAG, "Error %d registering URI handler: %s", err, esp_err_to_name(err));
@@ -112,17 +218,71 @@ esp_err_t app_web_server__stop(void)
 }
 
 /**
- * @brief Handler for GET / request.
+ * @brief Find static asset.
+ *
+ * @param uri URI the asset is served at.
+ * @return const app_web_server_asset_t* Asset, NULL if there is none at the URI.
+ */
+static const app_web_server_asset_t *app_web_server__find_asset(const char *uri)
+{
+    for (size_t i = 0; i < app_web_server_assets_count; i++)
+    {
+        if (strcmp(app_web_server_assets[i].uri, uri) == 0)
+        {
+            return &app_web_server_assets[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Send static asset as the response, gzipped, with its ETag.
+ *
+ * @param req HTTP request data.
+ * @param asset Asset.
+ * @return esp_err_t
+ * @retval ESP_OK if response is sent successfully.
+ * @retval Error code otherwise.
+ */
+static esp_err_t app_web_server__send_asset(httpd_req_t *req, const app_web_server_asset_t *asset)
+{
+    httpd_resp_set_type(req, asset->type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "ETag", asset->etag);
+    return httpd_resp_send(req, (const char *)asset->data, asset->len);
+}
+
+/**
+ * @brief Handler for GET request of a static asset, the asset is the URI handler context.
  *
  * @param req HTTP request data.
  * @return esp_err_t
  * @retval ESP_OK if response is sent successfully.
  * @retval ESP_FAIL otherwise.
  */
-static esp_err_t app_web_server__get_main_handler(httpd_req_t *req)
+static esp_err_t app_web_server__get_asset_handler(httpd_req_t *req)
 {
-    ESP_LOGI(TAG, "Received HTTP request (GET /)");
-    esp_err_t err = httpd_resp_send(req, home_page_html, HTTPD_RESP_USE_STRLEN);
+    ESP_LOGI(TAG, "Received HTTP request (GET %s)", req->uri);
+    const app_web_server_asset_t *asset = req->user_ctx;
+    char if_none_match[IF_NONE_MATCH_MAX_LEN + 1];
+    size_t if_none_match_len = httpd_req_get_hdr_value_len(req, "If-None-Match");
+    esp_err_t err;
+
+    // the header may list several ETags, the browser sends the one it got along with the asset
+    if ((if_none_match_len > 0) && (if_none_match_len <= IF_NONE_MATCH_MAX_LEN) &&
+        (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK) &&
+        (strstr(if_none_match, asset->etag) != NULL))
+    {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+        httpd_resp_set_hdr(req, "ETag", asset->etag);
+        err = httpd_resp_send(req, NULL, 0);
+    }
+    else
+    {
+        err = app_web_server__send_asset(req, asset);
+    }
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Error %d sending HTTP response: %s", err, esp_err_to_name(err));
@@ -177,16 +337,6 @@ static esp_err_t app_web_server__post_main_handler(httpd_req_t *req)
     {
         ESP_LOGI(TAG, "Succes receiving POST request, content received: %s", request_content);
 
-        err = httpd_resp_send(req, form_submission_response_html, HTTPD_RESP_USE_STRLEN);
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Error %d sending HTTP response: %s", err, esp_err_to_name(err));
-        }
-        else
-        {
-            ESP_LOGI(TAG, "Success sending HTTP response!");
-        }
-
         // convert authorized MAC received as string to array of bytes
         for (uint8_t i = 0; i < sizeof(authorized_mac) / sizeof(authorized_mac[0]); i++)
         {
@@ -198,16 +348,633 @@ static esp_err_t app_web_server__post_main_handler(httpd_req_t *req)
         ESP_LOGI(TAG, "Authorized MAC after converting from str to array of bytes: 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x 0x%2.2x",
                  authorized_mac[0], authorized_mac[1], authorized_mac[2], authorized_mac[3], authorized_mac[4], authorized_mac[5]);
 
+        // the MAC is committed before answering, so that the setting survives a reset once the user sees it saved
         err = app_nvs__set_authorized_mac(authorized_mac);
+        if (err == ESP_OK)
+        {
+            err = app_nvs__commit();
+        }
         if (err != ESP_OK)
         {
             ESP_LOGE(TAG, "Error %d writing authorized MAC to NVS: %s", err, esp_err_to_name(err));
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "Success writing authorized MAC to NVS!");
+
+        err = app_web_server__send_asset(req, app_web_server__find_asset(ASSET_SAVED_URI));
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error %d sending HTTP response: %s", err, esp_err_to_name(err));
             return ESP_FAIL;
         }
+        ESP_LOGI(TAG, "Success sending HTTP response!");
+        return ESP_OK;
+    }
+}
+
+
+/**
+ * @brief End JSON response.
+ *
+ * @param json Writer of the response.
+ * @return esp_err_t
+ * @retval ESP_OK if response is sent successfully.
+ * @retval ESP_FAIL otherwise.
+ */
+static esp_err_t app_web_server__end_json(app_web_server_json_t *json)
+{
+    esp_err_t err = app_web_server_json__end(json);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d sending HTTP response: %s", err, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Success sending HTTP response!");
+        return ESP_OK;
+    }
+}
+
+/**
+ * @brief Write battery state as a JSON object. The fields are null until the first battery reading.
+ *
+ * @param json Writer.
+ * @param key Key of the object in the enclosing object, NULL at the top level.
+ */
+static void app_web_server__write_battery(app_web_server_json_t *json, const char *key)
+{
+    app_measure_vcc_battery_t battery;
+
+    app_measure_vcc__get_battery(&battery);
+    app_web_server_json__object_begin(json, key);
+    if (!battery.valid)
+    {
+        app_web_server_json__null(json, "voltage_mv");
+        app_web_server_json__null(json, "load_ma");
+        app_web_server_json__null(json, "resistance_mohm");
+        app_web_server_json__null(json, "ocv_mv");
+        app_web_server_json__null(json, "percent");
+        app_web_server_json__null(json, "runtime_min");
+    }
+    else
+    {
+        app_web_server_json__int(json, "voltage_mv", battery.voltage_mv);
+        app_web_server_json__int(json, "load_ma", battery.load_ma);
+        app_web_server_json__int(json, "resistance_mohm", battery.resistance_mohm);
+        app_web_server_json__int(json, "ocv_mv", battery.ocv_mv);
+        app_web_server_json__int(json, "percent", battery.percent);
+        if (battery.runtime_min < 0)
+        {
+            app_web_server_json__null(json, "runtime_min");
+        }
+        else
+        {
+            app_web_server_json__int(json, "runtime_min", battery.runtime_min);
+        }
+    }
+    app_web_server_json__object_end(json);
+}
+
+/**
+ * @brief Handler for GET /api/battery request: battery voltage, state of charge and projected runtime, as JSON.
+ *
+ * @param req HTTP request data.
+ * @return esp_err_t
+ * @retval ESP_OK if response is sent successfully.
+ * @retval ESP_FAIL otherwise.
+ */
+static esp_err_t app_web_server__get_battery_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "Received HTTP request (GET /api/battery)");
+    app_web_server_json_t json;
+
+    app_web_server_json__begin(&json, req);
+    app_web_server__write_battery(&json, NULL);
+    return app_web_server__end_json(&json);
+}
+
+/**
+ * @brief Handler for GET /api/status request: uptime, battery, lid state and telemetry, as JSON.
+ *
+ * @param req HTTP request data.
+ * @return esp_err_t
+ * @retval ESP_OK if response is sent successfully.
+ * @retval ESP_FAIL otherwise.
+ */
+static esp_err_t app_web_server__get_status_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "Received HTTP request (GET /api/status)");
+    app_status_telemetry_t telemetry;
+    app_web_server_json_t json;
+
+    app_status__get(&telemetry);
+    app_web_server_json__begin(&json, req);
+    app_web_server_json__object_begin(&json, NULL);
+    app_web_server_json__int(&json, "uptime_ms", esp_timer_get_time() / 1000);
+    app_web_server_json__bool(&json, "gateway_battery_low", telemetry.gateway_battery_low);
+    app_web_server__write_battery(&json, "battery");
+
+    app_web_server_json__object_begin(&json, "beacon");
+    app_web_server_json__bool(&json, "battery_low", telemetry.beacon_battery_low);
+    if (telemetry.beacon_last_seen_ms == 0)
+    {
+        app_web_server_json__null(&json, "last_seen_ms");
+    }
+    else
+    {
+        app_web_server_json__int(&json, "last_seen_ms", telemetry.beacon_last_seen_ms);
+        app_web_server_json__int(&json, "rssi", telemetry.beacon_rssi);
+        app_web_server_json__int(&json, "battery_mv", telemetry.beacon_mv);
+        app_web_server_json__int(&json, "temp_q8", telemetry.beacon_temp_q8);
+    }
+    app_web_server_json__object_end(&json);
+
+    app_web_server_json__object_begin(&json, "lid");
+    app_web_server_json__string(&json, "state", lid_states_str[app_lid__get_state()]);
+    app_web_server_json__int(&json, "open_count", telemetry.lid_open_count);
+    app_web_server_json__int(&json, "close_count", telemetry.lid_close_count);
+    app_web_server_json__int(&json, "stall_count", telemetry.lid_stall_count);
+    app_web_server_json__object_end(&json);
+
+    app_web_server_json__object_begin(&json, "scan");
+    app_web_server_json__int(&json, "adv_count", telemetry.scan_adv_count);
+    app_web_server_json__int(&json, "adv_dropped", telemetry.scan_adv_dropped);
+    app_web_server_json__int(&json, "detection_count", telemetry.scan_detection_count);
+    app_web_server_json__object_end(&json);
+
+    app_web_server_json__object_end(&json);
+    return app_web_server__end_json(&json);
+}
+
+/**
+ * @brief Get integer field of the configuration.
+ *
+ * @param config Configuration.
+ * @param field Field.
+ * @return int32_t Value of the field.
+ */
+static int32_t app_web_server__config_field_get(const app_nvs_config_t *config, const config_field_t *field)
+{
+    const uint8_t *p = (const uint8_t *)config + field->offset;
+
+    if (field->size == 1)
+    {
+        return field->is_signed ? (int32_t)(int8_t)p[0] : (int32_t)p[0];
+    }
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return field->is_signed ? (int32_t)(int16_t)value : (int32_t)value;
+}
+
+/**
+ * @brief Set integer field of the configuration. Only checks that the value fits the field, app_nvs__set_config
+ * checks the rest.
+ *
+ * @param config Configuration.
+ * @param field Field.
+ * @param value Value, as parsed from JSON.
+ * @return esp_err_t
+ * @retval ESP_OK if the field is set.
+ * @retval ESP_ERR_INVALID_ARG if the value is not an integer or does not fit the field.
+ */
+static esp_err_t app_web_server__config_field_set(app_nvs_config_t *config, const config_field_t *field, double value)
+{
+    uint8_t *p = (uint8_t *)config + field->offset;
+    int32_t bits = 8 * field->size;
+    int32_t min = field->is_signed ? -(1L << (bits - 1)) : 0;
+    int32_t max = field->is_signed ? (1L << (bits - 1)) - 1 : (1L << bits) - 1;
+
+    // written so that NaN fails too
+    if (!((value >= min) && (value <= max) && (value == (double)(int32_t)value)))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (field->size == 1)
+    {
+        p[0] = (uint8_t)(int32_t)value;
+    }
+    else
+    {
+        uint16_t value_u16 = (uint16_t)(int32_t)value;
+        memcpy(p, &value_u16, sizeof(value_u16));
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Write configuration as a JSON object, without the Wi-Fi password.
+ *
+ * @param json Writer.
+ */
+static void app_web_server__write_config(app_web_server_json_t *json)
+{
+    app_nvs_config_t config;
+
+    app_nvs__get_config(&config);
+    app_web_server_json__object_begin(json, NULL);
+    app_web_server_json__int(json, "version", APP_NVS_CONFIG_VERSION);
+    app_web_server_json__array_begin(json, "authorized_macs");
+    for (size_t i = 0; i < config.authorized_macs_count; i++)
+    {
+        app_web_server_json__mac(json, NULL, config.authorized_macs[i]);
+    }
+    app_web_server_json__array_end(json);
+    for (size_t i = 0; i < sizeof(config_fields) / sizeof(config_fields[0]); i++)
+    {
+        app_web_server_json__int(json, config_fields[i].key, app_web_server__config_field_get(&config, &config_fields[i]));
+    }
+    app_web_server_json__string(json, "wifi_ssid", config.wifi_ssid);
+    app_web_server_json__bool(json, "wifi_password_set", config.wifi_password[0] != '\0');
+    app_web_server_json__object_end(json);
+}
+
+/**
+ * @brief Parse MAC address, as 12 hexadecimal digits, optionally with a colon between the bytes.
+ *
+ * @param str MAC address string.
+ * @param mac 6 bytes array to write the MAC address to.
+ * @return esp_err_t
+ * @retval ESP_OK if the MAC address is parsed.
+ * @retval ESP_ERR_INVALID_ARG otherwise.
+ */
+static esp_err_t app_web_server__parse_mac(const char *str, uint8_t mac[6])
+{
+    for (size_t i = 0; i < 6; i++)
+    {
+        if ((i > 0) && (*str == ':'))
+        {
+            str++;
+        }
+        if (!isxdigit((unsigned char)str[0]) || !isxdigit((unsigned char)str[1]))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        char byte_str[3] = {str[0], str[1], '\0'};
+        mac[i] = (uint8_t)strtol(byte_str, NULL, 16);
+        str += 2;
+    }
+    return (*str == '\0') ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+/**
+ * @brief Apply a configuration change, as received by POST /api/config, to a configuration.
+ *
+ * @param root JSON object with the fields to change.
+ * @param config Configuration.
+ * @param bad_key Set to the key of the first field that is unknown or invalid, NULL if the change is not an object.
+ * @return esp_err_t
+ * @retval ESP_OK if all the fields are applied.
+ * @retval ESP_ERR_INVALID_ARG otherwise.
+ */
+static esp_err_t app_web_server__apply_config_json(const cJSON *root, app_nvs_config_t *config, const char **bad_key)
+{
+    static const uint8_t zero_mac[6] = {0};
+    const cJSON *item;
+
+    *bad_key = NULL;
+    if (!cJSON_IsObject(root))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    cJSON_ArrayForEach(item, root)
+    {
+        esp_err_t err = ESP_ERR_INVALID_ARG;
+
+        *bad_key = item->string;
+        if (strcmp(item->string, "authorized_macs") == 0)
+        {
+            if (cJSON_IsArray(item) && (cJSON_GetArraySize(item) <= APP_NVS_MAX_AUTHORIZED_MACS))
+            {
+                const cJSON *mac_item;
+                err = ESP_OK;
+                config->authorized_macs_count = 0;
+                cJSON_ArrayForEach(mac_item, item)
+                {
+                    uint8_t *mac = config->authorized_macs[config->authorized_macs_count];
+                    if (!cJSON_IsString(mac_item) || (app_web_server__parse_mac(mac_item->valuestring, mac) != ESP_OK) ||
+                        (memcmp(mac, zero_mac, sizeof(zero_mac)) == 0))
+                    {
+                        err = ESP_ERR_INVALID_ARG;
+                        break;
+                    }
+                    // a duplicate would take a second registry entry for the same beacon
+                    for (size_t i = 0; (i < config->authorized_macs_count) && (err == ESP_OK); i++)
+                    {
+                        if (memcmp(config->authorized_macs[i], mac, 6) == 0)
+                        {
+                            err = ESP_ERR_INVALID_ARG;
+                        }
+                    }
+                    if (err != ESP_OK)
+                    {
+                        break;
+                    }
+                    config->authorized_macs_count++;
+                }
+            }
+        }
+        else if (strcmp(item->string, "wifi_ssid") == 0)
+        {
+            if (cJSON_IsString(item) && (strlen(item->valuestring) < sizeof(config->wifi_ssid)))
+            {
+                strcpy(config->wifi_ssid, item->valuestring);
+                err = ESP_OK;
+            }
+        }
+        else if (strcmp(item->string, "wifi_password") == 0)
+        {
+            if (cJSON_IsString(item) && (strlen(item->valuestring) < sizeof(config->wifi_password)))
+            {
+                strcpy(config->wifi_password, item->valuestring);
+                err = ESP_OK;
+            }
+        }
         else
         {
-            ESP_LOGI(TAG, "Success writing authorized MAC to NVS!");
-            return ESP_OK;
+            for (size_t i = 0; i < sizeof(config_fields) / sizeof(config_fields[0]); i++)
+            {
+                if ((strcmp(item->string, config_fields[i].key) == 0) && cJSON_IsNumber(item))
+                {
+                    err = app_web_server__config_field_set(config, &config_fields[i], item->valuedouble);
+                    break;
+                }
+            }
+        }
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+    *bad_key = NULL;
+    return ESP_OK;
+}
+
+/**
+ * @brief Handler for GET /api/config request: configuration, as JSON.
+ *
+ * @param req HTTP request data.
+ * @return esp_err_t
+ * @retval ESP_OK if response is sent successfully.
+ * @retval ESP_FAIL otherwise.
+ */
+static esp_err_t app_web_server__get_config_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "Received HTTP request (GET /api/config)");
+    app_web_server_json_t json;
+
+    app_web_server_json__begin(&json, req);
+    app_web_server__write_config(&json);
+    return app_web_server__end_json(&json);
+}
+
+/**
+ * @brief Handler for POST /api/config request: change the configuration and commit it, answering the new
+ * configuration as JSON.
+ *
+ * @param req HTTP request data.
+ * @return esp_err_t
+ * @retval ESP_OK if response is sent successfully.
+ * @retval ESP_FAIL otherwise.
+ */
+static esp_err_t app_web_server__post_config_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "Received HTTP request (POST /api/config)");
+    if (req->content_len > CONFIG_BODY_MAX_LEN)
+    {
+        // returning ESP_FAIL closes the socket, so the body is not read
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Request body too large");
+        return ESP_FAIL;
+    }
+    char *body = malloc(req->content_len + 1);
+    if (body == NULL)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    size_t received = 0;
+    while (received < req->content_len)
+    {
+        int ret = httpd_req_recv(req, &body[received], req->content_len - received);
+        if (ret <= 0)
+        {
+            ESP_LOGE(TAG, "Error receiving POST request");
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+            {
+                httpd_resp_send_408(req);
+            }
+            free(body);
+            return ESP_FAIL;
+        }
+        received += ret;
+    }
+
+    app_nvs_config_t config;
+    const char *bad_key = NULL;
+    char err_msg[64];
+    app_nvs__get_config(&config);
+    cJSON *root = cJSON_ParseWithLength(body, received);
+    free(body);
+    esp_err_t err = (root == NULL) ? ESP_ERR_INVALID_ARG : app_web_server__apply_config_json(root, &config, &bad_key);
+    if (bad_key != NULL)
+    {
+        snprintf(err_msg, sizeof(err_msg), "Invalid field %s", bad_key);
+    }
+    else
+    {
+        snprintf(err_msg, sizeof(err_msg), "Invalid configuration");
+    }
+    cJSON_Delete(root);
+
+    if (err == ESP_OK)
+    {
+        // checks the fields against each other and their allowed ranges
+        err = app_nvs__set_config(&config);
+    }
+    if (err == ESP_ERR_INVALID_ARG)
+    {
+        ESP_LOGW(TAG, "Rejected configuration: %s", err_msg);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err_msg);
+        return ESP_OK;
+    }
+    if (err == ESP_OK)
+    {
+        // committed before answering, as the form submission
+        err = app_nvs__commit();
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d writing configuration to NVS: %s", err, esp_err_to_name(err));
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    app_web_server_json_t json;
+    app_web_server_json__begin(&json, req);
+    app_web_server__write_config(&json);
+    return app_web_server__end_json(&json);
+}
+
+/**
+ * @brief Handler for GET /api/beacons request: authorized beacons with their last sightings, as JSON.
+ *
+ * @param req HTTP request data.
+ * @return esp_err_t
+ * @retval ESP_OK if response is sent successfully.
+ * @retval ESP_FAIL otherwise.
+ */
+static esp_err_t app_web_server__get_beacons_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "Received HTTP request (GET /api/beacons)");
+    uint8_t authorized_macs[APP_NVS_MAX_AUTHORIZED_MACS][6];
+    size_t authorized_macs_count = 0;
+    app_beacon_sighting_t sightings[APP_BEACON_HISTORY_LEN];
+    app_web_server_json_t json;
+
+    app_nvs__get_authorized_macs(authorized_macs, &authorized_macs_count);
+    app_web_server_json__begin(&json, req);
+    app_web_server_json__object_begin(&json, NULL);
+    app_web_server_json__array_begin(&json, "beacons");
+    for (size_t i = 0; i < authorized_macs_count; i++)
+    {
+        size_t count = app_beacon__get_history(authorized_macs[i], sightings, APP_BEACON_HISTORY_LEN);
+
+        app_web_server_json__object_begin(&json, NULL);
+        app_web_server_json__mac(&json, "mac", authorized_macs[i]);
+        app_web_server_json__array_begin(&json, "sightings");
+        for (size_t j = 0; j < count; j++)
+        {
+            app_web_server_json__object_begin(&json, NULL);
+            app_web_server_json__int(&json, "time_ms", sightings[j].time_ms);
+            app_web_server_json__int(&json, "rssi", sightings[j].rssi);
+            app_web_server_json__string(&json, "frame", frame_types_str[sightings[j].type]);
+            if (sightings[j].type == app_beacon_frame_eddystone_tlm)
+            {
+                app_web_server_json__object_begin(&json, "tlm");
+                app_web_server_json__int(&json, "battery_mv", sightings[j].tlm.battery_mv);
+                if (sightings[j].tlm.temp_q8 == APP_BEACON_TLM_TEMP_UNSUPPORTED)
+                {
+                    app_web_server_json__null(&json, "temp_q8");
+                }
+                else
+                {
+                    app_web_server_json__int(&json, "temp_q8", sightings[j].tlm.temp_q8);
+                }
+                app_web_server_json__int(&json, "adv_count", sightings[j].tlm.adv_count);
+                app_web_server_json__int(&json, "uptime_ds", sightings[j].tlm.uptime_ds);
+                app_web_server_json__object_end(&json);
+            }
+            app_web_server_json__object_end(&json);
         }
+        app_web_server_json__array_end(&json);
+        app_web_server_json__object_end(&json);
     }
-}
\ No newline at end of file
+    app_web_server_json__array_end(&json);
+    app_web_server_json__object_end(&json);
+    return app_web_server__end_json(&json);
+}
+
+/**
+ * @brief Get the from_seq parameter of the query string of a GET /api/feed_log request.
+ *
+ * @param req HTTP request data.
+ * @param from_seq Value of the parameter, 0 if it is not given.
+ * @return esp_err_t
+ * @retval ESP_OK if the parameter is valid or not given.
+ * @retval ESP_ERR_INVALID_ARG otherwise.
+ */
+static esp_err_t app_web_server__get_from_seq(httpd_req_t *req, uint32_t *from_seq)
+{
+    char query[QUERY_MAX_LEN + 1];
+    char value[11];
+    char *end;
+
+    *from_seq = 0;
+    size_t query_len = httpd_req_get_url_query_len(req);
+    if (query_len == 0)
+    {
+        return ESP_OK;
+    }
+    if (query_len > QUERY_MAX_LEN || httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = httpd_query_key_value(query, "from_seq", value, sizeof(value));
+    if (err == ESP_ERR_NOT_FOUND)
+    {
+        return ESP_OK;
+    }
+    if (err != ESP_OK || !isdigit((unsigned char)value[0]))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    unsigned long seq = strtoul(value, &end, 10);
+    if (*end != '\0' || seq > UINT32_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *from_seq = (uint32_t)seq;
+    return ESP_OK;
+}
+
+/**
+ * @brief Handler for GET /api/feed_log request: feeding log records from the sequence number given by from_seq, as
+ * JSON. The records are read and written FEED_LOG_READ_LEN at a time, so the stack use does not depend on the page
+ * length.
+ *
+ * @param req HTTP request data.
+ * @return esp_err_t
+ * @retval ESP_OK if response is sent successfully.
+ * @retval ESP_FAIL otherwise.
+ */
+static esp_err_t app_web_server__get_feed_log_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "Received HTTP request (GET /api/feed_log)");
+    app_feed_log_record_t records[FEED_LOG_READ_LEN];
+    app_web_server_json_t json;
+    uint32_t next_seq;
+    size_t total = 0;
+    size_t count;
+
+    if (app_web_server__get_from_seq(req, &next_seq) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid from_seq");
+        return ESP_OK;
+    }
+    app_feed_log__flush();
+
+    app_web_server_json__begin(&json, req);
+    app_web_server_json__object_begin(&json, NULL);
+    app_web_server_json__array_begin(&json, "records");
+    do
+    {
+        count = app_feed_log__read(next_seq, records, FEED_LOG_READ_LEN);
+        for (size_t i = 0; i < count; i++)
+        {
+            const app_feed_log_record_t *record = &records[i];
+            app_web_server_json__object_begin(&json, NULL);
+            app_web_server_json__int(&json, "seq", record->seq);
+            app_web_server_json__int(&json, "boot", record->boot);
+            if (record->event < sizeof(feed_log_events_str) / sizeof(feed_log_events_str[0]))
+            {
+                app_web_server_json__string(&json, "event", feed_log_events_str[record->event]);
+            }
+            else
+            {
+                app_web_server_json__int(&json, "event", record->event);
+            }
+            app_web_server_json__int(&json, "time_ms", record->time_ms);
+            app_web_server_json__int(&json, "duration_ms", record->duration_ms);
+            app_web_server_json__int(&json, "rssi", record->rssi);
+            app_web_server_json__mac(&json, "mac", record->mac);
+            app_web_server_json__object_end(&json);
+            next_seq = record->seq + 1;
+        }
+        total += count;
+    } while (count == FEED_LOG_READ_LEN && total < FEED_LOG_PAGE_LEN);
+    app_web_server_json__array_end(&json);
+    app_web_server_json__int(&json, "next_seq", next_seq);
+    app_web_server_json__object_end(&json);
+    return app_web_server__end_json(&json);
+}
@@ -0,0 +1,29 @@
+/**
+ * @file app_web_server_assets.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Private header of the static assets of the web UI, generated at build time from the www directory by
+ * tools/web_assets.py (see CMakeLists.txt).
+ * @version 0.1
+ * @date 2024-03-16
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief Typedef for a static asset, minified and gzipped.
+typedef struct
+{
+    const char *uri;     ///< URI the asset is served at
+    const char *type;    ///< Content type
+    const uint8_t *data; ///< Gzipped content
+    size_t len;          ///< Length of the gzipped content (bytes)
+    const char *etag;    ///< Entity tag (quoted), changes only when the content does
+} app_web_server_asset_t;
+
+extern const app_web_server_asset_t app_web_server_assets[]; ///< Static assets
+extern const size_t app_web_server_assets_count;             ///< Number of static assets
@@ -0,0 +1,320 @@
+/**
+ * @file app_web_server_json.c
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Contains the streaming JSON writer, which sends the JSON responses of the REST API as they are written.
+ * @version 0.1
+ * @date 2024-03-16
+ *
+ * @copyright Copyright (c) 2024 PetDog
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.'
+    See the License for the specific language governing permissions and
+    limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "app_web_server_json.h"
+
+/* The document is never held in memory as a whole: the writer only buffers APP_WEB_SERVER_JSON_BUF_SIZE bytes, on the
+ * stack of the handler, and sends them with httpd_resp_send_chunk (chunked transfer encoding) each time the buffer is
+ * full, so the size of a response is not bounded by the heap. The writer does not check that the calls are balanced
+ * or that keys are given exactly inside objects, the handlers are expected to write well-formed documents. Errors
+ * are sticky: after the first one (usually the client going away) the calls do nothing, and app_web_server_json__end
+ * returns it, so the handlers only check the result once.
+ */
+
+/**
+ * @brief Send the buffered output as an HTTP chunk.
+ *
+ * @param json Writer.
+ */
+static void app_web_server_json__flush(app_web_server_json_t *json)
+{
+    if ((json->err == ESP_OK) && (json->len > 0))
+    {
+        json->err = httpd_resp_send_chunk(json->req, json->buf, json->len);
+    }
+    json->len = 0;
+}
+
+/**
+ * @brief Write raw output.
+ *
+ * @param json Writer.
+ * @param data Output.
+ * @param len Length of the output (bytes).
+ */
+static void app_web_server_json__put(app_web_server_json_t *json, const char *data, size_t len)
+{
+    while ((len > 0) && (json->err == ESP_OK))
+    {
+        if (json->len == sizeof(json->buf))
+        {
+            app_web_server_json__flush(json);
+        }
+        size_t n = sizeof(json->buf) - json->len;
+        n = (len < n) ? len : n;
+        memcpy(&json->buf[json->len], data, n);
+        json->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Write string as a JSON string, quoted and escaped.
+ *
+ * @param json Writer.
+ * @param str String (UTF-8).
+ */
+static void app_web_server_json__put_string(app_web_server_json_t *json, const char *str)
+{
+    app_web_server_json__put(json, "\"", 1);
+    while (*str != '\0')
+    {
+        // copy the run of characters that need no escaping at once
+        size_t n = strcspn(str, "\"\\\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+                                "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f");
+        app_web_server_json__put(json, str, n);
+        str += n;
+        if (*str != '\0')
+        {
+            char escaped[7];
+            if ((*str == '"') || (*str == '\\'))
+            {
+                escaped[0] = '\\';
+                escaped[1] = *str;
+                escaped[2] = '\0';
+            }
+            else
+            {
+                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)*str);
+            }
+            app_web_server_json__put(json, escaped, strlen(escaped));
+            str++;
+        }
+    }
+    app_web_server_json__put(json, "\"", 1);
+}
+
+/**
+ * @brief Start a value: write the separator from the previous member of the enclosing object or array, and the key.
+ *
+ * @param json Writer.
+ * @param key Key of the value in the enclosing object, NULL in an array or at the top level.
+ */
+static void app_web_server_json__value(app_web_server_json_t *json, const char *key)
+{
+    if (json->depth > 0)
+    {
+        uint8_t bit = 1 << (json->depth - 1);
+        if (json->not_empty & bit)
+        {
+            app_web_server_json__put(json, ",", 1);
+        }
+        json->not_empty |= bit;
+    }
+    if (key != NULL)
+    {
+        app_web_server_json__put_string(json, key);
+        app_web_server_json__put(json, ":", 1);
+    }
+}
+
+/**
+ * @brief Open an object or array.
+ *
+ * @param json Writer.
+ * @param key Key of the object or array in the enclosing object, NULL in an array or at the top level.
+ * @param open Opening character.
+ */
+static void app_web_server_json__open(app_web_server_json_t *json, const char *key, const char *open)
+{
+    if (json->depth == APP_WEB_SERVER_JSON_DEPTH_MAX)
+    {
+        json->err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    app_web_server_json__value(json, key);
+    app_web_server_json__put(json, open, 1);
+    json->depth++;
+    json->not_empty &= ~(1 << (json->depth - 1));
+}
+
+/**
+ * @brief Close an object or array.
+ *
+ * @param json Writer.
+ * @param close Closing character.
+ */
+static void app_web_server_json__close(app_web_server_json_t *json, const char *close)
+{
+    if (json->depth == 0)
+    {
+        json->err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    app_web_server_json__put(json, close, 1);
+    json->depth--;
+}
+
+/**
+ * @brief Start writing the JSON response of a request.
+ *
+ * @param json Writer.
+ * @param req HTTP request data.
+ */
+void app_web_server_json__begin(app_web_server_json_t *json, httpd_req_t *req)
+{
+    json->req = req;
+    json->len = 0;
+    json->depth = 0;
+    json->not_empty = 0;
+    json->err = httpd_resp_set_type(req, "application/json");
+}
+
+/**
+ * @brief Send the rest of the response and end it.
+ *
+ * @param json Writer.
+ * @return esp_err_t
+ * @retval ESP_OK if the whole response is sent.
+ * @retval Error code of the first error otherwise.
+ */
+esp_err_t app_web_server_json__end(app_web_server_json_t *json)
+{
+    app_web_server_json__flush(json);
+    if (json->err == ESP_OK)
+    {
+        json->err = httpd_resp_send_chunk(json->req, NULL, 0);
+    }
+    return json->err;
+}
+
+/**
+ * @brief Open an object, closed with app_web_server_json__object_end.
+ *
+ * @param json Writer.
+ * @param key Key of the object in the enclosing object, NULL in an array or at the top level.
+ */
+void app_web_server_json__object_begin(app_web_server_json_t *json, const char *key)
+{
+    app_web_server_json__open(json, key, "{");
+}
+
+/**
+ * @brief Close the object opened last.
+ *
+ * @param json Writer.
+ */
+void app_web_server_json__object_end(app_web_server_json_t *json)
+{
+    app_web_server_json__close(json, "}");
+}
+
+/**
+ * @brief Open an array, closed with app_web_server_json__array_end.
+ *
+ * @param json Writer.
+ * @param key Key of the array in the enclosing object, NULL in an array or at the top level.
+ */
+void app_web_server_json__array_begin(app_web_server_json_t *json, const char *key)
+{
+    app_web_server_json__open(json, key, "[");
+}
+
+/**
+ * @brief Close the array opened last.
+ *
+ * @param json Writer.
+ */
+void app_web_server_json__array_end(app_web_server_json_t *json)
+{
+    app_web_server_json__close(json, "]");
+}
+
+/**
+ * @brief Write integer.
+ *
+ * @param json Writer.
+ * @param key Key in the enclosing object, NULL in an array.
+ * @param value Value.
+ */
+void app_web_server_json__int(app_web_server_json_t *json, const char *key, int64_t value)
+{
+    char str[21];
+
+    app_web_server_json__value(json, key);
+    int len = snprintf(str, sizeof(str), "%lld", (long long)value);
+    app_web_server_json__put(json, str, (size_t)len);
+}
+
+/**
+ * @brief Write boolean.
+ *
+ * @param json Writer.
+ * @param key Key in the enclosing object, NULL in an array.
+ * @param value Value (0: False, other: True).
+ */
+void app_web_server_json__bool(app_web_server_json_t *json, const char *key, uint8_t value)
+{
+    app_web_server_json__value(json, key);
+    if (value)
+    {
+        app_web_server_json__put(json, "true", 4);
+    }
+    else
+    {
+        app_web_server_json__put(json, "false", 5);
+    }
+}
+
+/**
+ * @brief Write null.
+ *
+ * @param json Writer.
+ * @param key Key in the enclosing object, NULL in an array.
+ */
+void app_web_server_json__null(app_web_server_json_t *json, const char *key)
+{
+    app_web_server_json__value(json, key);
+    app_web_server_json__put(json, "null", 4);
+}
+
+/**
+ * @brief Write string.
+ *
+ * @param json Writer.
+ * @param key Key in the enclosing object, NULL in an array.
+ * @param value Value (UTF-8).
+ */
+void app_web_server_json__string(app_web_server_json_t *json, const char *key, const char *value)
+{
+    app_web_server_json__value(json, key);
+    app_web_server_json__put_string(json, value);
+}
+
+/**
+ * @brief Write MAC address as a string, e.g. "50:6c:93:1e:00:01".
+ *
+ * @param json Writer.
+ * @param key Key in the enclosing object, NULL in an array.
+ * @param mac 6 bytes array with MAC address.
+ */
+void app_web_server_json__mac(app_web_server_json_t *json, const char *key, const uint8_t mac[6])
+{
+    char str[18];
+
+    snprintf(str, sizeof(str), "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    app_web_server_json__string(json, key, str);
+}
@@ -0,0 +1,44 @@
+/**
+ * @file app_web_server_json.h
+ * @author Henrique Sander Lourenço (henriquesander27@gmail.com)
+ * @brief Private header of the streaming JSON writer of the app_web_server component.
+ * @version 0.1
+ * @date 2024-03-16
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#define APP_WEB_SERVER_JSON_BUF_SIZE (256) ///< Size of the buffer of the writer, sent as one HTTP chunk when full (bytes)
+#define APP_WEB_SERVER_JSON_DEPTH_MAX (8)  ///< Maximum nesting of objects and arrays
+
+/// @brief Typedef for the state of a JSON writer, which writes the response of a request as it goes.
+typedef struct
+{
+    httpd_req_t *req;                       ///< Request being answered
+    char buf[APP_WEB_SERVER_JSON_BUF_SIZE]; ///< Output not sent yet
+    size_t len;                             ///< Length of the output not sent yet (bytes)
+    uint8_t depth;                          ///< Number of objects and arrays open
+    uint8_t not_empty;                      ///< Objects and arrays open that already have a member (one bit per depth)
+    esp_err_t err;                          ///< First error, nothing is written after it
+} app_web_server_json_t;
+
+void app_web_server_json__begin(app_web_server_json_t *json, httpd_req_t *req);
+esp_err_t app_web_server_json__end(app_web_server_json_t *json);
+void app_web_server_json__object_begin(app_web_server_json_t *json, const char *key);
+void app_web_server_json__object_end(app_web_server_json_t *json);
+void app_web_server_json__array_begin(app_web_server_json_t *json, const char *key);
+void app_web_server_json__array_end(app_web_server_json_t *json);
+void app_web_server_json__int(app_web_server_json_t *json, const char *key, int64_t value);
+void app_web_server_json__bool(app_web_server_json_t *json, const char *key, uint8_t value);
+void app_web_server_json__null(app_web_server_json_t *json, const char *key);
+void app_web_server_json__string(app_web_server_json_t *json, const char *key, const char *value);
+void app_web_server_json__mac(app_web_server_json_t *json, const char *key, const uint8_t mac[6]);
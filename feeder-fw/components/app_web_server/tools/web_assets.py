@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Build the static assets of the configuration web UI into a C source file.
+
+Each HTML/CSS/JS source is minified and gzipped, and emitted as a byte array
+along with its length, content type and ETag, in the app_web_server_assets
+table declared in app_web_server_assets.h. The output only depends on the
+sources (the gzip header has no name nor time), so the ETag of an asset only
+changes when the asset does.
+
+Usage: web_assets.py OUTPUT URI=SOURCE [URI=SOURCE ...]
+"""
+
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+CONTENT_TYPES = {
+    '.html': 'text/html; charset=utf-8',
+    '.css': 'text/css; charset=utf-8',
+    '.js': 'text/javascript; charset=utf-8',
+}
+
+
+def minify_html(text):
+    text = re.sub(r'<!--.*?-->', '', text, flags=re.S)
+    text = re.sub(r'>\s+<', '><', text)
+    return re.sub(r'\s+', ' ', text).strip()
+
+
+def minify_css(text):
+    text = re.sub(r'/\*.*?\*/', '', text, flags=re.S)
+    text = re.sub(r'\s+', ' ', text)
+    text = re.sub(r'\s*([{}:;,>])\s*', r'\1', text)
+    return text.replace(';}', '}').strip()
+
+
+def minify_js(text):
+    # Conservative: only indentation, blank lines and whole line comments are
+    # removed, the line breaks are kept so that automatic semicolon insertion
+    # still applies.
+    lines = (line.strip() for line in text.splitlines())
+    return '\n'.join(line for line in lines if line and not line.startswith('//'))
+
+
+MINIFIERS = {
+    '.html': minify_html,
+    '.css': minify_css,
+    '.js': minify_js,
+}
+
+
+def c_bytes(data):
+    rows = []
+    for i in range(0, len(data), 16):
+        rows.append('    ' + ' '.join('0x%02x,' % b for b in data[i:i + 16]))
+    return '\n'.join(rows)
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.exit(__doc__)
+    output = argv[1]
+    assets = []
+
+    for arg in argv[2:]:
+        uri, _, source = arg.partition('=')
+        ext = os.path.splitext(source)[1]
+        if not uri.startswith('/') or ext not in MINIFIERS:
+            sys.exit('web_assets.py: unsupported asset ' + arg)
+        with open(source, encoding='utf-8') as f:
+            text = MINIFIERS[ext](f.read())
+        data = gzip.compress(text.encode('utf-8'), compresslevel=9, mtime=0)
+        etag = '"%s"' % hashlib.sha256(data).hexdigest()[:16]
+        assets.append((uri, CONTENT_TYPES[ext], data, etag, os.path.basename(source)))
+
+    out = ['/* Generated by web_assets.py, do not edit. */', '',
+           '#include "app_web_server_assets.h"', '']
+    for i, (uri, _, data, _, name) in enumerate(assets):
+        out.append('// %s, served at %s' % (name, uri))
+        out.append('static const uint8_t asset_%d[] = {' % i)
+        out.append(c_bytes(data))
+        out.append('};')
+        out.append('')
+    out.append('const app_web_server_asset_t app_web_server_assets[] = {')
+    for i, (uri, content_type, data, etag, _) in enumerate(assets):
+        out.append('    {"%s", "%s", asset_%d, %d, "%s"},' % (uri, content_type, i, len(data), etag.replace('"', '\\"')))
+    out.append('};')
+    out.append('const size_t app_web_server_assets_count = %d;' % len(assets))
+    out.append('')
+
+    with open(output, 'w', encoding='utf-8') as f:
+        f.write('\n'.join(out))
+
+
+if __name__ == '__main__':
+    main(sys.argv)
@@ -0,0 +1,29 @@
+const form = document.getElementById('macForm');
+const mac = document.getElementById('mac');
+const btn = document.getElementById('formBtn');
+const msgBox = document.getElementById('msgBox');
+
+function isValidHexString(input) {
+    const hexPattern = /^[0-9a-fA-F:]+$/;
+    return hexPattern.test(input);
+}
+
+btn.addEventListener('click', (evt) => {
+    let errMsg = '';
+
+    if (mac.value.length != 12) {
+        errMsg = 'MAC com comprimento errado!';
+    } else if (!isValidHexString(mac.value)) {
+        errMsg = 'MAC com caracteres não permitidos!';
+    }
+    if (errMsg.length > 0) {
+        console.log(errMsg);
+        evt.preventDefault();
+        msgBox.textContent = errMsg;
+        msgBox.style.display = 'inline-block';
+        return;
+    }
+    // the firmware parses the MAC as 6 pairs of hex digits
+    mac.value = mac.value.toLowerCase();
+    form.submit();
+});
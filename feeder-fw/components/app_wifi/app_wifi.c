@@ -19,70 +19,156 @@
 #include "esp_netif.h"
 #include "esp_event.h"
 #include "esp_mac.h"
+#include "esp_timer.h"
 #include "lwip/err.h"
 #include "lwip/sys.h"
 
 #include "app_wifi.h"
 #include "app_web_server.h"
 #include "app_gpio.h"
+#include "app_pm.h"
+#include "app_event.h"
+#include "app_nvs.h"
 
-#define ESP_WIFI_AP_SSID "PetDog ComeInt" ///< Wi-Fi AP SSID
 #define ESP_WIFI_AP_CHANNEL 1             ///< Wi-Fi AP channel
-#define ESP_WIFI_AP_PWD "Senha12345"      ///< Wi-Fi AP password
 #define ESP_WIFI_MAX_CONN_TO_AP 1         ///< Maximum number of connections to the Wi-Fi AP
 
+/* The AP SSID and password and the time Wi-Fi is kept on are part of the configuration (see app_nvs.h). A new SSID or
+ * password is applied the next time Wi-Fi is started, so that the station configuring the feeder is not disconnected.
+ *
+ * Wi-Fi is only started when provisioning is requested (button hold), so the Wi-Fi stack is not brought up at boot:
+ * the default event loop, the AP netif and the Wi-Fi driver (its task, buffers and coexistence with BLE) are
+ * allocated by app_wifi__start and released by app_wifi__stop. Only the lwIP task, created by the first
+ * esp_netif_init, stays, because esp_netif does not support deinitialization.
+ *
+ * The state of the component is only touched by the app event loop. wifi_event_handler runs in the default event loop
+ * task, so it only counts the stations connected and raises stations_signal, whose handler starts or stops the web
+ * server. The configuration changes are notified by the app event loop as well (see app_nvs__subscribe).
+ */
+
 static const char *TAG = "app_wifi"; ///< Tag to be used when logging
 
 static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void app_wifi__apply_config(const app_nvs_config_t *config);
+static esp_err_t app_wifi__stack_init(void);
+static void app_wifi__stack_deinit(void);
 
 /// @brief Typedef for indicating Wi-Fi status.
 typedef enum wifi_status
 {
-    WIFI_OFF, /**< Wi-Fi off */
+    WIFI_OFF, /**< Wi-Fi off, stack not allocated */
     WIFI_ON   /**< Wi-Fi on */
 } wifi_status_t;
 
-static wifi_status_t wifi_status = WIFI_OFF;                 ///< Wi-Fi status
-static uint8_t wifi_timer_reset = 0;                         ///< Wi-Fi timer reset flag
-static TaskHandle_t app_wifi__wifi_timer_task_handle = NULL; ///< Wi-Fi timer task handle
+static wifi_status_t wifi_status = WIFI_OFF;                        ///< Wi-Fi status
+static esp_timer_handle_t wifi_timer = NULL;                        ///< Timer to count down the time Wi-Fi is kept on
+static uint16_t wifi_secs_left = 0;                                 ///< Time left before Wi-Fi is stopped (s)
+static uint16_t wifi_timeout_secs = 0;                              ///< Time Wi-Fi is kept on after it is started (s), from the configuration
+static wifi_config_t wifi_config = {
+    .ap = {
+        .channel = ESP_WIFI_AP_CHANNEL,
+        .max_connection = ESP_WIFI_MAX_CONN_TO_AP,
+        .authmode = WIFI_AUTH_WPA_WPA2_PSK},
+}; ///< Wi-Fi AP configuration
+static uint8_t event_loop_created = 0;                              ///< Flag that indicates that the default event loop was created by app_wifi__stack_init
+static esp_netif_t *wifi_netif = NULL;                              ///< AP netif, NULL while the Wi-Fi stack is not allocated
+static esp_event_handler_instance_t wifi_event_handler_inst = NULL; ///< Registered instance of wifi_event_handler
+static uint8_t wifi_driver_initialized = 0;                         ///< Flag that indicates that the Wi-Fi driver is initialized
+static uint8_t web_server_running = 0;                              ///< Flag that indicates that the web server was started for a station
+static uint8_t stations_count = 0;                                  ///< Number of stations connected, counted by wifi_event_handler
+static app_event_signal_t stations_signal;                          ///< Signal of a station connection or disconnection
 
-static void app_wifi__wifi_timer_task(void *arg)
+/**
+ * @brief Handler of wifi_timer, run by the event loop every second while Wi-Fi is on. Stops Wi-Fi when
+ * wifi_timeout_secs have passed since it was last started (a start request while Wi-Fi is on restarts the count).
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_wifi__wifi_timer_handler(void *arg)
 {
-    for (;;)
+    if (wifi_status != WIFI_ON)
+    {
+        return;
+    }
+    wifi_secs_left--;
+    ESP_LOGI(TAG, "Wi-Fi stopping in %d seconds", wifi_secs_left);
+    if (wifi_secs_left == 0)
     {
-        for (uint8_t i = 0; i < 180; i++)
-        {
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            if (wifi_timer_reset)
-            {
-                i = 0;
-                wifi_timer_reset = 0;
-            }
-            ESP_LOGI(TAG, "Wi-Fi stopping in %d seconds", 60 - i);
-        }
         app_wifi__stop();
-        vTaskSuspend(NULL);
     }
-    vTaskDelete(NULL);
 }
 
 /**
- * @brief Initialize Wi-Fi.
+ * @brief Handler of stations_signal, run by the event loop. Starts the web server when a station is connected, and
+ * stops it when none is.
+ *
+ * @param arg Optional argument (not being used).
+ */
+static void app_wifi__stations_handler(void *arg)
+{
+    if (wifi_status != WIFI_ON)
+    {
+        return;
+    }
+    uint8_t connected = (__atomic_load_n(&stations_count, __ATOMIC_ACQUIRE) > 0);
+    if (connected && !web_server_running)
+    {
+        web_server_running = (app_web_server__start() == ESP_OK);
+    }
+    else if (!connected && web_server_running)
+    {
+        app_web_server__stop();
+        web_server_running = 0;
+    }
+}
+
+/**
+ * @brief Initialize Wi-Fi component. The Wi-Fi stack itself is only brought up when Wi-Fi is started.
  *
  * @return esp_err_t
- * @retval ESP_OK if Wi-Fi i successfully initialized.
+ * @retval ESP_OK if Wi-Fi component is successfully initialized.
  * @retval ESP_FAIL otherwise.
  */
 esp_err_t app_wifi__init(void)
 {
-    wifi_config_t wifi_config = {
-        .ap = {
-            .ssid = ESP_WIFI_AP_SSID,
-            .channel = ESP_WIFI_AP_CHANNEL,
-            .password = ESP_WIFI_AP_PWD,
-            .max_connection = ESP_WIFI_MAX_CONN_TO_AP,
-            .authmode = WIFI_AUTH_WPA_WPA2_PSK},
-    };
+    app_nvs_config_t config;
+    app_nvs__get_config(&config);
+    app_wifi__apply_config(&config);
+
+    esp_err_t err = app_event__signal_create(app_wifi__stations_handler, NULL, &stations_signal);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d creating stations signal: %s", err, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+
+    err = app_nvs__subscribe(app_wifi__apply_config);
+    if (err != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    err = app_event__timer_create("wifi", app_wifi__wifi_timer_handler, NULL, &wifi_timer);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d creating Wi-Fi timer: %s", err, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Success initializing Wi-Fi!");
+    return ESP_OK;
+}
+
+/**
+ * @brief Allocate the Wi-Fi stack: TCP/IP stack, default event loop, AP netif and Wi-Fi driver in AP mode, with the
+ * current AP configuration. On failure, whatever was allocated is released.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK if the Wi-Fi stack is successfully allocated.
+ * @retval ESP_FAIL otherwise.
+ */
+static esp_err_t app_wifi__stack_init(void)
+{
     wifi_init_config_t wifi_init_config = WIFI_INIT_CONFIG_DEFAULT();
     esp_err_t err = esp_netif_init();
     if (err != ESP_OK)
@@ -90,81 +176,99 @@ esp_err_t app_wifi__init(void)
         ESP_LOGE(TAG, "Error initializing TCP/IP stack");
         return ESP_FAIL;
     }
-    else
+
+    err = esp_event_loop_create_default();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
     {
-        err = esp_event_loop_create_default();
-        if (err != ESP_OK)
-        {
-            ESP_LOGE(TAG, "Error %d creating default event loop: %s", err, esp_err_to_name(err));
-            return ESP_FAIL;
-        }
-        else
-        {
-            esp_netif_create_default_wifi_ap();
+        ESP_LOGE(TAG, "Error %d creating default event loop: %s", err, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    // if the default event loop already exists, it is someone else's and is not deleted
+    event_loop_created = (err == ESP_OK);
+
+    wifi_netif = esp_netif_create_default_wifi_ap();
+    if (wifi_netif == NULL)
+    {
+        ESP_LOGE(TAG, "Error creating AP netif");
+        app_wifi__stack_deinit();
+        return ESP_FAIL;
+    }
 
-            err = esp_event_handler_instance_register(WIFI_EVENT,
-                                                      ESP_EVENT_ANY_ID,
-                                                      (esp_event_handler_t)&wifi_event_handler,
-                                                      NULL, NULL);
-            if (err != ESP_OK)
-            {
-                ESP_LOGE(TAG, "Error %d registering event handler: %s", err, esp_err_to_name(err));
-                return ESP_FAIL;
-            }
-            else
-            {
-                err = esp_wifi_init(&wifi_init_config);
-                if (err != ESP_OK)
-                {
-                    ESP_LOGE(TAG, "Error %d registering initializing ESP Wi-Fi: %s", err, esp_err_to_name(err));
-                    return ESP_FAIL;
-                }
-                else
-                {
-                    err = esp_wifi_set_mode(WIFI_MODE_AP);
-                    if (err != ESP_OK)
-                    {
-                        ESP_LOGE(TAG, "Error %d setting Wi-Fi mode to AP: %s", err, esp_err_to_name(err));
-                        return ESP_FAIL;
-                    }
-                    else
-                    {
+    err = esp_event_handler_instance_register(WIFI_EVENT,
+                                              ESP_EVENT_ANY_ID,
+                                              (esp_event_handler_t)&wifi_event_handler,
+                                              NULL, &wifi_event_handler_inst);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d registering event handler: %s", err, esp_err_to_name(err));
+        app_wifi__stack_deinit();
+        return ESP_FAIL;
+    }
 
-                        if (strlen(ESP_WIFI_AP_PWD) == 0)
-                        {
-                            wifi_config.ap.authmode = WIFI_AUTH_OPEN;
-                        }
-                        err = esp_wifi_set_config(WIFI_IF_AP, &wifi_config);
-                        if (err != ESP_OK)
-                        {
-                            ESP_LOGE(TAG, "Error %d setting Wi-Fi configuration: %s", err, esp_err_to_name(err));
-                            return ESP_FAIL;
-                        }
+    err = esp_wifi_init(&wifi_init_config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d initializing ESP Wi-Fi: %s", err, esp_err_to_name(err));
+        app_wifi__stack_deinit();
+        return ESP_FAIL;
+    }
+    wifi_driver_initialized = 1;
 
-                        if (xTaskCreate(app_wifi__wifi_timer_task,
-                                        "app_wifi__wifi_timer_task", 2048, NULL, 10,
-                                        &app_wifi__wifi_timer_task_handle) != pdPASS)
-                        {
-                            ESP_LOGE(TAG, "Error creating app_wifi__wifi_timer_task");
-                            return ESP_FAIL;
-                        }
-                        vTaskSuspend(app_wifi__wifi_timer_task_handle);
-                        ESP_LOGI(TAG, "Created app_wifi__wifi_timer_task");
+    err = esp_wifi_set_mode(WIFI_MODE_AP);
+    if (err == ESP_OK)
+    {
+        err = esp_wifi_set_config(WIFI_IF_AP, &wifi_config);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error %d configuring Wi-Fi AP: %s", err, esp_err_to_name(err));
+        app_wifi__stack_deinit();
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
 
-                        ESP_LOGI(TAG, "Success initializing Wi-Fi!");
-                        return ESP_OK;
-                    }
-                }
-            }
+/**
+ * @brief Release the Wi-Fi stack allocated by app_wifi__stack_init, or the part of it that was allocated. The Wi-Fi
+ * driver must be stopped.
+ *
+ */
+static void app_wifi__stack_deinit(void)
+{
+    esp_err_t err;
+
+    if (wifi_driver_initialized)
+    {
+        err = esp_wifi_deinit();
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error %d deinitializing ESP Wi-Fi: %s", err, esp_err_to_name(err));
         }
+        wifi_driver_initialized = 0;
+    }
+    if (wifi_event_handler_inst != NULL)
+    {
+        esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler_inst);
+        wifi_event_handler_inst = NULL;
+    }
+    if (wifi_netif != NULL)
+    {
+        esp_netif_destroy_default_wifi(wifi_netif);
+        wifi_netif = NULL;
+    }
+    if (event_loop_created)
+    {
+        esp_event_loop_delete_default();
+        event_loop_created = 0;
     }
 }
 
 /**
- * @brief Start Wi-Fi.
+ * @brief Start Wi-Fi, allocating the Wi-Fi stack first.
  *
  * @return esp_err_t
  * @retval ESP_OK if Wi-Fi is successfully started or it's already started.
+ * @retval ESP_ERR_INVALID_STATE if the Wi-Fi component is not initialized.
  * @retval ESP_FAIL otherwise.
  */
 esp_err_t app_wifi__start(void)
@@ -172,31 +276,45 @@ esp_err_t app_wifi__start(void)
     esp_err_t err;
     if (wifi_status != WIFI_ON)
     {
+        if (wifi_timer == NULL)
+        {
+            ESP_LOGE(TAG, "Wi-Fi component not initialized");
+            return ESP_ERR_INVALID_STATE;
+        }
+        __atomic_store_n(&stations_count, 0, __ATOMIC_RELEASE);
+        if (app_wifi__stack_init() != ESP_OK)
+        {
+            return ESP_FAIL;
+        }
         err = esp_wifi_start();
         if (err != ESP_OK)
         {
             ESP_LOGE(TAG, "Error %d starting Wi-Fi: %s", err, esp_err_to_name(err));
+            app_wifi__stack_deinit();
             return ESP_FAIL;
         }
         else
         {
             ESP_LOGI(TAG, "Wi-Fi started!");
             wifi_status = WIFI_ON;
+            // the AP must keep beaconing and answering its station, which is not possible in light sleep
+            app_pm__lock_acquire(app_pm_lock_wifi);
+            wifi_secs_left = wifi_timeout_secs;
+            esp_timer_start_periodic(wifi_timer, 1000 * 1000);
             app_gpio__blink_blue_led_slow(2);
-            vTaskResume(app_wifi__wifi_timer_task_handle);
             return ESP_OK;
         }
     }
     else
     {
         ESP_LOGI(TAG, "Wi-Fi already started");
-        wifi_timer_reset = 1;
+        wifi_secs_left = wifi_timeout_secs;
         return ESP_OK;
     }
 }
 
 /**
- * @brief Stop Wi-Fi.
+ * @brief Stop Wi-Fi, and release the Wi-Fi stack. The web server is stopped if a station was connected.
  *
  * @return esp_err_t
  * @retval ESP_OK if Wi-Fi is successfully stopped.
@@ -207,6 +325,12 @@ esp_err_t app_wifi__stop(void)
     esp_err_t err;
     if (wifi_status != WIFI_OFF)
     {
+        // the station disconnection events are not handled once the event handler is unregistered
+        if (web_server_running)
+        {
+            app_web_server__stop();
+            web_server_running = 0;
+        }
         err = esp_wifi_stop();
         if (err != ESP_OK)
         {
@@ -215,9 +339,11 @@ esp_err_t app_wifi__stop(void)
         }
         else
         {
+            app_wifi__stack_deinit();
             ESP_LOGI(TAG, "Wi-Fi stopped");
             wifi_status = WIFI_OFF;
-            wifi_timer_reset = 1;
+            app_pm__lock_release(app_pm_lock_wifi);
+            esp_timer_stop(wifi_timer);
             app_gpio__blink_blue_led_fast(2);
             return ESP_OK;
         }
@@ -230,7 +356,8 @@ esp_err_t app_wifi__stop(void)
 }
 
 /**
- * @brief Wi-Fi event handler, triggered on connection/disconnection to AP.
+ * @brief Wi-Fi event handler, triggered on connection/disconnection to AP. Runs in the default event loop task, so
+ * the web server is started and stopped by the app event loop (see app_wifi__stations_handler).
  *
  * @param arg Optional additional arguments passed when some event happens.
  * @param event_base Base ID of the event.
@@ -244,13 +371,37 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t e
         wifi_event_ap_staconnected_t *event = (wifi_event_ap_staconnected_t *)event_data;
         ESP_LOGI(TAG, "station " MACSTR " joined, AID: %d",
                  MAC2STR(event->mac), event->aid);
-        app_web_server__start();
+        __atomic_add_fetch(&stations_count, 1, __ATOMIC_ACQ_REL);
+        app_event__signal(stations_signal);
     }
     else if (event_id == WIFI_EVENT_AP_STADISCONNECTED)
     {
         wifi_event_ap_stadisconnected_t *event = (wifi_event_ap_stadisconnected_t *)event_data;
         ESP_LOGI(TAG, "station " MACSTR " left, AID: %d",
                  MAC2STR(event->mac), event->aid);
-        app_web_server__stop();
+        __atomic_sub_fetch(&stations_count, 1, __ATOMIC_ACQ_REL);
+        app_event__signal(stations_signal);
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Apply the configuration: AP SSID and password, set the next time Wi-Fi is started, and time Wi-Fi is kept on.
+ * Subscribed to the configuration changes, run by the event loop like app_wifi__start (see app_nvs__subscribe).
+ *
+ * @param config Configuration.
+ */
+static void app_wifi__apply_config(const app_nvs_config_t *config)
+{
+    wifi_timeout_secs = config->wifi_timeout_secs;
+    // the SSID and password fields of wifi_config are not NUL-terminated when they are full (32 and 64 characters)
+    if (strncmp((const char *)wifi_config.ap.ssid, config->wifi_ssid, sizeof(wifi_config.ap.ssid)) != 0 ||
+        strncmp((const char *)wifi_config.ap.password, config->wifi_password, sizeof(wifi_config.ap.password)) != 0)
+    {
+        memset(wifi_config.ap.ssid, 0, sizeof(wifi_config.ap.ssid));
+        memset(wifi_config.ap.password, 0, sizeof(wifi_config.ap.password));
+        memcpy(wifi_config.ap.ssid, config->wifi_ssid, strlen(config->wifi_ssid));
+        wifi_config.ap.ssid_len = strlen(config->wifi_ssid);
+        memcpy(wifi_config.ap.password, config->wifi_password, strlen(config->wifi_password));
+        wifi_config.ap.authmode = (strlen(config->wifi_password) == 0) ? WIFI_AUTH_OPEN : WIFI_AUTH_WPA_WPA2_PSK;
+    }
+}
@@ -0,0 +1,567 @@
+/**
+ * @file beacon_replay.c
+ * @brief Replays a recorded BLE scan trace through the app_beacon GAP callback in the host simulation and reports
+ * the detection latency and accuracy, and the CPU cost per advertisement.
+ *
+ * The trace is a text file with one record per line, sorted by time (lines starting with '#' are ignored):
+ *   - M,<mac>                         MAC address to be authorized before the replay starts.
+ *   - A,<t_ms>,<mac>,<rssi>,<adv_hex> Advertisement received at t_ms, with the raw ble_adv bytes in hexadecimal.
+ *   - P,<t_ms>,<0|1>                  Ground truth: an authorized pet arrived at (1) or left (0) the feeder at t_ms.
+ * MAC addresses are written as aa:bb:cc:dd:ee:ff. Advertisements with the same t_ms are delivered back to back,
+ * before the simulated tasks run, so they reach the detection task in the same batch.
+ *
+ * Reported metrics:
+ *   - time to open: time from a pet arriving to the lid starting to open.
+ *   - time to close: time from a pet leaving to the lid starting to close.
+ *   - false opens: lid openings while no pet is at the feeder.
+ *   - missed visits: visits during which the lid never opened.
+ *   - CPU cost: host CPU time spent in the GAP callback per advertisement, and in the simulated tasks per
+ *     advertisement (the latter includes the periodic tasks).
+ *   - radio RX duty cycle: fraction of the time the BLE controller is receiving (scan window over scan interval).
+ *   - PM locks held: fraction of the time the app_pm locks that keep the CPU (ble_active) and APB (servo) at
+ *     their maximum frequency are held.
+ *
+ * The replay can also check the results, for the host tests (see CMakeLists.txt): with any of the options below, it
+ * exits with EXIT_FAILURE, after printing the metrics, if a result is out of its bound.
+ *   --max-missed <n>        missed visits
+ *   --max-false-opens <n>   false opens
+ *   --max-early-closes <n>  lid closings during a visit
+ *   --max-open-ms <ms>      time to open, of every visit
+ *   --max-close-ms <ms>     time to close, of every visit
+ *
+ * The defaults of the detection thresholds (see app_nvs.c) are set at build time with the FEEDER_TUNING_DEFINITIONS
+ * CMake cache variable, for example -DFEEDER_TUNING_DEFINITIONS="MIN_RSSI_FOR_DETECTION_DBM=-55;MIN_TIMES_SEEN_FOR_DETECTION=2".
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+#include "app_pm.h"
+#include "app_event.h"
+#include "app_nvs.h"
+#include "app_measure_vcc.h"
+#include "app_pwm.h"
+#include "app_lid.h"
+#include "app_status.h"
+#include "app_feed_log.h"
+#include "app_beacon.h"
+
+#define REPLAY_LINE_MAX_LEN (512)       ///< Maximum trace line length
+#define REPLAY_MAX_ADV_LEN (62)         ///< Maximum advertisement length (advertising data + scan response)
+#define REPLAY_TAIL_US (30000000)       ///< Time simulated after the last trace record, so the lid can close (us)
+#define REPLAY_LID_CHANNEL (0)          ///< LEDC channel driving the lid servo
+#define REPLAY_MAX_LID_EVENTS (4096)    ///< Maximum number of lid movements recorded
+#define REPLAY_MAX_VISITS (1024)        ///< Maximum number of ground truth visits
+
+/// @brief Trace record types.
+typedef enum
+{
+    replay_record_adv,
+    replay_record_presence,
+} replay_record_type_t;
+
+/// @brief Trace record.
+typedef struct
+{
+    replay_record_type_t type;
+    int64_t time_us;
+    uint8_t mac[6];
+    int rssi;
+    uint8_t adv[REPLAY_MAX_ADV_LEN];
+    uint8_t adv_len;
+    uint8_t present;
+} replay_record_t;
+
+/// @brief Lid movement, as seen on the servo PWM duty.
+typedef struct
+{
+    int64_t time_us;
+    uint8_t open;
+} replay_lid_event_t;
+
+/// @brief Ground truth visit of a pet to the feeder.
+typedef struct
+{
+    int64_t start_us;
+    int64_t end_us;
+} replay_visit_t;
+
+/// @brief Bounds of the results checked by the replay, -1 if not checked.
+typedef struct
+{
+    long max_missed;
+    long max_false_opens;
+    long max_early_closes;
+    double max_open_ms;
+    double max_close_ms;
+} replay_bounds_t;
+
+static replay_record_t *records = NULL;
+static size_t records_count = 0;
+static replay_lid_event_t lid_events[REPLAY_MAX_LID_EVENTS];
+static size_t lid_events_count = 0;
+static uint32_t lid_closed_duty = 0;
+static uint8_t lid_open = 0;
+static replay_visit_t visits[REPLAY_MAX_VISITS];
+static size_t visits_count = 0;
+
+static void replay__ledc_hook(int channel, uint32_t duty, bool timer_running, int64_t time_us)
+{
+    (void)timer_running;
+    if (channel != REPLAY_LID_CHANNEL || duty == 0)
+    {
+        return;
+    }
+    if (lid_closed_duty == 0)
+    {
+        // the first duty set is the closed lid position (app_lid__init closes the lid without a ramp)
+        lid_closed_duty = duty;
+    }
+    uint8_t open = duty != lid_closed_duty;
+    if (open != lid_open && lid_events_count < REPLAY_MAX_LID_EVENTS)
+    {
+        lid_events[lid_events_count].time_us = time_us;
+        lid_events[lid_events_count].open = open;
+        lid_events_count++;
+    }
+    lid_open = open;
+}
+
+static int64_t replay__cpu_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int replay__parse_mac(const char *str, uint8_t mac[6])
+{
+    unsigned int bytes[6];
+    if (sscanf(str, "%x:%x:%x:%x:%x:%x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != 6)
+    {
+        return -1;
+    }
+    for (int i = 0; i < 6; i++)
+    {
+        mac[i] = (uint8_t)bytes[i];
+    }
+    return 0;
+}
+
+static int replay__parse_hex(const char *str, uint8_t *out, uint8_t max_len, uint8_t *out_len)
+{
+    size_t len = strcspn(str, "\r\n");
+    if (len % 2 != 0 || len / 2 > max_len)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < len / 2; i++)
+    {
+        unsigned int byte;
+        if (sscanf(&str[i * 2], "%2x", &byte) != 1)
+        {
+            return -1;
+        }
+        out[i] = (uint8_t)byte;
+    }
+    *out_len = (uint8_t)(len / 2);
+    return 0;
+}
+
+static int replay__load_trace(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    char line[REPLAY_LINE_MAX_LEN];
+    size_t capacity = 0;
+    int line_number = 0;
+
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+        {
+            continue;
+        }
+        if (records_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 1024;
+            records = realloc(records, capacity * sizeof(*records));
+            if (records == NULL)
+            {
+                fclose(file);
+                return -1;
+            }
+        }
+        replay_record_t *record = &records[records_count];
+        memset(record, 0, sizeof(*record));
+
+        char mac_str[32];
+        char adv_str[REPLAY_LINE_MAX_LEN];
+        double time_ms;
+        int value;
+        if (line[0] == 'M' && sscanf(line, "M,%31s", mac_str) == 1 && replay__parse_mac(mac_str, record->mac) == 0)
+        {
+            if (app_nvs__set_authorized_mac(record->mac) != ESP_OK)
+            {
+                fprintf(stderr, "%s:%d: could not authorize MAC %s\n", path, line_number, mac_str);
+            }
+            continue;
+        }
+        else if (line[0] == 'A' &&
+                 sscanf(line, "A,%lf,%31[^,],%d,%511s", &time_ms, mac_str, &record->rssi, adv_str) == 4 &&
+                 replay__parse_mac(mac_str, record->mac) == 0 &&
+                 replay__parse_hex(adv_str, record->adv, sizeof(record->adv), &record->adv_len) == 0)
+        {
+            record->type = replay_record_adv;
+        }
+        else if (line[0] == 'P' && sscanf(line, "P,%lf,%d", &time_ms, &value) == 2)
+        {
+            record->type = replay_record_presence;
+            record->present = (value != 0);
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: invalid record\n", path, line_number);
+            fclose(file);
+            return -1;
+        }
+        record->time_us = (int64_t)(time_ms * 1000.0);
+        if (records_count > 0 && record->time_us < records[records_count - 1].time_us)
+        {
+            fprintf(stderr, "%s:%d: records are not sorted by time\n", path, line_number);
+            fclose(file);
+            return -1;
+        }
+        records_count++;
+    }
+    fclose(file);
+    return 0;
+}
+
+static int replay__compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void replay__print_stats(const char *name, int64_t *values, size_t count, double scale, const char *unit)
+{
+    if (count == 0)
+    {
+        printf("  %-26s n/a\n", name);
+        return;
+    }
+    int64_t sum = 0;
+    qsort(values, count, sizeof(*values), replay__compare_int64);
+    for (size_t i = 0; i < count; i++)
+    {
+        sum += values[i];
+    }
+    printf("  %-26s n=%zu mean=%.2f p50=%.2f p90=%.2f max=%.2f %s\n", name, count,
+           (double)sum / count * scale, values[count / 2] * scale, values[(count * 9) / 10] * scale,
+           values[count - 1] * scale, unit);
+}
+
+static int replay__parse_args(int argc, char **argv, replay_bounds_t *bounds, const char **trace_path)
+{
+    *bounds = (replay_bounds_t){-1, -1, -1, -1.0, -1.0};
+    *trace_path = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            if (*trace_path != NULL)
+            {
+                return -1;
+            }
+            *trace_path = argv[i];
+            continue;
+        }
+        if (i + 1 == argc)
+        {
+            return -1;
+        }
+        char *end;
+        const char *value = argv[++i];
+        double bound = strtod(value, &end);
+        if (*end != '\0' || bound < 0)
+        {
+            return -1;
+        }
+        if (strcmp(argv[i - 1], "--max-missed") == 0)
+        {
+            bounds->max_missed = (long)bound;
+        }
+        else if (strcmp(argv[i - 1], "--max-false-opens") == 0)
+        {
+            bounds->max_false_opens = (long)bound;
+        }
+        else if (strcmp(argv[i - 1], "--max-early-closes") == 0)
+        {
+            bounds->max_early_closes = (long)bound;
+        }
+        else if (strcmp(argv[i - 1], "--max-open-ms") == 0)
+        {
+            bounds->max_open_ms = bound;
+        }
+        else if (strcmp(argv[i - 1], "--max-close-ms") == 0)
+        {
+            bounds->max_close_ms = bound;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return (*trace_path != NULL) ? 0 : -1;
+}
+
+static int replay__check_count(const char *name, size_t value, long max)
+{
+    if (max >= 0 && value > (size_t)max)
+    {
+        fprintf(stderr, "FAIL: %s %zu, more than %ld\n", name, value, max);
+        return 1;
+    }
+    return 0;
+}
+
+static int replay__check_max_ms(const char *name, const int64_t *values_us, size_t count, double max_ms)
+{
+    int failures = 0;
+    for (size_t i = 0; i < count && max_ms >= 0; i++)
+    {
+        if (values_us[i] / 1e3 > max_ms)
+        {
+            fprintf(stderr, "FAIL: %s %.2f ms, more than %.2f ms\n", name, values_us[i] / 1e3, max_ms);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+static uint8_t replay__in_visit(int64_t time_us)
+{
+    for (size_t i = 0; i < visits_count; i++)
+    {
+        if (time_us >= visits[i].start_us && time_us < visits[i].end_us)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    replay_bounds_t bounds;
+    const char *trace_path;
+    if (replay__parse_args(argc, argv, &bounds, &trace_path) != 0)
+    {
+        fprintf(stderr, "Usage: %s [--max-missed <n>] [--max-false-opens <n>] [--max-early-closes <n>] "
+                        "[--max-open-ms <ms>] [--max-close-ms <ms>] <trace file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    host_sim__ledc_set_hook(replay__ledc_hook);
+    host_sim__adc_set_raw(0, 3500); // ~2.8 V battery, the servo current sense channel reads 0 mA
+
+    if (app_pm__init() != ESP_OK || app_event__init() != ESP_OK || app_nvs__init() != ESP_OK ||
+        app_feed_log__init() != ESP_OK || replay__load_trace(trace_path) != 0 ||
+        app_status__init() != ESP_OK || app_measure_vcc__init() != ESP_OK || app_pwm__init() != ESP_OK ||
+        app_lid__init() != ESP_OK || app_beacon__init() != ESP_OK || app_beacon__ble_scan_start() != ESP_OK)
+    {
+        return EXIT_FAILURE;
+    }
+
+    int64_t *callback_cost_ns = malloc((records_count + 1) * sizeof(int64_t));
+    size_t adv_delivered = 0;
+    size_t adv_not_scanned = 0;
+    size_t adv_outside_window = 0;
+    size_t adv_controller_filtered = 0;
+    int64_t tasks_cost_ns = 0;
+    int64_t visit_start_us = -1;
+    if (callback_cost_ns == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < records_count; i++)
+    {
+        replay_record_t *record = &records[i];
+        int64_t start_ns = replay__cpu_time_ns();
+        if (i == 0 || record->time_us != records[i - 1].time_us)
+        {
+            // advertisements received at the same time are all queued before the tasks run, as a burst would be
+            host_sim__run_until(record->time_us);
+        }
+        tasks_cost_ns += replay__cpu_time_ns() - start_ns;
+
+        if (record->type == replay_record_adv)
+        {
+            start_ns = replay__cpu_time_ns();
+            host_sim_ble_adv_result_t result = host_sim__ble_deliver_adv(record->mac, record->rssi, record->adv,
+                                                                         record->adv_len);
+            int64_t cost_ns = replay__cpu_time_ns() - start_ns;
+            switch (result)
+            {
+            case host_sim_ble_adv_received:
+                callback_cost_ns[adv_delivered++] = cost_ns;
+                break;
+            case host_sim_ble_adv_outside_window:
+                adv_outside_window++;
+                break;
+            case host_sim_ble_adv_filtered:
+                adv_controller_filtered++;
+                break;
+            default:
+                adv_not_scanned++;
+                break;
+            }
+        }
+        else if (record->present && visit_start_us < 0)
+        {
+            visit_start_us = record->time_us;
+        }
+        else if (!record->present && visit_start_us >= 0 && visits_count < REPLAY_MAX_VISITS)
+        {
+            visits[visits_count].start_us = visit_start_us;
+            visits[visits_count].end_us = record->time_us;
+            visits_count++;
+            visit_start_us = -1;
+        }
+    }
+    int64_t end_us = (records_count > 0 ? records[records_count - 1].time_us : 0) + REPLAY_TAIL_US;
+    if (visit_start_us >= 0 && visits_count < REPLAY_MAX_VISITS)
+    {
+        // a visit still going on at the end of the trace lasts until the end of the simulation
+        visits[visits_count].start_us = visit_start_us;
+        visits[visits_count].end_us = end_us;
+        visits_count++;
+    }
+    int64_t start_ns = replay__cpu_time_ns();
+    host_sim__run_until(end_us);
+    tasks_cost_ns += replay__cpu_time_ns() - start_ns;
+
+    int64_t *time_to_open_us = malloc((visits_count + 1) * sizeof(int64_t));
+    int64_t *time_to_close_us = malloc((visits_count + 1) * sizeof(int64_t));
+    size_t time_to_open_count = 0;
+    size_t time_to_close_count = 0;
+    size_t missed_visits = 0;
+    size_t early_closes = 0;
+    size_t false_opens = 0;
+    size_t lid_openings = 0;
+    if (time_to_open_us == NULL || time_to_close_us == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t v = 0; v < visits_count; v++)
+    {
+        int64_t open_us = -1;
+        int64_t close_us = -1;
+        for (size_t e = 0; e < lid_events_count; e++)
+        {
+            if (lid_events[e].open && open_us < 0 && lid_events[e].time_us >= visits[v].start_us &&
+                lid_events[e].time_us < visits[v].end_us)
+            {
+                open_us = lid_events[e].time_us;
+            }
+            else if (!lid_events[e].open && open_us >= 0 && close_us < 0 && lid_events[e].time_us >= open_us)
+            {
+                close_us = lid_events[e].time_us;
+            }
+        }
+        if (open_us < 0)
+        {
+            missed_visits++;
+            continue;
+        }
+        time_to_open_us[time_to_open_count++] = open_us - visits[v].start_us;
+        if (close_us >= 0 && close_us < visits[v].end_us)
+        {
+            early_closes++;
+        }
+        else if (close_us >= 0 && visits[v].end_us < end_us)
+        {
+            time_to_close_us[time_to_close_count++] = close_us - visits[v].end_us;
+        }
+    }
+    for (size_t e = 0; e < lid_events_count; e++)
+    {
+        if (lid_events[e].open)
+        {
+            lid_openings++;
+            false_opens += !replay__in_visit(lid_events[e].time_us);
+        }
+    }
+
+    printf("Trace: %s\n", trace_path);
+    printf("  simulated time             %.1f s\n", end_us / 1e6);
+    printf("  advertisements             %zu delivered, %zu filtered by controller, %zu outside scan window, "
+           "%zu while not scanning\n", adv_delivered, adv_controller_filtered, adv_outside_window, adv_not_scanned);
+    printf("  radio RX duty cycle        %.1f %%\n", 100.0 * host_sim__ble_get_rx_time_us() / end_us);
+    printf("  PM locks held              ble_active %.1f %%, servo %.1f %%\n",
+           100.0 * app_pm__get_lock_held_us(app_pm_lock_ble_active) / end_us,
+           100.0 * app_pm__get_lock_held_us(app_pm_lock_servo) / end_us);
+    printf("  visits                     %zu (%zu missed)\n", visits_count, missed_visits);
+    printf("  lid openings               %zu (%zu false, %zu closed during a visit)\n",
+           lid_openings, false_opens, early_closes);
+    replay__print_stats("time to open", time_to_open_us, time_to_open_count, 1e-3, "ms");
+    replay__print_stats("time to close", time_to_close_us, time_to_close_count, 1e-3, "ms");
+    replay__print_stats("GAP callback CPU per adv", callback_cost_ns, adv_delivered, 1.0, "ns");
+    printf("  %-26s %.2f ns\n", "tasks CPU per adv", adv_delivered ? (double)tasks_cost_ns / adv_delivered : 0.0);
+    app_status_telemetry_t telemetry;
+    app_status__get(&telemetry);
+    printf("  telemetry                  %u adv (%u dropped), %u detections, lid %u opens %u closes %u stalls\n",
+           (unsigned)telemetry.scan_adv_count, (unsigned)telemetry.scan_adv_dropped,
+           (unsigned)telemetry.scan_detection_count, (unsigned)telemetry.lid_open_count,
+           (unsigned)telemetry.lid_close_count, (unsigned)telemetry.lid_stall_count);
+    app_feed_log_record_t log_records[64];
+    size_t log_count = 0;
+    size_t log_visits = 0;
+    app_feed_log__flush();
+    for (uint32_t seq = 0;;)
+    {
+        size_t count = app_feed_log__read(seq, log_records, sizeof(log_records) / sizeof(log_records[0]));
+        if (count == 0)
+        {
+            break;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            log_visits += (log_records[i].event == app_feed_log_event_visit_end);
+        }
+        log_count += count;
+        seq = log_records[count - 1].seq + 1;
+    }
+    printf("  feed log                   %zu records, %zu visits ended\n", log_count, log_visits);
+
+    // time_to_open_us and time_to_close_us were sorted by replay__print_stats, the order does not matter here
+    int failures = replay__check_count("missed visits", missed_visits, bounds.max_missed) +
+                   replay__check_count("false opens", false_opens, bounds.max_false_opens) +
+                   replay__check_count("lid closings during a visit", early_closes, bounds.max_early_closes) +
+                   replay__check_max_ms("time to open", time_to_open_us, time_to_open_count, bounds.max_open_ms) +
+                   replay__check_max_ms("time to close", time_to_close_us, time_to_close_count, bounds.max_close_ms);
+
+    free(time_to_open_us);
+    free(time_to_close_us);
+    free(callback_cost_ns);
+    free(records);
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
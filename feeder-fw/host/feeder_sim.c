@@ -0,0 +1,113 @@
+/**
+ * @file feeder_sim.c
+ * @brief Host simulation of the feeder: the components are initialized as in app_main and a beacon is simulated
+ * approaching the feeder, staying nearby for a while and then leaving. The lid jams while closing, until the jam
+ * clears. Lid movements are printed as they happen. The simulation exits with EXIT_FAILURE if the feed log does not
+ * hold the expected events (the host tests run it, see CMakeLists.txt).
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+#include "app_event.h"
+#include "app_nvs.h"
+#include "app_gpio.h"
+#include "app_measure_vcc.h"
+#include "app_status.h"
+#include "app_feed_log.h"
+#include "app_pwm.h"
+#include "app_lid.h"
+#include "app_beacon.h"
+
+#define SIM_ADV_INTERVAL_US (100000)   ///< Simulated beacon advertising interval (us)
+#define SIM_DURATION_US (30000000)     ///< Simulation duration (us)
+#define SIM_BEACON_ARRIVAL_US (5000000) ///< Time at which the beacon gets close to the feeder (us)
+#define SIM_BEACON_LEAVE_US (15000000)  ///< Time at which the beacon goes away from the feeder (us)
+#define SIM_JAM_START_US (17800000)     ///< Time at which the lid jams while closing (us)
+#define SIM_JAM_END_US (20000000)       ///< Time at which the jam clears (us)
+#define SIM_SERVO_SENSE_CHANNEL (3)     ///< ADC channel of the servo current sense
+#define SIM_SERVO_STALL_RAW (100)       ///< Raw servo current sense reading of a stalled servo (~800 mA)
+
+static uint8_t beacon_mac[6] = {0x50, 0x6c, 0x93, 0x1e, 0x00, 0x01}; ///< Simulated beacon MAC address
+static const uint8_t beacon_adv[] = {
+    0x02, 0x01, 0x06, 0x03, 0x03, 0xaa, 0xfe, 0x11, 0x16, 0xaa, 0xfe, 0x20, 0x00,
+    0x0b, 0xb8, 0x19, 0x80, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x01, 0x00,
+}; ///< Simulated Eddystone TLM advertisement (3000 mV, 25.5 degrees Celsius)
+static const app_feed_log_event_t expected_events[] = {
+    app_feed_log_event_boot, app_feed_log_event_lid_close, app_feed_log_event_visit_start,
+    app_feed_log_event_lid_open, app_feed_log_event_visit_end, app_feed_log_event_lid_stall,
+    app_feed_log_event_lid_stall, app_feed_log_event_lid_close,
+}; ///< Events expected in the feed log: the visit, then the two stalls of the jam before the lid closes
+
+static void feeder_sim__ledc_hook(int channel, uint32_t duty, bool timer_running, int64_t time_us)
+{
+    printf("%8.3f s: LEDC channel %d duty=%u timer=%s\n", time_us / 1e6, channel, (unsigned)duty,
+           timer_running ? "running" : "paused");
+}
+
+static void feeder_sim__check(esp_err_t err, const char *what)
+{
+    if (err != ESP_OK)
+    {
+        fprintf(stderr, "%s failed: %s\n", what, esp_err_to_name(err));
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_WARN);
+    host_sim__ledc_set_hook(feeder_sim__ledc_hook);
+    host_sim__adc_set_raw(0, 3500); // ~2.8 V battery
+
+    feeder_sim__check(app_event__init(), "app_event__init");
+    feeder_sim__check(app_nvs__init(), "app_nvs__init");
+    feeder_sim__check(app_feed_log__init(), "app_feed_log__init");
+    feeder_sim__check(app_nvs__set_authorized_mac(beacon_mac), "app_nvs__set_authorized_mac");
+    feeder_sim__check(app_gpio__init(), "app_gpio__init");
+    feeder_sim__check(app_measure_vcc__init(), "app_measure_vcc__init");
+    feeder_sim__check(app_status__init(), "app_status__init");
+    feeder_sim__check(app_pwm__init(), "app_pwm__init");
+    feeder_sim__check(app_lid__init(), "app_lid__init");
+    feeder_sim__check(app_beacon__init(), "app_beacon__init");
+    feeder_sim__check(app_beacon__ble_scan_start(), "app_beacon__ble_scan_start");
+
+    for (int64_t t_us = 0; t_us < SIM_DURATION_US; t_us += SIM_ADV_INTERVAL_US)
+    {
+        host_sim__run_until(t_us);
+        host_sim__adc_set_raw(SIM_SERVO_SENSE_CHANNEL, (t_us >= SIM_JAM_START_US && t_us < SIM_JAM_END_US) ? SIM_SERVO_STALL_RAW : 0);
+        int rssi = (t_us >= SIM_BEACON_ARRIVAL_US && t_us < SIM_BEACON_LEAVE_US) ? -40 : -80;
+        host_sim__ble_deliver_adv(beacon_mac, rssi, beacon_adv, sizeof(beacon_adv));
+    }
+    host_sim__run_until(SIM_DURATION_US);
+
+    app_feed_log_record_t records[16];
+    feeder_sim__check(app_feed_log__flush(), "app_feed_log__flush");
+    size_t records_count = app_feed_log__read(0, records, sizeof(records) / sizeof(records[0]));
+    for (size_t i = 0; i < records_count; i++)
+    {
+        printf("feed log #%u: boot %u, %8.3f s, event %u, MAC %02x:%02x:%02x:%02x:%02x:%02x, RSSI %d, duration %u ms\n",
+               (unsigned)records[i].seq, (unsigned)records[i].boot, records[i].time_ms / 1e3, (unsigned)records[i].event,
+               records[i].mac[0], records[i].mac[1], records[i].mac[2], records[i].mac[3], records[i].mac[4],
+               records[i].mac[5], records[i].rssi, (unsigned)records[i].duration_ms);
+    }
+
+    size_t expected_count = sizeof(expected_events) / sizeof(expected_events[0]);
+    uint8_t failed = records_count != expected_count;
+    for (size_t i = 0; i < records_count && i < expected_count; i++)
+    {
+        failed |= records[i].event != expected_events[i];
+    }
+    if (failed)
+    {
+        fprintf(stderr, "FAIL: the feed log does not hold the %zu expected events\n", expected_count);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
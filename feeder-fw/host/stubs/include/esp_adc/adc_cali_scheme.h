@@ -0,0 +1,21 @@
+/**
+ * @file adc_cali_scheme.h
+ * @brief Host stub of the ADC calibration schemes. The line fitting scheme maps the raw reading linearly to 0-3300 mV.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "esp_adc/adc_cali.h"
+
+typedef struct
+{
+    int unit_id;
+    int atten;
+    int bitwidth;
+} adc_cali_line_fitting_config_t;
+
+esp_err_t adc_cali_create_scheme_line_fitting(const adc_cali_line_fitting_config_t *config, adc_cali_handle_t *ret_handle);
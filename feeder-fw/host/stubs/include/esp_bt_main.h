@@ -0,0 +1,14 @@
+/**
+ * @file esp_bt_main.h
+ * @brief Host stub of the Bluedroid main API.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+esp_err_t esp_bluedroid_init(void);
+esp_err_t esp_bluedroid_enable(void);
@@ -0,0 +1,126 @@
+/**
+ * @file esp_gap_ble_api.h
+ * @brief Host stub of the Bluedroid BLE GAP API. Only the scanning (observer) part is provided.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+#define ESP_BLE_ADV_DATA_LEN_MAX 31
+#define ESP_BLE_SCAN_RSP_DATA_LEN_MAX 31
+
+typedef enum
+{
+    ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT = 2,
+    ESP_GAP_BLE_SCAN_RESULT_EVT = 3,
+    ESP_GAP_BLE_SCAN_START_COMPLETE_EVT = 7,
+    ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT = 18,
+    ESP_GAP_BLE_UPDATE_WHITELIST_COMPLETE_EVT = 24,
+} esp_gap_ble_cb_event_t;
+
+typedef enum
+{
+    ESP_GAP_SEARCH_INQ_RES_EVT = 0,
+    ESP_GAP_SEARCH_INQ_CMPL_EVT = 1,
+} esp_gap_search_evt_t;
+
+typedef enum
+{
+    BLE_SCAN_TYPE_PASSIVE = 0x0,
+    BLE_SCAN_TYPE_ACTIVE = 0x1,
+} esp_ble_scan_type_t;
+
+typedef enum
+{
+    BLE_SCAN_FILTER_ALLOW_ALL = 0x0,
+    BLE_SCAN_FILTER_ALLOW_ONLY_WLST = 0x1,
+    BLE_SCAN_FILTER_ALLOW_UND_RPA_DIR = 0x2,
+    BLE_SCAN_FILTER_ALLOW_WLIST_RPA_DIR = 0x3,
+} esp_ble_scan_filter_t;
+
+typedef enum
+{
+    BLE_SCAN_DUPLICATE_DISABLE = 0x0,
+    BLE_SCAN_DUPLICATE_ENABLE = 0x1,
+} esp_ble_scan_duplicate_t;
+
+typedef enum
+{
+    ESP_BLE_EVT_CONN_ADV = 0x00,
+    ESP_BLE_EVT_NON_CONN_ADV = 0x03,
+    ESP_BLE_EVT_SCAN_RSP = 0x04,
+} esp_ble_evt_type_t;
+
+typedef enum
+{
+    BLE_WL_ADDR_TYPE_PUBLIC = 0x00,
+    BLE_WL_ADDR_TYPE_RANDOM = 0x01,
+} esp_ble_wl_addr_type_t;
+
+typedef enum
+{
+    ESP_BLE_WHITELIST_REMOVE = 0x00,
+    ESP_BLE_WHITELIST_ADD = 0x01,
+    ESP_BLE_WHITELIST_CLEAR = 0x02,
+} esp_ble_wl_operation_t;
+
+typedef struct
+{
+    esp_ble_scan_type_t scan_type;
+    esp_ble_addr_type_t own_addr_type;
+    esp_ble_scan_filter_t scan_filter_policy;
+    uint16_t scan_interval;
+    uint16_t scan_window;
+    esp_ble_scan_duplicate_t scan_duplicate;
+} esp_ble_scan_params_t;
+
+typedef union
+{
+    struct ble_scan_param_cmpl_evt_param
+    {
+        esp_bt_status_t status;
+    } scan_param_cmpl;
+    struct ble_scan_result_evt_param
+    {
+        esp_gap_search_evt_t search_evt;
+        esp_bd_addr_t bda;
+        esp_ble_evt_type_t ble_evt_type;
+        esp_ble_addr_type_t ble_addr_type;
+        int rssi;
+        uint8_t ble_adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+        int flag;
+        int num_resps;
+        uint8_t adv_data_len;
+        uint8_t scan_rsp_len;
+    } scan_rst;
+    struct ble_scan_start_cmpl_evt_param
+    {
+        esp_bt_status_t status;
+    } scan_start_cmpl;
+    struct ble_scan_stop_cmpl_evt_param
+    {
+        esp_bt_status_t status;
+    } scan_stop_cmpl;
+    struct ble_update_whitelist_cmpl_evt_param
+    {
+        esp_bt_status_t status;
+        esp_ble_wl_operation_t wl_operation;
+    } update_whitelist_cmpl;
+} esp_ble_gap_cb_param_t;
+
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback);
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *scan_params);
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration);
+esp_err_t esp_ble_gap_stop_scanning(void);
+esp_err_t esp_ble_gap_update_whitelist(bool add_remove, esp_bd_addr_t remote_bda, esp_ble_wl_addr_type_t wl_addr_type);
+esp_err_t esp_ble_gap_clear_whitelist(void);
+esp_err_t esp_ble_gap_get_whitelist_size(uint16_t *length);
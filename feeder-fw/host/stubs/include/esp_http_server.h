@@ -0,0 +1,22 @@
+/**
+ * @file esp_http_server.h
+ * @brief Host stub of the HTTP server API, reduced to the response functions used by the JSON writer of
+ * app_web_server. They are implemented by the test of the writer, which captures the response.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include "esp_err.h"
+
+typedef struct httpd_req
+{
+    void *user_ctx;
+} httpd_req_t;
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len);
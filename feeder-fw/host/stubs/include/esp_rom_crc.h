@@ -0,0 +1,13 @@
+/**
+ * @file esp_rom_crc.h
+ * @brief Host stub of the ROM CRC functions.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
@@ -0,0 +1,17 @@
+/**
+ * @file esp_system.h
+ * @brief Host stub of ESP-IDF system functions.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+typedef void (*shutdown_handler_t)(void);
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle);
+void esp_restart(void);
+uint32_t esp_get_free_heap_size(void);
@@ -0,0 +1,58 @@
+/**
+ * @file ble_gap.h
+ * @brief Host stub of the NimBLE GAP discovery API.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "nimble/ble.h"
+
+#define BLE_GAP_EVENT_DISC (7)
+#define BLE_GAP_EVENT_DISC_COMPLETE (8)
+
+#define BLE_HCI_ADV_RPT_EVTYPE_NONCONN_IND (3)
+
+struct ble_gap_disc_params
+{
+    uint16_t itvl;
+    uint16_t window;
+    uint8_t filter_policy;
+    uint8_t limited : 1;
+    uint8_t passive : 1;
+    uint8_t filter_duplicates : 1;
+};
+
+struct ble_gap_disc_desc
+{
+    uint8_t event_type;
+    uint8_t length_data;
+    ble_addr_t addr;
+    int8_t rssi;
+    const uint8_t *data;
+    ble_addr_t direct_addr;
+};
+
+struct ble_gap_event
+{
+    uint8_t type;
+    union
+    {
+        struct ble_gap_disc_desc disc;
+        struct
+        {
+            int reason;
+        } disc_complete;
+    };
+};
+
+typedef int ble_gap_event_fn(struct ble_gap_event *event, void *arg);
+
+int ble_gap_disc(uint8_t own_addr_type, int32_t duration_ms, const struct ble_gap_disc_params *disc_params,
+                 ble_gap_event_fn *cb, void *cb_arg);
+int ble_gap_disc_cancel(void);
+int ble_gap_wl_set(const ble_addr_t *addrs, uint8_t white_list_count);
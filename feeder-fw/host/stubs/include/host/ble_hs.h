@@ -0,0 +1,39 @@
+/**
+ * @file ble_hs.h
+ * @brief Host stub of the NimBLE host API.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "nimble/ble.h"
+#include "nimble/hci_common.h"
+#include "host/ble_gap.h"
+
+#define BLE_HS_FOREVER INT32_MAX
+
+#define BLE_HS_EALREADY (2)
+#define BLE_HS_EINVAL (3)
+#define BLE_HS_ENOTSUP (8)
+#define BLE_HS_EBUSY (15)
+#define BLE_HS_ERR_HCI_BASE (0x200)
+#define BLE_HS_HCI_ERR(x) ((x) ? BLE_HS_ERR_HCI_BASE + (x) : 0)
+#define BLE_ERR_CMD_DISALLOWED (0x0C)
+#define BLE_ERR_MEM_CAPACITY (0x07)
+
+#define BLE_OWN_ADDR_PUBLIC (0x00)
+
+typedef void ble_hs_sync_fn(void);
+typedef void ble_hs_reset_fn(int reason);
+
+struct ble_hs_cfg
+{
+    ble_hs_sync_fn *sync_cb;
+    ble_hs_reset_fn *reset_cb;
+};
+
+extern struct ble_hs_cfg ble_hs_cfg;
@@ -0,0 +1,42 @@
+/**
+ * @file host_sim.h
+ * @brief Control of the host simulation: simulated clock, cooperative FreeRTOS scheduler and hooks into the
+ * simulated peripherals (BLE GAP, LEDC, ADC, GPIO).
+ *
+ * Simulated tasks run in zero simulated time until they block (vTaskDelay, vTaskSuspend, ulTaskNotifyTake), and
+ * the clock only moves forward inside host_sim__run_until. Code that is not running in a simulated task (the
+ * simulation's main function) can call the peripheral hooks at any simulated time, for example to deliver a BLE
+ * advertisement, and then call host_sim__run_until to let the tasks react to it.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+int64_t host_sim__now_us(void);
+void host_sim__run_until(int64_t time_us);
+void host_sim__run_for(int64_t duration_us);
+
+/// @brief Outcome of an advertisement delivered to the simulated BLE controller.
+typedef enum
+{
+    host_sim_ble_adv_received,       ///< Advertisement reported to the GAP callback
+    host_sim_ble_adv_not_scanning,   ///< BLE scan is off
+    host_sim_ble_adv_outside_window, ///< BLE scan is on, but the advertisement fell outside the scan window
+    host_sim_ble_adv_filtered,       ///< Advertisement rejected by the controller whitelist
+} host_sim_ble_adv_result_t;
+
+host_sim_ble_adv_result_t host_sim__ble_deliver_adv(const uint8_t bda[6], int rssi, const uint8_t *adv, uint8_t adv_len);
+bool host_sim__ble_is_scanning(void);
+int64_t host_sim__ble_get_rx_time_us(void);
+
+typedef void (*host_sim_ledc_hook_t)(int channel, uint32_t duty, bool timer_running, int64_t time_us);
+void host_sim__ledc_set_hook(host_sim_ledc_hook_t hook);
+uint32_t host_sim__ledc_get_duty(int channel);
+
+void host_sim__adc_set_raw(int channel, int raw);
+void host_sim__gpio_set_input_level(int gpio_num, int level);
@@ -0,0 +1,23 @@
+/**
+ * @file hci_common.h
+ * @brief Host stub of the NimBLE HCI definitions.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define BLE_HCI_OP(ogf, ocf) ((ocf) | ((ogf) << 10))
+#define BLE_HCI_OGF_LE (0x08)
+#define BLE_HCI_OCF_LE_RD_WHITE_LIST_SIZE (0x000F)
+
+#define BLE_HCI_SCAN_FILT_NO_WL (0)
+#define BLE_HCI_SCAN_FILT_USE_WL (1)
+
+struct ble_hci_le_rd_white_list_rp
+{
+    uint8_t size;
+} __attribute__((packed));
@@ -0,0 +1,26 @@
+/**
+ * @file nimble_npl.h
+ * @brief Host stub of the NimBLE porting layer events, run by the NimBLE host task.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+struct ble_npl_event;
+typedef void ble_npl_event_fn(struct ble_npl_event *ev);
+
+struct ble_npl_event
+{
+    bool queued;
+    ble_npl_event_fn *fn;
+    void *arg;
+};
+
+struct ble_npl_eventq;
+
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg);
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev);
@@ -0,0 +1,15 @@
+/**
+ * @file nimble_port_freertos.h
+ * @brief Host stub of the NimBLE FreeRTOS port.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+void nimble_port_freertos_init(TaskFunction_t host_task_fn);
+void nimble_port_freertos_deinit(void);
@@ -0,0 +1,14 @@
+/**
+ * @file nvs_flash.h
+ * @brief Host stub of the NVS flash initialization API.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
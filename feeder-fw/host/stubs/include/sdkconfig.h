@@ -0,0 +1,14 @@
+/**
+ * @file sdkconfig.h
+ * @brief Host stub of the configuration header generated by the ESP-IDF build. Options that are not defined here
+ * are disabled in the host build (e.g. CONFIG_PM_ENABLE).
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 160
+#define CONFIG_XTAL_FREQ 40
@@ -0,0 +1,29 @@
+/**
+ * @file host_sim_app_wifi.c
+ * @brief Host stub of the app_wifi component, which is not part of the host build (no Wi-Fi or TCP/IP stack).
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include "esp_log.h"
+
+#include "app_wifi.h"
+
+static const char *TAG = "app_wifi"; ///< Tag to be used when logging
+
+esp_err_t app_wifi__init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t app_wifi__start(void)
+{
+    ESP_LOGI(TAG, "Wi-Fi start requested (not simulated)");
+    return ESP_OK;
+}
+
+esp_err_t app_wifi__stop(void)
+{
+    return ESP_OK;
+}
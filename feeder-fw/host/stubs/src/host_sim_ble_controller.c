@@ -0,0 +1,157 @@
+/**
+ * @file host_sim_ble_controller.c
+ * @brief Host stub of the ESP32 BT controller and its scan, shared by the stubs of the BLE host stacks (host_sim_bt.c for
+ * Bluedroid, host_sim_nimble.c for NimBLE). The scan window, the controller whitelist and the scan filter policy are
+ * simulated, so advertisements that the controller would miss or reject never reach the host stack. The time spent
+ * receiving is accounted, as a proxy of the radio power consumption.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <string.h>
+
+#include "esp_bt.h"
+#include "host_sim.h"
+#include "host_sim_internal.h"
+
+#define HOST_SIM_SCAN_UNIT_US (625) ///< Unit of the scan interval and window (us)
+
+/// @brief Controller whitelist entry.
+struct host_sim_whitelist_entry
+{
+    uint8_t bda[6];
+    uint8_t addr_type;
+};
+
+static bool scanning = false;
+static bool scan_use_whitelist = false;
+static int64_t scan_interval_us = 0;
+static int64_t scan_window_us = 0;
+static int64_t scan_start_us = 0;   ///< Time when the current scan started
+static int64_t rx_time_prev_us = 0; ///< Time spent receiving in previous scans
+static struct host_sim_whitelist_entry whitelist[HOST_SIM_BLE_WHITELIST_SIZE];
+static int whitelist_count = 0;
+
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode)
+{
+    (void)mode;
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg)
+{
+    (void)cfg;
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode)
+{
+    (void)mode;
+    return ESP_OK;
+}
+
+void host_sim__ble_ctrl_set_scan_params(uint16_t interval, uint16_t window, bool use_whitelist)
+{
+    scan_use_whitelist = use_whitelist;
+    scan_interval_us = (int64_t)interval * HOST_SIM_SCAN_UNIT_US;
+    scan_window_us = (int64_t)window * HOST_SIM_SCAN_UNIT_US;
+}
+
+void host_sim__ble_ctrl_set_scanning(bool scan)
+{
+    if (scan && !scanning)
+    {
+        scan_start_us = host_sim__now_us();
+    }
+    else if (!scan && scanning)
+    {
+        rx_time_prev_us = host_sim__ble_get_rx_time_us();
+    }
+    scanning = scan;
+}
+
+bool host_sim__ble_is_scanning(void)
+{
+    return scanning;
+}
+
+int64_t host_sim__ble_get_rx_time_us(void)
+{
+    if (!scanning || scan_interval_us == 0)
+    {
+        return rx_time_prev_us;
+    }
+    int64_t elapsed_us = host_sim__now_us() - scan_start_us;
+    int64_t in_interval_us = elapsed_us % scan_interval_us;
+    return rx_time_prev_us + (elapsed_us / scan_interval_us) * scan_window_us +
+           (in_interval_us < scan_window_us ? in_interval_us : scan_window_us);
+}
+
+bool host_sim__ble_ctrl_whitelist_in_use(void)
+{
+    // the controller rejects whitelist changes while the whitelist is in use
+    return scanning && scan_use_whitelist;
+}
+
+static bool host_sim__ble_ctrl_whitelist_contains(const uint8_t bda[6], uint8_t addr_type)
+{
+    for (int i = 0; i < whitelist_count; i++)
+    {
+        if (whitelist[i].addr_type == addr_type && memcmp(whitelist[i].bda, bda, 6) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool host_sim__ble_ctrl_whitelist_add(const uint8_t bda[6], uint8_t addr_type)
+{
+    if (host_sim__ble_ctrl_whitelist_contains(bda, addr_type))
+    {
+        return true;
+    }
+    if (whitelist_count == HOST_SIM_BLE_WHITELIST_SIZE)
+    {
+        return false;
+    }
+    memcpy(whitelist[whitelist_count].bda, bda, 6);
+    whitelist[whitelist_count].addr_type = addr_type;
+    whitelist_count++;
+    return true;
+}
+
+void host_sim__ble_ctrl_whitelist_remove(const uint8_t bda[6], uint8_t addr_type)
+{
+    for (int i = 0; i < whitelist_count; i++)
+    {
+        if (whitelist[i].addr_type == addr_type && memcmp(whitelist[i].bda, bda, 6) == 0)
+        {
+            whitelist[i] = whitelist[--whitelist_count];
+            break;
+        }
+    }
+}
+
+void host_sim__ble_ctrl_whitelist_clear(void)
+{
+    whitelist_count = 0;
+}
+
+host_sim_ble_adv_result_t host_sim__ble_ctrl_receive(const uint8_t bda[6])
+{
+    if (!scanning)
+    {
+        return host_sim_ble_adv_not_scanning;
+    }
+    if (scan_interval_us != 0 && (host_sim__now_us() - scan_start_us) % scan_interval_us >= scan_window_us)
+    {
+        return host_sim_ble_adv_outside_window;
+    }
+    if (scan_use_whitelist && !host_sim__ble_ctrl_whitelist_contains(bda, HOST_SIM_BLE_ADDR_PUBLIC))
+    {
+        return host_sim_ble_adv_filtered;
+    }
+    return host_sim_ble_adv_received;
+}
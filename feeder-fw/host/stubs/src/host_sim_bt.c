@@ -0,0 +1,189 @@
+/**
+ * @file host_sim_bt.c
+ * @brief Host stub of Bluedroid GAP. Completion events are delivered asynchronously from a
+ * simulated BTC task, like Bluedroid does, while advertisements are delivered by the simulation's main code with
+ * host_sim__ble_deliver_adv, through the simulated controller scan (see host_sim_ble_controller.c).
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <string.h>
+
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gap_ble_api.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host_sim_internal.h"
+
+#define HOST_SIM_BTC_QUEUE_SIZE (64) ///< Maximum number of pending GAP completion events
+
+/// @brief Pending GAP completion event.
+struct host_sim_btc_event
+{
+    esp_gap_ble_cb_event_t event;
+    esp_ble_gap_cb_param_t param;
+};
+
+static esp_gap_ble_cb_t gap_cb = NULL;
+static TaskHandle_t btc_task_handle = NULL;
+static struct host_sim_btc_event btc_queue[HOST_SIM_BTC_QUEUE_SIZE];
+static uint32_t btc_queue_head = 0;
+static uint32_t btc_queue_tail = 0;
+
+static void host_sim__btc_task(void *arg)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (btc_queue_tail != btc_queue_head)
+        {
+            struct host_sim_btc_event *btc_event = &btc_queue[btc_queue_tail % HOST_SIM_BTC_QUEUE_SIZE];
+            esp_gap_ble_cb_event_t event = btc_event->event;
+            esp_ble_gap_cb_param_t param = btc_event->param;
+            btc_queue_tail++;
+            if (event == ESP_GAP_BLE_SCAN_START_COMPLETE_EVT)
+            {
+                host_sim__ble_ctrl_set_scanning(true);
+            }
+            else if (event == ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT)
+            {
+                host_sim__ble_ctrl_set_scanning(false);
+            }
+            if (gap_cb != NULL)
+            {
+                gap_cb(event, &param);
+            }
+        }
+    }
+}
+
+static esp_err_t host_sim__btc_post_param(esp_gap_ble_cb_event_t event, const esp_ble_gap_cb_param_t *param)
+{
+    if (btc_task_handle == NULL || btc_queue_head - btc_queue_tail == HOST_SIM_BTC_QUEUE_SIZE)
+    {
+        return ESP_FAIL;
+    }
+    btc_queue[btc_queue_head % HOST_SIM_BTC_QUEUE_SIZE].event = event;
+    btc_queue[btc_queue_head % HOST_SIM_BTC_QUEUE_SIZE].param = *param;
+    btc_queue_head++;
+    xTaskNotifyGive(btc_task_handle);
+    return ESP_OK;
+}
+
+static esp_err_t host_sim__btc_post(esp_gap_ble_cb_event_t event)
+{
+    esp_ble_gap_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+    return host_sim__btc_post_param(event, &param);
+}
+
+esp_err_t esp_bluedroid_init(void)
+{
+    if (btc_task_handle == NULL &&
+        xTaskCreate(host_sim__btc_task, "BTC_TASK", 3000, NULL, 19, &btc_task_handle) != pdPASS)
+    {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback)
+{
+    gap_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *scan_params)
+{
+    host_sim__ble_ctrl_set_scan_params(scan_params->scan_interval, scan_params->scan_window,
+                                       scan_params->scan_filter_policy == BLE_SCAN_FILTER_ALLOW_ONLY_WLST);
+    return host_sim__btc_post(ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT);
+}
+
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration)
+{
+    (void)duration;
+    return host_sim__btc_post(ESP_GAP_BLE_SCAN_START_COMPLETE_EVT);
+}
+
+esp_err_t esp_ble_gap_stop_scanning(void)
+{
+    return host_sim__btc_post(ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT);
+}
+
+esp_err_t esp_ble_gap_update_whitelist(bool add_remove, esp_bd_addr_t remote_bda, esp_ble_wl_addr_type_t wl_addr_type)
+{
+    esp_ble_gap_cb_param_t param;
+
+    memset(&param, 0, sizeof(param));
+    param.update_whitelist_cmpl.wl_operation = add_remove ? ESP_BLE_WHITELIST_ADD : ESP_BLE_WHITELIST_REMOVE;
+    if (host_sim__ble_ctrl_whitelist_in_use() ||
+        (add_remove && !host_sim__ble_ctrl_whitelist_add(remote_bda, wl_addr_type)))
+    {
+        param.update_whitelist_cmpl.status = ESP_BT_STATUS_FAIL;
+    }
+    else if (!add_remove)
+    {
+        host_sim__ble_ctrl_whitelist_remove(remote_bda, wl_addr_type);
+    }
+    return host_sim__btc_post_param(ESP_GAP_BLE_UPDATE_WHITELIST_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_clear_whitelist(void)
+{
+    esp_ble_gap_cb_param_t param;
+
+    memset(&param, 0, sizeof(param));
+    param.update_whitelist_cmpl.wl_operation = ESP_BLE_WHITELIST_CLEAR;
+    if (host_sim__ble_ctrl_whitelist_in_use())
+    {
+        param.update_whitelist_cmpl.status = ESP_BT_STATUS_FAIL;
+    }
+    else
+    {
+        host_sim__ble_ctrl_whitelist_clear();
+    }
+    return host_sim__btc_post_param(ESP_GAP_BLE_UPDATE_WHITELIST_COMPLETE_EVT, &param);
+}
+
+esp_err_t esp_ble_gap_get_whitelist_size(uint16_t *length)
+{
+    *length = HOST_SIM_BLE_WHITELIST_SIZE;
+    return ESP_OK;
+}
+
+host_sim_ble_adv_result_t host_sim__ble_deliver_adv(const uint8_t bda[6], int rssi, const uint8_t *adv, uint8_t adv_len)
+{
+    esp_ble_gap_cb_param_t param;
+
+    if (gap_cb == NULL)
+    {
+        return host_sim_ble_adv_not_scanning;
+    }
+    host_sim_ble_adv_result_t result = host_sim__ble_ctrl_receive(bda);
+    if (result != host_sim_ble_adv_received)
+    {
+        return result;
+    }
+    memset(&param, 0, sizeof(param));
+    param.scan_rst.search_evt = ESP_GAP_SEARCH_INQ_RES_EVT;
+    memcpy(param.scan_rst.bda, bda, ESP_BD_ADDR_LEN);
+    param.scan_rst.ble_evt_type = ESP_BLE_EVT_NON_CONN_ADV;
+    param.scan_rst.ble_addr_type = BLE_ADDR_TYPE_PUBLIC;
+    param.scan_rst.rssi = rssi;
+    if (adv_len > ESP_BLE_ADV_DATA_LEN_MAX)
+    {
+        adv_len = ESP_BLE_ADV_DATA_LEN_MAX;
+    }
+    memcpy(param.scan_rst.ble_adv, adv, adv_len);
+    param.scan_rst.adv_data_len = adv_len;
+    gap_cb(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+    return host_sim_ble_adv_received;
+}
@@ -0,0 +1,486 @@
+/**
+ * @file host_sim_drivers.c
+ * @brief Host stubs of the LEDC, GPIO and ADC drivers. LEDC fades are not stepped: the channel jumps to the target
+ * duty when the fade time has elapsed, and the fade end callback is then called from the esp_timer task.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/ledc.h"
+#include "driver/gpio.h"
+#include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+#define HOST_SIM_ADC_CHANNELS (10) ///< Number of simulated ADC channels
+
+static uint32_t ledc_duty_set[LEDC_CHANNEL_MAX];     ///< Duty set with ledc_set_duty, not yet applied
+static uint32_t ledc_duty[LEDC_CHANNEL_MAX];         ///< Duty applied with ledc_update_duty
+static ledc_timer_t ledc_channel_timer[LEDC_CHANNEL_MAX];
+static bool ledc_channel_configured[LEDC_CHANNEL_MAX];
+static bool ledc_timer_running[LEDC_TIMER_MAX];
+static host_sim_ledc_hook_t ledc_hook = NULL;
+static esp_timer_handle_t ledc_fade_timers[LEDC_CHANNEL_MAX]; ///< Timers ending the fades, created by ledc_fade_func_install
+static uint32_t ledc_fade_target[LEDC_CHANNEL_MAX];
+static int ledc_fade_time_ms[LEDC_CHANNEL_MAX];
+static ledc_cbs_t ledc_cbs[LEDC_CHANNEL_MAX];
+static void *ledc_cbs_user_arg[LEDC_CHANNEL_MAX];
+static int gpio_levels[GPIO_NUM_MAX];
+static gpio_isr_t gpio_isr_handlers[GPIO_NUM_MAX];
+static void *gpio_isr_args[GPIO_NUM_MAX];
+static int adc_raw[HOST_SIM_ADC_CHANNELS];
+
+/// @brief Simulated ADC continuous driver.
+struct adc_continuous_ctx_t
+{
+    uint8_t *frame;          ///< Last conversion frame
+    uint32_t frame_size;     ///< Size of a conversion frame (bytes)
+    bool frame_ready;        ///< Flag that indicates if the last frame was not read yet
+    adc_digi_pattern_config_t pattern; ///< First entry of the conversion pattern, the only one simulated
+    uint32_t sample_freq_hz;
+    adc_continuous_evt_cbs_t cbs;
+    void *user_data;
+    esp_timer_handle_t frame_timer; ///< Timer ending each conversion frame
+    bool running;
+};
+static struct adc_continuous_ctx_t adc_continuous_ctx;
+
+static void host_sim__ledc_notify(ledc_channel_t channel)
+{
+    if (ledc_hook != NULL && ledc_channel_configured[channel])
+    {
+        ledc_hook(channel, ledc_duty[channel], ledc_timer_running[ledc_channel_timer[channel]], host_sim__now_us());
+    }
+}
+
+void host_sim__ledc_set_hook(host_sim_ledc_hook_t hook)
+{
+    ledc_hook = hook;
+}
+
+uint32_t host_sim__ledc_get_duty(int channel)
+{
+    return ledc_duty[channel];
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf)
+{
+    if (timer_conf->timer_num >= LEDC_TIMER_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_timer_running[timer_conf->timer_num] = true;
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf)
+{
+    if (ledc_conf->channel >= LEDC_CHANNEL_MAX || ledc_conf->timer_sel >= LEDC_TIMER_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_channel_timer[ledc_conf->channel] = ledc_conf->timer_sel;
+    ledc_channel_configured[ledc_conf->channel] = true;
+    ledc_duty_set[ledc_conf->channel] = ledc_conf->duty;
+    ledc_duty[ledc_conf->channel] = ledc_conf->duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty)
+{
+    (void)speed_mode;
+    if (channel >= LEDC_CHANNEL_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_duty_set[channel] = duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    (void)speed_mode;
+    if (channel >= LEDC_CHANNEL_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_duty[channel] = ledc_duty_set[channel];
+    host_sim__ledc_notify(channel);
+    return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    (void)speed_mode;
+    return ledc_duty[channel];
+}
+
+static esp_err_t host_sim__ledc_timer_set_running(ledc_timer_t timer_sel, bool running)
+{
+    if (timer_sel >= LEDC_TIMER_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_timer_running[timer_sel] = running;
+    for (int channel = 0; channel < LEDC_CHANNEL_MAX; channel++)
+    {
+        if (ledc_channel_timer[channel] == timer_sel)
+        {
+            host_sim__ledc_notify(channel);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t ledc_timer_pause(ledc_mode_t speed_mode, ledc_timer_t timer_sel)
+{
+    (void)speed_mode;
+    return host_sim__ledc_timer_set_running(timer_sel, false);
+}
+
+esp_err_t ledc_timer_resume(ledc_mode_t speed_mode, ledc_timer_t timer_sel)
+{
+    (void)speed_mode;
+    return host_sim__ledc_timer_set_running(timer_sel, true);
+}
+
+static void host_sim__ledc_fade_end_cb(void *arg)
+{
+    ledc_channel_t channel = (ledc_channel_t)(intptr_t)arg;
+    ledc_duty[channel] = ledc_fade_target[channel];
+    ledc_duty_set[channel] = ledc_fade_target[channel];
+    host_sim__ledc_notify(channel);
+    if (ledc_cbs[channel].fade_cb != NULL)
+    {
+        ledc_cb_param_t param = {
+            .event = LEDC_FADE_END_EVT,
+            .speed_mode = LEDC_LOW_SPEED_MODE,
+            .channel = channel,
+            .duty = ledc_duty[channel],
+        };
+        ledc_cbs[channel].fade_cb(&param, ledc_cbs_user_arg[channel]);
+    }
+}
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags)
+{
+    (void)intr_alloc_flags;
+    for (int channel = 0; channel < LEDC_CHANNEL_MAX; channel++)
+    {
+        if (ledc_fade_timers[channel] != NULL)
+        {
+            return ESP_ERR_INVALID_STATE;
+        }
+        const esp_timer_create_args_t timer_args = {
+            .callback = host_sim__ledc_fade_end_cb,
+            .arg = (void *)(intptr_t)channel,
+            .name = "ledc_fade",
+        };
+        esp_err_t err = esp_timer_create(&timer_args, &ledc_fade_timers[channel]);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t ledc_cb_register(ledc_mode_t speed_mode, ledc_channel_t channel, ledc_cbs_t *cbs, void *user_arg)
+{
+    (void)speed_mode;
+    if (channel >= LEDC_CHANNEL_MAX || cbs == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    ledc_cbs[channel] = *cbs;
+    ledc_cbs_user_arg[channel] = user_arg;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t target_duty, int max_fade_time_ms)
+{
+    (void)speed_mode;
+    if (channel >= LEDC_CHANNEL_MAX || max_fade_time_ms < 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ledc_fade_timers[channel] == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ledc_fade_target[channel] = target_duty;
+    ledc_fade_time_ms[channel] = max_fade_time_ms;
+    return ESP_OK;
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t speed_mode, ledc_channel_t channel, ledc_fade_mode_t fade_mode)
+{
+    (void)speed_mode;
+    if (channel >= LEDC_CHANNEL_MAX || fade_mode != LEDC_FADE_NO_WAIT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ledc_fade_timers[channel] == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_timer_stop(ledc_fade_timers[channel]);
+    return esp_timer_start_once(ledc_fade_timers[channel], (uint64_t)ledc_fade_time_ms[channel] * 1000);
+}
+
+esp_err_t ledc_fade_stop(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    (void)speed_mode;
+    if (channel >= LEDC_CHANNEL_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ledc_fade_timers[channel] == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_timer_stop(ledc_fade_timers[channel]);
+    return ESP_OK;
+}
+
+void host_sim__gpio_set_input_level(int gpio_num, int level)
+{
+    int previous_level = gpio_levels[gpio_num];
+    gpio_levels[gpio_num] = level;
+    if (previous_level != level && gpio_isr_handlers[gpio_num] != NULL)
+    {
+        gpio_isr_handlers[gpio_num](gpio_isr_args[gpio_num]);
+    }
+}
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    for (int gpio_num = 0; gpio_num < GPIO_NUM_MAX; gpio_num++)
+    {
+        if ((config->pin_bit_mask & (1ULL << gpio_num)) && config->pull_up_en == GPIO_PULLUP_ENABLE)
+        {
+            gpio_levels[gpio_num] = 1;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    gpio_levels[gpio_num] = (int)level;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return gpio_levels[gpio_num];
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    (void)intr_alloc_flags;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    gpio_isr_handlers[gpio_num] = isr_handler;
+    gpio_isr_args[gpio_num] = args;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    gpio_isr_handlers[gpio_num] = NULL;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num)
+{
+    (void)gpio_num;
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num)
+{
+    (void)gpio_num;
+    return ESP_OK;
+}
+
+void host_sim__adc_set_raw(int channel, int raw)
+{
+    adc_raw[channel] = raw;
+}
+
+esp_err_t adc_oneshot_new_unit(const adc_oneshot_unit_init_cfg_t *init_config, adc_oneshot_unit_handle_t *ret_unit)
+{
+    (void)init_config;
+    *ret_unit = (adc_oneshot_unit_handle_t)adc_raw;
+    return ESP_OK;
+}
+
+esp_err_t adc_oneshot_config_channel(adc_oneshot_unit_handle_t handle, adc_channel_t channel, const adc_oneshot_chan_cfg_t *config)
+{
+    (void)handle;
+    (void)config;
+    return (channel < HOST_SIM_ADC_CHANNELS) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t adc_oneshot_read(adc_oneshot_unit_handle_t handle, adc_channel_t chan, int *out_raw)
+{
+    (void)handle;
+    if (chan >= HOST_SIM_ADC_CHANNELS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (adc_continuous_ctx.running)
+    {
+        // the ADC unit is taken by the continuous driver
+        return ESP_ERR_TIMEOUT;
+    }
+    *out_raw = adc_raw[chan];
+    return ESP_OK;
+}
+
+static void host_sim__adc_continuous_frame_cb(void *arg)
+{
+    struct adc_continuous_ctx_t *ctx = arg;
+    adc_digi_output_data_t sample = {0};
+    sample.type1.channel = ctx->pattern.channel;
+    sample.type1.data = adc_raw[ctx->pattern.channel];
+    for (uint32_t i = 0; i + sizeof(sample) <= ctx->frame_size; i += sizeof(sample))
+    {
+        memcpy(&ctx->frame[i], &sample, sizeof(sample));
+    }
+    ctx->frame_ready = true;
+    if (ctx->cbs.on_conv_done != NULL)
+    {
+        adc_continuous_evt_data_t edata = {
+            .conv_frame_buffer = ctx->frame,
+            .size = ctx->frame_size,
+        };
+        ctx->cbs.on_conv_done(ctx, &edata, ctx->user_data);
+    }
+}
+
+esp_err_t adc_continuous_new_handle(const adc_continuous_handle_cfg_t *hdl_config, adc_continuous_handle_t *ret_handle)
+{
+    struct adc_continuous_ctx_t *ctx = &adc_continuous_ctx;
+    if (ctx->frame != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    ctx->frame = calloc(1, hdl_config->conv_frame_size);
+    if (ctx->frame == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    ctx->frame_size = hdl_config->conv_frame_size;
+    const esp_timer_create_args_t timer_args = {
+        .callback = host_sim__adc_continuous_frame_cb,
+        .arg = ctx,
+        .name = "adc_frame",
+    };
+    esp_err_t err = esp_timer_create(&timer_args, &ctx->frame_timer);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    *ret_handle = ctx;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_config(adc_continuous_handle_t handle, const adc_continuous_config_t *config)
+{
+    if (config->pattern_num == 0 || config->adc_pattern[0].channel >= HOST_SIM_ADC_CHANNELS || config->sample_freq_hz == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    handle->pattern = config->adc_pattern[0];
+    handle->sample_freq_hz = config->sample_freq_hz;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_register_event_callbacks(adc_continuous_handle_t handle, const adc_continuous_evt_cbs_t *cbs, void *user_data)
+{
+    handle->cbs = *cbs;
+    handle->user_data = user_data;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_start(adc_continuous_handle_t handle)
+{
+    if (handle->running || handle->sample_freq_hz == 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    handle->running = true;
+    uint64_t frame_us = (uint64_t)(handle->frame_size / sizeof(adc_digi_output_data_t)) * 1000000 / handle->sample_freq_hz;
+    return esp_timer_start_periodic(handle->frame_timer, frame_us);
+}
+
+esp_err_t adc_continuous_stop(adc_continuous_handle_t handle)
+{
+    if (!handle->running)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    handle->running = false;
+    esp_timer_stop(handle->frame_timer);
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_read(adc_continuous_handle_t handle, uint8_t *buf, uint32_t length_max, uint32_t *out_length, uint32_t timeout_ms)
+{
+    (void)timeout_ms;
+    if (!handle->frame_ready)
+    {
+        *out_length = 0;
+        return ESP_ERR_TIMEOUT;
+    }
+    *out_length = (length_max < handle->frame_size) ? length_max : handle->frame_size;
+    memcpy(buf, handle->frame, *out_length);
+    handle->frame_ready = false;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_deinit(adc_continuous_handle_t handle)
+{
+    if (handle->running)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_timer_delete(handle->frame_timer);
+    free(handle->frame);
+    memset(handle, 0, sizeof(*handle));
+    return ESP_OK;
+}
+
+esp_err_t adc_oneshot_del_unit(adc_oneshot_unit_handle_t handle)
+{
+    (void)handle;
+    return ESP_OK;
+}
+
+esp_err_t adc_cali_create_scheme_line_fitting(const adc_cali_line_fitting_config_t *config, adc_cali_handle_t *ret_handle)
+{
+    (void)config;
+    *ret_handle = (adc_cali_handle_t)adc_raw;
+    return ESP_OK;
+}
+
+esp_err_t adc_cali_raw_to_voltage(adc_cali_handle_t handle, int raw, int *voltage)
+{
+    (void)handle;
+    *voltage = (raw * 3300) / 4095;
+    return ESP_OK;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file host_sim_esp.c
+ * @brief Host stubs of ESP-IDF system services: error names, logging, and restart with its shutdown handlers.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+
+#define HOST_SIM_SHUTDOWN_HANDLERS_MAX (5) ///< Maximum number of shutdown handlers, as in ESP-IDF
+
+esp_log_level_t host_log_level = ESP_LOG_INFO;
+static shutdown_handler_t shutdown_handlers[HOST_SIM_SHUTDOWN_HANDLERS_MAX];
+static int shutdown_handlers_count = 0;
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_CRC:
+        return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+void esp_err_check_failed(esp_err_t err, const char *expr, const char *file, int line)
+{
+    fprintf(stderr, "ESP_ERROR_CHECK failed: %s (%d) at %s:%d, expression: %s\n", esp_err_to_name(err), err, file, line, expr);
+    abort();
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    (void)tag;
+    host_log_level = level;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(host_sim__now_us() / 1000);
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle)
+{
+    if (shutdown_handlers_count == HOST_SIM_SHUTDOWN_HANDLERS_MAX)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    shutdown_handlers[shutdown_handlers_count++] = handle;
+    return ESP_OK;
+}
+
+void esp_restart(void)
+{
+    // as in ESP-IDF, the handlers run in reverse order of registration
+    for (int i = shutdown_handlers_count - 1; i >= 0; i--)
+    {
+        shutdown_handlers[i]();
+    }
+    fprintf(stderr, "esp_restart called at %lld us\n", (long long)host_sim__now_us());
+    exit(EXIT_FAILURE);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
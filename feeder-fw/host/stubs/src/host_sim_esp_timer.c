@@ -0,0 +1,167 @@
+/**
+ * @file host_sim_esp_timer.c
+ * @brief Host stub of the ESP-IDF high resolution timer. Armed timers are kept in a list and fired, in expiry
+ * order, by a simulated esp_timer task that sleeps until the closest expiry time.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <stdlib.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host_sim_internal.h"
+
+#define HOST_SIM_ESP_TIMER_MAX_TIMERS (32) ///< Maximum number of timers
+#define HOST_SIM_ESP_TIMER_NOT_ARMED (INT64_MAX) ///< Expiry time of timers that are not armed
+
+/// @brief Simulated timer.
+struct esp_timer
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t expiry_us; ///< Time at which the timer fires, HOST_SIM_ESP_TIMER_NOT_ARMED if not armed
+    uint64_t period_us; ///< Period of periodic timers, 0 for one-shot timers
+};
+
+static struct esp_timer *timers[HOST_SIM_ESP_TIMER_MAX_TIMERS];
+static int timers_count = 0;
+static TaskHandle_t esp_timer_task_handle = NULL;
+
+static struct esp_timer *host_sim__esp_timer_next(void)
+{
+    struct esp_timer *next = NULL;
+    for (int i = 0; i < timers_count; i++)
+    {
+        if (timers[i]->expiry_us != HOST_SIM_ESP_TIMER_NOT_ARMED && (next == NULL || timers[i]->expiry_us < next->expiry_us))
+        {
+            next = timers[i];
+        }
+    }
+    return next;
+}
+
+static void host_sim__esp_timer_task(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        struct esp_timer *timer = host_sim__esp_timer_next();
+        if (timer == NULL || timer->expiry_us > esp_timer_get_time())
+        {
+            host_sim__task_notify_take_until(timer == NULL ? INT64_MAX : timer->expiry_us);
+            continue;
+        }
+        if (timer->period_us != 0)
+        {
+            timer->expiry_us += (int64_t)timer->period_us;
+        }
+        else
+        {
+            timer->expiry_us = HOST_SIM_ESP_TIMER_NOT_ARMED;
+        }
+        timer->callback(timer->arg);
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (esp_timer_task_handle == NULL &&
+        xTaskCreate(host_sim__esp_timer_task, "esp_timer", 4096, NULL, 22, &esp_timer_task_handle) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if (timers_count == HOST_SIM_ESP_TIMER_MAX_TIMERS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    struct esp_timer *timer = calloc(1, sizeof(*timer));
+    if (timer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+    timer->expiry_us = HOST_SIM_ESP_TIMER_NOT_ARMED;
+    timers[timers_count++] = timer;
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t host_sim__esp_timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (timer->expiry_us != HOST_SIM_ESP_TIMER_NOT_ARMED)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->expiry_us = esp_timer_get_time() + (int64_t)timeout_us;
+    timer->period_us = period_us;
+    xTaskNotifyGive(esp_timer_task_handle);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return host_sim__esp_timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return host_sim__esp_timer_start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (timer->expiry_us == HOST_SIM_ESP_TIMER_NOT_ARMED)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->expiry_us = HOST_SIM_ESP_TIMER_NOT_ARMED;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (timer->expiry_us != HOST_SIM_ESP_TIMER_NOT_ARMED)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (int i = 0; i < timers_count; i++)
+    {
+        if (timers[i] == timer)
+        {
+            timers[i] = timers[--timers_count];
+            break;
+        }
+    }
+    free(timer);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    return timer != NULL && timer->expiry_us != HOST_SIM_ESP_TIMER_NOT_ARMED;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return host_sim__now_us();
+}
@@ -0,0 +1,92 @@
+/**
+ * @file host_sim_flash.c
+ * @brief Host stub of the partition API and ROM CRC. The feedlog partition is backed by an in-memory NOR flash:
+ * erasing sets the bytes to 0xff and writing can only clear bits, as in the real flash.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#define HOST_SIM_FLASH_SECTOR_SIZE (4096)        ///< Flash sector size (bytes)
+#define HOST_SIM_FEED_LOG_SIZE (64 * 1024)       ///< Size of the feedlog partition, as in partitions.csv (bytes)
+
+static const esp_partition_t feed_log_partition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = (esp_partition_subtype_t)0x40,
+    .address = 0x187000,
+    .size = HOST_SIM_FEED_LOG_SIZE,
+    .erase_size = HOST_SIM_FLASH_SECTOR_SIZE,
+    .label = "feedlog",
+};
+static uint8_t feed_log_flash[HOST_SIM_FEED_LOG_SIZE];
+static bool feed_log_flash_initialized = false;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    if (type != feed_log_partition.type || (subtype != ESP_PARTITION_SUBTYPE_ANY && subtype != feed_log_partition.subtype) ||
+        (label != NULL && strcmp(label, feed_log_partition.label) != 0))
+    {
+        return NULL;
+    }
+    if (!feed_log_flash_initialized)
+    {
+        // a partition never written holds whatever was in the flash, here an erased one
+        memset(feed_log_flash, 0xff, sizeof(feed_log_flash));
+        feed_log_flash_initialized = true;
+    }
+    return &feed_log_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (partition != &feed_log_partition || src_offset + size > partition->size)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dst, &feed_log_flash[src_offset], size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    if (partition != &feed_log_partition || dst_offset + size > partition->size)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+        feed_log_flash[dst_offset + i] &= ((const uint8_t *)src)[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (partition != &feed_log_partition || offset + size > partition->size ||
+        offset % HOST_SIM_FLASH_SECTOR_SIZE || size % HOST_SIM_FLASH_SECTOR_SIZE)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(&feed_log_flash[offset], 0xff, size);
+    return ESP_OK;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
@@ -0,0 +1,487 @@
+/**
+ * @file host_sim_freertos.c
+ * @brief Host stub of the FreeRTOS task API: a cooperative, discrete-event scheduler running in simulated time.
+ *
+ * Each task runs on its own ucontext stack. The highest priority ready task runs until it blocks, then the
+ * next one is picked; when no task is ready the simulated clock jumps to the closest wake-up time. There is no
+ * preemption, so critical sections are no-ops.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "host_sim_internal.h"
+
+#define HOST_SIM_MAX_TASKS (32)               ///< Maximum number of simulated tasks
+#define HOST_SIM_TASK_STACK_SIZE (256 * 1024) ///< Host stack size of each simulated task (bytes)
+#define HOST_SIM_TICK_US (1000000 / configTICK_RATE_HZ) ///< Tick period (us)
+#define HOST_SIM_NO_WAKE_UP (INT64_MAX)       ///< Wake-up time of tasks blocked forever
+
+/// @brief Simulated task states.
+typedef enum
+{
+    host_sim_task_ready,
+    host_sim_task_blocked,
+    host_sim_task_suspended,
+    host_sim_task_deleted,
+} host_sim_task_state_t;
+
+/// @brief Simulated queue, a ring of length items of item_size bytes.
+struct host_sim_queue
+{
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count; ///< Number of items in the queue
+    UBaseType_t head;  ///< Index of the oldest item
+};
+
+/// @brief Simulated task.
+struct host_sim_task
+{
+    char name[32];
+    TaskFunction_t task_code;
+    void *params;
+    UBaseType_t priority;
+    host_sim_task_state_t state;
+    int64_t wake_up_us;      ///< Time at which a blocked task becomes ready again
+    uint8_t waiting_notify;  ///< Task is blocked on ulTaskNotifyTake
+    struct host_sim_queue *waiting_queue; ///< Queue the task is blocked on (to send or receive), NULL if none
+    uint32_t notify_count;   ///< Notification value, used as a counting semaphore
+    uint64_t sequence;       ///< Round-robin order among tasks of the same priority
+    ucontext_t context;
+    void *stack;
+};
+
+static struct host_sim_task tasks[HOST_SIM_MAX_TASKS];
+static int tasks_count = 0;
+static struct host_sim_task *current_task = NULL; ///< Running task, NULL when running the simulation's main code
+static ucontext_t scheduler_context;
+static int64_t now_us = 0;
+static uint64_t sequence = 0;
+
+int64_t host_sim__now_us(void)
+{
+    return now_us;
+}
+
+static void host_sim__task_entry(void)
+{
+    current_task->task_code(current_task->params);
+    // FreeRTOS tasks must not return, but be lenient and treat it as a self-delete
+    vTaskDelete(NULL);
+}
+
+static void host_sim__make_ready(struct host_sim_task *task)
+{
+    task->state = host_sim_task_ready;
+    task->waiting_notify = 0;
+    task->waiting_queue = NULL;
+    task->wake_up_us = HOST_SIM_NO_WAKE_UP;
+    task->sequence = sequence++;
+}
+
+/**
+ * @brief Give control back to the scheduler. Must only be called from a simulated task.
+ */
+static void host_sim__yield(void)
+{
+    struct host_sim_task *task = current_task;
+    swapcontext(&task->context, &scheduler_context);
+}
+
+/**
+ * @brief Block the running task until the given time. If called from the simulation's main code, the simulation
+ * runs until that time instead.
+ */
+static void host_sim__block_until(int64_t wake_up_us, uint8_t waiting_notify)
+{
+    if (current_task == NULL)
+    {
+        if (wake_up_us != HOST_SIM_NO_WAKE_UP)
+        {
+            host_sim__run_until(wake_up_us);
+        }
+        return;
+    }
+    current_task->state = host_sim_task_blocked;
+    current_task->wake_up_us = wake_up_us;
+    current_task->waiting_notify = waiting_notify;
+    host_sim__yield();
+}
+
+static struct host_sim_task *host_sim__next_ready_task(void)
+{
+    struct host_sim_task *next = NULL;
+    for (int i = 0; i < tasks_count; i++)
+    {
+        struct host_sim_task *task = &tasks[i];
+        if (task->state == host_sim_task_blocked && task->wake_up_us <= now_us)
+        {
+            host_sim__make_ready(task);
+        }
+        if (task->state == host_sim_task_ready &&
+            (next == NULL || task->priority > next->priority ||
+             (task->priority == next->priority && task->sequence < next->sequence)))
+        {
+            next = task;
+        }
+    }
+    return next;
+}
+
+void host_sim__run_until(int64_t time_us)
+{
+    if (current_task != NULL)
+    {
+        fprintf(stderr, "host_sim__run_until called from simulated task %s\n", current_task->name);
+        abort();
+    }
+    for (;;)
+    {
+        struct host_sim_task *task = host_sim__next_ready_task();
+        if (task != NULL)
+        {
+            current_task = task;
+            swapcontext(&scheduler_context, &task->context);
+            current_task = NULL;
+            if (task->state == host_sim_task_deleted && task->stack != NULL)
+            {
+                free(task->stack);
+                task->stack = NULL;
+            }
+            continue;
+        }
+
+        int64_t next_wake_up_us = HOST_SIM_NO_WAKE_UP;
+        for (int i = 0; i < tasks_count; i++)
+        {
+            if (tasks[i].state == host_sim_task_blocked && tasks[i].wake_up_us < next_wake_up_us)
+            {
+                next_wake_up_us = tasks[i].wake_up_us;
+            }
+        }
+        if (next_wake_up_us > time_us)
+        {
+            if (now_us < time_us)
+            {
+                now_us = time_us;
+            }
+            return;
+        }
+        now_us = next_wake_up_us;
+    }
+}
+
+void host_sim__run_for(int64_t duration_us)
+{
+    host_sim__run_until(now_us + duration_us);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char *name, uint32_t stack_depth, void *params,
+                       UBaseType_t priority, TaskHandle_t *created_task)
+{
+    (void)stack_depth;
+    if (tasks_count == HOST_SIM_MAX_TASKS)
+    {
+        return pdFAIL;
+    }
+    struct host_sim_task *task = &tasks[tasks_count];
+    memset(task, 0, sizeof(*task));
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    task->task_code = task_code;
+    task->params = params;
+    task->priority = priority;
+    task->stack = malloc(HOST_SIM_TASK_STACK_SIZE);
+    if (task->stack == NULL)
+    {
+        return pdFAIL;
+    }
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack;
+    task->context.uc_stack.ss_size = HOST_SIM_TASK_STACK_SIZE;
+    task->context.uc_link = &scheduler_context;
+    makecontext(&task->context, host_sim__task_entry, 0);
+    host_sim__make_ready(task);
+    tasks_count++;
+    if (created_task != NULL)
+    {
+        *created_task = task;
+    }
+    if (current_task == NULL)
+    {
+        /* The simulation's main code stands for app_main, the lowest priority task, so the new task preempts it
+         * and runs until it blocks, like it does on the target.
+         */
+        host_sim__run_until(now_us);
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char *name, uint32_t stack_depth, void *params,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    (void)core_id;
+    return xTaskCreate(task_code, name, stack_depth, params, priority, created_task);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL)
+    {
+        task = current_task;
+    }
+    if (task == NULL)
+    {
+        return;
+    }
+    task->state = host_sim_task_deleted;
+    if (task == current_task)
+    {
+        host_sim__yield();
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    int64_t tick_start_us = (now_us / HOST_SIM_TICK_US) * HOST_SIM_TICK_US;
+    host_sim__block_until(tick_start_us + (int64_t)ticks * HOST_SIM_TICK_US, 0);
+}
+
+void vTaskSuspend(TaskHandle_t task)
+{
+    if (task == NULL)
+    {
+        task = current_task;
+    }
+    if (task == NULL)
+    {
+        return;
+    }
+    task->state = host_sim_task_suspended;
+    task->waiting_notify = 0;
+    if (task == current_task)
+    {
+        host_sim__yield();
+    }
+}
+
+void vTaskResume(TaskHandle_t task)
+{
+    if (task != NULL && task->state == host_sim_task_suspended)
+    {
+        host_sim__make_ready(task);
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(now_us / HOST_SIM_TICK_US);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current_task;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait)
+{
+    struct host_sim_task *task = current_task;
+    if (task == NULL)
+    {
+        return 0;
+    }
+    if (task->notify_count == 0 && ticks_to_wait != 0)
+    {
+        int64_t wake_up_us = (ticks_to_wait == portMAX_DELAY) ? HOST_SIM_NO_WAKE_UP
+                                                              : now_us + (int64_t)ticks_to_wait * HOST_SIM_TICK_US;
+        host_sim__block_until(wake_up_us, 1);
+    }
+    uint32_t count = task->notify_count;
+    if (count != 0)
+    {
+        task->notify_count = clear_count_on_exit ? 0 : count - 1;
+    }
+    return count;
+}
+
+uint32_t host_sim__task_notify_take_until(int64_t wake_up_us)
+{
+    struct host_sim_task *task = current_task;
+    if (task == NULL)
+    {
+        return 0;
+    }
+    if (task->notify_count == 0 && wake_up_us > now_us)
+    {
+        host_sim__block_until(wake_up_us, 1);
+    }
+    uint32_t count = task->notify_count;
+    task->notify_count = 0;
+    return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    task->notify_count++;
+    if (task->state == host_sim_task_blocked && task->waiting_notify)
+    {
+        host_sim__make_ready(task);
+    }
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken)
+{
+    xTaskNotifyGive(task);
+    if (higher_priority_task_woken != NULL)
+    {
+        *higher_priority_task_woken = pdTRUE;
+    }
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct host_sim_queue *queue = calloc(1, sizeof(*queue));
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+    queue->items = calloc(length, item_size ? item_size : 1);
+    if (queue->items == NULL)
+    {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+/**
+ * @brief Make ready the tasks blocked on a queue, which check again if they can send or receive.
+ */
+static void host_sim__queue_wake_waiters(struct host_sim_queue *queue)
+{
+    for (int i = 0; i < tasks_count; i++)
+    {
+        if (tasks[i].state == host_sim_task_blocked && tasks[i].waiting_queue == queue)
+        {
+            host_sim__make_ready(&tasks[i]);
+        }
+    }
+}
+
+/**
+ * @brief Block the running task on a queue until it is woken by host_sim__queue_wake_waiters or the given time.
+ *
+ * @return uint8_t 0 if the time was reached (or if not called from a simulated task), 1 otherwise.
+ */
+static uint8_t host_sim__queue_wait(struct host_sim_queue *queue, int64_t wake_up_us)
+{
+    if (current_task == NULL || now_us >= wake_up_us)
+    {
+        return 0;
+    }
+    current_task->state = host_sim_task_blocked;
+    current_task->wake_up_us = wake_up_us;
+    current_task->waiting_queue = queue;
+    host_sim__yield();
+    return 1;
+}
+
+static int64_t host_sim__ticks_to_wake_up_us(TickType_t ticks_to_wait)
+{
+    return (ticks_to_wait == portMAX_DELAY) ? HOST_SIM_NO_WAKE_UP : now_us + (int64_t)ticks_to_wait * HOST_SIM_TICK_US;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    int64_t wake_up_us = host_sim__ticks_to_wake_up_us(ticks_to_wait);
+    while (queue->count == queue->length)
+    {
+        if (!host_sim__queue_wait(queue, wake_up_us))
+        {
+            return pdFALSE;
+        }
+    }
+    memcpy(&queue->items[((queue->head + queue->count) % queue->length) * queue->item_size], item, queue->item_size);
+    queue->count++;
+    host_sim__queue_wake_waiters(queue);
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higher_priority_task_woken)
+{
+    if (higher_priority_task_woken != NULL)
+    {
+        *higher_priority_task_woken = pdTRUE;
+    }
+    if (queue->count == queue->length)
+    {
+        return pdFALSE;
+    }
+    memcpy(&queue->items[((queue->head + queue->count) % queue->length) * queue->item_size], item, queue->item_size);
+    queue->count++;
+    host_sim__queue_wake_waiters(queue);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    int64_t wake_up_us = host_sim__ticks_to_wake_up_us(ticks_to_wait);
+    while (queue->count == 0)
+    {
+        if (!host_sim__queue_wait(queue, wake_up_us))
+        {
+            return pdFALSE;
+        }
+    }
+    memcpy(buffer, &queue->items[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    host_sim__queue_wake_waiters(queue);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t semaphore = xQueueCreate(1, 0);
+    if (semaphore != NULL)
+    {
+        semaphore->count = 1;
+    }
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    // created empty, as in FreeRTOS
+    return xQueueCreate(1, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    uint8_t item;
+    return xQueueReceive(semaphore, &item, ticks_to_wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    uint8_t item = 0;
+    return xQueueSend(semaphore, &item, 0);
+}
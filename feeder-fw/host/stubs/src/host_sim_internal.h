@@ -0,0 +1,47 @@
+/**
+ * @file host_sim_internal.h
+ * @brief Functions shared between the host stubs, not part of the simulated ESP-IDF and FreeRTOS APIs.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "host_sim.h"
+
+/**
+ * @brief Block the running task until it is notified or until the given simulated time, whichever comes first,
+ * like ulTaskNotifyTake(pdTRUE, ...) with a microsecond resolution timeout.
+ *
+ * @param wake_up_us Simulated time at which the task is woken up if not notified before (us), INT64_MAX to wait
+ * forever.
+ * @return uint32_t Notification count before it was cleared.
+ */
+uint32_t host_sim__task_notify_take_until(int64_t wake_up_us);
+
+/* Simulated BT controller scan (host_sim_ble_controller.c), driven by the stubs of the BLE host stacks. MACs are in
+ * the order they are printed, most significant byte first.
+ */
+#define HOST_SIM_BLE_WHITELIST_SIZE (12) ///< Number of addresses that fit in the controller whitelist (ESP32 default)
+#define HOST_SIM_BLE_ADDR_PUBLIC (0)     ///< Whitelist address type of the public addresses
+#define HOST_SIM_BLE_ADDR_RANDOM (1)     ///< Whitelist address type of the random addresses
+
+void host_sim__ble_ctrl_set_scan_params(uint16_t interval, uint16_t window, bool use_whitelist);
+void host_sim__ble_ctrl_set_scanning(bool scan);
+bool host_sim__ble_ctrl_whitelist_in_use(void);
+bool host_sim__ble_ctrl_whitelist_add(const uint8_t bda[6], uint8_t addr_type);
+void host_sim__ble_ctrl_whitelist_remove(const uint8_t bda[6], uint8_t addr_type);
+void host_sim__ble_ctrl_whitelist_clear(void);
+
+/**
+ * @brief Check if the controller receives an advertisement: the scan is on, in its window, and the whitelist lets
+ * the advertiser through if it is in use.
+ *
+ * @param bda Advertiser's MAC address.
+ * @return host_sim_ble_adv_result_t host_sim_ble_adv_received if it is received, the reason it is not otherwise.
+ */
+host_sim_ble_adv_result_t host_sim__ble_ctrl_receive(const uint8_t bda[6]);
@@ -0,0 +1,190 @@
+/**
+ * @file host_sim_nimble.c
+ * @brief Host stub of the NimBLE host. The porting layer events are run by a simulated NimBLE host task, which
+ * syncs with the controller when it starts. As in NimBLE, the discovery starts and stops synchronously, the
+ * whitelist is set with HCI commands that the controller rejects while the whitelist is in use, and advertisements
+ * are delivered by the simulation's main code with host_sim__ble_deliver_adv, through the simulated controller scan
+ * (see host_sim_ble_controller.c). The only HCI command supported by ble_hs_hci_cmd_tx is LE Read Filter Accept List
+ * Size.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "host/ble_hs.h"
+#include "host_sim_internal.h"
+
+#define HOST_SIM_NIMBLE_EVENTQ_SIZE (16)     ///< Maximum number of pending porting layer events
+#define HOST_SIM_NIMBLE_ADV_DATA_LEN_MAX (31) ///< Maximum legacy advertising data length
+
+int ble_hs_hci_cmd_tx(uint16_t opcode, const void *cmd, uint8_t cmd_len, void *rsp, uint8_t rsp_len);
+
+struct ble_hs_cfg ble_hs_cfg;
+
+static QueueHandle_t eventq = NULL;
+static ble_gap_event_fn *disc_cb = NULL;
+static void *disc_cb_arg = NULL;
+
+static void host_sim__nimble_reverse_mac(uint8_t dst[6], const uint8_t src[6])
+{
+    for (int i = 0; i < 6; i++)
+    {
+        dst[i] = src[5 - i];
+    }
+}
+
+esp_err_t nimble_port_init(void)
+{
+    if (eventq == NULL)
+    {
+        eventq = xQueueCreate(HOST_SIM_NIMBLE_EVENTQ_SIZE, sizeof(struct ble_npl_event *));
+    }
+    return (eventq != NULL) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void nimble_port_run(void)
+{
+    struct ble_npl_event *ev;
+
+    if (ble_hs_cfg.sync_cb != NULL)
+    {
+        ble_hs_cfg.sync_cb();
+    }
+    for (;;)
+    {
+        xQueueReceive(eventq, &ev, portMAX_DELAY);
+        ev->queued = false;
+        ev->fn(ev);
+    }
+}
+
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void)
+{
+    return (struct ble_npl_eventq *)eventq;
+}
+
+void nimble_port_freertos_init(TaskFunction_t host_task_fn)
+{
+    xTaskCreate(host_task_fn, "nimble_host", 4096, NULL, 21, NULL);
+}
+
+void nimble_port_freertos_deinit(void)
+{
+}
+
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg)
+{
+    ev->queued = false;
+    ev->fn = fn;
+    ev->arg = arg;
+}
+
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev)
+{
+    // as in NimBLE, an event already queued is not queued again
+    if (!ev->queued)
+    {
+        ev->queued = true;
+        xQueueSend((QueueHandle_t)evq, &ev, portMAX_DELAY);
+    }
+}
+
+int ble_gap_disc(uint8_t own_addr_type, int32_t duration_ms, const struct ble_gap_disc_params *disc_params,
+                 ble_gap_event_fn *cb, void *cb_arg)
+{
+    (void)own_addr_type;
+    (void)duration_ms;
+    if (host_sim__ble_is_scanning())
+    {
+        return BLE_HS_EALREADY;
+    }
+    host_sim__ble_ctrl_set_scan_params(disc_params->itvl, disc_params->window,
+                                       disc_params->filter_policy == BLE_HCI_SCAN_FILT_USE_WL);
+    disc_cb = cb;
+    disc_cb_arg = cb_arg;
+    host_sim__ble_ctrl_set_scanning(true);
+    return 0;
+}
+
+int ble_gap_disc_cancel(void)
+{
+    if (!host_sim__ble_is_scanning())
+    {
+        return BLE_HS_EALREADY;
+    }
+    host_sim__ble_ctrl_set_scanning(false);
+    return 0;
+}
+
+int ble_gap_wl_set(const ble_addr_t *addrs, uint8_t white_list_count)
+{
+    uint8_t bda[6];
+
+    if (white_list_count == 0)
+    {
+        return BLE_HS_EINVAL;
+    }
+    if (host_sim__ble_ctrl_whitelist_in_use())
+    {
+        return BLE_HS_HCI_ERR(BLE_ERR_CMD_DISALLOWED);
+    }
+    host_sim__ble_ctrl_whitelist_clear();
+    for (uint8_t i = 0; i < white_list_count; i++)
+    {
+        host_sim__nimble_reverse_mac(bda, addrs[i].val);
+        if (!host_sim__ble_ctrl_whitelist_add(bda, addrs[i].type))
+        {
+            return BLE_HS_HCI_ERR(BLE_ERR_MEM_CAPACITY);
+        }
+    }
+    return 0;
+}
+
+int ble_hs_hci_cmd_tx(uint16_t opcode, const void *cmd, uint8_t cmd_len, void *rsp, uint8_t rsp_len)
+{
+    (void)cmd;
+    (void)cmd_len;
+    if (opcode != BLE_HCI_OP(BLE_HCI_OGF_LE, BLE_HCI_OCF_LE_RD_WHITE_LIST_SIZE) ||
+        rsp_len != sizeof(struct ble_hci_le_rd_white_list_rp))
+    {
+        return BLE_HS_ENOTSUP;
+    }
+    ((struct ble_hci_le_rd_white_list_rp *)rsp)->size = HOST_SIM_BLE_WHITELIST_SIZE;
+    return 0;
+}
+
+host_sim_ble_adv_result_t host_sim__ble_deliver_adv(const uint8_t bda[6], int rssi, const uint8_t *adv, uint8_t adv_len)
+{
+    struct ble_gap_event event;
+
+    if (disc_cb == NULL)
+    {
+        return host_sim_ble_adv_not_scanning;
+    }
+    host_sim_ble_adv_result_t result = host_sim__ble_ctrl_receive(bda);
+    if (result != host_sim_ble_adv_received)
+    {
+        return result;
+    }
+    if (adv_len > HOST_SIM_NIMBLE_ADV_DATA_LEN_MAX)
+    {
+        adv_len = HOST_SIM_NIMBLE_ADV_DATA_LEN_MAX;
+    }
+    memset(&event, 0, sizeof(event));
+    event.type = BLE_GAP_EVENT_DISC;
+    event.disc.event_type = BLE_HCI_ADV_RPT_EVTYPE_NONCONN_IND;
+    event.disc.addr.type = BLE_ADDR_PUBLIC;
+    host_sim__nimble_reverse_mac(event.disc.addr.val, bda);
+    event.disc.rssi = (int8_t)rssi;
+    event.disc.data = adv;
+    event.disc.length_data = adv_len;
+    disc_cb(&event, disc_cb_arg);
+    return host_sim_ble_adv_received;
+}
@@ -0,0 +1,167 @@
+/**
+ * @file host_sim_nvs.c
+ * @brief Host stub of NVS, backed by an in-memory key-value store. Writes are visible to reads right away, like
+ * in NVS, and nothing survives the end of the simulation.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvs_flash.h"
+
+#define HOST_SIM_NVS_MAX_ENTRIES (64)     ///< Maximum number of keys in the store
+#define HOST_SIM_NVS_MAX_NAMESPACES (8)   ///< Maximum number of namespaces
+#define HOST_SIM_NVS_NAME_LEN (16)        ///< Maximum namespace and key length (including terminator), as in NVS
+
+/// @brief Key-value entry.
+typedef struct
+{
+    uint32_t namespace_index;
+    char key[HOST_SIM_NVS_NAME_LEN];
+    void *value;
+    size_t length;
+} host_sim_nvs_entry_t;
+
+static bool initialized = false;
+static char namespaces[HOST_SIM_NVS_MAX_NAMESPACES][HOST_SIM_NVS_NAME_LEN];
+static uint32_t namespaces_count = 0;
+static host_sim_nvs_entry_t entries[HOST_SIM_NVS_MAX_ENTRIES];
+
+static host_sim_nvs_entry_t *host_sim__nvs_find(nvs_handle_t handle, const char *key)
+{
+    for (int i = 0; i < HOST_SIM_NVS_MAX_ENTRIES; i++)
+    {
+        if (entries[i].value != NULL && entries[i].namespace_index == handle && strcmp(entries[i].key, key) == 0)
+        {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    for (int i = 0; i < HOST_SIM_NVS_MAX_ENTRIES; i++)
+    {
+        free(entries[i].value);
+        entries[i].value = NULL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    (void)open_mode;
+    if (!initialized)
+    {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (strlen(namespace_name) >= HOST_SIM_NVS_NAME_LEN)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (uint32_t i = 0; i < namespaces_count; i++)
+    {
+        if (strcmp(namespaces[i], namespace_name) == 0)
+        {
+            *out_handle = i;
+            return ESP_OK;
+        }
+    }
+    if (namespaces_count == HOST_SIM_NVS_MAX_NAMESPACES)
+    {
+        return ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+    strcpy(namespaces[namespaces_count], namespace_name);
+    *out_handle = namespaces_count++;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void)handle;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void)handle;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    if (strlen(key) >= HOST_SIM_NVS_NAME_LEN)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    host_sim_nvs_entry_t *entry = host_sim__nvs_find(handle, key);
+    if (entry == NULL)
+    {
+        for (int i = 0; i < HOST_SIM_NVS_MAX_ENTRIES && entry == NULL; i++)
+        {
+            if (entries[i].value == NULL)
+            {
+                entry = &entries[i];
+            }
+        }
+        if (entry == NULL)
+        {
+            return ESP_ERR_NVS_NO_FREE_PAGES;
+        }
+        entry->namespace_index = handle;
+        strcpy(entry->key, key);
+    }
+    void *copy = malloc(length > 0 ? length : 1);
+    if (copy == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(copy, value, length);
+    free(entry->value);
+    entry->value = copy;
+    entry->length = length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    host_sim_nvs_entry_t *entry = host_sim__nvs_find(handle, key);
+    if (entry == NULL)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value == NULL)
+    {
+        *length = entry->length;
+        return ESP_OK;
+    }
+    if (*length < entry->length)
+    {
+        *length = entry->length;
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out_value, entry->value, entry->length);
+    *length = entry->length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    host_sim_nvs_entry_t *entry = host_sim__nvs_find(handle, key);
+    if (entry == NULL)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    free(entry->value);
+    entry->value = NULL;
+    return ESP_OK;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file adv_test.c
+ * @brief Unit test of the advertising data parser of app_beacon: decoding of the Eddystone-TLM, Eddystone-UID and
+ * iBeacon frames, and the walk of the AD structures, which must stop at a malformed structure.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <string.h>
+
+#include "app_beacon_adv.h"
+#include "host_test.h"
+
+static const uint8_t tlm_adv[] = {
+    0x02, 0x01, 0x06, 0x03, 0x03, 0xaa, 0xfe, 0x11, 0x16, 0xaa, 0xfe, 0x20, 0x00,
+    0x0b, 0xb8, 0x19, 0x80, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x01, 0x00,
+}; ///< Eddystone-TLM advertisement (3000 mV, 25.5 degrees Celsius, 16 advertisements, 25.6 s), as in feeder_sim.c
+static const uint8_t uid_adv[] = {
+    0x02, 0x01, 0x06, 0x03, 0x03, 0xaa, 0xfe, 0x17, 0x16, 0xaa, 0xfe, 0x00, 0xeb, 0x00, 0x01, 0x02, 0x03, 0x04,
+    0x05, 0x06, 0x07, 0x08, 0x09, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x00, 0x00,
+}; ///< Eddystone-UID advertisement (-21 dBm at 0 m), with the reserved bytes
+static const uint8_t ibeacon_adv[] = {
+    0x02, 0x01, 0x06, 0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15, 0xf7, 0x82, 0x6d, 0xa6, 0x4f, 0xa2, 0x4e, 0x98,
+    0x80, 0x24, 0xbc, 0x5b, 0x71, 0xe0, 0x89, 0x3e, 0x12, 0x34, 0x56, 0x78, 0xc5,
+}; ///< iBeacon advertisement (major 0x1234, minor 0x5678, -59 dBm at 1 m)
+
+int main(void)
+{
+    app_beacon_frame_t frame;
+    uint8_t adv[64];
+
+    HOST_TEST_CHECK(app_beacon_adv__parse(tlm_adv, sizeof(tlm_adv), &frame) == 1);
+    HOST_TEST_CHECK(frame.type == app_beacon_frame_eddystone_tlm);
+    HOST_TEST_CHECK(frame.tlm.version == 0 && frame.tlm.battery_mv == 3000 && frame.tlm.temp_q8 == 0x1980);
+    HOST_TEST_CHECK(frame.tlm.adv_count == 0x10 && frame.tlm.uptime_ds == 0x100);
+
+    HOST_TEST_CHECK(app_beacon_adv__parse(uid_adv, sizeof(uid_adv), &frame) == 1);
+    HOST_TEST_CHECK(frame.type == app_beacon_frame_eddystone_uid);
+    HOST_TEST_CHECK(frame.uid.tx_power == -21);
+    HOST_TEST_CHECK(memcmp(frame.uid.namespace_id, &uid_adv[13], sizeof(frame.uid.namespace_id)) == 0);
+    HOST_TEST_CHECK(memcmp(frame.uid.instance_id, &uid_adv[23], sizeof(frame.uid.instance_id)) == 0);
+
+    HOST_TEST_CHECK(app_beacon_adv__parse(ibeacon_adv, sizeof(ibeacon_adv), &frame) == 1);
+    HOST_TEST_CHECK(frame.type == app_beacon_frame_ibeacon);
+    HOST_TEST_CHECK(memcmp(frame.ibeacon.uuid, &ibeacon_adv[9], sizeof(frame.ibeacon.uuid)) == 0);
+    HOST_TEST_CHECK(frame.ibeacon.major == 0x1234 && frame.ibeacon.minor == 0x5678 && frame.ibeacon.tx_power == -59);
+
+    // a frame truncated by the advertisement length is not decoded
+    for (uint8_t len = 0; len < sizeof(tlm_adv); len++)
+    {
+        HOST_TEST_CHECK(app_beacon_adv__parse(tlm_adv, len, &frame) == 0);
+        HOST_TEST_CHECK(frame.type == app_beacon_frame_none);
+    }
+
+    // an AD structure of zero length ends the walk
+    memcpy(adv, tlm_adv, sizeof(tlm_adv));
+    adv[3] = 0x00;
+    HOST_TEST_CHECK(app_beacon_adv__parse(adv, sizeof(tlm_adv), &frame) == 0);
+
+    // an AD structure longer than the advertisement ends the walk
+    memcpy(adv, tlm_adv, sizeof(tlm_adv));
+    adv[3] = 0x30;
+    HOST_TEST_CHECK(app_beacon_adv__parse(adv, sizeof(tlm_adv), &frame) == 0);
+
+    // an encrypted TLM, an unknown Eddystone frame and non-iBeacon manufacturer data are not decoded
+    memcpy(adv, tlm_adv, sizeof(tlm_adv));
+    adv[12] = 0x01;
+    HOST_TEST_CHECK(app_beacon_adv__parse(adv, sizeof(tlm_adv), &frame) == 0);
+    memcpy(adv, tlm_adv, sizeof(tlm_adv));
+    adv[11] = 0x10;
+    HOST_TEST_CHECK(app_beacon_adv__parse(adv, sizeof(tlm_adv), &frame) == 0);
+    memcpy(adv, ibeacon_adv, sizeof(ibeacon_adv));
+    adv[5] = 0x59;
+    HOST_TEST_CHECK(app_beacon_adv__parse(adv, sizeof(ibeacon_adv), &frame) == 0);
+
+    // the frame is found after other AD structures, here a complete local name
+    static const uint8_t name[] = {0x05, 0x09, 'P', 'e', 't', '1'};
+    memcpy(adv, name, sizeof(name));
+    memcpy(&adv[sizeof(name)], ibeacon_adv, sizeof(ibeacon_adv));
+    HOST_TEST_CHECK(app_beacon_adv__parse(adv, sizeof(name) + sizeof(ibeacon_adv), &frame) == 1);
+    HOST_TEST_CHECK(frame.type == app_beacon_frame_ibeacon && frame.ibeacon.minor == 0x5678);
+
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,155 @@
+/**
+ * @file feed_log_test.c
+ * @brief Unit test of the recovery of the feeding log after a boot. The feedlog partition of the simulated flash
+ * is written as a previous boot left it, then app_feed_log__init must find the head of the log and continue the
+ * sequence and boot numbers from its last valid record. The flash state is given by the scenario argument:
+ *   - empty: never written, the log starts at sequence and boot 1.
+ *   - wrapped: every sector written, the head in the first sector and the oldest records in the second one.
+ *   - torn: a write torn by a power cut after the last record, with its sequence number still erased.
+ *   - corrupt: no valid first record in any sector, the partition is erased and the log starts over.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "app_event.h"
+#include "app_feed_log.h"
+#include "host_test.h"
+
+#define TEST_SECTOR_SIZE (4096)                                                    ///< Flash sector size (bytes)
+#define TEST_RECORDS_PER_SECTOR (TEST_SECTOR_SIZE / sizeof(app_feed_log_record_t)) ///< Number of records in a sector
+#define TEST_BOOT (5)                                                              ///< Boot number of the records written before the test boot
+
+static const esp_partition_t *partition = NULL; ///< Feeding log partition
+
+/**
+ * @brief Write a valid record, as app_feed_log does.
+ *
+ * @param sector Sector.
+ * @param slot Record slot in the sector.
+ * @param seq Sequence number.
+ */
+static void feed_log_test__write_record(uint32_t sector, uint32_t slot, uint32_t seq)
+{
+    app_feed_log_record_t record = {
+        .seq = seq,
+        .boot = TEST_BOOT,
+        .event = app_feed_log_event_lid_open,
+        .time_ms = seq * 1000,
+    };
+    record.crc = esp_rom_crc32_le(0, (const uint8_t *)&record, offsetof(app_feed_log_record_t, crc));
+    HOST_TEST_CHECK(esp_partition_write(partition, sector * TEST_SECTOR_SIZE + slot * sizeof(record), &record, sizeof(record)) == ESP_OK);
+}
+
+/**
+ * @brief Check the records read from a sequence number on.
+ *
+ * @param from_seq Sequence number of the first record to be read.
+ * @param first_seq Sequence number expected of the first record read.
+ * @param count Number of records expected, the last one the boot record of the test.
+ */
+static void feed_log_test__check_read(uint32_t from_seq, uint32_t first_seq, size_t count)
+{
+    app_feed_log_record_t records[16];
+    size_t max = sizeof(records) / sizeof(records[0]);
+    size_t read_count = app_feed_log__read(from_seq, records, max);
+
+    HOST_TEST_CHECK(read_count == ((count < max) ? count : max));
+    for (size_t i = 0; i < read_count; i++)
+    {
+        HOST_TEST_CHECK(records[i].seq == first_seq + i);
+    }
+    if (count <= max && read_count == count && count > 0)
+    {
+        HOST_TEST_CHECK(records[count - 1].event == app_feed_log_event_boot);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *scenario = (argc == 2) ? argv[1] : "";
+    uint32_t boot_seq;
+    uint16_t boot_boot = TEST_BOOT + 1;
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "feedlog");
+    HOST_TEST_CHECK(partition != NULL);
+    if (partition == NULL)
+    {
+        return HOST_TEST_RESULT();
+    }
+    uint32_t sectors = partition->size / TEST_SECTOR_SIZE;
+
+    if (strcmp(scenario, "empty") == 0)
+    {
+        boot_seq = 1;
+        boot_boot = 1;
+    }
+    else if (strcmp(scenario, "wrapped") == 0)
+    {
+        // sectors 1 to the last one full, from sequence number 1000 on, then the head sector 0 with 10 records
+        uint32_t seq = 1000;
+        for (uint32_t sector = 1; sector <= sectors; sector++)
+        {
+            uint32_t slots = (sector < sectors) ? TEST_RECORDS_PER_SECTOR : 10;
+            for (uint32_t slot = 0; slot < slots; slot++)
+            {
+                feed_log_test__write_record(sector % sectors, slot, seq++);
+            }
+        }
+        boot_seq = seq;
+    }
+    else if (strcmp(scenario, "torn") == 0)
+    {
+        for (uint32_t slot = 0; slot < 5; slot++)
+        {
+            feed_log_test__write_record(0, slot, slot + 1);
+        }
+        // the write of slot 5 was torn after programming a few bytes following the sequence number
+        static const uint8_t torn[8] = {0x05, 0x00, 0x01, 0x00, 0x12, 0x34, 0x00, 0x00};
+        HOST_TEST_CHECK(esp_partition_write(partition, 5 * sizeof(app_feed_log_record_t) + sizeof(uint32_t), torn, sizeof(torn)) == ESP_OK);
+        boot_seq = 6;
+    }
+    else if (strcmp(scenario, "corrupt") == 0)
+    {
+        // a first record whose CRC does not match, e.g. written by another firmware
+        static const uint8_t garbage[sizeof(app_feed_log_record_t)] = {0x01, 0x00, 0x00, 0x00, 0x55, 0xaa};
+        HOST_TEST_CHECK(esp_partition_write(partition, 0, garbage, sizeof(garbage)) == ESP_OK);
+        boot_seq = 1;
+        boot_boot = 1;
+    }
+    else
+    {
+        fprintf(stderr, "Usage: %s <empty|wrapped|torn|corrupt>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    HOST_TEST_CHECK(app_event__init() == ESP_OK);
+    HOST_TEST_CHECK(app_feed_log__init() == ESP_OK);
+    HOST_TEST_CHECK(app_feed_log__flush() == ESP_OK);
+
+    // the boot record continues the log
+    app_feed_log_record_t record;
+    HOST_TEST_CHECK(app_feed_log__read(boot_seq, &record, 1) == 1);
+    HOST_TEST_CHECK(record.seq == boot_seq && record.boot == boot_boot && record.event == app_feed_log_event_boot);
+    HOST_TEST_CHECK(app_feed_log__read(boot_seq + 1, &record, 1) == 0);
+
+    if (strcmp(scenario, "wrapped") == 0)
+    {
+        // the oldest records are the ones of the sector after the head
+        feed_log_test__check_read(0, 1000, (sectors - 1) * TEST_RECORDS_PER_SECTOR + 11);
+        feed_log_test__check_read(boot_seq - 10, boot_seq - 10, 11);
+    }
+    else
+    {
+        // the records before the boot one, the torn slot being skipped
+        feed_log_test__check_read(0, 1, boot_seq);
+    }
+
+    return HOST_TEST_RESULT();
+}
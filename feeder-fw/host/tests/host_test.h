@@ -0,0 +1,29 @@
+/**
+ * @file host_test.h
+ * @brief Checks of the host unit tests. A failed check is printed with its location and the test goes on, so that
+ * one run reports every failure; main returns HOST_TEST_RESULT() for ctest.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int host_test_failures = 0; ///< Number of failed checks
+
+/// Check condition, printing it with its location if it is false.
+#define HOST_TEST_CHECK(condition)                                                \
+    do                                                                            \
+    {                                                                             \
+        if (!(condition))                                                         \
+        {                                                                         \
+            fprintf(stderr, "%s:%d: FAIL: %s\n", __FILE__, __LINE__, #condition); \
+            host_test_failures++;                                                 \
+        }                                                                         \
+    } while (0)
+
+/// Exit status of the test: EXIT_SUCCESS if every check passed.
+#define HOST_TEST_RESULT() ((host_test_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE)
@@ -0,0 +1,150 @@
+/**
+ * @file json_writer_test.c
+ * @brief Unit test of the streaming JSON writer of app_web_server. The HTTP response functions of the stub are
+ * implemented here: the chunks sent are captured, so that the document can be compared as a whole and the writes
+ * counted, and a send error can be injected.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <string.h>
+
+#include "app_web_server_json.h"
+#include "host_test.h"
+
+#define TEST_RESPONSE_MAX_LEN (4096) ///< Maximum length of a captured response (bytes)
+
+/// @brief Typedef for a response captured by the stub of the HTTP server.
+typedef struct
+{
+    char body[TEST_RESPONSE_MAX_LEN + 1]; ///< Chunks sent, concatenated
+    size_t len;                           ///< Length of the body (bytes)
+    int chunks;                           ///< Number of non-empty chunks sent
+    int ended;                            ///< Number of terminating (empty) chunks sent
+    int fail_at_chunk;                    ///< Non-empty chunk whose send fails (1 is the first one), 0 for none
+    const char *type;                     ///< Content type set
+} test_response_t;
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    ((test_response_t *)r->user_ctx)->type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    test_response_t *response = r->user_ctx;
+
+    if (buf == NULL || buf_len == 0)
+    {
+        response->ended++;
+        return ESP_OK;
+    }
+    HOST_TEST_CHECK(response->ended == 0);
+    HOST_TEST_CHECK(buf_len <= APP_WEB_SERVER_JSON_BUF_SIZE);
+    if (++response->chunks == response->fail_at_chunk)
+    {
+        return ESP_FAIL;
+    }
+    if (response->len + (size_t)buf_len <= TEST_RESPONSE_MAX_LEN)
+    {
+        memcpy(&response->body[response->len], buf, (size_t)buf_len);
+        response->len += (size_t)buf_len;
+        response->body[response->len] = '\0';
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Write a document with every kind of value, nested objects and arrays, and strings to be escaped.
+ *
+ * @param response Captured response.
+ */
+static void json_writer_test__values(test_response_t *response)
+{
+    static const uint8_t mac[6] = {0x50, 0x6c, 0x93, 0x1e, 0x00, 0x01};
+    httpd_req_t req = {.user_ctx = response};
+    app_web_server_json_t json;
+
+    app_web_server_json__begin(&json, &req);
+    app_web_server_json__object_begin(&json, NULL);
+    app_web_server_json__int(&json, "min", INT64_MIN);
+    app_web_server_json__int(&json, "max", INT64_MAX);
+    app_web_server_json__bool(&json, "on", 1);
+    app_web_server_json__bool(&json, "off", 0);
+    app_web_server_json__null(&json, "none");
+    app_web_server_json__string(&json, "str", "a\"b\\c\n\x01\x1f/");
+    app_web_server_json__array_begin(&json, "empty");
+    app_web_server_json__array_end(&json);
+    app_web_server_json__array_begin(&json, "macs");
+    app_web_server_json__mac(&json, NULL, mac);
+    app_web_server_json__object_begin(&json, NULL);
+    app_web_server_json__object_end(&json);
+    app_web_server_json__int(&json, NULL, -1);
+    app_web_server_json__array_end(&json);
+    app_web_server_json__object_end(&json);
+    HOST_TEST_CHECK(app_web_server_json__end(&json) == ESP_OK);
+}
+
+int main(void)
+{
+    static test_response_t response;
+    httpd_req_t req = {.user_ctx = &response};
+    app_web_server_json_t json;
+
+    // values, separators and escaping
+    memset(&response, 0, sizeof(response));
+    json_writer_test__values(&response);
+    HOST_TEST_CHECK(strcmp(response.type, "application/json") == 0);
+    HOST_TEST_CHECK(strcmp(response.body, "{\"min\":-9223372036854775808,\"max\":9223372036854775807,\"on\":true,"
+                                          "\"off\":false,\"none\":null,\"str\":\"a\\\"b\\\\c\\u000a\\u0001\\u001f/\","
+                                          "\"empty\":[],\"macs\":[\"50:6c:93:1e:00:01\",{},-1]}") == 0);
+    HOST_TEST_CHECK(response.chunks == 1 && response.ended == 1);
+
+    // a document longer than the buffer is sent in several chunks, and ended once
+    memset(&response, 0, sizeof(response));
+    app_web_server_json__begin(&json, &req);
+    app_web_server_json__array_begin(&json, NULL);
+    for (int i = 0; i < 200; i++)
+    {
+        app_web_server_json__int(&json, NULL, 1000 + i);
+    }
+    app_web_server_json__array_end(&json);
+    HOST_TEST_CHECK(app_web_server_json__end(&json) == ESP_OK);
+    HOST_TEST_CHECK(response.len == 2 + 200 * 4 + 199);
+    HOST_TEST_CHECK(response.chunks == (int)((response.len + APP_WEB_SERVER_JSON_BUF_SIZE - 1) / APP_WEB_SERVER_JSON_BUF_SIZE));
+    HOST_TEST_CHECK(response.ended == 1);
+    HOST_TEST_CHECK(strncmp(response.body, "[1000,1001,", 11) == 0 && strcmp(&response.body[response.len - 6], ",1199]") == 0);
+
+    // errors are sticky: nothing is sent after a failed chunk, and the response is not ended
+    memset(&response, 0, sizeof(response));
+    response.fail_at_chunk = 2;
+    app_web_server_json__begin(&json, &req);
+    app_web_server_json__array_begin(&json, NULL);
+    for (int i = 0; i < 200; i++)
+    {
+        app_web_server_json__string(&json, NULL, "abcdefgh");
+    }
+    app_web_server_json__array_end(&json);
+    HOST_TEST_CHECK(app_web_server_json__end(&json) == ESP_FAIL);
+    HOST_TEST_CHECK(response.chunks == 2 && response.len == APP_WEB_SERVER_JSON_BUF_SIZE && response.ended == 0);
+
+    // nesting deeper than the maximum is an error
+    memset(&response, 0, sizeof(response));
+    app_web_server_json__begin(&json, &req);
+    for (int i = 0; i <= APP_WEB_SERVER_JSON_DEPTH_MAX; i++)
+    {
+        app_web_server_json__array_begin(&json, NULL);
+    }
+    HOST_TEST_CHECK(app_web_server_json__end(&json) == ESP_ERR_INVALID_STATE);
+    HOST_TEST_CHECK(response.chunks == 0 && response.ended == 0);
+
+    // closing more than was opened is an error
+    memset(&response, 0, sizeof(response));
+    app_web_server_json__begin(&json, &req);
+    app_web_server_json__object_end(&json);
+    HOST_TEST_CHECK(app_web_server_json__end(&json) == ESP_ERR_INVALID_STATE);
+
+    return HOST_TEST_RESULT();
+}
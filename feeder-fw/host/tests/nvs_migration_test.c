@@ -0,0 +1,145 @@
+/**
+ * @file nvs_migration_test.c
+ * @brief Unit test of the configuration schema handling of app_nvs. NVS is written as a previous (or later)
+ * firmware left it, then app_nvs__get_data must load the configuration and, once the commit timer expires, write it
+ * back in the current schema. The NVS contents are given by the scenario argument:
+ *   - v0_list: version 0 keys, with the list of authorized MACs (and the single MAC of older versions).
+ *   - v0_single: version 0 key of the single authorized MAC only.
+ *   - newer_version: configuration blob of a newer schema version, with a field appended.
+ *   - invalid_field: configuration blob of the current version with a field out of its range.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "nvs.h"
+#include "host_sim.h"
+
+#include "app_event.h"
+#include "app_nvs.h"
+#include "host_test.h"
+
+#define TEST_NAMESPACE "nvs_main"     ///< Main NVS namespace of app_nvs
+#define TEST_COMMIT_WAIT_US (5000000) ///< Time after which the changes are committed, longer than COMMIT_DELAY_MS of app_nvs (us)
+
+/// @brief Typedef for the configuration blob, with the layout of config_blob_t of app_nvs.c.
+typedef struct
+{
+    uint16_t version;        ///< Schema version
+    uint16_t size;           ///< Size of the configuration that follows the header
+    app_nvs_config_t config; ///< Configuration
+    uint8_t appended[4];     ///< Field appended by a newer schema version
+} test_config_blob_t;
+
+static const uint8_t macs[2][6] = {
+    {0x50, 0x6c, 0x93, 0x1e, 0x00, 0x01},
+    {0x50, 0x6c, 0x93, 0x1e, 0x00, 0x02},
+}; ///< Authorized MACs
+
+/**
+ * @brief Check if a key is in the main NVS namespace.
+ *
+ * @param handle NVS handle.
+ * @param key Key.
+ * @return uint8_t 1 if the key is found, 0 otherwise.
+ */
+static uint8_t nvs_migration_test__has_key(nvs_handle_t handle, const char *key)
+{
+    test_config_blob_t blob;
+    size_t len = sizeof(blob);
+    return nvs_get_blob(handle, key, &blob, &len) != ESP_ERR_NVS_NOT_FOUND;
+}
+
+int main(int argc, char **argv)
+{
+    const char *scenario = (argc == 2) ? argv[1] : "";
+    test_config_blob_t blob = {0};
+    app_nvs_config_t defaults;
+    app_nvs_config_t config;
+    nvs_handle_t handle;
+    size_t macs_count;
+
+    HOST_TEST_CHECK(app_event__init() == ESP_OK);
+    HOST_TEST_CHECK(app_nvs__init() == ESP_OK);
+    app_nvs__get_config(&defaults); // the defaults are used until app_nvs__get_data
+    HOST_TEST_CHECK(nvs_open(TEST_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK);
+
+    if (strcmp(scenario, "v0_list") == 0)
+    {
+        HOST_TEST_CHECK(nvs_set_blob(handle, "auth_macs", macs, sizeof(macs)) == ESP_OK);
+        HOST_TEST_CHECK(nvs_set_blob(handle, "auth_mac", macs[1], sizeof(macs[1])) == ESP_OK);
+        macs_count = 2;
+    }
+    else if (strcmp(scenario, "v0_single") == 0)
+    {
+        HOST_TEST_CHECK(nvs_set_blob(handle, "auth_mac", macs[0], sizeof(macs[0])) == ESP_OK);
+        macs_count = 1;
+    }
+    else if (strcmp(scenario, "newer_version") == 0)
+    {
+        blob.version = APP_NVS_CONFIG_VERSION + 1;
+        blob.size = sizeof(blob.config) + sizeof(blob.appended);
+        blob.config = defaults;
+        memcpy(blob.config.authorized_macs, macs, sizeof(macs));
+        blob.config.authorized_macs_count = 2;
+        HOST_TEST_CHECK(nvs_set_blob(handle, "config", &blob, offsetof(test_config_blob_t, appended) + sizeof(blob.appended)) == ESP_OK);
+        macs_count = 0;
+    }
+    else if (strcmp(scenario, "invalid_field") == 0)
+    {
+        blob.version = APP_NVS_CONFIG_VERSION;
+        blob.size = sizeof(blob.config);
+        blob.config = defaults;
+        memcpy(blob.config.authorized_macs, macs, sizeof(macs[0]));
+        blob.config.authorized_macs_count = 1;
+        blob.config.min_times_seen_for_detection = 0;
+        HOST_TEST_CHECK(nvs_set_blob(handle, "config", &blob, offsetof(test_config_blob_t, appended)) == ESP_OK);
+        macs_count = 1;
+    }
+    else
+    {
+        fprintf(stderr, "Usage: %s <v0_list|v0_single|newer_version|invalid_field>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    HOST_TEST_CHECK(app_nvs__get_data() == ESP_OK);
+    app_nvs__get_config(&config);
+    HOST_TEST_CHECK(config.authorized_macs_count == macs_count);
+    HOST_TEST_CHECK(memcmp(config.authorized_macs, macs, macs_count * sizeof(macs[0])) == 0);
+    HOST_TEST_CHECK(config.min_times_seen_for_detection == defaults.min_times_seen_for_detection);
+    HOST_TEST_CHECK(config.lid_ramp_ms == defaults.lid_ramp_ms);
+    host_sim__run_for(TEST_COMMIT_WAIT_US);
+
+    size_t len = sizeof(blob);
+    memset(&blob, 0, sizeof(blob));
+    HOST_TEST_CHECK(nvs_get_blob(handle, "config", &blob, &len) == ESP_OK);
+    if (strcmp(scenario, "newer_version") == 0)
+    {
+        // the blob of the newer version is kept, so that the newer firmware still finds its configuration
+        HOST_TEST_CHECK(blob.version == APP_NVS_CONFIG_VERSION + 1 && blob.config.authorized_macs_count == 2);
+    }
+    else if (strcmp(scenario, "invalid_field") == 0)
+    {
+        // a blob of the current version is not written back until the configuration is set again
+        HOST_TEST_CHECK(blob.version == APP_NVS_CONFIG_VERSION && blob.config.min_times_seen_for_detection == 0);
+    }
+    else
+    {
+        // migrated: written in the current schema, and the version 0 keys erased
+        HOST_TEST_CHECK(len == offsetof(test_config_blob_t, appended));
+        HOST_TEST_CHECK(blob.version == APP_NVS_CONFIG_VERSION && blob.size == sizeof(app_nvs_config_t));
+        HOST_TEST_CHECK(blob.config.authorized_macs_count == macs_count);
+        HOST_TEST_CHECK(!nvs_migration_test__has_key(handle, "auth_macs") && !nvs_migration_test__has_key(handle, "auth_mac"));
+
+        // read again, now from the blob
+        HOST_TEST_CHECK(app_nvs__get_data() == ESP_OK);
+        app_nvs__get_config(&config);
+        HOST_TEST_CHECK(config.authorized_macs_count == macs_count);
+        HOST_TEST_CHECK(memcmp(config.authorized_macs, macs, macs_count * sizeof(macs[0])) == 0);
+    }
+
+    return HOST_TEST_RESULT();
+}
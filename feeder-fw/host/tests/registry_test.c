@@ -0,0 +1,99 @@
+/**
+ * @file registry_test.c
+ * @brief Unit test of the authorized beacons registry of app_beacon: the beacons are removed in a scrambled order,
+ * so that the backward shift deletion moves keys of clusters of the hash table, some of them wrapping around it, and
+ * after each removal every beacon left must still be found, at an entry holding its MAC address.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include <string.h>
+
+#include "app_beacon_registry.h"
+#include "host_test.h"
+
+#define TEST_MACS_COUNT (APP_BEACON_REGISTRY_MAX_ENTRIES) ///< Number of beacons added, a full registry
+#define TEST_ROUNDS (8)                                   ///< Number of fill and empty rounds, each with another removal order
+
+static uint8_t macs[TEST_MACS_COUNT][6]; ///< MAC addresses of the beacons
+static uint8_t present[TEST_MACS_COUNT]; ///< Flag that indicates that the beacon is in the registry
+
+/**
+ * @brief Check that the registry holds exactly the beacons flagged as present.
+ *
+ */
+static void registry_test__check_contents(void)
+{
+    size_t count = 0;
+
+    for (int i = 0; i < TEST_MACS_COUNT; i++)
+    {
+        int index = app_beacon_registry__find(macs[i]);
+        if (present[i])
+        {
+            count++;
+            HOST_TEST_CHECK(index != APP_BEACON_REGISTRY_NOT_FOUND);
+            app_beacon_registry_entry_t *entry = app_beacon_registry__get(index);
+            HOST_TEST_CHECK(entry != NULL && memcmp(entry->auth_mac, macs[i], 6) == 0);
+        }
+        else
+        {
+            HOST_TEST_CHECK(index == APP_BEACON_REGISTRY_NOT_FOUND);
+        }
+    }
+    HOST_TEST_CHECK(app_beacon_registry__count() == count);
+    HOST_TEST_CHECK(app_beacon_registry__get((int)count) == NULL);
+}
+
+int main(void)
+{
+    static const uint8_t zero_mac[6] = {0};
+    static const uint8_t extra_mac[6] = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+    uint32_t lcg = 12345;
+    int order[TEST_MACS_COUNT];
+
+    app_beacon_registry__clear();
+    HOST_TEST_CHECK(app_beacon_registry__add(zero_mac) == ESP_ERR_INVALID_ARG);
+    HOST_TEST_CHECK(app_beacon_registry__remove(extra_mac) == ESP_ERR_NOT_FOUND);
+    for (int round = 0; round < TEST_ROUNDS; round++)
+    {
+        // random MACs, so that their keys collide and form clusters in the hash table
+        for (int i = 0; i < TEST_MACS_COUNT; i++)
+        {
+            for (int j = 0; j < 6; j++)
+            {
+                lcg = lcg * 1103515245 + 12345;
+                macs[i][j] = (uint8_t)(lcg >> 16);
+            }
+        }
+        for (int i = 0; i < TEST_MACS_COUNT; i++)
+        {
+            HOST_TEST_CHECK(app_beacon_registry__add(macs[i]) == ESP_OK);
+            present[i] = 1;
+            order[i] = i;
+        }
+        HOST_TEST_CHECK(app_beacon_registry__add(macs[0]) == ESP_OK); // already registered
+        HOST_TEST_CHECK(app_beacon_registry__add(extra_mac) == ESP_ERR_NO_MEM);
+        registry_test__check_contents();
+
+        // Fisher-Yates shuffle of the removal order
+        for (int i = TEST_MACS_COUNT - 1; i > 0; i--)
+        {
+            lcg = lcg * 1103515245 + 12345;
+            int j = (int)((lcg >> 16) % (uint32_t)(i + 1));
+            int tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+        for (int i = 0; i < TEST_MACS_COUNT; i++)
+        {
+            HOST_TEST_CHECK(app_beacon_registry__remove(macs[order[i]]) == ESP_OK);
+            HOST_TEST_CHECK(app_beacon_registry__remove(macs[order[i]]) == ESP_ERR_NOT_FOUND);
+            present[order[i]] = 0;
+            registry_test__check_contents();
+        }
+    }
+
+    return HOST_TEST_RESULT();
+}
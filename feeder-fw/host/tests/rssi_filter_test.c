@@ -0,0 +1,98 @@
+/**
+ * @file rssi_filter_test.c
+ * @brief Unit test of the RSSI filters of app_beacon, built once per filter (see CMakeLists.txt): a constant RSSI
+ * must be output as is, and a step of the RSSI must be followed monotonically, within the maximum step per sample.
+ *
+ * @copyright Copyright (c) 2024 PetDog
+ *
+ */
+
+#include "app_beacon_rssi_filter.h"
+#include "host_test.h"
+
+#define TEST_SAMPLES (64)     ///< Number of samples after a step of the RSSI, enough for every filter to settle
+#define TEST_SETTLED_Q8 (256) ///< Largest distance to the RSSI of a settled filter output (dB, Q8)
+
+/**
+ * @brief Feed a constant RSSI to a reset filter, until it has an output.
+ *
+ * @param filter Filter.
+ * @param rssi RSSI (dBm).
+ * @return int32_t Filter output (dBm, Q8).
+ */
+static int32_t rssi_filter_test__settle(app_beacon_rssi_filter_t *filter, int8_t rssi)
+{
+    int32_t output_q8 = 0;
+    int samples = 1;
+
+    app_beacon_rssi_filter__reset(filter);
+    while (!app_beacon_rssi_filter__update(filter, rssi, &output_q8))
+    {
+        samples++;
+    }
+    HOST_TEST_CHECK(samples <= APP_BEACON_RSSI_FILTER_WINDOW);
+    return output_q8;
+}
+
+/**
+ * @brief Check the filter output after a step of the RSSI.
+ *
+ * @param from Constant RSSI before the step (dBm).
+ * @param to Constant RSSI after the step (dBm).
+ */
+static void rssi_filter_test__step(int8_t from, int8_t to)
+{
+    app_beacon_rssi_filter_t filter;
+    int32_t prev_q8 = rssi_filter_test__settle(&filter, from);
+    int32_t output_q8 = prev_q8;
+
+    HOST_TEST_CHECK(prev_q8 == APP_BEACON_RSSI_FILTER_Q8(from));
+    for (int i = 0; i < TEST_SAMPLES; i++)
+    {
+        HOST_TEST_CHECK(app_beacon_rssi_filter__update(&filter, to, &output_q8) == 1);
+        int32_t delta_q8 = (to > from) ? output_q8 - prev_q8 : prev_q8 - output_q8;
+        HOST_TEST_CHECK(delta_q8 >= 0);
+#if APP_BEACON_RSSI_FILTER_MAX_STEP_DB
+        HOST_TEST_CHECK(delta_q8 <= APP_BEACON_RSSI_FILTER_Q8(APP_BEACON_RSSI_FILTER_MAX_STEP_DB));
+#endif
+        prev_q8 = output_q8;
+    }
+    int32_t error_q8 = output_q8 - APP_BEACON_RSSI_FILTER_Q8(to);
+    HOST_TEST_CHECK(error_q8 <= TEST_SETTLED_Q8 && error_q8 >= -TEST_SETTLED_Q8);
+}
+
+int main(void)
+{
+    app_beacon_rssi_filter_t filter;
+    int32_t output_q8 = 0;
+
+    rssi_filter_test__step(-80, -40);
+    rssi_filter_test__step(-40, -80);
+    rssi_filter_test__step(-60, -59);
+
+#if (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_RUNNING_SUM)
+    // the first output is the average of a full window
+    int32_t sum = 0;
+    app_beacon_rssi_filter__reset(&filter);
+    for (int i = 0; i < APP_BEACON_RSSI_FILTER_WINDOW; i++)
+    {
+        int8_t rssi = (i % 2) ? -50 : -60;
+        sum += rssi;
+        uint8_t has_output = app_beacon_rssi_filter__update(&filter, rssi, &output_q8);
+        HOST_TEST_CHECK(has_output == (i == APP_BEACON_RSSI_FILTER_WINDOW - 1));
+    }
+    HOST_TEST_CHECK(output_q8 == APP_BEACON_RSSI_FILTER_Q8(sum) / APP_BEACON_RSSI_FILTER_WINDOW);
+#elif (APP_BEACON_RSSI_FILTER == APP_BEACON_RSSI_FILTER_MEDIAN)
+    // a single outlier does not move the median of a window of 3 samples or more
+    rssi_filter_test__settle(&filter, -60);
+    HOST_TEST_CHECK(app_beacon_rssi_filter__update(&filter, -20, &output_q8) == 1);
+    HOST_TEST_CHECK(APP_BEACON_RSSI_FILTER_WINDOW < 3 || output_q8 == APP_BEACON_RSSI_FILTER_Q8(-60));
+#else
+    // the first sample initializes the estimate
+    app_beacon_rssi_filter__reset(&filter);
+    HOST_TEST_CHECK(app_beacon_rssi_filter__update(&filter, -70, &output_q8) == 1);
+    HOST_TEST_CHECK(output_q8 == APP_BEACON_RSSI_FILTER_Q8(-70));
+#endif
+
+    return HOST_TEST_RESULT();
+}
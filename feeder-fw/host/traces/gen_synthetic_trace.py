@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""Generate a synthetic BLE scan trace for beacon_replay.
+
+The trace contains authorized pet beacons advertising Eddystone TLM frames, which visit the feeder (strong RSSI),
+pass by it without stopping (strong RSSI for a short time, must not open the lid) and stay away (weak RSSI), plus
+foreign devices advertising with random MAC addresses. With --pets greater than 1 the pets move together and their
+beacons advertise at the same instants, so that their advertisements reach the detection task in the same batch.
+See beacon_replay.c for the trace format.
+"""
+
+import argparse
+import random
+
+PET_MACS = ["50:6c:93:1e:00:01", "50:6c:93:1e:00:02", "50:6c:93:1e:00:03", "50:6c:93:1e:00:04"]
+TLM_ADV = "0201060303aafe1116aafe2000{bat:04x}1980{cnt:08x}{sec:08x}"
+FOREIGN_ADVS = [
+    "0201060303aafe1116aafe2000{bat:04x}1980{cnt:08x}{sec:08x}",  # other Eddystone TLM beacons
+    "0201061aff4c000215{uuid}00010002c5",                       # iBeacon
+    "02011a0aff4c0010050318{rnd}",                               # phone
+]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--duration", type=float, default=120.0, help="trace duration (s)")
+    parser.add_argument("--foreign-rate", type=float, default=20.0, help="foreign advertisements per second")
+    parser.add_argument("--adv-interval", type=float, default=0.1, help="pet beacon advertising interval (s)")
+    parser.add_argument("--loss", type=float, default=0.2, help="pet beacon advertisement loss probability")
+    parser.add_argument("--pets", type=int, default=1, choices=range(1, len(PET_MACS) + 1), help="number of pets")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+    rng = random.Random(args.seed)
+
+    # (start, end, near RSSI) of each period in which the pet is close to the feeder; visits longer than 5 s
+    # are ground truth visits, shorter ones are the pet passing by
+    periods = []
+    t = 10.0
+    while t < args.duration - 20.0:
+        length = rng.choice([1.0, 1.5, 20.0, 40.0])
+        periods.append((t, min(t + length, args.duration - 5.0)))
+        t += length + rng.uniform(15.0, 40.0)
+
+    records = []
+    for start, end in periods:
+        if end - start > 5.0:
+            records.append((start, "P,{:.1f},1".format(start * 1000)))
+            records.append((end, "P,{:.1f},0".format(end * 1000)))
+
+    t = 0.0
+    count = 0
+    while t < args.duration:
+        near = any(start <= t < end for start, end in periods)
+        for pet_mac in PET_MACS[:args.pets]:
+            rssi = int(rng.gauss(-40 if near else -82, 4))
+            if rng.random() >= args.loss:
+                adv = TLM_ADV.format(bat=3000, cnt=count, sec=int(t * 10))
+                records.append((t, "A,{:.1f},{},{},{}".format(t * 1000, pet_mac, rssi, adv)))
+        count += 1
+        t += args.adv_interval + rng.uniform(0, 0.01)
+
+    t = 0.0
+    while args.foreign_rate > 0 and t < args.duration:
+        t += rng.expovariate(args.foreign_rate)
+        mac = ":".join("{:02x}".format(rng.randrange(256)) for _ in range(6))
+        adv = rng.choice(FOREIGN_ADVS).format(bat=rng.randrange(2000, 3300), cnt=rng.randrange(1 << 32),
+                                              sec=rng.randrange(1 << 32), uuid="%032x" % rng.getrandbits(128),
+                                              rnd="%010x" % rng.getrandbits(40))
+        records.append((t, "A,{:.1f},{},{},{}".format(t * 1000, mac, int(rng.gauss(-75, 10)), adv)))
+
+    records.sort(key=lambda record: record[0])
+    print("# synthetic trace: duration={}s foreign_rate={}/s adv_interval={}s loss={} pets={} seed={}".format(
+        args.duration, args.foreign_rate, args.adv_interval, args.loss, args.pets, args.seed))
+    for pet_mac in PET_MACS[:args.pets]:
+        print("M," + pet_mac)
+    for _, line in records:
+        print(line)
+
+
+if __name__ == "__main__":
+    main()
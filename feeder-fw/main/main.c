@@ -13,19 +13,76 @@
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+#include "app_pm.h"
+#include "app_event.h"
 #include "app_nvs.h"
+#include "app_feed_log.h"
 #include "app_wifi.h"
 #include "app_gpio.h"
 #include "app_measure_vcc.h"
 #include "app_status.h"
 #include "app_pwm.h"
+#include "app_lid.h"
 #include "app_beacon.h"
+#include "app_boot.h"
+
+#define BOOT_PROFILE (0)                     ///< Whether to print the boot report, with the time to the first BLE scan result (0: False, other: True)
+#define BOOT_PROFILE_REPORT_DELAY_MS (10000) ///< Time after the init stages at which the boot report is printed, the first BLE scan result is expected before it (ms)
+
+/// @brief Typedef for the indexes of the init stages in boot_stages.
+typedef enum
+{
+    boot_stage_pm,
+    boot_stage_event,
+    boot_stage_nvs,
+    boot_stage_config,
+    boot_stage_feed_log,
+    boot_stage_gpio,
+    boot_stage_status,
+    boot_stage_beacon,
+    boot_stage_pwm,
+    boot_stage_measure_vcc,
+    boot_stage_lid,
+    boot_stage_scan,
+    boot_stage_wifi,
+    boot_stages_count,
+} boot_stage_t;
 
 static const char *TAG = "main"; ///< Tag to be used when logging
 
+static esp_err_t app_main__load_config(void);
+static esp_err_t app_main__init_gpio(void);
+
+/* Init stages, with the stages each one needs to be done before it starts. Stages that are ready are started in the
+ * order of the table, so the BT controller and Bluedroid bring-up (beacon), the slowest stage, is started as soon as
+ * the configuration is loaded (the PHY calibration data is also kept in NVS), and the GPIO, ADC and PWM stages run
+ * meanwhile. The BLE scan is only started once the lid can be opened.
+ */
+static const app_boot_stage_t boot_stages[boot_stages_count] = {
+    [boot_stage_pm] = {"pm", app_pm__init, 0},
+    [boot_stage_event] = {"event", app_event__init, 0},
+    [boot_stage_nvs] = {"nvs", app_nvs__init, APP_BOOT_DEP(boot_stage_event)},
+    [boot_stage_config] = {"config", app_main__load_config, APP_BOOT_DEP(boot_stage_nvs)},
+    [boot_stage_feed_log] = {"feed_log", app_feed_log__init, APP_BOOT_DEP(boot_stage_event)},
+    [boot_stage_gpio] = {"gpio", app_main__init_gpio, APP_BOOT_DEP(boot_stage_event)},
+    [boot_stage_status] = {"status", app_status__init, APP_BOOT_DEP(boot_stage_event) | APP_BOOT_DEP(boot_stage_gpio)},
+    [boot_stage_beacon] = {"beacon", app_beacon__init, APP_BOOT_DEP(boot_stage_pm) | APP_BOOT_DEP(boot_stage_event) |
+                                                           APP_BOOT_DEP(boot_stage_config) | APP_BOOT_DEP(boot_stage_status)},
+    [boot_stage_pwm] = {"pwm", app_pwm__init, APP_BOOT_DEP(boot_stage_pm) | APP_BOOT_DEP(boot_stage_event)},
+    [boot_stage_measure_vcc] = {"measure_vcc", app_measure_vcc__init, APP_BOOT_DEP(boot_stage_pm) | APP_BOOT_DEP(boot_stage_event) |
+                                                                          APP_BOOT_DEP(boot_stage_status) | APP_BOOT_DEP(boot_stage_pwm)},
+    [boot_stage_lid] = {"lid", app_lid__init, APP_BOOT_DEP(boot_stage_config) | APP_BOOT_DEP(boot_stage_feed_log) |
+                                                  APP_BOOT_DEP(boot_stage_status) | APP_BOOT_DEP(boot_stage_pwm) |
+                                                  APP_BOOT_DEP(boot_stage_measure_vcc)},
+    [boot_stage_scan] = {"scan", app_beacon__ble_scan_start, APP_BOOT_DEP(boot_stage_beacon) | APP_BOOT_DEP(boot_stage_lid)},
+    [boot_stage_wifi] = {"wifi", app_wifi__init, APP_BOOT_DEP(boot_stage_pm) | APP_BOOT_DEP(boot_stage_event) |
+                                                     APP_BOOT_DEP(boot_stage_config) | APP_BOOT_DEP(boot_stage_gpio)},
+};
+
 /**
  * @brief Restar ESP32 in 3 seconds if fatal error is found.
  *
@@ -38,64 +95,93 @@ static void app_error_handling__restart(void)
     esp_restart();
 }
 
+/**
+ * @brief Init stage that reads the configuration from NVS into its RAM cache. A configuration that was never
+ * written is not an error, the defaults are used.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code of app_nvs__get_data otherwise.
+ */
+static esp_err_t app_main__load_config(void)
+{
+    esp_err_t err = app_nvs__get_data();
+    return (err == ESP_ERR_NOT_FOUND) ? ESP_OK : err;
+}
+
+/**
+ * @brief Init stage that initializes the GPIOs and blinks the blue LED to indicate that the program has started.
+ *
+ * @return esp_err_t
+ * @retval ESP_OK on success.
+ * @retval Error code of app_gpio__init otherwise.
+ */
+static esp_err_t app_main__init_gpio(void)
+{
+    esp_err_t err = app_gpio__init();
+    if (err == ESP_OK)
+    {
+        app_gpio__blink_blue_led_slow(1);
+    }
+    return err;
+}
+
+#if BOOT_PROFILE
+/**
+ * @brief Print the boot report, run by the event loop BOOT_PROFILE_REPORT_DELAY_MS after the init stages.
+ *
+ * @param arg Not used.
+ */
+static void app_main__boot_report_handler(void *arg)
+{
+    (void)arg;
+    app_boot__add_milestone("First BLE scan start", app_beacon__get_first_scan_start_us());
+    app_boot__add_milestone("First BLE scan result", app_beacon__get_first_scan_result_us());
+    app_boot__add_stat("BLE stack heap", app_beacon__get_ble_stack_heap_bytes(), "bytes");
+    app_boot__print_report();
+}
+#endif // BOOT_PROFILE
+
 /**
  * @brief Starting point of the program, where components are initialized and started, if applicable.
  *
- * The following operations are performed in this function:
+ * The components are initialized by the init stages in boot_stages, each one as soon as the ones it depends on are
+ * done, so that independent stages run concurrently:
+ *   - Power management is initialized.
+ *   - Application event loop is initialized.
  *   - Non-volatile storage (NVS) is initialized.
- *   - Data is read from NVS (authorized MAC address).
- *   - Wi-Fi is initialized.
- *   - GPIOs are initialized.
- *   - Blue LED is blinked to indicate that the program has started.
- *   - VCC measurement is initialized.
+ *   - Configuration (authorized MAC addresses and tunables) is read from NVS into its RAM cache, migrated if written by a previous version.
+ *   - Feeding event log is initialized (its head is recovered from flash and the boot is recorded).
+ *   - GPIOs are initialized, and the blue LED is blinked to indicate that the program has started.
  *   - Status component is initialized.
+ *   - Beacon component is initialized (BT controller and Bluedroid), concurrently with the PWM, VCC measurement and lid.
  *   - PWM component is initialized.
- *   - Beacon component is initialized.
+ *   - VCC measurement is initialized.
+ *   - Lid component is initialized (the lid is closed).
+ *   - BLE scan is started.
+ *   - Wi-Fi component is initialized (the Wi-Fi stack is only brought up when Wi-Fi is started).
+ *
+ * If BOOT_PROFILE is enabled, the boot report (time taken by each stage, times of the first BLE scan start and
+ * result, and heap taken by the BLE stack) is printed by the event loop BOOT_PROFILE_REPORT_DELAY_MS after the init
+ * stages. The times of the first scan start and result are recorded by app_beacon as they happen, so nothing waits
+ * for them.
  *
  * Check the components' documentation for more details.
  */
 void app_main(void)
 {
     ESP_LOGI(TAG, "Hello World!");
-    esp_err_t err = app_nvs__init();
-    if (err != ESP_OK)
-    {
-        app_error_handling__restart();
-    }
-    err = app_nvs__get_data();
-    if (err != ESP_OK && err != ESP_ERR_NOT_FOUND)
-    {
-        app_error_handling__restart();
-    }
-    err = app_wifi__init();
+    esp_err_t err = app_boot__run(boot_stages, boot_stages_count);
     if (err != ESP_OK)
     {
         app_error_handling__restart();
     }
-    err = app_gpio__init();
-    if (err != ESP_OK)
-    {
-        app_error_handling__restart();
-    }
-    app_gpio__blink_blue_led_slow(1);
-    err = app_measure_vcc__init();
-    if (err != ESP_OK)
-    {
-        app_error_handling__restart();
-    }
-    err = app_status__init();
-    if (err != ESP_OK)
-    {
-        app_error_handling__restart();
-    }
-    err = app_pwm__init();
-    if (err != ESP_OK)
-    {
-        app_error_handling__restart();
-    }
-    err = app_beacon__init();
-    if (err != ESP_OK)
+
+#if BOOT_PROFILE
+    esp_timer_handle_t report_timer;
+    if (app_event__timer_create("boot_report", app_main__boot_report_handler, NULL, &report_timer) == ESP_OK)
     {
-        app_error_handling__restart();
+        esp_timer_start_once(report_timer, (uint64_t)BOOT_PROFILE_REPORT_DELAY_MS * 1000);
     }
+#endif // BOOT_PROFILE
 }